@@ -25,10 +25,18 @@ namespace UnrealBuildTool.Rules
             PrivateDependencyModuleNames.AddRange(
                 new string[]
                 {
-                    "Analytics"
+                    "Analytics",
+                    "RenderCore",
+                    "RHI"
                 }
             );
 
+            // Stand-in server for the non-shipping benchmarks and tests
+            if (Target.Configuration != UnrealTargetConfiguration.Shipping)
+            {
+                PrivateDependencyModuleNames.Add("HTTPServer");
+            }
+
             PublicIncludePathModuleNames.AddRange(
                 new string[]
                 {
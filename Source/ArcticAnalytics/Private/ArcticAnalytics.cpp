@@ -3,30 +3,48 @@
 #include "ArcticAnalytics.h"
 #include "AnalyticsEventAttribute.h"
 
+#include "Async/Async.h"
 #include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
 #include "Misc/ConfigCacheIni.h"
 #include "Misc/FileHelper.h"
 #include "Misc/Guid.h"
 #include "Misc/Paths.h"
-#include "Runtime/Online/HTTP/Public/Http.h"
+#include "Misc/ScopeLock.h"
 
-#include "Data_SHA256.h"
+#include "ArcticAnalyticsCollectorArchive.h"
+#include "ArcticAnalyticsEventCosts.h"
+#include "ArcticAnalyticsEventJson.h"
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryArchive.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "ArcticAnalyticsSettings.h"
+#include "ArcticAnalyticsTrace.h"
 
-DEFINE_LOG_CATEGORY_STATIC(LogArcticAnalyticsAnalytics, Display, All);
+DEFINE_LOG_CATEGORY(LogArcticAnalyticsAnalytics);
 
 IMPLEMENT_MODULE(FAnalyticsArcticAnalytics, ArcticAnalytics)
 
 void FAnalyticsArcticAnalytics::StartupModule()
 {
 	ArcticAnalyticsProvider = MakeShareable(new FAnalyticsProviderArcticAnalytics());
+	SelfMetricsTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([](float DeltaTime)
+	{
+		FArcticAnalyticsSelfMetrics::Get().PublishStats();
+		return true;
+	}));
 }
 
 void FAnalyticsArcticAnalytics::ShutdownModule()
 {
+	FTSTicker::GetCoreTicker().RemoveTicker(SelfMetricsTickHandle);
 	if (ArcticAnalyticsProvider.IsValid())
 	{
 		ArcticAnalyticsProvider->EndSession();
 	}
+	// Ends all sessions and waits for their files to be written
+	MultiSessionProvider.Reset();
 }
 
 TSharedPtr<IAnalyticsProvider> FAnalyticsArcticAnalytics::CreateAnalyticsProvider(const FAnalyticsProviderConfigurationDelegate& GetConfigValue) const
@@ -34,12 +52,147 @@ TSharedPtr<IAnalyticsProvider> FAnalyticsArcticAnalytics::CreateAnalyticsProvide
 	return ArcticAnalyticsProvider;
 }
 
+FArcticAnalyticsMultiSessionProvider& FAnalyticsArcticAnalytics::GetMultiSessionProvider()
+{
+	if (!MultiSessionProvider)
+	{
+		MultiSessionProvider = MakeUnique<FArcticAnalyticsMultiSessionProvider>(FPaths::ProjectSavedDir() / TEXT("Analytics"), true);
+	}
+	return *MultiSessionProvider;
+}
+
+FArcticAnalyticsBudgetCounters FAnalyticsArcticAnalytics::GetMemoryBudgetCounters() const
+{
+	return FArcticAnalyticsMemoryBudget::Get().GetCounters();
+}
+
+FArcticAnalyticsSelfMetricsSnapshot FAnalyticsArcticAnalytics::GetSelfMetrics() const
+{
+	return FArcticAnalyticsSelfMetrics::Get().GetSnapshot();
+}
+
 // Provider
 
-FAnalyticsProviderArcticAnalytics::FAnalyticsProviderArcticAnalytics() : bHasSessionStarted(false), bHasWrittenFirstEvent(false), Age(0), FileWriter(nullptr)
+FAnalyticsProviderArcticAnalytics::FAnalyticsProviderArcticAnalytics()
+	: bHasSessionStarted(false), bHasWrittenFirstEvent(false), Age(0), FileWriter(nullptr), bInMemorySessions(false), SessionSink(ESessionSink::File), NextRecordId(0), DroppedReportInterval(10.0f), LastDroppedReportTime(0.0),
+	  MetricWindowSeconds(10.0f), MetricWindowEnd(0.0), bHoistDefaultAttributes(false),
+	  Uploader(MakeShared<FArcticAnalyticsUploader, ESPMode::ThreadSafe>(1)), BulkOldestRecordTime(0.0), ReportedWrittenBytes(0),
+	  EventCostReportSize(20), PendingBatchCostIndex(INDEX_NONE), bRecoveryScanPending(false), ProviderStartTime(FDateTime::UtcNow()),
+	  RecoveryMinAgeSeconds(60.0f)
 {
+	CurrentDefaultEventAttributes = MakeUnique<const TArray<FAnalyticsEventAttribute>>();
+	DefaultEventAttributes.store(CurrentDefaultEventAttributes.Get());
+	NumDefaultAttributeReaders.store(0);
+
 	AnalyticsFilePath = FPaths::ProjectSavedDir() / TEXT("Analytics");
 	UserId = FGuid::NewGuid().ToString();
+	ArcticAnalyticsSettings::GetString(TEXT("CollectorSocketPath"), CollectorSocketPath);
+	ArcticAnalyticsSettings::GetBool(TEXT("bInMemorySessions"), bInMemorySessions);
+	EventPolicies.LoadFromConfig();
+	ArcticAnalyticsSettings::GetFloat(TEXT("DroppedReportInterval"), DroppedReportInterval);
+	ArcticAnalyticsSettings::GetFloat(TEXT("MetricWindowSeconds"), MetricWindowSeconds);
+
+	ArcticAnalyticsSettings::GetBool(TEXT("bHoistDefaultAttributes"), bHoistDefaultAttributes);
+
+	bool bColumnarBatches = false;
+	ArcticAnalyticsSettings::GetBool(TEXT("bColumnarBatches"), bColumnarBatches);
+	if (bColumnarBatches)
+	{
+		int32 BatchMaxEvents = 256;
+		ArcticAnalyticsSettings::GetInt(TEXT("BatchMaxEvents"), BatchMaxEvents);
+		BatchEncoder = MakeUnique<FArcticAnalyticsBatchEncoder>(BatchMaxEvents);
+	}
+
+	float ErrorCoalesceWindowSeconds = 0.0f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("ErrorCoalesceWindowSeconds"), ErrorCoalesceWindowSeconds);
+	if (ErrorCoalesceWindowSeconds > 0.0f)
+	{
+		int32 ErrorCoalesceSlots = 64;
+		ArcticAnalyticsSettings::GetInt(TEXT("ErrorCoalesceSlots"), ErrorCoalesceSlots);
+		ErrorCoalescer = MakeUnique<FArcticAnalyticsErrorCoalescer>(ErrorCoalesceSlots, ErrorCoalesceWindowSeconds);
+	}
+
+	TArray<FString> ConfigPriorityEvents;
+	if (!ArcticAnalyticsSettings::GetArray(TEXT("PriorityEvents"), ConfigPriorityEvents))
+	{
+		ConfigPriorityEvents = {TEXT("Error"), TEXT("Progress")};
+	}
+	PriorityEventNames.Append(ConfigPriorityEvents);
+	bool bPriorityLane = false;
+	ArcticAnalyticsSettings::GetBool(TEXT("bPriorityLane"), bPriorityLane);
+	if (bPriorityLane)
+	{
+		float PriorityFlushSeconds = 2.0f;
+		ArcticAnalyticsSettings::GetFloat(TEXT("PriorityFlushSeconds"), PriorityFlushSeconds);
+		PriorityLane = MakeUnique<FArcticAnalyticsPriorityLane>(PriorityFlushSeconds);
+	}
+
+	bool bEventCostReport = false;
+	ArcticAnalyticsSettings::GetBool(TEXT("bEventCostReport"), bEventCostReport);
+	if (bEventCostReport)
+	{
+		int32 EventCostSlots = 256;
+		ArcticAnalyticsSettings::GetInt(TEXT("EventCostSlots"), EventCostSlots);
+		ArcticAnalyticsSettings::GetInt(TEXT("EventCostReportSize"), EventCostReportSize);
+		EventCosts = MakeUnique<FArcticAnalyticsEventCosts>(EventCostSlots);
+	}
+
+	bool bRecentEvents = false;
+	ArcticAnalyticsSettings::GetBool(TEXT("bRecentEvents"), bRecentEvents);
+	if (bRecentEvents)
+	{
+		int32 RecentEventsCapacity = 4096;
+		ArcticAnalyticsSettings::GetInt(TEXT("RecentEventsCapacity"), RecentEventsCapacity);
+		RecentEvents = MakeUnique<FArcticAnalyticsRecentEvents>(RecentEventsCapacity);
+	}
+
+	bool bSessionIndex = false;
+	ArcticAnalyticsSettings::GetBool(TEXT("bSessionIndex"), bSessionIndex);
+	if (bSessionIndex)
+	{
+		int32 SessionIndexCheckpointBytes = 64 * 1024;
+		ArcticAnalyticsSettings::GetInt(TEXT("SessionIndexCheckpointBytes"), SessionIndexCheckpointBytes);
+		SessionIndex = MakeUnique<FArcticAnalyticsSessionIndex>(SessionIndexCheckpointBytes);
+	}
+
+	bool bCaptureFramePerformance = false;
+	ArcticAnalyticsSettings::GetBool(TEXT("bCaptureFramePerformance"), bCaptureFramePerformance);
+	if (bCaptureFramePerformance)
+	{
+		int32 FrameCaptureCapacity = 300;
+		float FrameCaptureMemorySampleSeconds = 1.0f;
+		ArcticAnalyticsSettings::GetInt(TEXT("FrameCaptureCapacity"), FrameCaptureCapacity);
+		ArcticAnalyticsSettings::GetFloat(TEXT("FrameCaptureMemorySampleSeconds"), FrameCaptureMemorySampleSeconds);
+		FrameCapture = MakeUnique<FArcticAnalyticsFrameCapture>(FrameCaptureCapacity, FrameCaptureMemorySampleSeconds);
+		FrameCapture->OnBufferFull.BindRaw(this, &FAnalyticsProviderArcticAnalytics::WriteFrameCapture);
+	}
+
+	float FrameBudgetMicroseconds = 0.0f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("FrameBudgetMicroseconds"), FrameBudgetMicroseconds);
+	FString FrameBudgetOverrun;
+	ArcticAnalyticsSettings::GetString(TEXT("FrameBudgetOverrun"), FrameBudgetOverrun);
+	SetFrameBudget(FrameBudgetMicroseconds, FrameBudgetOverrun == TEXT("Sample") ? EArcticAnalyticsOverrunMode::Sample : EArcticAnalyticsOverrunMode::Defer);
+
+	float HousekeepingBudgetMicroseconds = 0.0f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("HousekeepingBudgetMicroseconds"), HousekeepingBudgetMicroseconds);
+	if (HousekeepingBudgetMicroseconds > 0.0f)
+	{
+		float HousekeepingSpikeFactor = 1.5f;
+		int32 HousekeepingSpikeFrames = 30;
+		float HousekeepingMaxDeferSeconds = 5.0f;
+		ArcticAnalyticsSettings::GetFloat(TEXT("HousekeepingSpikeFactor"), HousekeepingSpikeFactor);
+		ArcticAnalyticsSettings::GetInt(TEXT("HousekeepingSpikeFrames"), HousekeepingSpikeFrames);
+		ArcticAnalyticsSettings::GetFloat(TEXT("HousekeepingMaxDeferSeconds"), HousekeepingMaxDeferSeconds);
+		Housekeeping = MakeUnique<FArcticAnalyticsHousekeeping>(HousekeepingBudgetMicroseconds / 1000000.0, HousekeepingSpikeFactor, HousekeepingSpikeFrames,
+																HousekeepingMaxDeferSeconds);
+		Uploader->SetScheduled(true);
+		Housekeeping->AddTask(TEXT("UploadStart"), [this]() { return Uploader->CanStartUpload(); }, [this]() { Uploader->StartNextUpload(); });
+		Housekeeping->AddTask(TEXT("UploadRetry"), [this]() { return Uploader->HasDueRetry(); }, [this]() { Uploader->DrainRetry(); });
+		ArcticAnalyticsSettings::GetBool(TEXT("bRecoverSessions"), bRecoveryScanPending);
+		ArcticAnalyticsSettings::GetFloat(TEXT("RecoveryMinAgeSeconds"), RecoveryMinAgeSeconds);
+		Housekeeping->AddTask(TEXT("SessionRecovery"), [this]() { return HasSessionRecoveryWork(); }, [this]() { StepSessionRecovery(); });
+		HousekeepingTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FAnalyticsProviderArcticAnalytics::TickHousekeeping));
+	}
 }
 
 FAnalyticsProviderArcticAnalytics::~FAnalyticsProviderArcticAnalytics()
@@ -48,42 +201,111 @@ FAnalyticsProviderArcticAnalytics::~FAnalyticsProviderArcticAnalytics()
 	{
 		EndSession();
 	}
+	if (Housekeeping)
+	{
+		// Uploads queued by the last session start right away, as they would without housekeeping
+		FTSTicker::GetCoreTicker().RemoveTicker(HousekeepingTickHandle);
+		Uploader->SetScheduled(false);
+	}
+	if (RecoveryResult.IsValid())
+	{
+		RecoveryResult.Wait();
+	}
 }
 
 bool FAnalyticsProviderArcticAnalytics::StartSession(const TArray<FAnalyticsEventAttribute>& Attributes)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(StartSession);
 	if (bHasSessionStarted)
 	{
 		EndSession();
 	}
 	SessionId = UserId + TEXT("-") + FDateTime::UtcNow().ToString();
 	const FString FilePath = AnalyticsFilePath / (SessionId + TEXT(".analytics"));
-	// Close the old file and open a new one
-	FileWriter = TUniquePtr<FArchive>(IFileManager::Get().CreateFileWriter(*FilePath, FILEWRITE_EvenIfReadOnly));
+	// Close the old file and open a new one, unless a local collector takes the session or it stays in memory
+	FileWriter = nullptr;
+	SessionSink = ESessionSink::File;
+	ReportedWrittenBytes = 0;
+	if (!CollectorSocketPath.IsEmpty())
+	{
+		FileWriter = FArcticAnalyticsCollectorArchive::Connect(CollectorSocketPath, SessionId, FilePath);
+		SessionSink = FileWriter ? ESessionSink::Collector : ESessionSink::File;
+	}
+	if (!FileWriter && bInMemorySessions)
+	{
+		int32 MemorySessionChunkBytes = 64 * 1024;
+		int32 MemorySessionMaxMB = 64;
+		ArcticAnalyticsSettings::GetInt(TEXT("MemorySessionChunkBytes"), MemorySessionChunkBytes);
+		ArcticAnalyticsSettings::GetInt(TEXT("MemorySessionMaxMB"), MemorySessionMaxMB);
+		FileWriter = MakeUnique<FArcticAnalyticsMemoryArchive>(MemorySessionChunkBytes, (int64)MemorySessionMaxMB * 1024 * 1024, FilePath);
+		SessionSink = ESessionSink::Memory;
+	}
+	if (!FileWriter)
+	{
+		FileWriter = TUniquePtr<FArchive>(IFileManager::Get().CreateFileWriter(*FilePath, FILEWRITE_EvenIfReadOnly));
+	}
 	if (FileWriter)
 	{
-		FileWriter->Logf(TEXT("{"));
-		FileWriter->Logf(TEXT("\t\"sessionId\" : \"%s\","), *SessionId);
-		FileWriter->Logf(TEXT("\t\"userId\" : \"%s\","), *UserId);
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("{"));
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"sessionId\" : \"%s\","), *SessionId);
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"userId\" : \"%s\","), *UserId);
 		if (BuildInfo.Len() > 0)
 		{
-			FileWriter->Logf(TEXT("\t\"buildInfo\" : \"%s\","), *BuildInfo);
+			ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"buildInfo\" : \"%s\","), *BuildInfo);
 		}
 		if (Age != 0)
 		{
-			FileWriter->Logf(TEXT("\t\"age\" : %d,"), Age);
+			ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"age\" : %d,"), Age);
 		}
 		if (Gender.Len() > 0)
 		{
-			FileWriter->Logf(TEXT("\t\"gender\" : \"%s\","), *Gender);
+			ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"gender\" : \"%s\","), *Gender);
 		}
 		if (Location.Len() > 0)
 		{
-			FileWriter->Logf(TEXT("\t\"location\" : \"%s\","), *Location);
+			ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"location\" : \"%s\","), *Location);
+		}
+		if (bHoistDefaultAttributes)
+		{
+			// Written once here instead of into every event
+			TStringBuilder<1024> Builder;
+			ArcticAnalyticsEventJson::AppendAttributesObject(Builder, *FDefaultAttributesScope(*this));
+			ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"defaultAttributes\" : %s,"), Builder.ToString());
 		}
-		FileWriter->Logf(TEXT("\t\"events\" : ["));
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\"events\" : ["));
 		bHasSessionStarted = true;
-		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Session created file (%s) for user (%s)"), *FilePath, *UserId);
+		if (SessionIndex)
+		{
+			SessionIndex->Reset();
+		}
+		BulkOldestRecordTime = 0.0;
+		LastDroppedReportTime = FPlatformTime::Seconds();
+		if (EventCosts)
+		{
+			// The previous session's report was counted after it was consumed
+			EventCosts->Reset();
+		}
+		// Samples recorded before the session started belong to no session
+		Metrics.CloseWindow();
+		MetricWindowEnd = LastDroppedReportTime + MetricWindowSeconds;
+		MetricWindowTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FAnalyticsProviderArcticAnalytics::TickMetricWindow), 0.25f);
+		if (FrameCapture)
+		{
+			FrameCapture->Flush();
+			FrameCapture->Start();
+		}
+		if (PriorityLane)
+		{
+			PriorityLane->Start(SessionId, UserId, BuildInfo);
+			PriorityLaneTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FAnalyticsProviderArcticAnalytics::TickPriorityLane), 0.25f);
+		}
+		if (FrameBudget)
+		{
+			FrameBudgetTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FAnalyticsProviderArcticAnalytics::TickFrameBudget));
+		}
+		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Session created %s (%s) for user (%s)"),
+			SessionSink == ESessionSink::Collector ? TEXT("collector stream") : SessionSink == ESessionSink::Memory ? TEXT("in memory, spilling to") : TEXT("file"),
+			SessionSink == ESessionSink::Collector ? *CollectorSocketPath : *FilePath, *UserId);
 	}
 	else
 	{
@@ -94,90 +316,567 @@ bool FAnalyticsProviderArcticAnalytics::StartSession(const TArray<FAnalyticsEven
 
 void FAnalyticsProviderArcticAnalytics::EndSession()
 {
+	ARCTICANALYTICS_TRACE_SCOPE(EndSession);
+	// Deferred calls and the records written below belong to the session whatever the budget
+	FArcticAnalyticsFrameBudget::FSuspendScope SuspendBudget(FrameBudget.Get());
+	if (FrameBudget)
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(FrameBudgetTickHandle);
+		FrameBudget->FlushDeferred();
+	}
 	if (FileWriter)
 	{
-		FileWriter->Logf(TEXT("\t]"));
-		FileWriter->Logf(TEXT("}"));
+		TArray<FAnalyticsEventAttribute> BudgetReport;
+		if (FrameBudget && FrameBudget->ConsumeReport(FPlatformTime::Seconds(), true, BudgetReport))
+		{
+			WriteInternalEvent(TEXT("ArcticAnalyticsFrameBudgetOverrun"), BudgetReport);
+		}
+		if (FrameCapture)
+		{
+			FrameCapture->Stop();
+			WriteFrameCapture();
+		}
+		FTSTicker::GetCoreTicker().RemoveTicker(MetricWindowTickHandle);
+		WriteMetricSummaries();
+		if (EventPolicies.HasDroppedEvents())
+		{
+			WriteDroppedEventsReport();
+		}
+		if (ErrorCoalescer && !ErrorCoalescer->IsEmpty())
+		{
+			WriteCoalescedErrors();
+		}
+		if (EventCosts)
+		{
+			WriteEventCostReport();
+		}
+		FlushPendingBatch();
+		if (PriorityLane)
+		{
+			FTSTicker::GetCoreTicker().RemoveTicker(PriorityLaneTickHandle);
+			FlushPriorityLane();
+		}
+		FArcticAnalyticsSessionIndex* Index = GetSessionFileIndex();
+		if (Index)
+		{
+			Index->EndRecord(FileWriter->Tell());
+		}
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t]"));
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("}"));
 		FileWriter->Flush();
+		ReportWrittenBytes();
+		const int64 SessionFileBytes = FileWriter->Tell();
 		FileWriter->Close();
-		SendDataToServer();
+		if (Index)
+		{
+			// Saved once the session file is complete, so an index always matches its file
+			Index->Save(AnalyticsFilePath / (SessionId + TEXT(".analytics")), SessionFileBytes);
+		}
+		// In memory sessions are uploaded from their buffers unless they spilled to the session file
+		FArcticAnalyticsMemoryArchive* MemoryWriter = SessionSink == ESessionSink::Memory ? static_cast<FArcticAnalyticsMemoryArchive*>(FileWriter.Get()) : nullptr;
+		if (MemoryWriter && !MemoryWriter->HasSpilled())
+		{
+			const double OldestRecordTime = BulkOldestRecordTime;
+			Uploader->EnqueueBuffer(SessionId, MemoryWriter->ReleaseBuffer(), false, [this, OldestRecordTime](bool bSucceeded)
+			{
+				OnDelivered(EArcticAnalyticsLane::Bulk, OldestRecordTime, bSucceeded);
+			});
+		}
+		// The collector uploads what it receives. If it went away mid session, the rest of the session is in the session file
+		else if (SessionSink != ESessionSink::Collector || static_cast<FArcticAnalyticsCollectorArchive*>(FileWriter.Get())->HasFallenBack())
+		{
+			SendDataToServer();
+		}
 		FileWriter = nullptr;
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Session ended for user (%s) and session id (%s)"), *UserId, *SessionId);
 	}
+	// Snapshots replaced while a reader was open are freed here at the latest
+	ReclaimDefaultEventAttributes();
 	bHasWrittenFirstEvent = false;
 	bHasSessionStarted = false;
 }
 
 void FAnalyticsProviderArcticAnalytics::FlushEvents()
 {
+	ARCTICANALYTICS_TRACE_SCOPE(FlushEvents);
+	FArcticAnalyticsFrameBudget::FSuspendScope SuspendBudget(FrameBudget.Get());
+	if (FrameBudget)
+	{
+		FrameBudget->FlushDeferred();
+	}
 	if (FileWriter)
 	{
+		const double StartTime = FPlatformTime::Seconds();
+		if (FrameCapture)
+		{
+			WriteFrameCapture();
+		}
+		WriteMetricSummaries();
+		if (EventPolicies.HasDroppedEvents())
+		{
+			WriteDroppedEventsReport();
+		}
+		if (ErrorCoalescer && !ErrorCoalescer->IsEmpty())
+		{
+			WriteCoalescedErrors();
+		}
+		FlushPendingBatch();
+		if (PriorityLane)
+		{
+			FlushPriorityLane();
+		}
 		FileWriter->Flush();
+		ReportWrittenBytes();
+		FArcticAnalyticsSelfMetrics::Get().AddFlush(FPlatformTime::Seconds() - StartTime);
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Analytics file flushed"));
 	}
 }
 
+void FAnalyticsProviderArcticAnalytics::ReportWrittenBytes()
+{
+	const int64 WrittenBytes = FileWriter->Tell();
+	FArcticAnalyticsSelfMetrics::Get().AddBytesWritten(WrittenBytes - ReportedWrittenBytes);
+	ReportedWrittenBytes = WrittenBytes;
+}
+
 void FAnalyticsProviderArcticAnalytics::SendDataToServer()
 {
-	// Get configured server
-	FString ConfigServer;
-	if (!GConfig->GetString(TEXT("/Script/ArcticAnalytics.Settings"), TEXT("Server"), ConfigServer,
-							FString::Printf(TEXT("%sDefaultEngine.ini"), *FPaths::SourceConfigDir())))
+	ARCTICANALYTICS_TRACE_SCOPE(SendDataToServer);
+	// The uploader only lives as long as this provider and drops its callbacks with it
+	const double OldestRecordTime = BulkOldestRecordTime;
+	Uploader->EnqueueFile(AnalyticsFilePath / (SessionId + TEXT(".analytics")), [this, OldestRecordTime](bool bSucceeded)
+	{
+		OnDelivered(EArcticAnalyticsLane::Bulk, OldestRecordTime, bSucceeded);
+	});
+}
+
+void FAnalyticsProviderArcticAnalytics::FlushPriorityLane()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(FlushPriorityLane);
+	if (PriorityLane->IsEmpty())
 	{
-		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Server not configured! Can't send data to server."));
 		return;
 	}
-	// Get configured secret
-	FString ConfigSecret;
-	if (!GConfig->GetString(TEXT("/Script/ArcticAnalytics.Settings"), TEXT("Secret"), ConfigSecret,
-							FString::Printf(TEXT("%sDefaultEngine.ini"), *FPaths::SourceConfigDir())))
+	const FString DocumentName = PriorityLane->GetDocumentName();
+	double OldestRecordTime;
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Document = PriorityLane->Flush(OldestRecordTime);
+	Uploader->EnqueueBuffer(DocumentName, Document, true, [this, OldestRecordTime](bool bSucceeded)
+	{
+		OnDelivered(EArcticAnalyticsLane::Priority, OldestRecordTime, bSucceeded);
+	});
+}
+
+bool FAnalyticsProviderArcticAnalytics::TickPriorityLane(float DeltaTime)
+{
+	const double Now = FPlatformTime::Seconds();
+	// Coalesced errors are otherwise only written with the next recorded event, which may never come
+	if (ErrorCoalescer && IsPriorityEvent(TEXT("Error")) && ErrorCoalescer->NeedsDrain(Now))
+	{
+		WriteCoalescedErrors();
+	}
+	if (PriorityLane->IsDue(Now, Uploader->GetController().GetBatchBytes()))
+	{
+		FlushPriorityLane();
+	}
+	return true;
+}
+
+bool FAnalyticsProviderArcticAnalytics::TickMetricWindow(float DeltaTime)
+{
+	if (FPlatformTime::Seconds() >= MetricWindowEnd)
+	{
+		WriteMetricSummaries();
+	}
+	return true;
+}
+
+bool FAnalyticsProviderArcticAnalytics::TickFrameBudget(float DeltaTime)
+{
+	FrameBudget->ReplayDeferred();
+	TArray<FAnalyticsEventAttribute> Report;
+	if (FrameBudget->ConsumeReport(FPlatformTime::Seconds(), false, Report))
+	{
+		WriteInternalEvent(TEXT("ArcticAnalyticsFrameBudgetOverrun"), Report);
+	}
+	return true;
+}
+
+bool FAnalyticsProviderArcticAnalytics::TickHousekeeping(float DeltaTime)
+{
+	Housekeeping->Tick(DeltaTime);
+	return true;
+}
+
+bool FAnalyticsProviderArcticAnalytics::HasSessionRecoveryWork() const
+{
+	if (RecoveryResult.IsValid())
+	{
+		return RecoveryResult.IsReady();
+	}
+	return bRecoveryScanPending || RecoveryCandidates.Num() > 0;
+}
+
+void FAnalyticsProviderArcticAnalytics::StepSessionRecovery()
+{
+	if (RecoveryResult.IsValid())
 	{
-		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Secret not configured! Can't send data to server."));
+		const TPair<EArcticAnalyticsRecoveryResult, int64> Result = RecoveryResult.Get();
+		RecoveryResult = TFuture<TPair<EArcticAnalyticsRecoveryResult, int64>>();
+		switch (Result.Key)
+		{
+		case EArcticAnalyticsRecoveryResult::Recovered:
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Recovered unfinished session (%s) of an earlier run, dropped (%lld) bytes of its last record"),
+				   *RecoveringFilePath, Result.Value);
+			Uploader->EnqueueFile(RecoveringFilePath);
+			break;
+		case EArcticAnalyticsRecoveryResult::InUse:
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Session (%s) is in use by another instance and is not recovered"), *RecoveringFilePath);
+			break;
+		case EArcticAnalyticsRecoveryResult::Failed:
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session (%s) of an earlier run can't be recovered"), *RecoveringFilePath);
+			break;
+		default:
+			break;
+		}
 		return;
 	}
-	// Create the request
-	const TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
-	// Set endpoint
-	Request->SetURL(ConfigServer);
-	// Set headers
-	Request->SetHeader(TEXT("User-Agent"), TEXT("X-UnrealEngine-Agent"));
-	Request->SetHeader(TEXT("Content-Type"), TEXT("application/json"));
-	Request->SetHeader(TEXT("Accept"), TEXT("application/json"));
-	// Set analytics content
-	FString AnalyticsPath = AnalyticsFilePath / (SessionId + TEXT(".analytics"));
-	FString AnalyticsJson;
-	if (!FFileHelper::LoadFileToString(AnalyticsJson, *AnalyticsPath))
-	{
-		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Session could not be loaded! Can't send data to server."));
+	if (!bRecoveryScanPending)
+	{
+		// Read and rewritten on a worker, only the tail of the file is read
+		RecoveringFilePath = RecoveryCandidates.Pop(false);
+		RecoveryResult = Async(EAsyncExecution::ThreadPool, [FilePath = RecoveringFilePath, MinAgeSeconds = (double)RecoveryMinAgeSeconds]()
+		{
+			int64 DroppedBytes = 0;
+			const EArcticAnalyticsRecoveryResult Result = ArcticAnalyticsSessionRecovery::Recover(FilePath, MinAgeSeconds, DroppedBytes);
+			return TPair<EArcticAnalyticsRecoveryResult, int64>(Result, DroppedBytes);
+		});
 		return;
 	}
-	// HMAC for auth header
-	SHA256Key Hash = HMAC_SHA256::Hash(ConfigSecret, AnalyticsJson);
-	Request->SetHeader(TEXT("Authorization"), Hash.ToHexString());
-	// POST request
-	Request->SetVerb("POST");
-	Request->SetContentAsString(AnalyticsJson);
-	Request->ProcessRequest();
+	bRecoveryScanPending = false;
+	TArray<FString> FileNames;
+	IFileManager::Get().FindFiles(FileNames, *(AnalyticsFilePath / TEXT("*.analytics")), true, false);
+	for (const FString& FileName : FileNames)
+	{
+		const FString FilePath = AnalyticsFilePath / FileName;
+		if (IFileManager::Get().GetTimeStamp(*FilePath) < ProviderStartTime)
+		{
+			RecoveryCandidates.Add(FilePath);
+		}
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::OnDelivered(EArcticAnalyticsLane Lane, double OldestRecordTime, bool bSucceeded)
+{
+	if (!bSucceeded || OldestRecordTime <= 0.0)
+	{
+		return;
+	}
+	const double LatencySeconds = FPlatformTime::Seconds() - OldestRecordTime;
+	DeliveryLatency[(int32)Lane].Add(LatencySeconds);
+	// Also summarized with the other metrics while a session is running
+	static const FName MetricNames[] = {TEXT("ArcticAnalytics.DeliveryLatencyMs.Bulk"), TEXT("ArcticAnalytics.DeliveryLatencyMs.Priority")};
+	if (bHasSessionStarted)
+	{
+		RecordMetric(MetricNames[(int32)Lane], LatencySeconds * 1000.0);
+	}
+	UE_LOG(LogArcticAnalyticsAnalytics, Verbose, TEXT("%s lane delivered after (%.3f) seconds"), Lane == EArcticAnalyticsLane::Priority ? TEXT("Priority") : TEXT("Bulk"),
+		   LatencySeconds);
+}
+
+void FAnalyticsProviderArcticAnalytics::SetEventPolicy(const FString& EventName, const FArcticAnalyticsEventPolicy& Policy)
+{
+	if (!bHasSessionStarted)
+	{
+		EventPolicies.SetPolicy(EventName, Policy);
+	}
+	else
+	{
+		// Policies are read without locking while recording, so they can't change mid session
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FAnalyticsProviderArcticAnalytics::SetEventPolicy called while a session is in progress. Ignoring."));
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::SetFrameBudget(float BudgetMicroseconds, EArcticAnalyticsOverrunMode Mode)
+{
+	if (bHasSessionStarted)
+	{
+		// Deferred calls of the session would be lost with the budget
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FAnalyticsProviderArcticAnalytics::SetFrameBudget called while a session is in progress. Ignoring."));
+		return;
+	}
+	FrameBudget.Reset();
+	if (BudgetMicroseconds > 0.0f)
+	{
+		float FrameBudgetSampleRate = 0.1f;
+		int32 FrameBudgetMaxDeferred = 4096;
+		float FrameBudgetReportInterval = 10.0f;
+		ArcticAnalyticsSettings::GetFloat(TEXT("FrameBudgetSampleRate"), FrameBudgetSampleRate);
+		ArcticAnalyticsSettings::GetInt(TEXT("FrameBudgetMaxDeferred"), FrameBudgetMaxDeferred);
+		ArcticAnalyticsSettings::GetFloat(TEXT("FrameBudgetReportInterval"), FrameBudgetReportInterval);
+		FrameBudget = MakeUnique<FArcticAnalyticsFrameBudget>(BudgetMicroseconds / 1000000.0, Mode, FrameBudgetSampleRate, FrameBudgetMaxDeferred,
+															   FrameBudgetReportInterval);
+	}
+}
+
+bool FAnalyticsProviderArcticAnalytics::ShouldRecordEvent(const FString& EventName, uint32 RecordId, EArcticAnalyticsRecordType Type)
+{
+	if (EventPolicies.HasDroppedEvents() && FPlatformTime::Seconds() - LastDroppedReportTime >= DroppedReportInterval)
+	{
+		WriteDroppedEventsReport();
+	}
+	if (ErrorCoalescer && ErrorCoalescer->NeedsDrain(FPlatformTime::Seconds()))
+	{
+		WriteCoalescedErrors();
+	}
+	if (!EventPolicies.ShouldRecord(EventName, RecordId))
+	{
+		FArcticAnalyticsSelfMetrics::Get().AddDropped(Type);
+		return false;
+	}
+	return true;
+}
+
+bool FAnalyticsProviderArcticAnalytics::AdmitRecord(const FString& EventName, int64 EncodedBytes, EArcticAnalyticsRecordType Type, int32 NumEvents)
+{
+	FArcticAnalyticsSelfMetrics& SelfMetrics = FArcticAnalyticsSelfMetrics::Get();
+	// Only in memory sessions hold on to events, the memory budget doesn't apply to the other sinks
+	FArcticAnalyticsMemoryArchive* MemoryWriter = SessionSink == ESessionSink::Memory ? static_cast<FArcticAnalyticsMemoryArchive*>(FileWriter.Get()) : nullptr;
+	if (MemoryWriter && !MemoryWriter->HasSpilled())
+	{
+		switch (FArcticAnalyticsMemoryBudget::Get().Admit(EncodedBytes, IsPriorityEvent(EventName)))
+		{
+		case EArcticAnalyticsBudgetDecision::Drop:
+			SelfMetrics.AddDropped(Type, NumEvents);
+			return false;
+		case EArcticAnalyticsBudgetDecision::Spill:
+			MemoryWriter->Spill();
+			break;
+		default:
+			break;
+		}
+	}
+	SelfMetrics.AddRecorded(Type, NumEvents);
+	return true;
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteDroppedEventsReport()
+{
+	LastDroppedReportTime = FPlatformTime::Seconds();
+	const TArray<FAnalyticsEventAttribute> DroppedCounts = EventPolicies.ConsumeDroppedCounts();
+	if (DroppedCounts.Num() > 0)
+	{
+		WriteInternalEvent(TEXT("ArcticAnalyticsDroppedEvents"), DroppedCounts);
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::RecordMetric(const FString& MetricName, double Value)
+{
+	RecordMetric(FName(*MetricName), Value);
+}
+
+void FAnalyticsProviderArcticAnalytics::RecordMetric(FName MetricName, double Value)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(RecordMetric);
+	if (bHasSessionStarted)
+	{
+		// Windows are closed by TickMetricWindow, so samples from any thread and quiet periods get their summaries
+		Metrics.Record(MetricName, Value);
+	}
+	else
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Verbose, TEXT("FAnalyticsProviderArcticAnalytics::RecordMetric called before StartSession. Ignoring."));
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteMetricSummaries()
+{
+	MetricWindowEnd = FPlatformTime::Seconds() + MetricWindowSeconds;
+	for (const FArcticAnalyticsMetricSummary& Summary : Metrics.CloseWindow())
+	{
+		WriteInternalEvent(TEXT("MetricSummary"), Summary.ToAttributes());
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteFrameCapture()
+{
+	if (FrameCapture->Num() > 0)
+	{
+		WriteInternalEvent(TEXT("FrameCapture"), FrameCapture->Flush());
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteInternalEvent(const TCHAR* EventName, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	if (!FileWriter)
+	{
+		return;
+	}
+	// Not a Record* call, so sampling, rate limits and the budgets can't drop the report, and it isn't counted as a recorded event
+	const double TimestampUTC = FDateTime::UtcNow().ToUnixTimestampDecimal();
+	TArray<FAnalyticsEventAttribute> EventAttributes;
+	if (!bHoistDefaultAttributes)
+	{
+		EventAttributes.Append(*FDefaultAttributesScope(*this));
+	}
+	EventAttributes.Append(Attributes);
+	FlushPendingBatch();
+	TStringBuilder<4096> Builder;
+	ArcticAnalyticsEventJson::AppendEvent(Builder, EventName, TimestampUTC, NextRecordId++, EventAttributes);
+	FArcticAnalyticsSelfMetrics::Get().AddBytesEncoded(Builder.Len());
+	WriteEventRecord(Builder.ToString(), EventName, TimestampUTC);
+}
+
+void FAnalyticsProviderArcticAnalytics::AddEventCost(const FString& EventName, int32 NumAttributes, int64 EncodedBytes, uint64 StartCycles)
+{
+	if (EventCosts)
+	{
+		EventCosts->Add(EventCosts->Intern(EventName), NumAttributes, EncodedBytes, FPlatformTime::Cycles64() - StartCycles);
+	}
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteEventCostReport()
+{
+	// Events still in the columnar batch are charged their bytes first
+	FlushPendingBatch();
+	const TArray<FArcticAnalyticsEventCost> Costs = EventCosts->Consume();
+	if (Costs.Num() == 0)
+	{
+		return;
+	}
+
+	int64 TotalBytes = 0;
+	for (const FArcticAnalyticsEventCost& Cost : Costs)
+	{
+		TotalBytes += Cost.EncodedBytes;
+	}
+	UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Event costs of session (%s), (%d) event names, (%lld) bytes:"), *SessionId, Costs.Num(), TotalBytes);
+	for (int32 Index = 0; Index < FMath::Min(Costs.Num(), EventCostReportSize); ++Index)
+	{
+		const FArcticAnalyticsEventCost& Cost = Costs[Index];
+		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("  %-32s %8lld events %10lld bytes (%5.1f%%) %5.1f attributes/event %8.2fms encode"), *Cost.EventName,
+			   Cost.Count, Cost.EncodedBytes, TotalBytes > 0 ? 100.0 * Cost.EncodedBytes / TotalBytes : 0.0, Cost.GetAttributesPerEvent(),
+			   Cost.GetEncodeSeconds() * 1000.0);
+	}
+	WriteInternalEvent(TEXT("ArcticAnalyticsEventCosts"), FArcticAnalyticsEventCosts::ToAttributes(Costs, EventCostReportSize));
+}
+
+FArchive& FAnalyticsProviderArcticAnalytics::BeginRecord(bool bPriority, const TCHAR* EventName, double OldestTimestampUTC)
+{
+	if (bPriority && PriorityLane)
+	{
+		return PriorityLane->BeginRecord();
+	}
+	if (SessionSink == ESessionSink::Collector)
+	{
+		static_cast<FArcticAnalyticsCollectorArchive*>(FileWriter.Get())->MarkRecordBoundary();
+	}
+	FArcticAnalyticsSessionIndex* Index = GetSessionFileIndex();
+	if (bHasWrittenFirstEvent)
+	{
+		if (Index)
+		{
+			Index->EndRecord(FileWriter->Tell());
+		}
+		ArcticAnalyticsEventJson::WriteLinef(*FileWriter, TEXT("\t\t,"));
+	}
+	else
+	{
+		BulkOldestRecordTime = FPlatformTime::Seconds();
+	}
+	bHasWrittenFirstEvent = true;
+	if (Index)
+	{
+		const double NowUTC = FDateTime::UtcNow().ToUnixTimestampDecimal();
+		Index->BeginRecord(EventName, OldestTimestampUTC > 0.0 ? OldestTimestampUTC : NowUTC, NowUTC, FileWriter->Tell());
+	}
+	return *FileWriter;
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteEventRecord(const TCHAR* Record, const TCHAR* EventName, double OldestTimestampUTC, bool bPriority)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Write);
+	ArcticAnalyticsEventJson::WriteLine(BeginRecord(bPriority, EventName, OldestTimestampUTC), Record);
+}
+
+void FAnalyticsProviderArcticAnalytics::FlushPendingBatch()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(FlushPendingBatch);
+	if (BatchEncoder && !BatchEncoder->IsEmpty())
+	{
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		const double OldestTimestampUTC = BatchEncoder->GetOldestTimestampUTC();
+		const int32 NumEvents = BatchEncoder->Num();
+		TStringBuilder<4096> Builder;
+		{
+			ARCTICANALYTICS_TRACE_SCOPE(Encode);
+			TRACE_COUNTER_SET(ArcticAnalytics_EncodedBatchEvents, NumEvents);
+			BatchEncoder->Encode(Builder);
+		}
+		// Batched events are admitted together, once their record is encoded
+		if (!AdmitRecord(BatchEncoder->GetEventName(), Builder.Len(), EArcticAnalyticsRecordType::Event, NumEvents))
+		{
+			return;
+		}
+		FArcticAnalyticsSelfMetrics::Get().AddBytesEncoded(Builder.Len());
+		WriteEventRecord(Builder.ToString(), *BatchEncoder->GetEventName(), OldestTimestampUTC);
+		if (EventCosts)
+		{
+			EventCosts->AddEncoded(PendingBatchCostIndex, Builder.Len(), FPlatformTime::Cycles64() - StartCycles);
+		}
+	}
 }
 
 void FAnalyticsProviderArcticAnalytics::SetDefaultEventAttributes(TArray<FAnalyticsEventAttribute>&& Attributes)
 {
-	DefaultEventAttributes = Attributes;
+	ARCTICANALYTICS_TRACE_SCOPE(SetDefaultEventAttributes);
+	TUniquePtr<const TArray<FAnalyticsEventAttribute>> Snapshot = MakeUnique<const TArray<FAnalyticsEventAttribute>>(MoveTemp(Attributes));
+	if (bHoistDefaultAttributes && bHasSessionStarted && FileWriter)
+	{
+		// Events don't carry the defaults, so readers need to know from which point on the new ones apply
+		FlushPendingBatch();
+		const double TimestampUTC = FDateTime::UtcNow().ToUnixTimestampDecimal();
+		TStringBuilder<1024> Builder;
+		Builder.Appendf(TEXT("\t\t{\n"));
+		Builder.Appendf(TEXT("\t\t\t\"eventKind\": \"defaultsChanged\",\n"));
+		Builder.Appendf(TEXT("\t\t\t\"TimestampUTC\": \"%.3f\",\n"), TimestampUTC);
+		Builder.Appendf(TEXT("\t\t\t\"defaultAttributes\": "));
+		ArcticAnalyticsEventJson::AppendAttributesObject(Builder, *Snapshot);
+		Builder.Appendf(TEXT("\n\t\t}"));
+		WriteEventRecord(Builder.ToString(), TEXT("defaultsChanged"), TimestampUTC);
+	}
+
+	// Publish the new immutable snapshot, readers still using the old one are unaffected
+	FScopeLock Lock(&DefaultEventAttributesCS);
+	DefaultEventAttributes.store(Snapshot.Get());
+	RetiredDefaultEventAttributes.Add(MoveTemp(CurrentDefaultEventAttributes));
+	CurrentDefaultEventAttributes = MoveTemp(Snapshot);
+	ReclaimDefaultEventAttributes();
+}
+
+void FAnalyticsProviderArcticAnalytics::ReclaimDefaultEventAttributes()
+{
+	FScopeLock Lock(&DefaultEventAttributesCS);
+	// Every retired snapshot was replaced before this check. A reader that registers after it loads the current one
+	if (RetiredDefaultEventAttributes.Num() > 0 && NumDefaultAttributeReaders.load() == 0)
+	{
+		RetiredDefaultEventAttributes.Empty();
+	}
 }
 
 TArray<FAnalyticsEventAttribute> FAnalyticsProviderArcticAnalytics::GetDefaultEventAttributesSafe() const
 {
-	return DefaultEventAttributes;
+	// The interface returns by value, so this copy can't be avoided. Use FDefaultAttributesScope where possible
+	return *FDefaultAttributesScope(*this);
 }
 
 int32 FAnalyticsProviderArcticAnalytics::GetDefaultEventAttributeCount() const
 {
-	return DefaultEventAttributes.Num();
+	return FDefaultAttributesScope(*this)->Num();
 }
 
 FAnalyticsEventAttribute FAnalyticsProviderArcticAnalytics::GetDefaultEventAttribute(int AttributeIndex) const
 {
-	return DefaultEventAttributes[AttributeIndex];
+	return (*FDefaultAttributesScope(*this))[AttributeIndex];
 }
 
 void FAnalyticsProviderArcticAnalytics::SetUserID(const FString& InUserID)
@@ -221,50 +920,85 @@ bool FAnalyticsProviderArcticAnalytics::SetSessionID(const FString& InSessionID)
 
 void FAnalyticsProviderArcticAnalytics::RecordEvent(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes)
 {
-	static uint32 RecordId(0);
-
+	ARCTICANALYTICS_TRACE_SCOPE(RecordEvent);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), *EventName);
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::Event, [&]() -> TFunction<void()>
+	{
+		return [this, EventName, Attributes]() { RecordEvent(EventName, Attributes); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		if (FileWriter)
 		{
-			TStringBuilder<1024> Builder;
-			if (bHasWrittenFirstEvent)
+			const uint32 RecordId = NextRecordId++;
+			if (!ShouldRecordEvent(EventName, RecordId, EArcticAnalyticsRecordType::Event))
 			{
-				Builder.Appendf(TEXT(","));
+				return;
 			}
-			bHasWrittenFirstEvent = true;
-
-			// Log event as JSON
-			Builder.Appendf(TEXT("\t\t{\n"));
-			Builder.Appendf(TEXT("\t\t\t\"EventName\": \"%s\""), *EventName);
-			
-			// Add the event timestamp field
-			Builder.Appendf(TEXT(",\n\t\t\t\"TimestampUTC\": \"%s\""), FDateTime::UtcNow().ToUnixTimestampDecimal());
-			
-			// Add the record Id and increment it
-			Builder.Appendf(TEXT(",\n\t\t\t\"RecordId\": \"%s\""), RecordId++);
-
-			// Accumulate all the attributes together. We could have had two loops but this seems cleaner
-			TArray<FAnalyticsEventAttribute> EventAttributes(DefaultEventAttributes);
-			EventAttributes.Append(Attributes);
-
-			// Add all the attributes
-			for (const FAnalyticsEventAttribute& Attribute : EventAttributes)
+			const double TimestampUTC = FDateTime::UtcNow().ToUnixTimestampDecimal();
+			const bool bPriority = PriorityLane && IsPriorityEvent(EventName);
+
+			// Accumulate all the attributes together, unless the defaults are only written to the session header.
+			// Priority documents have no header, so their events always carry the defaults
+			const bool bMergeDefaults = !bHoistDefaultAttributes || bPriority;
+			TArray<FAnalyticsEventAttribute> MergedAttributes;
+			if (bMergeDefaults)
 			{
-				// This should be almost nearly true, but we should check and JSON'ify as needed
-				if (Attribute.IsJsonFragment())
+				const FDefaultAttributesScope DefaultAttributes(*this);
+				MergedAttributes.Reserve(DefaultAttributes->Num() + Attributes.Num());
+				MergedAttributes.Append(*DefaultAttributes);
+				MergedAttributes.Append(Attributes);
+			}
+			const TArray<FAnalyticsEventAttribute>& EventAttributes = bMergeDefaults ? MergedAttributes : Attributes;
+
+			if (BatchEncoder && !bPriority)
+			{
+				// Runs of events with the same shape are written as a single columnar batch
+				if (!BatchEncoder->Matches(EventName, EventAttributes))
 				{
-					Builder.Appendf(TEXT(",\n\t\t\t\"%s\":%s"), *Attribute.GetName(), *Attribute.GetValue());
+					FlushPendingBatch();
 				}
-				else
+				const uint64 StartCycles = FPlatformTime::Cycles64();
+				BatchEncoder->Append(EventName, TimestampUTC, RecordId, EventAttributes);
+				if (EventCosts)
 				{
-					Builder.Appendf(TEXT(",\n\t\t\t\"%s\":\"%s\""), *Attribute.GetName(), *Attribute.GetValue());
+					// The batch is charged its bytes and encode time when it is written
+					PendingBatchCostIndex = EventCosts->Intern(EventName);
+					EventCosts->AddEvent(PendingBatchCostIndex, EventAttributes.Num(), FPlatformTime::Cycles64() - StartCycles);
+				}
+				if (BatchEncoder->IsFull())
+				{
+					FlushPendingBatch();
+				}
+			}
+			else
+			{
+				// Log event as JSON
+				const uint64 StartCycles = FPlatformTime::Cycles64();
+				TStringBuilder<1024> Builder;
+				{
+					ARCTICANALYTICS_TRACE_SCOPE(Encode);
+					ArcticAnalyticsEventJson::AppendEvent(Builder, EventName, TimestampUTC, RecordId, EventAttributes);
+				}
+				if (!AdmitRecord(EventName, Builder.Len(), EArcticAnalyticsRecordType::Event))
+				{
+					return;
+				}
+				FArcticAnalyticsSelfMetrics::Get().AddBytesEncoded(Builder.Len());
+				WriteEventRecord(Builder.ToString(), *EventName, TimestampUTC, bPriority);
+				if (EventCosts)
+				{
+					EventCosts->Add(EventCosts->Intern(EventName), EventAttributes.Num(), Builder.Len(), FPlatformTime::Cycles64() - StartCycles);
 				}
 			}
 
-			Builder.Appendf(TEXT("\n\t\t}"));
-
-			FileWriter->Logf(TEXT("%s"), Builder.ToString());
+			if (RecentEvents)
+			{
+				RecentEvents->Add(EventName, Attributes);
+			}
 
 			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Analytics event (%s) written with (%d) attributes"), *EventName, Attributes.Num());
 		}
@@ -277,30 +1011,53 @@ void FAnalyticsProviderArcticAnalytics::RecordEvent(const FString& EventName, co
 
 void FAnalyticsProviderArcticAnalytics::RecordItemPurchase(const FString& ItemId, const FString& Currency, int PerItemCost, int ItemQuantity)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordItemPurchase);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("recordItemPurchase"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::ItemPurchase, [&]() -> TFunction<void()>
+	{
+		return [this, ItemId, Currency, PerItemCost, ItemQuantity]() { RecordItemPurchase(ItemId, Currency, PerItemCost, ItemQuantity); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("recordItemPurchase"), NextRecordId++, EArcticAnalyticsRecordType::ItemPurchase))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventName\" : \"recordItemPurchase\","));
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventName\" : \"recordItemPurchase\",") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"itemId\", \t\"value\" : \"%s\" },"), *ItemId);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"currency\", \t\"value\" : \"%s\" },"), *Currency);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"perItemCost\", \t\"value\" : \"%d\" },"), PerItemCost);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"itemQuantity\", \t\"value\" : \"%d\" }"), ItemQuantity);
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"itemId\", \t\"value\" : \"%s\" },") LINE_TERMINATOR, *ItemId);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"currency\", \t\"value\" : \"%s\" },") LINE_TERMINATOR, *Currency);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"perItemCost\", \t\"value\" : \"%d\" },") LINE_TERMINATOR, PerItemCost);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"itemQuantity\", \t\"value\" : \"%d\" }") LINE_TERMINATOR, ItemQuantity);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
+
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("recordItemPurchase"), Builder.Len(), EArcticAnalyticsRecordType::ItemPurchase))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("recordItemPurchase"), 0.0, IsPriorityEvent(TEXT("recordItemPurchase")));
+		if (RecentEvents)
+		{
+			RecentEvents->Add(TEXT("recordItemPurchase"), {FAnalyticsEventAttribute(TEXT("perItemCost"), PerItemCost),
+														   FAnalyticsEventAttribute(TEXT("itemQuantity"), ItemQuantity)});
+		}
+		AddEventCost(TEXT("recordItemPurchase"), 4, Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("(%d) number of item (%s) purchased with (%s) at a cost of (%d) each"), ItemQuantity, *ItemId, *Currency, PerItemCost);
 	}
@@ -313,31 +1070,54 @@ void FAnalyticsProviderArcticAnalytics::RecordItemPurchase(const FString& ItemId
 void FAnalyticsProviderArcticAnalytics::RecordCurrencyPurchase(const FString& GameCurrencyType, int GameCurrencyAmount, const FString& RealCurrencyType,
 															   float RealMoneyCost, const FString& PaymentProvider)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordCurrencyPurchase);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("recordCurrencyPurchase"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::CurrencyPurchase, [&]() -> TFunction<void()>
+	{
+		return [this, GameCurrencyType, GameCurrencyAmount, RealCurrencyType, RealMoneyCost, PaymentProvider]() { RecordCurrencyPurchase(GameCurrencyType, GameCurrencyAmount, RealCurrencyType, RealMoneyCost, PaymentProvider); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("recordCurrencyPurchase"), NextRecordId++, EArcticAnalyticsRecordType::CurrencyPurchase))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventName\" : \"recordCurrencyPurchase\","));
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventName\" : \"recordCurrencyPurchase\",") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyType\", \t\"value\" : \"%s\" },"), *GameCurrencyType);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyAmount\", \t\"value\" : \"%d\" },"), GameCurrencyAmount);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"realCurrencyType\", \t\"value\" : \"%s\" },"), *RealCurrencyType);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"realMoneyCost\", \t\"value\" : \"%f\" },"), RealMoneyCost);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"paymentProvider\", \t\"value\" : \"%s\" }"), *PaymentProvider);
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyType\", \t\"value\" : \"%s\" },") LINE_TERMINATOR, *GameCurrencyType);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyAmount\", \t\"value\" : \"%d\" },") LINE_TERMINATOR, GameCurrencyAmount);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"realCurrencyType\", \t\"value\" : \"%s\" },") LINE_TERMINATOR, *RealCurrencyType);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"realMoneyCost\", \t\"value\" : \"%f\" },") LINE_TERMINATOR, RealMoneyCost);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"paymentProvider\", \t\"value\" : \"%s\" }") LINE_TERMINATOR, *PaymentProvider);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
+
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("recordCurrencyPurchase"), Builder.Len(), EArcticAnalyticsRecordType::CurrencyPurchase))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("recordCurrencyPurchase"), 0.0, IsPriorityEvent(TEXT("recordCurrencyPurchase")));
+		if (RecentEvents)
+		{
+			RecentEvents->Add(TEXT("recordCurrencyPurchase"), {FAnalyticsEventAttribute(TEXT("gameCurrencyAmount"), GameCurrencyAmount),
+															   FAnalyticsEventAttribute(TEXT("realMoneyCost"), RealMoneyCost)});
+		}
+		AddEventCost(TEXT("recordCurrencyPurchase"), 5, Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("(%d) amount of in game currency (%s) purchased with (%s) at a cost of (%f) each"),
 			   GameCurrencyAmount, *GameCurrencyType, *RealCurrencyType, RealMoneyCost);
@@ -350,28 +1130,50 @@ void FAnalyticsProviderArcticAnalytics::RecordCurrencyPurchase(const FString& Ga
 
 void FAnalyticsProviderArcticAnalytics::RecordCurrencyGiven(const FString& GameCurrencyType, int GameCurrencyAmount)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordCurrencyGiven);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("recordCurrencyGiven"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::CurrencyGiven, [&]() -> TFunction<void()>
+	{
+		return [this, GameCurrencyType, GameCurrencyAmount]() { RecordCurrencyGiven(GameCurrencyType, GameCurrencyAmount); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("recordCurrencyGiven"), NextRecordId++, EArcticAnalyticsRecordType::CurrencyGiven))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventName\" : \"recordCurrencyGiven\","));
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventName\" : \"recordCurrencyGiven\",") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyType\", \t\"value\" : \"%s\" },"), *GameCurrencyType);
-		FileWriter->Logf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyAmount\", \t\"value\" : \"%d\" }"), GameCurrencyAmount);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyType\", \t\"value\" : \"%s\" },") LINE_TERMINATOR, *GameCurrencyType);
+		Builder.Appendf(TEXT("\t\t\t\t{ \"name\" : \"gameCurrencyAmount\", \t\"value\" : \"%d\" }") LINE_TERMINATOR, GameCurrencyAmount);
 
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("recordCurrencyGiven"), Builder.Len(), EArcticAnalyticsRecordType::CurrencyGiven))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("recordCurrencyGiven"), 0.0, IsPriorityEvent(TEXT("recordCurrencyGiven")));
+		if (RecentEvents)
+		{
+			RecentEvents->Add(TEXT("recordCurrencyGiven"), {FAnalyticsEventAttribute(TEXT("gameCurrencyAmount"), GameCurrencyAmount)});
+		}
+		AddEventCost(TEXT("recordCurrencyGiven"), 2, Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("(%d) amount of in game currency (%s) given to user"), GameCurrencyAmount, *GameCurrencyType);
 	}
@@ -403,38 +1205,40 @@ void FAnalyticsProviderArcticAnalytics::SetBuildInfo(const FString& InBuildInfo)
 
 void FAnalyticsProviderArcticAnalytics::RecordError(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordError);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("Error"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::Error, [&]() -> TFunction<void()>
+	{
+		return [this, Error, Attributes]() { RecordError(Error, Attributes); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		// This also drains the coalescer when its window is over or it is full
+		if (!ShouldRecordEvent(TEXT("Error"), NextRecordId++, EArcticAnalyticsRecordType::Error))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
-
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"error\" : \"%s\","), *Error);
-
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
-		bool bHasWrittenFirstAttr = false;
-		// Write out the list of attributes as an array of attribute objects
-		for (auto Attr : Attributes)
+		bool bRecorded = true;
+		if (ErrorCoalescer)
 		{
-			if (bHasWrittenFirstAttr)
-			{
-				FileWriter->Logf(TEXT("\t\t\t,"));
-			}
-			FileWriter->Logf(TEXT("\t\t\t{"));
-			FileWriter->Logf(TEXT("\t\t\t\t\"name\" : \"%s\","), *Attr.GetName());
-			FileWriter->Logf(TEXT("\t\t\t\t\"value\" : \"%s\""), *Attr.GetValue());
-			FileWriter->Logf(TEXT("\t\t\t}"));
-			bHasWrittenFirstAttr = true;
+			// The coalescer holds one entry per distinct error, its records are written without asking the memory budget
+			FArcticAnalyticsSelfMetrics::Get().AddRecorded(EArcticAnalyticsRecordType::Error);
+			ErrorCoalescer->Add(Error, Attributes, FDateTime::UtcNow().ToUnixTimestampDecimal());
+		}
+		else
+		{
+			FlushPendingBatch();
+			bRecorded = WriteErrorRecord(Error, Attributes, nullptr);
+		}
+		if (RecentEvents && bRecorded)
+		{
+			RecentEvents->Add(TEXT("Error"), Attributes);
 		}
-		FileWriter->Logf(TEXT("\t\t\t]"));
-
-		FileWriter->Logf(TEXT("\t\t}"));
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Error is (%s) number of attributes is (%d)"), *Error, Attributes.Num());
 	}
@@ -444,42 +1248,118 @@ void FAnalyticsProviderArcticAnalytics::RecordError(const FString& Error, const
 	}
 }
 
+bool FAnalyticsProviderArcticAnalytics::WriteErrorRecord(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes,
+														 const FArcticAnalyticsErrorCoalescer::FEntry* Coalesced)
+{
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	TStringBuilder<1024> Builder;
+
+	Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+	Builder.Appendf(TEXT("\t\t\t\"error\" : \"%s\",") LINE_TERMINATOR, *Error);
+
+	if (Coalesced)
+	{
+		Builder.Appendf(TEXT("\t\t\t\"count\" : %u,") LINE_TERMINATOR, Coalesced->Count);
+		Builder.Appendf(TEXT("\t\t\t\"firstTimestamp\" : \"%.3f\",") LINE_TERMINATOR, Coalesced->FirstTimestampUTC);
+		Builder.Appendf(TEXT("\t\t\t\"lastTimestamp\" : \"%.3f\",") LINE_TERMINATOR, Coalesced->LastTimestampUTC);
+	}
+
+	Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+	Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
+	bool bHasWrittenFirstAttr = false;
+	// Write out the list of attributes as an array of attribute objects
+	for (auto Attr : Attributes)
+	{
+		if (bHasWrittenFirstAttr)
+		{
+			Builder.Appendf(TEXT("\t\t\t,") LINE_TERMINATOR);
+		}
+		Builder.Appendf(TEXT("\t\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\t\"name\" : \"%s\",") LINE_TERMINATOR, *Attr.GetName());
+		Builder.Appendf(TEXT("\t\t\t\t\"value\" : \"%s\"") LINE_TERMINATOR, *Attr.GetValue());
+		Builder.Appendf(TEXT("\t\t\t}") LINE_TERMINATOR);
+		bHasWrittenFirstAttr = true;
+	}
+	Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
+
+	Builder.Append(TEXT("\t\t}"));
+	// Coalesced errors were admitted when they were recorded
+	if (!Coalesced && !AdmitRecord(TEXT("Error"), Builder.Len(), EArcticAnalyticsRecordType::Error))
+	{
+		return false;
+	}
+	WriteEventRecord(Builder.ToString(), TEXT("Error"), Coalesced ? Coalesced->FirstTimestampUTC : 0.0, IsPriorityEvent(TEXT("Error")));
+	AddEventCost(TEXT("Error"), Attributes.Num(), Builder.Len(), StartCycles);
+	return true;
+}
+
+void FAnalyticsProviderArcticAnalytics::WriteCoalescedErrors()
+{
+	FlushPendingBatch();
+	ErrorCoalescer->Drain([this](const FArcticAnalyticsErrorCoalescer::FEntry& Entry)
+	{
+		WriteErrorRecord(Entry.Error, Entry.Attributes, &Entry);
+	});
+}
+
 void FAnalyticsProviderArcticAnalytics::RecordProgress(const FString& ProgressType, const FString& ProgressName, const TArray<FAnalyticsEventAttribute>& Attributes)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordProgress);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("Progress"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::Progress, [&]() -> TFunction<void()>
+	{
+		return [this, ProgressType, ProgressName, Attributes]() { RecordProgress(ProgressType, ProgressName, Attributes); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("Progress"), NextRecordId++, EArcticAnalyticsRecordType::Progress))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventType\" : \"Progress\","));
-		FileWriter->Logf(TEXT("\t\t\t\"progressType\" : \"%s\","), *ProgressType);
-		FileWriter->Logf(TEXT("\t\t\t\"progressName\" : \"%s\","), *ProgressName);
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventType\" : \"Progress\",") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"progressType\" : \"%s\",") LINE_TERMINATOR, *ProgressType);
+		Builder.Appendf(TEXT("\t\t\t\"progressName\" : \"%s\",") LINE_TERMINATOR, *ProgressName);
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 		bool bHasWrittenFirstAttr = false;
 		// Write out the list of attributes as an array of attribute objects
 		for (auto Attr : Attributes)
 		{
 			if (bHasWrittenFirstAttr)
 			{
-				FileWriter->Logf(TEXT("\t\t\t,"));
+				Builder.Appendf(TEXT("\t\t\t,") LINE_TERMINATOR);
 			}
-			FileWriter->Logf(TEXT("\t\t\t{"));
-			FileWriter->Logf(TEXT("\t\t\t\t\"name\" : \"%s\","), *Attr.GetName());
-			FileWriter->Logf(TEXT("\t\t\t\t\"value\" : \"%s\""), *Attr.GetValue());
-			FileWriter->Logf(TEXT("\t\t\t}"));
+			Builder.Appendf(TEXT("\t\t\t{") LINE_TERMINATOR);
+			Builder.Appendf(TEXT("\t\t\t\t\"name\" : \"%s\",") LINE_TERMINATOR, *Attr.GetName());
+			Builder.Appendf(TEXT("\t\t\t\t\"value\" : \"%s\"") LINE_TERMINATOR, *Attr.GetValue());
+			Builder.Appendf(TEXT("\t\t\t}") LINE_TERMINATOR);
 			bHasWrittenFirstAttr = true;
 		}
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("Progress"), Builder.Len(), EArcticAnalyticsRecordType::Progress))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("Progress"), 0.0, IsPriorityEvent(TEXT("Progress")));
+		if (RecentEvents)
+		{
+			RecentEvents->Add(TEXT("Progress"), Attributes);
+		}
+		AddEventCost(TEXT("Progress"), Attributes.Num(), Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Progress event is type (%s), named (%s), number of attributes is (%d)"), *ProgressType,
 			   *ProgressName, Attributes.Num());
@@ -492,40 +1372,64 @@ void FAnalyticsProviderArcticAnalytics::RecordProgress(const FString& ProgressTy
 
 void FAnalyticsProviderArcticAnalytics::RecordItemPurchase(const FString& ItemId, int ItemQuantity, const TArray<FAnalyticsEventAttribute>& Attributes)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordItemPurchase);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("ItemPurchase"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::ItemPurchase, [&]() -> TFunction<void()>
+	{
+		return [this, ItemId, ItemQuantity, Attributes]() { RecordItemPurchase(ItemId, ItemQuantity, Attributes); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("ItemPurchase"), NextRecordId++, EArcticAnalyticsRecordType::ItemPurchase))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventType\" : \"ItemPurchase\","));
-		FileWriter->Logf(TEXT("\t\t\t\"itemId\" : \"%s\","), *ItemId);
-		FileWriter->Logf(TEXT("\t\t\t\"itemQuantity\" : %d,"), ItemQuantity);
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventType\" : \"ItemPurchase\",") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"itemId\" : \"%s\",") LINE_TERMINATOR, *ItemId);
+		Builder.Appendf(TEXT("\t\t\t\"itemQuantity\" : %d,") LINE_TERMINATOR, ItemQuantity);
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 		bool bHasWrittenFirstAttr = false;
 		// Write out the list of attributes as an array of attribute objects
 		for (auto Attr : Attributes)
 		{
 			if (bHasWrittenFirstAttr)
 			{
-				FileWriter->Logf(TEXT("\t\t\t,"));
+				Builder.Appendf(TEXT("\t\t\t,") LINE_TERMINATOR);
 			}
-			FileWriter->Logf(TEXT("\t\t\t{"));
-			FileWriter->Logf(TEXT("\t\t\t\t\"name\" : \"%s\","), *Attr.GetName());
-			FileWriter->Logf(TEXT("\t\t\t\t\"value\" : \"%s\""), *Attr.GetValue());
-			FileWriter->Logf(TEXT("\t\t\t}"));
+			Builder.Appendf(TEXT("\t\t\t{") LINE_TERMINATOR);
+			Builder.Appendf(TEXT("\t\t\t\t\"name\" : \"%s\",") LINE_TERMINATOR, *Attr.GetName());
+			Builder.Appendf(TEXT("\t\t\t\t\"value\" : \"%s\"") LINE_TERMINATOR, *Attr.GetValue());
+			Builder.Appendf(TEXT("\t\t\t}") LINE_TERMINATOR);
 			bHasWrittenFirstAttr = true;
 		}
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("ItemPurchase"), Builder.Len(), EArcticAnalyticsRecordType::ItemPurchase))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("ItemPurchase"), 0.0, IsPriorityEvent(TEXT("ItemPurchase")));
+		if (RecentEvents)
+		{
+			TArray<FAnalyticsEventAttribute> RecentAttributes(Attributes);
+			RecentAttributes.Emplace(TEXT("itemQuantity"), ItemQuantity);
+			RecentEvents->Add(TEXT("ItemPurchase"), RecentAttributes);
+		}
+		AddEventCost(TEXT("ItemPurchase"), Attributes.Num(), Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Item purchase id (%s), quantity (%d), number of attributes is (%d)"), *ItemId, ItemQuantity,
 			   Attributes.Num());
@@ -538,40 +1442,64 @@ void FAnalyticsProviderArcticAnalytics::RecordItemPurchase(const FString& ItemId
 
 void FAnalyticsProviderArcticAnalytics::RecordCurrencyPurchase(const FString& GameCurrencyType, int GameCurrencyAmount, const TArray<FAnalyticsEventAttribute>& Attributes)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordCurrencyPurchase);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("CurrencyPurchase"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::CurrencyPurchase, [&]() -> TFunction<void()>
+	{
+		return [this, GameCurrencyType, GameCurrencyAmount, Attributes]() { RecordCurrencyPurchase(GameCurrencyType, GameCurrencyAmount, Attributes); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("CurrencyPurchase"), NextRecordId++, EArcticAnalyticsRecordType::CurrencyPurchase))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventType\" : \"CurrencyPurchase\","));
-		FileWriter->Logf(TEXT("\t\t\t\"gameCurrencyType\" : \"%s\","), *GameCurrencyType);
-		FileWriter->Logf(TEXT("\t\t\t\"gameCurrencyAmount\" : %d,"), GameCurrencyAmount);
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventType\" : \"CurrencyPurchase\",") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"gameCurrencyType\" : \"%s\",") LINE_TERMINATOR, *GameCurrencyType);
+		Builder.Appendf(TEXT("\t\t\t\"gameCurrencyAmount\" : %d,") LINE_TERMINATOR, GameCurrencyAmount);
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 		bool bHasWrittenFirstAttr = false;
 		// Write out the list of attributes as an array of attribute objects
 		for (auto Attr : Attributes)
 		{
 			if (bHasWrittenFirstAttr)
 			{
-				FileWriter->Logf(TEXT("\t\t\t,"));
+				Builder.Appendf(TEXT("\t\t\t,") LINE_TERMINATOR);
 			}
-			FileWriter->Logf(TEXT("\t\t\t{"));
-			FileWriter->Logf(TEXT("\t\t\t\t\"name\" : \"%s\","), *Attr.GetName());
-			FileWriter->Logf(TEXT("\t\t\t\t\"value\" : \"%s\""), *Attr.GetValue());
-			FileWriter->Logf(TEXT("\t\t\t}"));
+			Builder.Appendf(TEXT("\t\t\t{") LINE_TERMINATOR);
+			Builder.Appendf(TEXT("\t\t\t\t\"name\" : \"%s\",") LINE_TERMINATOR, *Attr.GetName());
+			Builder.Appendf(TEXT("\t\t\t\t\"value\" : \"%s\"") LINE_TERMINATOR, *Attr.GetValue());
+			Builder.Appendf(TEXT("\t\t\t}") LINE_TERMINATOR);
 			bHasWrittenFirstAttr = true;
 		}
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("CurrencyPurchase"), Builder.Len(), EArcticAnalyticsRecordType::CurrencyPurchase))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("CurrencyPurchase"), 0.0, IsPriorityEvent(TEXT("CurrencyPurchase")));
+		if (RecentEvents)
+		{
+			TArray<FAnalyticsEventAttribute> RecentAttributes(Attributes);
+			RecentAttributes.Emplace(TEXT("gameCurrencyAmount"), GameCurrencyAmount);
+			RecentEvents->Add(TEXT("CurrencyPurchase"), RecentAttributes);
+		}
+		AddEventCost(TEXT("CurrencyPurchase"), Attributes.Num(), Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Currency purchase type (%s), quantity (%d), number of attributes is (%d)"), *GameCurrencyType,
 			   GameCurrencyAmount, Attributes.Num());
@@ -584,40 +1512,64 @@ void FAnalyticsProviderArcticAnalytics::RecordCurrencyPurchase(const FString& Ga
 
 void FAnalyticsProviderArcticAnalytics::RecordCurrencyGiven(const FString& GameCurrencyType, int GameCurrencyAmount, const TArray<FAnalyticsEventAttribute>& Attributes)
 {
+	ARCTICANALYTICS_TRACE_SCOPE(RecordCurrencyGiven);
+	FArcticAnalyticsFrameBudget::FScope BudgetScope(FrameBudget.Get(), TEXT("CurrencyGiven"));
+	if (!AdmitCall(BudgetScope, EArcticAnalyticsRecordType::CurrencyGiven, [&]() -> TFunction<void()>
+	{
+		return [this, GameCurrencyType, GameCurrencyAmount, Attributes]() { RecordCurrencyGiven(GameCurrencyType, GameCurrencyAmount, Attributes); };
+	}))
+	{
+		return;
+	}
 	if (bHasSessionStarted)
 	{
 		check(FileWriter);
 
-		if (bHasWrittenFirstEvent)
+		if (!ShouldRecordEvent(TEXT("CurrencyGiven"), NextRecordId++, EArcticAnalyticsRecordType::CurrencyGiven))
 		{
-			FileWriter->Logf(TEXT("\t\t,"));
+			return;
 		}
-		bHasWrittenFirstEvent = true;
+		FlushPendingBatch();
+
+		const uint64 StartCycles = FPlatformTime::Cycles64();
+		TStringBuilder<1024> Builder;
 
-		FileWriter->Logf(TEXT("\t\t{"));
-		FileWriter->Logf(TEXT("\t\t\t\"eventType\" : \"CurrencyGiven\","));
-		FileWriter->Logf(TEXT("\t\t\t\"gameCurrencyType\" : \"%s\","), *GameCurrencyType);
-		FileWriter->Logf(TEXT("\t\t\t\"gameCurrencyAmount\" : %d,"), GameCurrencyAmount);
+		Builder.Appendf(TEXT("\t\t{") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"eventType\" : \"CurrencyGiven\",") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t\"gameCurrencyType\" : \"%s\",") LINE_TERMINATOR, *GameCurrencyType);
+		Builder.Appendf(TEXT("\t\t\t\"gameCurrencyAmount\" : %d,") LINE_TERMINATOR, GameCurrencyAmount);
 
-		FileWriter->Logf(TEXT("\t\t\t\"attributes\" :"));
-		FileWriter->Logf(TEXT("\t\t\t["));
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :") LINE_TERMINATOR);
+		Builder.Appendf(TEXT("\t\t\t[") LINE_TERMINATOR);
 		bool bHasWrittenFirstAttr = false;
 		// Write out the list of attributes as an array of attribute objects
 		for (auto Attr : Attributes)
 		{
 			if (bHasWrittenFirstAttr)
 			{
-				FileWriter->Logf(TEXT("\t\t\t,"));
+				Builder.Appendf(TEXT("\t\t\t,") LINE_TERMINATOR);
 			}
-			FileWriter->Logf(TEXT("\t\t\t{"));
-			FileWriter->Logf(TEXT("\t\t\t\t\"name\" : \"%s\","), *Attr.GetName());
-			FileWriter->Logf(TEXT("\t\t\t\t\"value\" : \"%s\""), *Attr.GetValue());
-			FileWriter->Logf(TEXT("\t\t\t}"));
+			Builder.Appendf(TEXT("\t\t\t{") LINE_TERMINATOR);
+			Builder.Appendf(TEXT("\t\t\t\t\"name\" : \"%s\",") LINE_TERMINATOR, *Attr.GetName());
+			Builder.Appendf(TEXT("\t\t\t\t\"value\" : \"%s\"") LINE_TERMINATOR, *Attr.GetValue());
+			Builder.Appendf(TEXT("\t\t\t}") LINE_TERMINATOR);
 			bHasWrittenFirstAttr = true;
 		}
-		FileWriter->Logf(TEXT("\t\t\t]"));
+		Builder.Appendf(TEXT("\t\t\t]") LINE_TERMINATOR);
 
-		FileWriter->Logf(TEXT("\t\t}"));
+		Builder.Append(TEXT("\t\t}"));
+		if (!AdmitRecord(TEXT("CurrencyGiven"), Builder.Len(), EArcticAnalyticsRecordType::CurrencyGiven))
+		{
+			return;
+		}
+		WriteEventRecord(Builder.ToString(), TEXT("CurrencyGiven"), 0.0, IsPriorityEvent(TEXT("CurrencyGiven")));
+		if (RecentEvents)
+		{
+			TArray<FAnalyticsEventAttribute> RecentAttributes(Attributes);
+			RecentAttributes.Emplace(TEXT("gameCurrencyAmount"), GameCurrencyAmount);
+			RecentEvents->Add(TEXT("CurrencyGiven"), RecentAttributes);
+		}
+		AddEventCost(TEXT("CurrencyGiven"), Attributes.Num(), Builder.Len(), StartCycles);
 
 		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Currency given type (%s), quantity (%d), number of attributes is (%d)"), *GameCurrencyType,
 			   GameCurrencyAmount, Attributes.Num());
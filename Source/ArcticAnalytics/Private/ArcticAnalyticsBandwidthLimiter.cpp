@@ -0,0 +1,88 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsBandwidthLimiter.h"
+
+#include "Engine/Engine.h"
+#include "Engine/World.h"
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsSettings.h"
+
+FArcticAnalyticsBandwidthLimiter& FArcticAnalyticsBandwidthLimiter::Get()
+{
+	static FArcticAnalyticsBandwidthLimiter Limiter;
+	return Limiter;
+}
+
+FArcticAnalyticsBandwidthLimiter::FArcticAnalyticsBandwidthLimiter()
+	: BytesPerSecond(0), BurstBytes(64 * 1024), NetGameFraction(1.0f), bNetworkGameActive(false), Tokens(0.0), LastRefillTime(0.0)
+{
+	LoadFromConfig();
+}
+
+void FArcticAnalyticsBandwidthLimiter::LoadFromConfig()
+{
+	int32 UploadBandwidthKBps = 0;
+	ArcticAnalyticsSettings::GetInt(TEXT("UploadBandwidthKBps"), UploadBandwidthKBps);
+	int32 UploadBurstKB = 64;
+	ArcticAnalyticsSettings::GetInt(TEXT("UploadBurstKB"), UploadBurstKB);
+	float UploadNetGameBandwidthFraction = 0.25f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("UploadNetGameBandwidthFraction"), UploadNetGameBandwidthFraction);
+	Configure((int64)UploadBandwidthKBps * 1024, (int64)UploadBurstKB * 1024, UploadNetGameBandwidthFraction);
+}
+
+void FArcticAnalyticsBandwidthLimiter::Configure(int64 InBytesPerSecond, int64 InBurstBytes, float InNetGameFraction)
+{
+	BytesPerSecond = FMath::Max<int64>(0, InBytesPerSecond);
+	BurstBytes = FMath::Max<int64>(1024, InBurstBytes);
+	NetGameFraction = FMath::Clamp(InNetGameFraction, 0.01f, 1.0f);
+	Tokens = (double)BurstBytes;
+	LastRefillTime = FPlatformTime::Seconds();
+}
+
+int64 FArcticAnalyticsBandwidthLimiter::GetBytesPerSecond() const
+{
+	if (BytesPerSecond <= 0)
+	{
+		return 0;
+	}
+	return FMath::Max<int64>(1, IsNetworkGameActive() ? (int64)(BytesPerSecond * NetGameFraction) : BytesPerSecond);
+}
+
+bool FArcticAnalyticsBandwidthLimiter::TryAcquire(int64 Bytes)
+{
+	check(IsInGameThread());
+	if (BytesPerSecond <= 0)
+	{
+		return true;
+	}
+	const double Now = FPlatformTime::Seconds();
+	Tokens = FMath::Min<double>(BurstBytes, Tokens + (Now - LastRefillTime) * GetBytesPerSecond());
+	LastRefillTime = Now;
+	// Requests are kept to the burst, so one never waits for more than the bucket holds
+	if (Tokens < FMath::Min<double>(Bytes, BurstBytes))
+	{
+		return false;
+	}
+	Tokens -= Bytes;
+	return true;
+}
+
+void FArcticAnalyticsBandwidthLimiter::UpdateNetworkGameActive()
+{
+	check(IsInGameThread());
+	bool bActive = false;
+	if (GEngine)
+	{
+		for (const FWorldContext& Context : GEngine->GetWorldContexts())
+		{
+			const UWorld* World = Context.World();
+			if (World && World->GetNetMode() != NM_Standalone)
+			{
+				bActive = true;
+				break;
+			}
+		}
+	}
+	bNetworkGameActive.store(bActive, std::memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+/**
+ * Process wide token bucket shared by every analytics upload, so uploading mid session never takes more of the
+ * player's uplink than UploadBandwidthKBps. While a network game is running the rate is further scaled by
+ * UploadNetGameBandwidthFraction, leaving the link to replication.
+ *
+ * Uploads are paced on the game thread: a request is only handed to the HTTP module once the bucket holds tokens
+ * for its whole body, so the rate holds without ever blocking the HTTP thread. The uploader chunks anything larger
+ * than the burst, so no single request goes out faster than the cap allows.
+ */
+class FArcticAnalyticsBandwidthLimiter
+{
+public:
+	static FArcticAnalyticsBandwidthLimiter& Get();
+
+	/** Reads the UploadBandwidth settings. Not thread safe, only call while nothing is uploading */
+	void LoadFromConfig();
+
+	/** Replaces the configured rate, a rate of 0 disables the limiter. Not thread safe, only call while nothing is uploading */
+	void Configure(int64 InBytesPerSecond, int64 InBurstBytes, float InNetGameFraction);
+
+	bool IsEnabled() const
+	{
+		return BytesPerSecond > 0;
+	}
+
+	/** Largest request the uploader hands to the HTTP module while the limiter is enabled */
+	int64 GetBurstBytes() const
+	{
+		return BurstBytes;
+	}
+
+	/** Current rate in bytes per second, 0 when unlimited */
+	int64 GetBytesPerSecond() const;
+
+	/** Takes Bytes from the bucket if it holds that many. Game thread only */
+	bool TryAcquire(int64 Bytes);
+
+	/** Checks whether any world is a client, listen or dedicated server. Game thread only */
+	void UpdateNetworkGameActive();
+
+	bool IsNetworkGameActive() const
+	{
+		return bNetworkGameActive.load(std::memory_order_relaxed);
+	}
+
+private:
+	FArcticAnalyticsBandwidthLimiter();
+
+	int64 BytesPerSecond;
+	int64 BurstBytes;
+	float NetGameFraction;
+
+	std::atomic<bool> bNetworkGameActive;
+
+	/** Goes negative only for a request larger than the burst */
+	double Tokens;
+	double LastRefillTime;
+};
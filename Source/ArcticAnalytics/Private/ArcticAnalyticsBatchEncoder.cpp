@@ -0,0 +1,165 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsBatchEncoder.h"
+
+FArcticAnalyticsBatchEncoder::FArcticAnalyticsBatchEncoder(int32 InMaxEvents) : MaxEvents(FMath::Max(1, InMaxEvents)), NumEvents(0)
+{
+}
+
+bool FArcticAnalyticsBatchEncoder::Matches(const FString& InEventName, const TArray<FAnalyticsEventAttribute>& Attributes) const
+{
+	if (NumEvents == 0)
+	{
+		return true;
+	}
+	if (Attributes.Num() != Columns.Num() || !InEventName.Equals(EventName, ESearchCase::CaseSensitive))
+	{
+		return false;
+	}
+	for (int32 Index = 0; Index < Columns.Num(); ++Index)
+	{
+		if (!Attributes[Index].GetName().Equals(Columns[Index].Key, ESearchCase::CaseSensitive))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void FArcticAnalyticsBatchEncoder::Append(const FString& InEventName, double TimestampUTC, uint32 RecordId, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	check(Matches(InEventName, Attributes));
+	if (NumEvents == 0)
+	{
+		EventName = InEventName;
+		// Columns are reset rather than emptied, so runs of the same shape reuse their allocations
+		Columns.SetNum(Attributes.Num());
+		for (int32 Index = 0; Index < Attributes.Num(); ++Index)
+		{
+			Columns[Index].Key = Attributes[Index].GetName();
+		}
+	}
+	++NumEvents;
+	TimestampsMs.Add((int64)FMath::RoundToDouble(TimestampUTC * 1000.0));
+	RecordIds.Add(RecordId);
+	for (int32 Index = 0; Index < Attributes.Num(); ++Index)
+	{
+		Columns[Index].Values.Add(Attributes[Index].GetValue());
+		Columns[Index].IsJsonFragment.Add(Attributes[Index].IsJsonFragment());
+	}
+}
+
+void FArcticAnalyticsBatchEncoder::Encode(FStringBuilderBase& Builder)
+{
+	if (NumEvents == 0)
+	{
+		return;
+	}
+
+	Builder.Appendf(TEXT("\t\t{\n"));
+	Builder.Appendf(TEXT("\t\t\t\"eventKind\": \"batch\",\n"));
+	Builder.Appendf(TEXT("\t\t\t\"EventName\": \"%s\",\n"), *EventName);
+	Builder.Appendf(TEXT("\t\t\t\"count\": %d,\n"), NumEvents);
+
+	// Key schema
+	Builder.Appendf(TEXT("\t\t\t\"keys\": ["));
+	for (int32 Index = 0; Index < Columns.Num(); ++Index)
+	{
+		Builder.Appendf(Index == 0 ? TEXT("\"%s\"") : TEXT(",\"%s\""), *Columns[Index].Key);
+	}
+	Builder.Appendf(TEXT("],\n"));
+
+	// Delta encoded timestamps and record ids, the first delta is always 0
+	Builder.Appendf(TEXT("\t\t\t\"TimestampUTC\": {\"baseMs\": %lld, \"deltaMs\": ["), TimestampsMs[0]);
+	for (int32 Index = 0; Index < NumEvents; ++Index)
+	{
+		Builder.Appendf(Index == 0 ? TEXT("%lld") : TEXT(",%lld"), Index == 0 ? 0ll : TimestampsMs[Index] - TimestampsMs[Index - 1]);
+	}
+	Builder.Appendf(TEXT("]},\n"));
+	Builder.Appendf(TEXT("\t\t\t\"RecordId\": {\"base\": %u, \"delta\": ["), RecordIds[0]);
+	for (int32 Index = 0; Index < NumEvents; ++Index)
+	{
+		Builder.Appendf(Index == 0 ? TEXT("%d") : TEXT(",%d"), Index == 0 ? 0 : (int32)(RecordIds[Index] - RecordIds[Index - 1]));
+	}
+	Builder.Appendf(TEXT("]},\n"));
+
+	Builder.Appendf(TEXT("\t\t\t\"columns\": {"));
+	for (int32 Index = 0; Index < Columns.Num(); ++Index)
+	{
+		Builder.Appendf(Index == 0 ? TEXT("\n\t\t\t\t\"%s\": ") : TEXT(",\n\t\t\t\t\"%s\": "), *Columns[Index].Key);
+		EncodeColumn(Builder, Columns[Index]);
+	}
+	Builder.Appendf(TEXT("\n\t\t\t}\n"));
+	Builder.Appendf(TEXT("\t\t}"));
+
+	NumEvents = 0;
+	TimestampsMs.Reset();
+	RecordIds.Reset();
+	for (FColumn& Column : Columns)
+	{
+		Column.Values.Reset();
+		Column.IsJsonFragment.Reset();
+	}
+}
+
+void FArcticAnalyticsBatchEncoder::EncodeColumn(FStringBuilderBase& Builder, const FColumn& Column)
+{
+	const bool bAllStrings = Column.IsJsonFragment.Find(true) == INDEX_NONE;
+
+	// String columns with few distinct values are written as a dictionary plus an index per event
+	FDictionary& Distinct = Dictionary;
+	Distinct.Reset();
+	if (bAllStrings && NumEvents > 1)
+	{
+		const int32 MaxDistinct = FMath::Max(1, NumEvents / 4);
+		for (const FString& Value : Column.Values)
+		{
+			if (!Distinct.Contains(Value))
+			{
+				if (Distinct.Num() == MaxDistinct)
+				{
+					Distinct.Reset();
+					break;
+				}
+				Distinct.Add(Value, Distinct.Num());
+			}
+		}
+	}
+
+	if (Distinct.Num() > 0)
+	{
+		Builder.Appendf(TEXT("{\"dictionary\": ["));
+		bool bFirst = true;
+		for (const TPair<FString, int32>& Pair : Distinct)
+		{
+			Builder.Appendf(bFirst ? TEXT("\"%s\"") : TEXT(",\"%s\""), *Pair.Key);
+			bFirst = false;
+		}
+		Builder.Appendf(TEXT("], \"indices\": ["));
+		for (int32 Index = 0; Index < Column.Values.Num(); ++Index)
+		{
+			Builder.Appendf(Index == 0 ? TEXT("%d") : TEXT(",%d"), Distinct.FindChecked(Column.Values[Index]));
+		}
+		Builder.Appendf(TEXT("]}"));
+	}
+	else
+	{
+		Builder.AppendChar(TEXT('['));
+		for (int32 Index = 0; Index < Column.Values.Num(); ++Index)
+		{
+			if (Index > 0)
+			{
+				Builder.AppendChar(TEXT(','));
+			}
+			if (Column.IsJsonFragment[Index])
+			{
+				Builder.Append(Column.Values[Index]);
+			}
+			else
+			{
+				Builder.Appendf(TEXT("\"%s\""), *Column.Values[Index]);
+			}
+		}
+		Builder.AppendChar(TEXT(']'));
+	}
+}
@@ -0,0 +1,94 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+#include "Misc/StringBuilder.h"
+
+/**
+ * Collects a run of events that share the same event name and attribute keys and encodes them as a
+ * single columnar batch record: the keys are written once, followed by one array of values per key.
+ * Timestamps and RecordIds are delta encoded and low cardinality string columns are dictionary encoded.
+ */
+class FArcticAnalyticsBatchEncoder
+{
+public:
+	explicit FArcticAnalyticsBatchEncoder(int32 InMaxEvents);
+
+	bool IsEmpty() const
+	{
+		return NumEvents == 0;
+	}
+
+	bool IsFull() const
+	{
+		return NumEvents >= MaxEvents;
+	}
+
+	int32 Num() const
+	{
+		return NumEvents;
+	}
+
+	const FString& GetEventName() const
+	{
+		return EventName;
+	}
+
+	/** Timestamp of the oldest batched event, 0 if the batch is empty */
+	double GetOldestTimestampUTC() const
+	{
+		return NumEvents > 0 ? TimestampsMs[0] / 1000.0 : 0.0;
+	}
+
+	/** Whether an event has the same shape as the batched events and can be appended to the batch */
+	bool Matches(const FString& InEventName, const TArray<FAnalyticsEventAttribute>& Attributes) const;
+
+	/** Appends an event to the batch, the batch must be empty or match the event */
+	void Append(const FString& InEventName, double TimestampUTC, uint32 RecordId, const TArray<FAnalyticsEventAttribute>& Attributes);
+
+	/** Encodes the batched events as a JSON object into the builder and empties the batch */
+	void Encode(FStringBuilderBase& Builder);
+
+private:
+	struct FColumn
+	{
+		FString Key;
+		TArray<FString> Values;
+		/** Whether the value at the same index is a JSON fragment rather than a string */
+		TBitArray<> IsJsonFragment;
+	};
+
+	/** Dictionary values are compared case sensitively, unlike the default FString map */
+	struct FDictionaryKeyFuncs : BaseKeyFuncs<TPair<FString, int32>, FString, false>
+	{
+		static const FString& GetSetKey(const TPair<FString, int32>& Element)
+		{
+			return Element.Key;
+		}
+		static bool Matches(const FString& A, const FString& B)
+		{
+			return A.Equals(B, ESearchCase::CaseSensitive);
+		}
+		static uint32 GetKeyHash(const FString& Key)
+		{
+			return FCrc::StrCrc32(*Key);
+		}
+	};
+	typedef TMap<FString, int32, FDefaultSetAllocator, FDictionaryKeyFuncs> FDictionary;
+
+	void EncodeColumn(FStringBuilderBase& Builder, const FColumn& Column);
+
+	/** Maximum number of events in a batch */
+	const int32 MaxEvents;
+	/** Number of events in the batch */
+	int32 NumEvents;
+	FString EventName;
+	/** Timestamps in milliseconds since the unix epoch */
+	TArray<int64> TimestampsMs;
+	TArray<uint32> RecordIds;
+	TArray<FColumn> Columns;
+	/** Distinct values of the column being encoded, kept around to reuse the allocation */
+	FDictionary Dictionary;
+};
@@ -0,0 +1,296 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "CoreMinimal.h"
+
+#if !UE_BUILD_SHIPPING
+
+#include "Containers/Ticker.h"
+#include "Dom/JsonObject.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/Paths.h"
+
+#include "ArcticAnalyticsBenchmarkResults.h"
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsProvider.h"
+#include "ArcticAnalyticsTestServer.h"
+#include "Data_SHA256.h"
+
+namespace
+{
+#if STATS
+	/** Reads the allocation counters FMalloc keeps for the stats system, which count every thread */
+	struct FAllocationCounters : public FMalloc
+	{
+		static uint64 GetNumAllocations()
+		{
+			return TotalMallocCalls.load(std::memory_order_relaxed) + TotalReallocCalls.load(std::memory_order_relaxed);
+		}
+	};
+
+	/** Allocations per second other threads make while the benchmark is idle, measured once */
+	double GetBackgroundAllocationRate()
+	{
+		static const double Rate = []()
+		{
+			const uint64 StartAllocations = FAllocationCounters::GetNumAllocations();
+			const double StartTime = FPlatformTime::Seconds();
+			FPlatformProcess::Sleep(0.25f);
+			return (FAllocationCounters::GetNumAllocations() - StartAllocations) / (FPlatformTime::Seconds() - StartTime);
+		}();
+		return Rate;
+	}
+#endif
+
+	/** Latencies of one benchmark case, in cycles */
+	struct FLatencySamples
+	{
+		TArray<uint64> Cycles;
+		double TotalSeconds = 0.0;
+		/** Less the background rate of other threads, -1 without STATS */
+		int64 NumAllocations = -1;
+
+		void Write(FJsonObject& Object)
+		{
+			Object.SetNumberField(TEXT("events"), Cycles.Num());
+			Object.SetNumberField(TEXT("eventsPerSecond"), Cycles.Num() / FMath::Max(TotalSeconds, 1e-9));
+			ArcticAnalyticsBenchmarkResults::AddPercentiles(Object, Cycles);
+			Object.SetNumberField(TEXT("allocationsPerEvent"), NumAllocations >= 0 ? (double)NumAllocations / Cycles.Num() : -1.0);
+		}
+	};
+
+	/** Times every call of Record and counts the allocations made meanwhile, less those other threads make at idle */
+	template <typename FunctionType>
+	FLatencySamples MeasureCalls(int32 NumCalls, FunctionType&& Record)
+	{
+		FLatencySamples Samples;
+		Samples.Cycles.SetNumUninitialized(NumCalls);
+#if STATS
+		const double BackgroundRate = GetBackgroundAllocationRate();
+		const uint64 StartAllocations = FAllocationCounters::GetNumAllocations();
+#endif
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Index = 0; Index < NumCalls; ++Index)
+		{
+			const uint64 StartCycles = FPlatformTime::Cycles64();
+			Record(Index);
+			Samples.Cycles[Index] = FPlatformTime::Cycles64() - StartCycles;
+		}
+		Samples.TotalSeconds = FPlatformTime::Seconds() - StartTime;
+#if STATS
+		const double NumAllocations = (double)(FAllocationCounters::GetNumAllocations() - StartAllocations) - BackgroundRate * Samples.TotalSeconds;
+		Samples.NumAllocations = FMath::Max<int64>(0, FMath::RoundToInt64(NumAllocations));
+#endif
+		return Samples;
+	}
+
+	TArray<FAnalyticsEventAttribute> MakeAttributes(int32 NumAttributes, int32 ValueBytes)
+	{
+		TArray<FAnalyticsEventAttribute> Attributes;
+		for (int32 Index = 0; Index < NumAttributes; ++Index)
+		{
+			Attributes.Emplace(FString::Printf(TEXT("attribute%d"), Index), FString::ChrN(ValueBytes, TEXT('x')));
+		}
+		return Attributes;
+	}
+
+	/**
+	 * One run of the benchmark. Recording and hashing are measured synchronously, EndSession is measured until the
+	 * stand-in server received the session, so the run finishes on a later tick.
+	 */
+	class FBenchmarkRun : public TSharedFromThis<FBenchmarkRun>
+	{
+	public:
+		FBenchmarkRun(int32 InNumCalls, int32 InEndSessionEvents, uint32 InPort)
+			: NumCalls(InNumCalls), EndSessionEvents(InEndSessionEvents), Server(InPort), Results(MakeShared<FJsonObject>())
+		{
+		}
+
+		void Start()
+		{
+			if (!Server.Start())
+			{
+				return;
+			}
+			Provider = MakeShared<FAnalyticsProviderArcticAnalytics>();
+			ArcticAnalyticsBenchmarkResults::AddHeader(*Results);
+			Results->SetNumberField(TEXT("callsPerCase"), NumCalls);
+
+			BenchmarkHashing();
+			BenchmarkRecordPaths();
+			// Records the EndSession session once the upload of the recording session is out of the way
+			WaitForDelivery([this]() { BenchmarkEndSession(); });
+		}
+
+	private:
+		void BenchmarkHashing()
+		{
+			TArray<uint8> Data;
+			Data.SetNumUninitialized(16 * 1024 * 1024);
+			for (int32 Index = 0; Index < Data.Num(); ++Index)
+			{
+				Data[Index] = (uint8)(Index * 31);
+			}
+			const double MegaBytes = Data.Num() / (1024.0 * 1024.0);
+
+			double StartTime = FPlatformTime::Seconds();
+			SHA256::Hash(Data.GetData(), Data.Num());
+			const double Sha256Seconds = FPlatformTime::Seconds() - StartTime;
+
+			StartTime = FPlatformTime::Seconds();
+			HMAC_SHA256 Hmac(FString(TEXT("Benchmark")));
+			// In the pieces the uploader signs files in
+			for (int32 Offset = 0; Offset < Data.Num(); Offset += 64 * 1024)
+			{
+				Hmac.Update(Data.GetData() + Offset, FMath::Min(64 * 1024, Data.Num() - Offset));
+			}
+			Hmac.Final();
+			const double HmacSeconds = FPlatformTime::Seconds() - StartTime;
+
+			TSharedRef<FJsonObject> Hashing = MakeShared<FJsonObject>();
+			Hashing->SetNumberField(TEXT("sha256MBps"), MegaBytes / Sha256Seconds);
+			Hashing->SetNumberField(TEXT("hmacSha256MBps"), MegaBytes / HmacSeconds);
+			Results->SetObjectField(TEXT("hashing"), Hashing);
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Benchmark: SHA-256 %.1f MB/s, HMAC-SHA256 %.1f MB/s"), MegaBytes / Sha256Seconds, MegaBytes / HmacSeconds);
+		}
+
+		void BenchmarkRecordPaths()
+		{
+			static const int32 AttributeCounts[] = {0, 4, 16};
+			static const int32 ValueSizes[] = {8, 64, 512};
+
+			FAnalyticsProviderArcticAnalytics& P = *Provider;
+			P.StartSession(TArray<FAnalyticsEventAttribute>());
+			TArray<TSharedPtr<FJsonValue>> Cases;
+			const auto AddCase = [this, &Cases](const TCHAR* Path, int32 NumAttributes, int32 ValueBytes, FLatencySamples&& Samples)
+			{
+				TSharedRef<FJsonObject> Case = MakeShared<FJsonObject>();
+				Case->SetStringField(TEXT("path"), Path);
+				Case->SetNumberField(TEXT("attributes"), NumAttributes);
+				Case->SetNumberField(TEXT("valueBytes"), ValueBytes);
+				Samples.Write(*Case);
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Benchmark: %s attributes=%d valueBytes=%d %.0f events/s p50=%.2fus p99=%.2fus p99.9=%.2fus allocs/event=%.1f"),
+					   Path, NumAttributes, ValueBytes, Case->GetNumberField(TEXT("eventsPerSecond")), Case->GetNumberField(TEXT("p50Us")),
+					   Case->GetNumberField(TEXT("p99Us")), Case->GetNumberField(TEXT("p999Us")), Case->GetNumberField(TEXT("allocationsPerEvent")));
+				Cases.Add(MakeShared<FJsonValueObject>(Case));
+			};
+
+			for (const int32 ValueBytes : ValueSizes)
+			{
+				const FString Value = FString::ChrN(ValueBytes, TEXT('v'));
+				// Paths without attributes only vary by the size of their strings
+				AddCase(TEXT("RecordItemPurchase"), 0, ValueBytes, MeasureCalls(NumCalls, [&](int32) { P.RecordItemPurchase(Value, Value, 100, 1); }));
+				AddCase(TEXT("RecordCurrencyPurchase"), 0, ValueBytes,
+						MeasureCalls(NumCalls, [&](int32) { P.RecordCurrencyPurchase(Value, 100, Value, 0.99f, Value); }));
+				AddCase(TEXT("RecordCurrencyGiven"), 0, ValueBytes, MeasureCalls(NumCalls, [&](int32) { P.RecordCurrencyGiven(Value, 100); }));
+
+				for (const int32 NumAttributes : AttributeCounts)
+				{
+					const TArray<FAnalyticsEventAttribute> Attributes = MakeAttributes(NumAttributes, ValueBytes);
+					AddCase(TEXT("RecordEvent"), NumAttributes, ValueBytes, MeasureCalls(NumCalls, [&](int32) { P.RecordEvent(TEXT("BenchmarkEvent"), Attributes); }));
+					AddCase(TEXT("RecordItemPurchaseAttributes"), NumAttributes, ValueBytes,
+							MeasureCalls(NumCalls, [&](int32) { P.RecordItemPurchase(Value, 1, Attributes); }));
+					AddCase(TEXT("RecordCurrencyPurchaseAttributes"), NumAttributes, ValueBytes,
+							MeasureCalls(NumCalls, [&](int32) { P.RecordCurrencyPurchase(Value, 100, Attributes); }));
+					AddCase(TEXT("RecordCurrencyGivenAttributes"), NumAttributes, ValueBytes,
+							MeasureCalls(NumCalls, [&](int32) { P.RecordCurrencyGiven(Value, 100, Attributes); }));
+					AddCase(TEXT("RecordError"), NumAttributes, ValueBytes, MeasureCalls(NumCalls, [&](int32) { P.RecordError(Value, Attributes); }));
+					AddCase(TEXT("RecordProgress"), NumAttributes, ValueBytes,
+							MeasureCalls(NumCalls, [&](int32) { P.RecordProgress(TEXT("Benchmark"), Value, Attributes); }));
+				}
+			}
+			Results->SetArrayField(TEXT("record"), Cases);
+			SessionIds.Add(P.GetSessionID());
+			P.EndSession();
+		}
+
+		void BenchmarkEndSession()
+		{
+			const TArray<FAnalyticsEventAttribute> Attributes = MakeAttributes(4, 16);
+			Provider->StartSession(TArray<FAnalyticsEventAttribute>());
+			for (int32 Index = 0; Index < EndSessionEvents; ++Index)
+			{
+				Provider->RecordEvent(TEXT("BenchmarkEvent"), Attributes);
+			}
+			const FString SessionId = Provider->GetSessionID();
+			SessionIds.Add(SessionId);
+			const double StartTime = FPlatformTime::Seconds();
+			Provider->EndSession();
+			const double EndSessionSeconds = FPlatformTime::Seconds() - StartTime;
+
+			TSharedRef<FJsonObject> EndSession = MakeShared<FJsonObject>();
+			EndSession->SetNumberField(TEXT("events"), EndSessionEvents);
+			EndSession->SetNumberField(TEXT("endSessionMs"), EndSessionSeconds * 1000.0);
+			EndSession->SetNumberField(TEXT("fileBytes"), (double)FMath::Max<int64>(0, IFileManager::Get().FileSize(*SessionFilePath(SessionId))));
+			Results->SetObjectField(TEXT("endSession"), EndSession);
+			WaitForDelivery([this, EndSession, StartTime]()
+			{
+				const bool bDelivered = !bTimedOut;
+				EndSession->SetNumberField(TEXT("deliveredMs"), bDelivered ? (FPlatformTime::Seconds() - StartTime) * 1000.0 : -1.0);
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Benchmark: EndSession of %d events %.2fms, delivered after %.2fms"), EndSessionEvents,
+					   EndSession->GetNumberField(TEXT("endSessionMs")), EndSession->GetNumberField(TEXT("deliveredMs")));
+				Finish();
+			});
+		}
+
+		/** Calls Continue once the provider delivered another session, or after 30 seconds */
+		void WaitForDelivery(TFunction<void()>&& Continue)
+		{
+			const int64 Deliveries = Provider->GetDeliveryLatency(EArcticAnalyticsLane::Bulk).Deliveries;
+			const double Deadline = FPlatformTime::Seconds() + 30.0;
+			FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([This = AsShared(), Continue = MoveTemp(Continue), Deliveries, Deadline](float DeltaTime)
+			{
+				This->bTimedOut = FPlatformTime::Seconds() > Deadline;
+				if (This->Provider->GetDeliveryLatency(EArcticAnalyticsLane::Bulk).Deliveries > Deliveries || This->bTimedOut)
+				{
+					Continue();
+					return false;
+				}
+				return true;
+			}));
+		}
+
+		void Finish()
+		{
+			ArcticAnalyticsBenchmarkResults::Save(Results, TEXT("ArcticAnalyticsBenchmark"));
+
+			Provider.Reset();
+			for (const FString& SessionId : SessionIds)
+			{
+				IFileManager::Get().Delete(*SessionFilePath(SessionId));
+			}
+			Server.Stop();
+		}
+
+		static FString SessionFilePath(const FString& SessionId)
+		{
+			return FPaths::ProjectSavedDir() / TEXT("Analytics") / (SessionId + TEXT(".analytics"));
+		}
+
+		const int32 NumCalls;
+		const int32 EndSessionEvents;
+		FArcticAnalyticsTestServer Server;
+		TSharedRef<FJsonObject> Results;
+		TSharedPtr<FAnalyticsProviderArcticAnalytics> Provider;
+		TArray<FString> SessionIds;
+		bool bTimedOut = false;
+	};
+
+	void Benchmark(const TArray<FString>& Args)
+	{
+		const int32 NumCalls = FMath::Max(1, Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 2000);
+		const int32 EndSessionEvents = FMath::Max(1, Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 10000);
+		const uint32 Port = Args.Num() > 2 ? (uint32)FCString::Atoi(*Args[2]) : 8089;
+		MakeShared<FBenchmarkRun>(NumCalls, EndSessionEvents, Port)->Start();
+	}
+
+	FAutoConsoleCommand BenchmarkCommand(TEXT("ArcticAnalytics.Benchmark"),
+		TEXT("Benchmarks every Record* path, hashing and EndSession against a stand-in server, and writes the results as JSON to Saved/Analytics/BenchmarkResults. ")
+		TEXT("Args: [CallsPerCase=2000] [EndSessionEvents=10000] [Port=8089]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&Benchmark));
+}
+
+#endif
@@ -0,0 +1,48 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsBenchmarkResults.h"
+
+#if !UE_BUILD_SHIPPING
+
+#include "Dom/JsonObject.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+#include "ArcticAnalyticsLog.h"
+
+void ArcticAnalyticsBenchmarkResults::AddHeader(FJsonObject& Object)
+{
+	Object.SetStringField(TEXT("timestamp"), FDateTime::UtcNow().ToIso8601());
+	Object.SetStringField(TEXT("platform"), FPlatformProperties::IniPlatformName());
+}
+
+void ArcticAnalyticsBenchmarkResults::AddPercentiles(FJsonObject& Object, TArray<uint64>& Cycles)
+{
+	Cycles.Sort();
+	const auto Percentile = [&Cycles](double Fraction)
+	{
+		return Cycles.Num() > 0 ? FPlatformTime::ToSeconds64(Cycles[FMath::Min(Cycles.Num() - 1, (int32)(Fraction * Cycles.Num()))]) * 1000000.0 : 0.0;
+	};
+	Object.SetNumberField(TEXT("p50Us"), Percentile(0.5));
+	Object.SetNumberField(TEXT("p90Us"), Percentile(0.9));
+	Object.SetNumberField(TEXT("p99Us"), Percentile(0.99));
+	Object.SetNumberField(TEXT("p999Us"), Percentile(0.999));
+	Object.SetNumberField(TEXT("maxUs"), Percentile(1.0));
+}
+
+void ArcticAnalyticsBenchmarkResults::Save(const TSharedRef<FJsonObject>& Results, const TCHAR* Name)
+{
+	const FString ResultsPath = FPaths::ProjectSavedDir() / TEXT("Analytics") / TEXT("BenchmarkResults") /
+								FString::Printf(TEXT("%s-%s.json"), Name, *FDateTime::Now().ToString());
+	FString Json;
+	const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+	FJsonSerializer::Serialize(Results, Writer);
+	FFileHelper::SaveStringToFile(Json, *ResultsPath);
+	UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Results written to (%s)"), *ResultsPath);
+}
+
+#endif
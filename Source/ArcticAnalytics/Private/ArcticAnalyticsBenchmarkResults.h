@@ -0,0 +1,24 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if !UE_BUILD_SHIPPING
+
+class FJsonObject;
+
+/** Result helpers shared by the non-shipping benchmark and load test */
+namespace ArcticAnalyticsBenchmarkResults
+{
+	/** Adds the timestamp and platform every result file starts with */
+	void AddHeader(FJsonObject& Object);
+
+	/** Sorts call latencies in cycles and adds p50Us, p90Us, p99Us, p999Us and maxUs, all 0 without calls */
+	void AddPercentiles(FJsonObject& Object, TArray<uint64>& Cycles);
+
+	/** Writes results to Saved/Analytics/BenchmarkResults/<Name>-<local time>.json and logs the path */
+	void Save(const TSharedRef<FJsonObject>& Results, const TCHAR* Name);
+}
+
+#endif
@@ -0,0 +1,278 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsChunkedUpload.h"
+
+#include "Async/Async.h"
+#include "Containers/Ticker.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryArchive.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "ArcticAnalyticsSettings.h"
+#include "ArcticAnalyticsTrace.h"
+#include "Data_SHA256.h"
+
+FArcticAnalyticsChunkedUpload::FArcticAnalyticsChunkedUpload(const FString& InUploadId, const TSharedRef<FArchive, ESPMode::ThreadSafe>& InContent,
+															 const FString& InSecret, FSendChunk&& InSendChunk, FGetChunkBytes&& InGetChunkBytes)
+	: UploadId(InUploadId), Content(InContent), Secret(InSecret), SendChunk(MoveTemp(InSendChunk)), GetChunkBytes(MoveTemp(InGetChunkBytes)),
+	  TotalBytes(InContent->TotalSize()), MaxRetries(5), RetrySeconds(1.0f), AckedBytes(0), ConsecutiveFailures(0), NumRetries(0)
+{
+	ArcticAnalyticsSettings::GetInt(TEXT("UploadMaxRetries"), MaxRetries);
+	ArcticAnalyticsSettings::GetFloat(TEXT("UploadRetrySeconds"), RetrySeconds);
+}
+
+void FArcticAnalyticsChunkedUpload::SetRetryPolicy(int32 InMaxRetries, float InRetrySeconds)
+{
+	MaxRetries = InMaxRetries;
+	RetrySeconds = InRetrySeconds;
+}
+
+void FArcticAnalyticsChunkedUpload::SetRetryScheduler(FScheduleRetry&& InScheduleRetry)
+{
+	ScheduleRetry = MoveTemp(InScheduleRetry);
+}
+
+void FArcticAnalyticsChunkedUpload::Start(FOnComplete&& InOnComplete)
+{
+	check(IsInGameThread());
+	OnComplete = MoveTemp(InOnComplete);
+	SendNext();
+}
+
+FString FArcticAnalyticsChunkedUpload::Sign(const FString& Secret, const FString& UploadId, int64 Offset, int64 TotalBytes, const FArcticAnalyticsChunkBuffer& Data)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Hash);
+	HMAC_SHA256 Hmac(Secret);
+	Hmac.Update(FString::Printf(TEXT("%s:%lld:%lld:%lld\n"), *UploadId, Offset, Data.NumBytes, TotalBytes));
+	for (const TArray<uint8>& Chunk : Data.Chunks)
+	{
+		Hmac.Update(Chunk.GetData(), Chunk.Num());
+	}
+	return Hmac.Final().ToHexString();
+}
+
+void FArcticAnalyticsChunkedUpload::SendNext()
+{
+	check(IsInGameThread());
+	// Read the next chunk from the acknowledged offset, which may be behind what was sent before. Only one chunk is
+	// in flight at a time, so the worker has the content archive to itself
+	const int64 Offset = AckedBytes;
+	const int64 Length = FMath::Min(TotalBytes - Offset, FMath::Max<int64>(1024, GetChunkBytes()));
+	Async(EAsyncExecution::ThreadPool, [This = AsShared(), Offset, Length]()
+	{
+		TSharedRef<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Data = MakeShared<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>();
+		TArray<uint8>& Bytes = Data->Chunks.AddDefaulted_GetRef();
+		Bytes.SetNumUninitialized((int32)Length);
+		This->Content->Seek(Offset);
+		This->Content->Serialize(Bytes.GetData(), Length);
+		if (This->Content->IsError())
+		{
+			AsyncTask(ENamedThreads::GameThread, [This, Offset]()
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Upload (%s) could not read its content at offset (%lld)"), *This->UploadId, Offset);
+				This->Finish(false);
+			});
+			return;
+		}
+		Data->NumBytes = Length;
+		Data->ChargedBytes = Length;
+		FArcticAnalyticsMemoryBudget::Get().Charge(Length);
+
+		const double HashStartTime = FPlatformTime::Seconds();
+		FString Signature = Sign(This->Secret, This->UploadId, Offset, This->TotalBytes, *Data);
+		FArcticAnalyticsSelfMetrics::Get().AddHash(Length, FPlatformTime::Seconds() - HashStartTime);
+
+		AsyncTask(ENamedThreads::GameThread, [This, Offset, Data, Signature = MoveTemp(Signature)]()
+		{
+			This->SendChunk(FArcticAnalyticsUploadChunk{This->UploadId, Offset, This->TotalBytes, Data, Signature},
+							[This](bool bSucceeded, int64 ServerAckedBytes) { This->OnAcked(bSucceeded, ServerAckedBytes); });
+		});
+	});
+}
+
+void FArcticAnalyticsChunkedUpload::OnAcked(bool bSucceeded, int64 ServerAckedBytes)
+{
+	check(IsInGameThread());
+	const int64 PreviousAckedBytes = AckedBytes;
+	if (bSucceeded)
+	{
+		// The server is authoritative, also when it is behind what was sent
+		AckedBytes = FMath::Clamp<int64>(ServerAckedBytes, 0, TotalBytes);
+		if (AckedBytes == TotalBytes)
+		{
+			Finish(true);
+			return;
+		}
+	}
+	if (AckedBytes > PreviousAckedBytes)
+	{
+		ConsecutiveFailures = 0;
+		SendNext();
+		return;
+	}
+
+	if (++ConsecutiveFailures > MaxRetries)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Upload (%s) gave up at offset (%lld) of (%lld) after (%d) retries"), *UploadId, AckedBytes,
+			   TotalBytes, MaxRetries);
+		Finish(false);
+		return;
+	}
+	++NumRetries;
+	const float Delay = RetrySeconds * (float)(1 << FMath::Min(ConsecutiveFailures - 1, 10));
+	if (ScheduleRetry)
+	{
+		ScheduleRetry(Delay, [This = AsShared()]() { This->SendNext(); });
+		return;
+	}
+	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([This = AsShared()](float DeltaTime)
+	{
+		This->SendNext();
+		return false;
+	}), Delay);
+}
+
+void FArcticAnalyticsChunkedUpload::Finish(bool bSucceeded)
+{
+	if (OnComplete)
+	{
+		FOnComplete Callback = MoveTemp(OnComplete);
+		OnComplete = nullptr;
+		Callback(bSucceeded);
+	}
+}
+
+#if !UE_BUILD_SHIPPING
+
+#include "ArcticAnalyticsTestServer.h"
+#include "ArcticAnalyticsUploader.h"
+
+namespace
+{
+	/**
+	 * Uploads random data in chunks through the uploader and HTTP to the stand-in server, which fails a share of the
+	 * requests before or after storing them, and checks that the server ends up with exactly the data that was sent
+	 */
+	class FChunkedUploadTest : public TSharedFromThis<FChunkedUploadTest>
+	{
+	public:
+		FChunkedUploadTest(float InDropRate, int64 InTotalBytes, int64 InChunkBytes, uint32 InPort)
+			: DropRate(InDropRate), TotalBytes(InTotalBytes), ChunkBytes(InChunkBytes), Server(InPort)
+		{
+		}
+
+		void Start()
+		{
+			if (!Server.Start(TEXT("ChunkedUploadTest")))
+			{
+				return;
+			}
+			Server.SetFailureRate(FMath::Clamp(DropRate, 0.0f, 0.9f));
+			Server.SetKeepUploads(true);
+			// Read by the uploader and its chunked uploads when they are created, fixing the chunk size
+			Server.OverrideSetting(TEXT("bChunkedUploads"), TEXT("True"));
+			Server.OverrideSetting(TEXT("UploadMinBatchKB"), LexToString(ChunkBytes / 1024));
+			Server.OverrideSetting(TEXT("UploadMaxBatchKB"), LexToString(ChunkBytes / 1024));
+			Server.OverrideSetting(TEXT("UploadMaxRetries"), TEXT("20"));
+			Server.OverrideSetting(TEXT("UploadRetrySeconds"), TEXT("0.01"));
+			Uploader = MakeShared<FArcticAnalyticsUploader, ESPMode::ThreadSafe>(1);
+
+			Source = MakeShared<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>();
+			FRandomStream Random(42);
+			for (int64 Remaining = TotalBytes; Remaining > 0;)
+			{
+				TArray<uint8>& Chunk = Source->Chunks.AddDefaulted_GetRef();
+				Chunk.SetNumUninitialized((int32)FMath::Min<int64>(Remaining, 64 * 1024));
+				for (uint8& Byte : Chunk)
+				{
+					Byte = (uint8)Random.RandHelper(256);
+				}
+				Remaining -= Chunk.Num();
+			}
+			Source->NumBytes = TotalBytes;
+
+			StartTime = FPlatformTime::Seconds();
+			Uploader->EnqueueBuffer(TEXT("ChunkedUploadTest"), Source.ToSharedRef(), false,
+									[This = AsShared()](bool bSucceeded) { This->Finish(bSucceeded); });
+		}
+
+	private:
+		void Finish(bool bSucceeded)
+		{
+			// Compare what the server stored with the source
+			const TArray<uint8>* Stored = Server.GetUpload(TEXT("ChunkedUploadTest"));
+			int64 FirstMismatch = -1;
+			if (Stored == nullptr || Stored->Num() != Source->NumBytes)
+			{
+				FirstMismatch = Stored ? FMath::Min<int64>(Stored->Num(), Source->NumBytes) : 0;
+			}
+			else
+			{
+				int64 Offset = 0;
+				for (const TArray<uint8>& Chunk : Source->Chunks)
+				{
+					if (FMemory::Memcmp(Stored->GetData() + Offset, Chunk.GetData(), Chunk.Num()) != 0)
+					{
+						FirstMismatch = Offset;
+						break;
+					}
+					Offset += Chunk.Num();
+				}
+			}
+
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Chunked upload test: %.2fs, %d requests, %d failed, %d rejected"), FPlatformTime::Seconds() - StartTime,
+				   Server.GetNumRequests(), Server.GetNumFailed(), Server.GetNumRejected());
+			TArray<FString> Failures;
+			if (!bSucceeded)
+			{
+				Failures.Add(TEXT("the upload gave up"));
+			}
+			if (FirstMismatch >= 0)
+			{
+				Failures.Add(FString::Printf(TEXT("the server stored (%d) of (%lld) bytes and differs from offset (%lld)"), Stored ? Stored->Num() : 0,
+											 Source->NumBytes, FirstMismatch));
+			}
+			if (Server.GetNumRejected() > 0)
+			{
+				Failures.Add(FString::Printf(TEXT("(%d) chunks had a wrong signature or length"), Server.GetNumRejected()));
+			}
+			if (Failures.Num() > 0)
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Chunked upload test failed: %s"), *FString::Join(Failures, TEXT(", ")));
+			}
+			else
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Chunked upload test passed"));
+			}
+			Uploader.Reset();
+			Server.Stop();
+		}
+
+		const float DropRate;
+		const int64 TotalBytes;
+		const int64 ChunkBytes;
+		FArcticAnalyticsTestServer Server;
+		TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> Uploader;
+		TSharedPtr<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Source;
+		double StartTime = 0.0;
+	};
+
+	void ChunkedUploadTest(const TArray<FString>& Args)
+	{
+		const float DropRate = Args.Num() > 0 ? FCString::Atof(*Args[0]) : 0.2f;
+		const int64 TotalBytes = (int64)((Args.Num() > 1 ? FCString::Atof(*Args[1]) : 8.0f) * 1024 * 1024);
+		const int64 ChunkBytes = FMath::Max(1, Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 256) * 1024;
+		const uint32 Port = Args.Num() > 3 ? (uint32)FCString::Atoi(*Args[3]) : 8089;
+		MakeShared<FChunkedUploadTest>(DropRate, TotalBytes, ChunkBytes, Port)->Start();
+	}
+
+	FAutoConsoleCommand ChunkedUploadTestCommand(TEXT("ArcticAnalytics.ChunkedUploadTest"),
+		TEXT("Uploads random data in chunks over HTTP to a stand-in server that drops requests, and checks it arrives intact. ")
+		TEXT("Args: [DropRate=0.2] [SizeMB=8] [ChunkKB=256] [Port=8089]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&ChunkedUploadTest));
+}
+
+#endif
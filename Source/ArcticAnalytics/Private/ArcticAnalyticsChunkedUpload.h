@@ -0,0 +1,101 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FArcticAnalyticsChunkBuffer;
+
+/** One piece of a chunked upload, as sent to the server */
+struct FArcticAnalyticsUploadChunk
+{
+	FString UploadId;
+	int64 Offset;
+	int64 TotalBytes;
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Data;
+	/** HMAC_SHA256 of the chunk header line and the chunk data, see FArcticAnalyticsChunkedUpload */
+	FString Signature;
+};
+
+/**
+ * Uploads a large session as a sequence of chunks, each acknowledged by the server, so a dropped connection only
+ * costs the chunk that was in flight.
+ *
+ * Every chunk carries its upload id, offset, length and the total size, and is signed with HMAC_SHA256 over
+ * "<UploadId>:<Offset>:<Length>:<Total>\n" followed by its data. The server answers with the number of bytes it has
+ * stored contiguously from the start. It stores chunks whose offset is at or before that count, ignores the bytes
+ * it already has, and otherwise just answers with its count, so the client always continues from the server's
+ * acknowledged offset, also after a response was lost.
+ *
+ * A failed chunk is sent again after UploadRetrySeconds, doubled on every further failure, and the upload gives up
+ * after UploadMaxRetries failures in a row. Game thread only, chunks are read and signed on a thread pool worker.
+ */
+class FArcticAnalyticsChunkedUpload : public TSharedFromThis<FArcticAnalyticsChunkedUpload, ESPMode::ThreadSafe>
+{
+public:
+	/** Called on the game thread with the server's acknowledged byte count, or false if the chunk did not get through */
+	using FOnChunkAcked = TFunction<void(bool bSucceeded, int64 AckedBytes)>;
+	using FSendChunk = TFunction<void(const FArcticAnalyticsUploadChunk& Chunk, FOnChunkAcked&& OnAcked)>;
+	/** Size the next chunk should have */
+	using FGetChunkBytes = TFunction<int64()>;
+	using FOnComplete = TFunction<void(bool bSucceeded)>;
+	/** Runs Retry once DelaySeconds passed */
+	using FScheduleRetry = TFunction<void(float DelaySeconds, TFunction<void()>&& Retry)>;
+
+	/**
+	 * @param InContent seekable archive with the whole session
+	 * @param InSecret secret chunks are signed with
+	 * @param InSendChunk transport for single chunks
+	 */
+	FArcticAnalyticsChunkedUpload(const FString& InUploadId, const TSharedRef<FArchive, ESPMode::ThreadSafe>& InContent, const FString& InSecret,
+								  FSendChunk&& InSendChunk, FGetChunkBytes&& InGetChunkBytes);
+
+	/** Replaces UploadMaxRetries and UploadRetrySeconds for this upload */
+	void SetRetryPolicy(int32 InMaxRetries, float InRetrySeconds);
+
+	/** Hands retries to a scheduler instead of the core ticker. Must be called before Start */
+	void SetRetryScheduler(FScheduleRetry&& InScheduleRetry);
+
+	/** Sends chunks until the server acknowledged everything or the retries ran out */
+	void Start(FOnComplete&& InOnComplete);
+
+	int64 GetAckedBytes() const
+	{
+		return AckedBytes;
+	}
+
+	int64 GetTotalBytes() const
+	{
+		return TotalBytes;
+	}
+
+	/** Chunks sent again after a failure, over the whole upload */
+	int32 GetNumRetries() const
+	{
+		return NumRetries;
+	}
+
+	/** Signature of one chunk as the server checks it */
+	static FString Sign(const FString& Secret, const FString& UploadId, int64 Offset, int64 TotalBytes, const FArcticAnalyticsChunkBuffer& Data);
+
+private:
+	void SendNext();
+	void OnAcked(bool bSucceeded, int64 ServerAckedBytes);
+	void Finish(bool bSucceeded);
+
+	const FString UploadId;
+	TSharedRef<FArchive, ESPMode::ThreadSafe> Content;
+	const FString Secret;
+	FSendChunk SendChunk;
+	FGetChunkBytes GetChunkBytes;
+	FOnComplete OnComplete;
+	FScheduleRetry ScheduleRetry;
+	const int64 TotalBytes;
+	int32 MaxRetries;
+	float RetrySeconds;
+
+	int64 AckedBytes;
+	/** Failures since the last chunk that moved the acknowledged offset */
+	int32 ConsecutiveFailures;
+	int32 NumRetries;
+};
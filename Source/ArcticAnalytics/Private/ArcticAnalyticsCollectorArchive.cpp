@@ -0,0 +1,385 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsCollectorArchive.h"
+
+#include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsSessionWriter.h"
+#include "ArcticAnalyticsSettings.h"
+
+#if ARCTICANALYTICS_WITH_COLLECTOR_SOCKET
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	/** 4 byte payload length and 1 byte frame type */
+	constexpr int32 FrameHeaderBytes = 5;
+}
+
+#if defined(MSG_NOSIGNAL)
+#define ARCTICANALYTICS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define ARCTICANALYTICS_SEND_FLAGS 0
+#endif
+
+TUniquePtr<FArchive> FArcticAnalyticsCollectorArchive::Connect(const FString& SocketPath, const FString& SessionId, const FString& FallbackFilePath)
+{
+#if ARCTICANALYTICS_WITH_COLLECTOR_SOCKET
+	const FTCHARToUTF8 Path(*SocketPath);
+	sockaddr_un Address = {};
+	if (Path.Length() >= (int32)sizeof(Address.sun_path))
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Collector socket path (%s) is too long"), *SocketPath);
+		return nullptr;
+	}
+	Address.sun_family = AF_UNIX;
+	FMemory::Memcpy(Address.sun_path, Path.Get(), Path.Length());
+
+	const int Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (Socket < 0)
+	{
+		return nullptr;
+	}
+	if (connect(Socket, (const sockaddr*)&Address, sizeof(Address)) != 0)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("No collector listening on (%s), errno (%d)"), *SocketPath, errno);
+		close(Socket);
+		return nullptr;
+	}
+#if defined(SO_NOSIGPIPE)
+	const int NoSigPipe = 1;
+	setsockopt(Socket, SOL_SOCKET, SO_NOSIGPIPE, &NoSigPipe, sizeof(NoSigPipe));
+#endif
+	// Sends never block, frames the collector has no room for are queued
+	fcntl(Socket, F_SETFL, fcntl(Socket, F_GETFL, 0) | O_NONBLOCK);
+
+	TUniquePtr<FArcticAnalyticsCollectorArchive> Archive(new FArcticAnalyticsCollectorArchive(Socket, FallbackFilePath));
+	const FTCHARToUTF8 Id(*SessionId);
+	Archive->PendingData.Append((const uint8*)Id.Get(), Id.Length());
+	Archive->QueueFrame(EFrameType::Start);
+	if (!Archive->WaitForQueued())
+	{
+		// Nothing was written yet, the caller writes the whole session to a file of its own
+		close(Socket);
+		Archive->Socket = -1;
+		return nullptr;
+	}
+	return Archive;
+#else
+	return nullptr;
+#endif
+}
+
+FArcticAnalyticsCollectorArchive::FArcticAnalyticsCollectorArchive(int InSocket, const FString& InFallbackFilePath)
+	: Socket(InSocket), FrameBytes(16 * 1024), SentBytes(0), QueuedBytes(0), MaxQueuedBytes(0), SendTimeoutMs(250), TotalBytes(0), bHeaderComplete(false),
+	  bSentData(false), FallbackFilePath(InFallbackFilePath), bFallenBack(false), bFallbackWriteFailed(false)
+{
+	SetIsSaving(true);
+	SetIsPersistent(true);
+	int32 CollectorMaxQueuedKB = 1024;
+	ArcticAnalyticsSettings::GetInt(TEXT("CollectorFrameBytes"), FrameBytes);
+	ArcticAnalyticsSettings::GetInt(TEXT("CollectorMaxQueuedKB"), CollectorMaxQueuedKB);
+	ArcticAnalyticsSettings::GetInt(TEXT("CollectorSendTimeoutMs"), SendTimeoutMs);
+	MaxQueuedBytes = (int64)FMath::Max(1, CollectorMaxQueuedKB) * 1024;
+	const FArcticAnalyticsMemoryBudget& Budget = FArcticAnalyticsMemoryBudget::Get();
+	if (Budget.IsEnabled())
+	{
+		// A stalled collector doesn't get to take the whole budget from the sessions that are buffered in memory
+		MaxQueuedBytes = FMath::Min(MaxQueuedBytes, Budget.GetBudgetBytes() / 4);
+	}
+	PendingData.Reserve(FrameBytes);
+}
+
+FArcticAnalyticsCollectorArchive::~FArcticAnalyticsCollectorArchive()
+{
+	Close();
+}
+
+void FArcticAnalyticsCollectorArchive::Serialize(void* Data, int64 Num)
+{
+	TotalBytes += Num;
+	if (FallbackWriter)
+	{
+		FallbackData.Append((const uint8*)Data, (int32)Num);
+		return;
+	}
+	if (!bHeaderComplete)
+	{
+		Header.Append((const uint8*)Data, (int32)Num);
+	}
+	PendingData.Append((const uint8*)Data, (int32)Num);
+}
+
+void FArcticAnalyticsCollectorArchive::MarkRecordBoundary()
+{
+	bHeaderComplete = true;
+	if (FallbackWriter)
+	{
+		if (FallbackData.Num() >= FrameBytes)
+		{
+			WriteFallbackData(false);
+		}
+	}
+	else if (Socket >= 0 && PendingData.Num() >= FrameBytes)
+	{
+		QueueFrame(EFrameType::Data);
+		SendOrFallBack();
+	}
+}
+
+void FArcticAnalyticsCollectorArchive::Flush()
+{
+	if (FallbackWriter)
+	{
+		WriteFallbackData(false);
+	}
+	else if (Socket >= 0 && PendingData.Num() > 0)
+	{
+		QueueFrame(EFrameType::Data);
+		SendOrFallBack();
+	}
+}
+
+bool FArcticAnalyticsCollectorArchive::Close()
+{
+	if (SendTickHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(SendTickHandle);
+		SendTickHandle.Reset();
+	}
+	if (Socket >= 0)
+	{
+		if (!FallbackWriter)
+		{
+			if (PendingData.Num() > 0)
+			{
+				QueueFrame(EFrameType::Data);
+			}
+			// Only the session's end waits for the collector. It has the whole session even if the End frame doesn't make it
+			QueueFrame(EFrameType::End);
+			if (!WaitForQueued() && HasQueuedData())
+			{
+				FallBackToFile();
+			}
+		}
+#if ARCTICANALYTICS_WITH_COLLECTOR_SOCKET
+		close(Socket);
+#endif
+		Socket = -1;
+	}
+	DiscardQueuedFrames();
+	if (FallbackWriter)
+	{
+		WriteFallbackData(true);
+		FallbackWriter = nullptr;
+		if (bFallbackWriteFailed.load())
+		{
+			SetError();
+		}
+	}
+	return !IsError();
+}
+
+int64 FArcticAnalyticsCollectorArchive::Tell()
+{
+	return TotalBytes;
+}
+
+FString FArcticAnalyticsCollectorArchive::GetArchiveName() const
+{
+	return TEXT("FArcticAnalyticsCollectorArchive");
+}
+
+void FArcticAnalyticsCollectorArchive::QueueFrame(EFrameType Type)
+{
+	FQueuedFrame& Frame = QueuedFrames.AddDefaulted_GetRef();
+	Frame.Type = Type;
+	Frame.Bytes.SetNumUninitialized(FrameHeaderBytes + PendingData.Num());
+	const uint32 Length = (uint32)PendingData.Num();
+	Frame.Bytes[0] = (uint8)(Length & 0xff);
+	Frame.Bytes[1] = (uint8)((Length >> 8) & 0xff);
+	Frame.Bytes[2] = (uint8)((Length >> 16) & 0xff);
+	Frame.Bytes[3] = (uint8)((Length >> 24) & 0xff);
+	Frame.Bytes[4] = (uint8)Type;
+	FMemory::Memcpy(Frame.Bytes.GetData() + FrameHeaderBytes, PendingData.GetData(), PendingData.Num());
+	PendingData.Reset();
+	QueuedBytes += Frame.Bytes.Num();
+	FArcticAnalyticsMemoryBudget::Get().Charge(Frame.Bytes.Num());
+}
+
+bool FArcticAnalyticsCollectorArchive::SendQueued()
+{
+#if ARCTICANALYTICS_WITH_COLLECTOR_SOCKET
+	while (QueuedFrames.Num() > 0)
+	{
+		const FQueuedFrame& Frame = QueuedFrames[0];
+		const ssize_t Sent = send(Socket, Frame.Bytes.GetData() + SentBytes, Frame.Bytes.Num() - SentBytes, ARCTICANALYTICS_SEND_FLAGS);
+		if (Sent > 0)
+		{
+			SentBytes += (int32)Sent;
+			if (SentBytes == Frame.Bytes.Num())
+			{
+				bSentData |= Frame.Type == EFrameType::Data;
+				QueuedBytes -= Frame.Bytes.Num();
+				FArcticAnalyticsMemoryBudget::Get().Release(Frame.Bytes.Num());
+				QueuedFrames.RemoveAt(0, 1, false);
+				SentBytes = 0;
+			}
+			continue;
+		}
+		if (Sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (Sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			// The collector's receive buffer is full, the rest goes out once it caught up
+			return true;
+		}
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Sending to the collector failed, errno (%d)"), errno);
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FArcticAnalyticsCollectorArchive::SendOrFallBack()
+{
+	if (!SendQueued())
+	{
+		// Part of a frame may have gone out, so the collector can't resync this stream anyway
+		FallBackToFile();
+	}
+	else if (QueuedBytes > MaxQueuedBytes)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Collector fell (%lld) bytes behind"), QueuedBytes);
+		FallBackToFile();
+	}
+	else if (QueuedFrames.Num() > 0 && !SendTickHandle.IsValid())
+	{
+		SendTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FArcticAnalyticsCollectorArchive::TickSend));
+	}
+}
+
+bool FArcticAnalyticsCollectorArchive::TickSend(float DeltaTime)
+{
+	if (!FallbackWriter)
+	{
+		SendOrFallBack();
+	}
+	if (FallbackWriter || QueuedFrames.Num() == 0)
+	{
+		SendTickHandle.Reset();
+		return false;
+	}
+	return true;
+}
+
+bool FArcticAnalyticsCollectorArchive::WaitForQueued()
+{
+#if ARCTICANALYTICS_WITH_COLLECTOR_SOCKET
+	const double Deadline = FPlatformTime::Seconds() + SendTimeoutMs / 1000.0;
+	while (SendQueued())
+	{
+		if (QueuedFrames.Num() == 0)
+		{
+			return true;
+		}
+		const int32 RemainingMs = (int32)((Deadline - FPlatformTime::Seconds()) * 1000.0);
+		pollfd PollFd = {Socket, POLLOUT, 0};
+		if (RemainingMs <= 0 || poll(&PollFd, 1, RemainingMs) <= 0)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Collector did not accept data within (%d) ms"), SendTimeoutMs);
+			return false;
+		}
+	}
+#endif
+	return false;
+}
+
+bool FArcticAnalyticsCollectorArchive::HasQueuedData() const
+{
+	return QueuedFrames.ContainsByPredicate([](const FQueuedFrame& Frame) { return Frame.Type == EFrameType::Data; });
+}
+
+void FArcticAnalyticsCollectorArchive::DiscardQueuedFrames()
+{
+	FArcticAnalyticsMemoryBudget::Get().Release(QueuedBytes);
+	QueuedFrames.Empty();
+	QueuedBytes = 0;
+	SentBytes = 0;
+}
+
+void FArcticAnalyticsCollectorArchive::FallBackToFile()
+{
+	if (FallbackWriter)
+	{
+		return;
+	}
+	UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Collector unavailable, writing the rest of the session to (%s)"), *FallbackFilePath);
+	bFallenBack = true;
+	FallbackWriter = MakeUnique<FArcticAnalyticsSessionWriter>();
+
+	// Data frames the collector didn't get completely, a partly sent one ends its stream before the frame
+	TArray<uint8> Unsent;
+	for (const FQueuedFrame& Frame : QueuedFrames)
+	{
+		if (Frame.Type == EFrameType::Data)
+		{
+			Unsent.Append(Frame.Bytes.GetData() + FrameHeaderBytes, Frame.Bytes.Num() - FrameHeaderBytes);
+		}
+	}
+	Unsent.Append(PendingData);
+	DiscardQueuedFrames();
+	PendingData.Empty();
+
+	int32 SkipBytes = 0;
+	if (bSentData)
+	{
+		// The collector has the start of the session, the file repeats the header and goes on with the first record it didn't get
+		static const ANSICHAR Separator[] = "\t\t," LINE_TERMINATOR_ANSI;
+		const int32 SeparatorBytes = UE_ARRAY_COUNT(Separator) - 1;
+		FallbackData.Append(Header);
+		if (Unsent.Num() >= SeparatorBytes && FMemory::Memcmp(Unsent.GetData(), Separator, SeparatorBytes) == 0)
+		{
+			SkipBytes = SeparatorBytes;
+		}
+	}
+	FallbackData.Append(Unsent.GetData() + SkipBytes, Unsent.Num() - SkipBytes);
+	Header.Empty();
+	WriteFallbackData(false);
+}
+
+void FArcticAnalyticsCollectorArchive::WriteFallbackData(bool bFinal)
+{
+	if (FallbackData.Num() == 0 && !bFinal)
+	{
+		return;
+	}
+	// The session writer gives the memory back once the data is written. The fallback file is the session's own path,
+	// which nothing else writes to, so appending to it starts it
+	FArcticAnalyticsMemoryBudget::Get().Charge(FallbackData.Num());
+	TFunction<void(bool)> OnWritten;
+	if (bFinal)
+	{
+		OnWritten = [this](bool bSucceeded) { bFallbackWriteFailed.store(!bSucceeded); };
+	}
+	FallbackWriter->Enqueue(FallbackFilePath, MoveTemp(FallbackData), MoveTemp(OnWritten));
+	FallbackData.Reset();
+	if (bFinal)
+	{
+		// The session is uploaded once it is closed, so the file has to be complete by then
+		FallbackWriter->WaitForWrites();
+	}
+}
@@ -0,0 +1,130 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "Serialization/Archive.h"
+
+#include <atomic>
+
+class FArcticAnalyticsSessionWriter;
+
+/** Whether sessions can be streamed to a local collector over a Unix domain socket on this platform */
+#define ARCTICANALYTICS_WITH_COLLECTOR_SOCKET (PLATFORM_UNIX || PLATFORM_MAC)
+
+/**
+ * Archive that streams a session to a local collector process over a Unix domain socket instead of writing it to disk.
+ *
+ * Written data is buffered and sent in frames of a 4 byte little endian payload length, a 1 byte frame type and the
+ * payload. A session is a Start frame holding the session id, any number of Data frames holding the session document
+ * and an End frame. Sends never block while recording: frames the collector has no room for are queued, charged to
+ * the memory budget, and sent from a core ticker once it catches up. Only if the queue grows past
+ * CollectorMaxQueuedKB, or a quarter of the memory budget, or the collector went away, does the rest of the session
+ * go to a fallback file, written by a session writer thread. Connecting and closing wait up to
+ * CollectorSendTimeoutMs for the Start frame and the rest of the session.
+ *
+ * Data is only sent at record boundaries, so the collector never holds part of a record. A stream that stops without
+ * an End frame ends after its last complete frame. The fallback file repeats the session header and holds every record
+ * the collector didn't get, so once the writer closes it it is a complete session document of its own.
+ */
+class FArcticAnalyticsCollectorArchive : public FArchive
+{
+public:
+	enum class EFrameType : uint8
+	{
+		Start = 1,
+		Data = 2,
+		End = 3
+	};
+
+	/**
+	 * Connects to the collector and starts a session.
+	 *
+	 * @param SocketPath path of the collector's socket
+	 * @param SessionId the session the data belongs to
+	 * @param FallbackFilePath where the rest of the session is written if the collector stops reading
+	 *
+	 * @return the archive, or null if no collector took the session, in which case the session should be written to a file
+	 */
+	static TUniquePtr<FArchive> Connect(const FString& SocketPath, const FString& SessionId, const FString& FallbackFilePath);
+
+	/** Called by the writer before each record, everything written up to here may be sent */
+	void MarkRecordBoundary();
+
+	/** Whether the rest of the session went to the fallback file, which then needs to be uploaded like a session file */
+	bool HasFallenBack() const
+	{
+		return bFallenBack;
+	}
+
+	virtual ~FArcticAnalyticsCollectorArchive();
+
+	// FArchive interface
+	virtual void Serialize(void* Data, int64 Num) override;
+	virtual void Flush() override;
+	virtual bool Close() override;
+	virtual int64 Tell() override;
+	virtual FString GetArchiveName() const override;
+
+private:
+	FArcticAnalyticsCollectorArchive(int InSocket, const FString& InFallbackFilePath);
+
+	struct FQueuedFrame
+	{
+		EFrameType Type;
+		/** Frame header and payload */
+		TArray<uint8> Bytes;
+	};
+
+	/** Queues the pending data as a frame of the given type */
+	void QueueFrame(EFrameType Type);
+	/** Sends queued frames until the collector has no room, false if the socket failed */
+	bool SendQueued();
+	/** Sends what the collector has room for, and falls back to the file if it failed or the queue is too long */
+	void SendOrFallBack();
+	/** Sends every queued frame, waiting at most the send timeout for the collector to make room */
+	bool WaitForQueued();
+	bool TickSend(float DeltaTime);
+	/** Whether a Data frame is not completely sent yet */
+	bool HasQueuedData() const;
+	/** Drops the queued frames and gives their memory back to the budget */
+	void DiscardQueuedFrames();
+	/** Switches to the fallback file after the collector failed, keeping the data that wasn't sent */
+	void FallBackToFile();
+	/** Hands the buffered fallback data to the session writer, the final call also waits for it to be written */
+	void WriteFallbackData(bool bFinal);
+
+	/** Socket descriptor, -1 once closed */
+	int Socket;
+	/** Data waiting to be queued as the next frame */
+	TArray<uint8> PendingData;
+	/** Pending data is queued once it reaches this size */
+	int32 FrameBytes;
+	/** Frames not sent completely yet, in order */
+	TArray<FQueuedFrame> QueuedFrames;
+	/** Bytes of the first queued frame that were sent */
+	int32 SentBytes;
+	int64 QueuedBytes;
+	/** The session falls back to the file once more than this is queued */
+	int64 MaxQueuedBytes;
+	/** Longest time connecting and closing wait for the collector */
+	int32 SendTimeoutMs;
+	/** Registered while frames are queued */
+	FTSTicker::FDelegateHandle SendTickHandle;
+	/** Bytes written to the archive so far */
+	int64 TotalBytes;
+	/** Everything written before the first record, repeated at the start of the fallback file */
+	TArray<uint8> Header;
+	bool bHeaderComplete;
+	/** Whether the collector received any complete Data frame */
+	bool bSentData;
+	FString FallbackFilePath;
+	/** Appends to the fallback file off the game thread, created on fallback */
+	TUniquePtr<FArcticAnalyticsSessionWriter> FallbackWriter;
+	/** Written since the last buffer went to the session writer */
+	TArray<uint8> FallbackData;
+	bool bFallenBack;
+	/** Set by the session writer if a write to the fallback file failed */
+	std::atomic<bool> bFallbackWriteFailed;
+};
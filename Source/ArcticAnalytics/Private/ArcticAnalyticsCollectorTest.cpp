@@ -0,0 +1,277 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "CoreMinimal.h"
+
+#include "ArcticAnalyticsCollectorArchive.h"
+
+#if !UE_BUILD_SHIPPING && ARCTICANALYTICS_WITH_COLLECTOR_SOCKET
+
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonSerializer.h"
+
+#include "ArcticAnalyticsEventJson.h"
+#include "ArcticAnalyticsLog.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+	/** What the stub collector received from one connection */
+	struct FStubCollectorSession
+	{
+		FString SessionId;
+		/** Payloads of every complete Data frame */
+		TArray<uint8> Data;
+		int32 NumDataFrames = 0;
+		bool bEnded = false;
+	};
+
+	int ListenOnStubSocket(const FString& SocketPath)
+	{
+		const FTCHARToUTF8 Path(*SocketPath);
+		sockaddr_un Address = {};
+		Address.sun_family = AF_UNIX;
+		FMemory::Memcpy(Address.sun_path, Path.Get(), FMath::Min<int32>(Path.Length(), sizeof(Address.sun_path) - 1));
+		unlink(Address.sun_path);
+		const int Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (Socket >= 0 && (bind(Socket, (const sockaddr*)&Address, sizeof(Address)) != 0 || listen(Socket, 1) != 0))
+		{
+			close(Socket);
+			return -1;
+		}
+		return Socket;
+	}
+
+	bool ReadStub(int Socket, uint8* Data, int32 Num)
+	{
+		while (Num > 0)
+		{
+			const ssize_t Read = recv(Socket, Data, Num, 0);
+			if (Read < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (Read <= 0)
+			{
+				return false;
+			}
+			Data += Read;
+			Num -= (int32)Read;
+		}
+		return true;
+	}
+
+	/**
+	 * Accepts one connection and reads its frames like the collector does, dropping a trailing incomplete frame. After
+	 * PauseAfterDataFrames it stops reading until Resume is triggered, so the sender's buffer fills up, and with
+	 * bCloseOnAccept it hangs up right away.
+	 */
+	FStubCollectorSession ServeStubCollector(int ListenSocket, int32 PauseAfterDataFrames, FEvent* Resume, bool bCloseOnAccept)
+	{
+		FStubCollectorSession Session;
+		const int Socket = accept(ListenSocket, nullptr, nullptr);
+		if (Socket < 0 || bCloseOnAccept)
+		{
+			if (Socket >= 0)
+			{
+				close(Socket);
+			}
+			return Session;
+		}
+		uint8 FrameHeader[5];
+		TArray<uint8> Payload;
+		while (ReadStub(Socket, FrameHeader, sizeof(FrameHeader)))
+		{
+			Payload.SetNumUninitialized(FrameHeader[0] | (FrameHeader[1] << 8) | (FrameHeader[2] << 16) | (FrameHeader[3] << 24));
+			if (!ReadStub(Socket, Payload.GetData(), Payload.Num()))
+			{
+				break;
+			}
+			const FArcticAnalyticsCollectorArchive::EFrameType Type = (FArcticAnalyticsCollectorArchive::EFrameType)FrameHeader[4];
+			if (Type == FArcticAnalyticsCollectorArchive::EFrameType::Start)
+			{
+				Session.SessionId = FString(FUTF8ToTCHAR((const ANSICHAR*)Payload.GetData(), Payload.Num()));
+			}
+			else if (Type == FArcticAnalyticsCollectorArchive::EFrameType::Data)
+			{
+				Session.Data.Append(Payload);
+				if (++Session.NumDataFrames == PauseAfterDataFrames)
+				{
+					Resume->Wait();
+				}
+			}
+			else if (Type == FArcticAnalyticsCollectorArchive::EFrameType::End)
+			{
+				Session.bEnded = true;
+				break;
+			}
+		}
+		close(Socket);
+		return Session;
+	}
+
+	void WriteStubSession(FArchive& Writer, FArcticAnalyticsCollectorArchive& Collector, const FString& SessionId, int32 NumRecords)
+	{
+		ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("{"));
+		ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("\t\"sessionId\" : \"%s\","), *SessionId);
+		ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("\t\"events\" : ["));
+		const FString Padding = FString::ChrN(100, TEXT('x'));
+		for (int32 Index = 0; Index < NumRecords; ++Index)
+		{
+			Collector.MarkRecordBoundary();
+			if (Index > 0)
+			{
+				ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("\t\t,"));
+			}
+			ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("\t\t{ \"eventName\" : \"CollectorTest\", \"index\" : %d, \"padding\" : \"%s\" }"), Index, *Padding);
+		}
+		ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("\t]"));
+		ArcticAnalyticsEventJson::WriteLinef(Writer, TEXT("}"));
+	}
+
+	/** Adds the index of every event of a session document to Indices, false if it doesn't parse */
+	bool ReadStubIndices(const FString& Document, const FString& SessionId, TArray<int32>& Indices)
+	{
+		TSharedPtr<FJsonObject> Root;
+		const TArray<TSharedPtr<FJsonValue>>* Events;
+		if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Document), Root) || !Root.IsValid() || Root->GetStringField(TEXT("sessionId")) != SessionId ||
+			!Root->TryGetArrayField(TEXT("events"), Events))
+		{
+			return false;
+		}
+		for (const TSharedPtr<FJsonValue>& Event : *Events)
+		{
+			Indices.Add((int32)Event->AsObject()->GetNumberField(TEXT("index")));
+		}
+		return true;
+	}
+
+	/** Whether Indices holds every index below NumRecords exactly once */
+	bool HasEveryIndexOnce(TArray<int32>& Indices, int32 NumRecords)
+	{
+		Indices.Sort();
+		for (int32 Index = 0; Index < Indices.Num(); ++Index)
+		{
+			if (Indices[Index] != Index)
+			{
+				return false;
+			}
+		}
+		return Indices.Num() == NumRecords;
+	}
+
+	/**
+	 * Streams sessions to a stub collector: one it reads completely, one it stops reading mid session so the rest
+	 * falls back to the session file, and one it hangs up on before the Start frame is through.
+	 */
+	void CollectorTest(const TArray<FString>& Args)
+	{
+		const FString SocketPath = FString::Printf(TEXT("/tmp/arcticanalytics-test-%u.sock"), FPlatformProcess::GetCurrentProcessId());
+		const FString FallbackFilePath = FPaths::ProjectSavedDir() / TEXT("Analytics") / TEXT("CollectorTest.analytics");
+		const int ListenSocket = ListenOnStubSocket(SocketPath);
+		if (ListenSocket < 0)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Collector test could not listen on (%s)"), *SocketPath);
+			return;
+		}
+		FEvent* Resume = FPlatformProcess::GetSynchEventFromPool(true);
+		TArray<FString> Failures;
+		const auto Check = [&Failures](bool bPassed, const TCHAR* Failure)
+		{
+			if (!bPassed)
+			{
+				Failures.Add(Failure);
+			}
+		};
+
+		// Read completely, the collector gets the whole document and nothing is written to disk
+		{
+			IFileManager::Get().Delete(*FallbackFilePath);
+			const int32 NumRecords = 2000;
+			TFuture<FStubCollectorSession> Served = Async(EAsyncExecution::Thread, [ListenSocket]() { return ServeStubCollector(ListenSocket, 0, nullptr, false); });
+			TUniquePtr<FArchive> Writer = FArcticAnalyticsCollectorArchive::Connect(SocketPath, TEXT("Streamed"), FallbackFilePath);
+			Check(Writer.IsValid(), TEXT("streamed session did not connect"));
+			if (Writer)
+			{
+				FArcticAnalyticsCollectorArchive& Collector = static_cast<FArcticAnalyticsCollectorArchive&>(*Writer);
+				WriteStubSession(*Writer, Collector, TEXT("Streamed"), NumRecords);
+				Writer->Close();
+				Check(!Collector.HasFallenBack(), TEXT("streamed session fell back"));
+			}
+			const FStubCollectorSession Session = Served.Get();
+			TArray<int32> Indices;
+			Check(Session.bEnded && Session.SessionId == TEXT("Streamed"), TEXT("streamed session was not started and ended"));
+			Check(ReadStubIndices(FString(FUTF8ToTCHAR((const ANSICHAR*)Session.Data.GetData(), Session.Data.Num())), TEXT("Streamed"), Indices) &&
+					  HasEveryIndexOnce(Indices, NumRecords),
+				  TEXT("streamed session did not arrive whole"));
+			Check(!IFileManager::Get().FileExists(*FallbackFilePath), TEXT("streamed session wrote a fallback file"));
+		}
+
+		// The collector stops reading, every record is either with the collector or in the fallback file
+		{
+			IFileManager::Get().Delete(*FallbackFilePath);
+			const int32 NumRecords = 40000;
+			Resume->Reset();
+			TFuture<FStubCollectorSession> Served =
+				Async(EAsyncExecution::Thread, [ListenSocket, Resume]() { return ServeStubCollector(ListenSocket, 2, Resume, false); });
+			TUniquePtr<FArchive> Writer = FArcticAnalyticsCollectorArchive::Connect(SocketPath, TEXT("FellBack"), FallbackFilePath);
+			Check(Writer.IsValid(), TEXT("stalled session did not connect"));
+			if (Writer)
+			{
+				FArcticAnalyticsCollectorArchive& Collector = static_cast<FArcticAnalyticsCollectorArchive&>(*Writer);
+				WriteStubSession(*Writer, Collector, TEXT("FellBack"), NumRecords);
+				Writer->Close();
+				Check(Collector.HasFallenBack(), TEXT("stalled session did not fall back"));
+			}
+			Resume->Trigger();
+			const FStubCollectorSession Session = Served.Get();
+			Check(!Session.bEnded && Session.NumDataFrames >= 2, TEXT("stalled session ended or sent too little"));
+
+			// The collector closes a stream without an End frame after its last complete record
+			TArray<int32> Indices;
+			const FString Received = FString(FUTF8ToTCHAR((const ANSICHAR*)Session.Data.GetData(), Session.Data.Num())) + TEXT("\t]\n}");
+			FString Fallback;
+			Check(ReadStubIndices(Received, TEXT("FellBack"), Indices), TEXT("stalled session's collector part does not parse"));
+			Check(FFileHelper::LoadFileToString(Fallback, *FallbackFilePath) && ReadStubIndices(Fallback, TEXT("FellBack"), Indices),
+				  TEXT("fallback file is not a complete session"));
+			Check(HasEveryIndexOnce(Indices, NumRecords), TEXT("stalled session lost or repeated records"));
+			IFileManager::Get().Delete(*FallbackFilePath);
+		}
+
+		// Hung up before the Start frame is through, which the send times out on as it's larger than the socket buffer
+		{
+			TFuture<FStubCollectorSession> Served = Async(EAsyncExecution::Thread, [ListenSocket]() { return ServeStubCollector(ListenSocket, 0, nullptr, true); });
+			TUniquePtr<FArchive> Writer = FArcticAnalyticsCollectorArchive::Connect(SocketPath, FString::ChrN(8 * 1024 * 1024, TEXT('s')), FallbackFilePath);
+			Served.Wait();
+			Check(!Writer.IsValid(), TEXT("session connected although the Start frame failed"));
+			Writer = nullptr;
+			Check(!IFileManager::Get().FileExists(*FallbackFilePath), TEXT("failed connect left a fallback file"));
+		}
+
+		FPlatformProcess::ReturnSynchEventToPool(Resume);
+		close(ListenSocket);
+		unlink(TCHAR_TO_UTF8(*SocketPath));
+		if (Failures.Num() > 0)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Collector test failed: %s"), *FString::Join(Failures, TEXT(", ")));
+		}
+		else
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Collector test passed"));
+		}
+	}
+
+	FAutoConsoleCommand CollectorTestCommand(TEXT("ArcticAnalytics.CollectorTest"),
+		TEXT("Streams sessions to a stub collector that reads everything, stops reading mid session and hangs up at the start, and checks no record is lost."),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&CollectorTest));
+}
+
+#endif
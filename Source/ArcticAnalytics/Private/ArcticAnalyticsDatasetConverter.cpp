@@ -0,0 +1,1145 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsDatasetConverter.h"
+
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "Dom/JsonObject.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformMisc.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Parse.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+#include <atomic>
+#include <limits>
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsTrace.h"
+
+namespace
+{
+	/** In order of promotion, a column takes the highest type of its values across all files */
+	enum class EColumnType : uint8
+	{
+		Null,
+		Int,
+		Double,
+		String
+	};
+
+	const TCHAR* ColumnTypeNames[] = {TEXT("string"), TEXT("int64"), TEXT("double"), TEXT("string")};
+
+	const int64 NullInt = MIN_int64;
+	const double NullDouble = std::numeric_limits<double>::quiet_NaN();
+	const uint32 NullStringId = MAX_uint32;
+
+	/** A scalar value as read from a session */
+	struct FValue
+	{
+		bool bNull = true;
+		/** Whether it was a JSON number, otherwise its text is checked for one */
+		bool bNumber = false;
+		FString Text;
+	};
+
+	bool TryParseInt(const FString& Text, int64& OutValue)
+	{
+		const int32 First = Text.Len() > 0 && Text[0] == TEXT('-') ? 1 : 0;
+		// 18 digits always fit
+		if (Text.Len() == First || Text.Len() - First > 18)
+		{
+			return false;
+		}
+		for (int32 Index = First; Index < Text.Len(); ++Index)
+		{
+			if (!FChar::IsDigit(Text[Index]))
+			{
+				return false;
+			}
+		}
+		OutValue = FCString::Atoi64(*Text);
+		return true;
+	}
+
+	/** Values of one column of one session file */
+	struct FChunkColumn
+	{
+		FString Name;
+		EColumnType Type = EColumnType::Null;
+		/** While parsing, the dictionary id of the value of every row, INDEX_NONE for none */
+		TArray<int32> Ids;
+		TArray<FString> Dictionary;
+		TMap<FString, int32> DictionaryIds;
+		bool bAllInts = true;
+		bool bAllNumbers = true;
+		/** Values of int and double columns, and of columns only set through SetInt */
+		TArray<int64> Ints;
+		TArray<double> Doubles;
+
+		void Set(int32 Row, const FValue& Value)
+		{
+			for (int32 Index = Ids.Num(); Index <= Row; ++Index)
+			{
+				Ids.Add(INDEX_NONE);
+			}
+			if (Value.bNull)
+			{
+				Ids[Row] = INDEX_NONE;
+				return;
+			}
+			int32& Id = DictionaryIds.FindOrAdd(Value.Text, Dictionary.Num());
+			if (Id == Dictionary.Num())
+			{
+				int64 Int;
+				bAllInts = bAllInts && TryParseInt(Value.Text, Int);
+				bAllNumbers = bAllNumbers && (bAllInts || Value.bNumber || (Value.Text.Len() > 0 && FCString::IsNumeric(*Value.Text)));
+				Dictionary.Add(Value.Text);
+			}
+			Ids[Row] = Id;
+		}
+
+		void SetInt(int32 Row, int64 Value)
+		{
+			while (Ints.Num() <= Row)
+			{
+				Ints.Add(NullInt);
+			}
+			Ints[Row] = Value;
+		}
+
+		/** Pads the column to NumRows and settles its type, numbers are parsed once per distinct value */
+		void Finish(int32 NumRows)
+		{
+			if (Dictionary.Num() == 0)
+			{
+				Type = Ints.Num() > 0 ? EColumnType::Int : EColumnType::Null;
+				while (Type == EColumnType::Int && Ints.Num() < NumRows)
+				{
+					Ints.Add(NullInt);
+				}
+				Ids.Empty();
+				return;
+			}
+			Ids.Reserve(NumRows);
+			while (Ids.Num() < NumRows)
+			{
+				Ids.Add(INDEX_NONE);
+			}
+			DictionaryIds.Empty();
+			if (bAllInts)
+			{
+				Type = EColumnType::Int;
+				TArray<int64> Values;
+				for (const FString& Text : Dictionary)
+				{
+					Values.Add(FCString::Atoi64(*Text));
+				}
+				Ints.SetNumUninitialized(NumRows);
+				for (int32 Row = 0; Row < NumRows; ++Row)
+				{
+					Ints[Row] = Ids[Row] == INDEX_NONE ? NullInt : Values[Ids[Row]];
+				}
+			}
+			else if (bAllNumbers)
+			{
+				Type = EColumnType::Double;
+				TArray<double> Values;
+				for (const FString& Text : Dictionary)
+				{
+					Values.Add(FCString::Atod(*Text));
+				}
+				Doubles.SetNumUninitialized(NumRows);
+				for (int32 Row = 0; Row < NumRows; ++Row)
+				{
+					Doubles[Row] = Ids[Row] == INDEX_NONE ? NullDouble : Values[Ids[Row]];
+				}
+			}
+			else
+			{
+				Type = EColumnType::String;
+				return;
+			}
+			Ids.Empty();
+			Dictionary.Empty();
+		}
+	};
+
+	/** The rows of one session file */
+	struct FSessionChunk
+	{
+		FString Path;
+		int64 Bytes = 0;
+		int32 NumRows = 0;
+		bool bParsed = false;
+		TArray<FChunkColumn> Columns;
+		TMap<FString, int32> ColumnIds;
+
+		FChunkColumn& FindOrAddColumn(const FString& Name)
+		{
+			int32& ColumnId = ColumnIds.FindOrAdd(Name, Columns.Num());
+			if (ColumnId == Columns.Num())
+			{
+				Columns.AddDefaulted_GetRef().Name = Name;
+			}
+			return Columns[ColumnId];
+		}
+
+		/** Sets a value of the last row */
+		void Set(const FString& Name, const FValue& Value)
+		{
+			FindOrAddColumn(Name).Set(NumRows - 1, Value);
+		}
+
+		void SetInt(const FString& Name, int64 Value)
+		{
+			FindOrAddColumn(Name).SetInt(NumRows - 1, Value);
+		}
+
+		void Finish()
+		{
+			for (FChunkColumn& Column : Columns)
+			{
+				Column.Finish(NumRows);
+			}
+		}
+	};
+
+	/**
+	 * Serves a UTF-8 session file to TJsonReader as TCHARs, reading and decoding it a block at a time, so a worker
+	 * holds two small buffers instead of the whole file
+	 */
+	class FUtf8FileArchive : public FArchive
+	{
+	public:
+		explicit FUtf8FileArchive(TUniquePtr<FArchive>&& InFile)
+			: File(MoveTemp(InFile)), DecodedOffset(0), Position(0), bAtStart(true)
+		{
+			SetIsLoading(true);
+		}
+
+		virtual void Serialize(void* Data, int64 Num) override
+		{
+			uint8* Out = (uint8*)Data;
+			while (Num > 0)
+			{
+				if (DecodedOffset == Decoded.Num() && !Refill())
+				{
+					FMemory::Memzero(Out, Num);
+					SetError();
+					return;
+				}
+				// TJsonReader asks for whole TCHARs
+				const int32 NumChars = (int32)FMath::Min<int64>(Num / sizeof(TCHAR), Decoded.Num() - DecodedOffset);
+				check(NumChars > 0);
+				FMemory::Memcpy(Out, Decoded.GetData() + DecodedOffset, NumChars * sizeof(TCHAR));
+				DecodedOffset += NumChars;
+				Position += NumChars * sizeof(TCHAR);
+				Out += NumChars * sizeof(TCHAR);
+				Num -= NumChars * sizeof(TCHAR);
+			}
+		}
+
+		virtual bool AtEnd() override
+		{
+			return DecodedOffset == Decoded.Num() && !Refill();
+		}
+
+		virtual int64 Tell() override
+		{
+			return Position;
+		}
+
+		virtual FString GetArchiveName() const override
+		{
+			return TEXT("FUtf8FileArchive");
+		}
+
+	private:
+		static constexpr int32 BlockBytes = 64 * 1024;
+
+		/** Decodes the next block of the file, false at its end or on a read error */
+		bool Refill()
+		{
+			Decoded.Reset();
+			DecodedOffset = 0;
+			while (Decoded.Num() == 0)
+			{
+				const int64 Remaining = File->TotalSize() - File->Tell();
+				if (Remaining <= 0 || File->IsError())
+				{
+					// A sequence cut off by the end of the file decodes to a replacement character, as LoadFileToString would
+					if (Undecoded.Num() > 0 && !File->IsError())
+					{
+						const FUTF8ToTCHAR Converted((const ANSICHAR*)Undecoded.GetData(), Undecoded.Num());
+						Decoded.Append(Converted.Get(), Converted.Length());
+						Undecoded.Reset();
+						return Decoded.Num() > 0;
+					}
+					return false;
+				}
+				const int32 NumRead = (int32)FMath::Min<int64>(Remaining, BlockBytes);
+				const int32 Start = Undecoded.Num();
+				Undecoded.SetNumUninitialized(Start + NumRead, false);
+				File->Serialize(Undecoded.GetData() + Start, NumRead);
+				if (File->IsError())
+				{
+					SetError();
+					return false;
+				}
+				int32 SkipBytes = 0;
+				if (bAtStart)
+				{
+					bAtStart = false;
+					SkipBytes = Undecoded.Num() >= 3 && Undecoded[0] == 0xEF && Undecoded[1] == 0xBB && Undecoded[2] == 0xBF ? 3 : 0;
+				}
+				// A sequence that continues in the next block is decoded with it
+				const int32 NumComplete = GetNumCompleteBytes(Undecoded);
+				if (NumComplete > SkipBytes)
+				{
+					const FUTF8ToTCHAR Converted((const ANSICHAR*)Undecoded.GetData() + SkipBytes, NumComplete - SkipBytes);
+					Decoded.Append(Converted.Get(), Converted.Length());
+				}
+				Undecoded.RemoveAt(0, FMath::Max(NumComplete, SkipBytes), false);
+			}
+			return true;
+		}
+
+		/** Bytes up to the start of a trailing UTF-8 sequence that is not complete yet */
+		static int32 GetNumCompleteBytes(const TArray<uint8>& Bytes)
+		{
+			for (int32 Index = Bytes.Num() - 1; Index >= FMath::Max(0, Bytes.Num() - 4); --Index)
+			{
+				const uint8 Byte = Bytes[Index];
+				if ((Byte & 0xC0) != 0x80)
+				{
+					const int32 Length = Byte < 0x80 ? 1 : Byte < 0xE0 ? 2 : Byte < 0xF0 ? 3 : 4;
+					return Index + Length > Bytes.Num() ? Index : Bytes.Num();
+				}
+			}
+			return Bytes.Num();
+		}
+
+		TUniquePtr<FArchive> File;
+		/** Bytes read from the file that are not decoded yet */
+		TArray<uint8> Undecoded;
+		TArray<TCHAR> Decoded;
+		int32 DecodedOffset;
+		/** Bytes served so far */
+		int64 Position;
+		bool bAtStart;
+	};
+
+	/**
+	 * Reads a session file token by token into a chunk, without building a DOM of the session. Fields the schema
+	 * doesn't describe are read as attributes, JSON fragment values are left out.
+	 */
+	class FSessionParser
+	{
+	public:
+		FSessionParser(FArchive& Content, FSessionChunk& InChunk)
+			: Reader(TJsonReaderFactory<>::Create(&Content)), Chunk(InChunk)
+		{
+		}
+
+		bool Parse()
+		{
+			EJsonNotation Notation;
+			if (!Next(Notation) || Notation != EJsonNotation::ObjectStart)
+			{
+				return false;
+			}
+			while (Next(Notation))
+			{
+				if (Notation == EJsonNotation::ObjectEnd)
+				{
+					return true;
+				}
+				const FString Identifier = Reader->GetIdentifier();
+				bool bRead = true;
+				if (Notation == EJsonNotation::ArrayStart)
+				{
+					bRead = Identifier == TEXT("events") ? ReadEvents() : Skip();
+				}
+				else if (Notation == EJsonNotation::ObjectStart)
+				{
+					bRead = Identifier == TEXT("defaultAttributes") ? ReadAttributeMap(Defaults) : Skip();
+				}
+				else
+				{
+					// Header fields, repeated in every row
+					Header.Emplace(Identifier, ToValue(Notation));
+				}
+				if (!bRead)
+				{
+					return false;
+				}
+			}
+			return false;
+		}
+
+	private:
+		typedef TArray<TPair<FString, FValue>> FFields;
+
+		bool Next(EJsonNotation& Notation)
+		{
+			return Reader->ReadNext(Notation) && Notation != EJsonNotation::Error;
+		}
+
+		static bool IsNested(EJsonNotation Notation)
+		{
+			return Notation == EJsonNotation::ObjectStart || Notation == EJsonNotation::ArrayStart;
+		}
+
+		/** Skips the object or array that just started */
+		bool Skip()
+		{
+			EJsonNotation Notation;
+			int32 Depth = 1;
+			while (Depth > 0 && Next(Notation))
+			{
+				Depth += IsNested(Notation) ? 1 : Notation == EJsonNotation::ObjectEnd || Notation == EJsonNotation::ArrayEnd ? -1 : 0;
+			}
+			return Depth == 0;
+		}
+
+		FValue ToValue(EJsonNotation Notation) const
+		{
+			FValue Value;
+			Value.bNull = Notation != EJsonNotation::String && Notation != EJsonNotation::Number && Notation != EJsonNotation::Boolean;
+			Value.bNumber = Notation == EJsonNotation::Number;
+			if (Notation == EJsonNotation::String)
+			{
+				Value.Text = Reader->GetValueAsString();
+			}
+			else if (Notation == EJsonNotation::Number)
+			{
+				Value.Text = Reader->GetValueAsNumberString();
+			}
+			else if (Notation == EJsonNotation::Boolean)
+			{
+				Value.Text = Reader->GetValueAsBoolean() ? TEXT("true") : TEXT("false");
+			}
+			return Value;
+		}
+
+		bool ReadEvents()
+		{
+			EJsonNotation Notation;
+			while (Next(Notation))
+			{
+				if (Notation == EJsonNotation::ArrayEnd)
+				{
+					return true;
+				}
+				if (Notation == EJsonNotation::ObjectStart ? !ReadRecord() : Notation == EJsonNotation::ArrayStart && !Skip())
+				{
+					return false;
+				}
+			}
+			return false;
+		}
+
+		bool ReadRecord()
+		{
+			FString EventName;
+			FString Kind;
+			bool bError = false;
+			int64 TimestampMs = NullInt;
+			int64 RecordId = NullInt;
+			TArray<int64> BatchTimestampsMs;
+			TArray<int64> BatchRecordIds;
+			TArray<TPair<FString, TArray<FValue>>> BatchColumns;
+			FFields RecordDefaults;
+			Fields.Reset();
+
+			EJsonNotation Notation;
+			while (Next(Notation) && Notation != EJsonNotation::ObjectEnd)
+			{
+				const FString Identifier = Reader->GetIdentifier();
+				bool bRead = true;
+				if (Notation == EJsonNotation::ObjectStart)
+				{
+					bRead = Identifier == TEXT("TimestampUTC") ? ReadDeltas(TEXT("baseMs"), TEXT("deltaMs"), BatchTimestampsMs)
+							: Identifier == TEXT("RecordId")   ? ReadDeltas(TEXT("base"), TEXT("delta"), BatchRecordIds)
+							: Identifier == TEXT("columns")	   ? ReadColumns(BatchColumns)
+							: Identifier == TEXT("defaultAttributes") ? ReadAttributeMap(RecordDefaults)
+																	   : Skip();
+				}
+				else if (Notation == EJsonNotation::ArrayStart)
+				{
+					bRead = Identifier == TEXT("attributes") ? ReadAttributeList(Fields) : Skip();
+				}
+				else if (Identifier == TEXT("EventName") || Identifier == TEXT("eventName") || Identifier == TEXT("eventType"))
+				{
+					EventName = ToValue(Notation).Text;
+				}
+				else if (Identifier == TEXT("eventKind"))
+				{
+					Kind = ToValue(Notation).Text;
+				}
+				else if (Identifier == TEXT("TimestampUTC"))
+				{
+					// Seconds with milliseconds
+					TimestampMs = (int64)FMath::RoundToDouble(FCString::Atod(*ToValue(Notation).Text) * 1000.0);
+				}
+				else if (Identifier == TEXT("RecordId"))
+				{
+					RecordId = FCString::Atoi64(*ToValue(Notation).Text);
+				}
+				else
+				{
+					bError = bError || Identifier == TEXT("error");
+					Fields.Emplace(Identifier, ToValue(Notation));
+				}
+				if (!bRead)
+				{
+					return false;
+				}
+			}
+			if (Notation != EJsonNotation::ObjectEnd)
+			{
+				return false;
+			}
+
+			if (Kind == TEXT("defaultsChanged"))
+			{
+				Defaults = MoveTemp(RecordDefaults);
+				return true;
+			}
+			EventName = EventName.IsEmpty() && bError ? TEXT("Error") : EventName;
+			if (Kind == TEXT("batch"))
+			{
+				for (int32 Index = 0; Index < BatchTimestampsMs.Num(); ++Index)
+				{
+					BeginRow(EventName, BatchTimestampsMs[Index], BatchRecordIds.IsValidIndex(Index) ? BatchRecordIds[Index] : NullInt);
+					for (const TPair<FString, TArray<FValue>>& Column : BatchColumns)
+					{
+						if (Column.Value.IsValidIndex(Index))
+						{
+							Chunk.Set(Column.Key, Column.Value[Index]);
+						}
+					}
+				}
+				return true;
+			}
+			BeginRow(EventName, TimestampMs, RecordId);
+			for (const TPair<FString, FValue>& Field : Fields)
+			{
+				Chunk.Set(Field.Key, Field.Value);
+			}
+			return true;
+		}
+
+		void BeginRow(const FString& EventName, int64 TimestampMs, int64 RecordId)
+		{
+			++Chunk.NumRows;
+			for (const TPair<FString, FValue>& Field : Header)
+			{
+				Chunk.Set(Field.Key, Field.Value);
+			}
+			for (const TPair<FString, FValue>& Field : Defaults)
+			{
+				Chunk.Set(Field.Key, Field.Value);
+			}
+			FValue Name;
+			Name.bNull = EventName.IsEmpty();
+			Name.Text = EventName;
+			Chunk.Set(TEXT("EventName"), Name);
+			Chunk.SetInt(TEXT("TimestampMs"), TimestampMs);
+			Chunk.SetInt(TEXT("RecordId"), RecordId);
+		}
+
+		/** Reads [{ "name": ..., "value": ... }, ...] */
+		bool ReadAttributeList(FFields& OutFields)
+		{
+			EJsonNotation Notation;
+			while (Next(Notation))
+			{
+				if (Notation == EJsonNotation::ArrayEnd)
+				{
+					return true;
+				}
+				if (Notation != EJsonNotation::ObjectStart)
+				{
+					if (Notation == EJsonNotation::ArrayStart && !Skip())
+					{
+						return false;
+					}
+					continue;
+				}
+				FString Name;
+				FValue Value;
+				while (Next(Notation) && Notation != EJsonNotation::ObjectEnd)
+				{
+					if (IsNested(Notation))
+					{
+						if (!Skip())
+						{
+							return false;
+						}
+					}
+					else if (Reader->GetIdentifier() == TEXT("name"))
+					{
+						Name = ToValue(Notation).Text;
+					}
+					else if (Reader->GetIdentifier() == TEXT("value"))
+					{
+						Value = ToValue(Notation);
+					}
+				}
+				if (Notation != EJsonNotation::ObjectEnd)
+				{
+					return false;
+				}
+				if (!Name.IsEmpty())
+				{
+					OutFields.Emplace(MoveTemp(Name), MoveTemp(Value));
+				}
+			}
+			return false;
+		}
+
+		/** Reads { "name": value, ... } */
+		bool ReadAttributeMap(FFields& OutFields)
+		{
+			OutFields.Reset();
+			EJsonNotation Notation;
+			while (Next(Notation))
+			{
+				if (Notation == EJsonNotation::ObjectEnd)
+				{
+					return true;
+				}
+				if (!IsNested(Notation))
+				{
+					OutFields.Emplace(Reader->GetIdentifier(), ToValue(Notation));
+				}
+				else if (!Skip())
+				{
+					return false;
+				}
+			}
+			return false;
+		}
+
+		/** Reads scalars of an array, nested values are read as missing */
+		bool ReadValueArray(TArray<FValue>& OutValues)
+		{
+			EJsonNotation Notation;
+			while (Next(Notation))
+			{
+				if (Notation == EJsonNotation::ArrayEnd)
+				{
+					return true;
+				}
+				if (IsNested(Notation) && !Skip())
+				{
+					return false;
+				}
+				OutValues.Add(IsNested(Notation) ? FValue() : ToValue(Notation));
+			}
+			return false;
+		}
+
+		/** Reads a base and the deltas from one value to the next, as the values */
+		bool ReadDeltas(const TCHAR* BaseName, const TCHAR* DeltaName, TArray<int64>& OutValues)
+		{
+			int64 Base = 0;
+			TArray<FValue> Deltas;
+			EJsonNotation Notation;
+			while (Next(Notation) && Notation != EJsonNotation::ObjectEnd)
+			{
+				const bool bRead = Notation == EJsonNotation::ArrayStart && Reader->GetIdentifier() == DeltaName ? ReadValueArray(Deltas) : IsNested(Notation) ? Skip() : true;
+				if (!bRead)
+				{
+					return false;
+				}
+				if (!IsNested(Notation) && Reader->GetIdentifier() == BaseName)
+				{
+					Base = FCString::Atoi64(*ToValue(Notation).Text);
+				}
+			}
+			OutValues.Reset(Deltas.Num());
+			for (const FValue& Delta : Deltas)
+			{
+				Base += FCString::Atoi64(*Delta.Text);
+				OutValues.Add(Base);
+			}
+			return Notation == EJsonNotation::ObjectEnd;
+		}
+
+		/** Reads the columns of a batch, arrays of values or dictionaries with an index per value */
+		bool ReadColumns(TArray<TPair<FString, TArray<FValue>>>& OutColumns)
+		{
+			EJsonNotation Notation;
+			while (Next(Notation))
+			{
+				if (Notation == EJsonNotation::ObjectEnd)
+				{
+					return true;
+				}
+				if (!IsNested(Notation))
+				{
+					continue;
+				}
+				TArray<FValue>& Values = OutColumns.Emplace_GetRef(Reader->GetIdentifier(), TArray<FValue>()).Value;
+				if (Notation == EJsonNotation::ArrayStart)
+				{
+					if (!ReadValueArray(Values))
+					{
+						return false;
+					}
+					continue;
+				}
+				TArray<FValue> Dictionary;
+				TArray<FValue> Indices;
+				while (Next(Notation) && Notation != EJsonNotation::ObjectEnd)
+				{
+					const bool bRead = Notation != EJsonNotation::ArrayStart ? !IsNested(Notation) || Skip()
+									   : Reader->GetIdentifier() == TEXT("dictionary") ? ReadValueArray(Dictionary)
+									   : Reader->GetIdentifier() == TEXT("indices")	   ? ReadValueArray(Indices)
+																					   : Skip();
+					if (!bRead)
+					{
+						return false;
+					}
+				}
+				if (Notation != EJsonNotation::ObjectEnd)
+				{
+					return false;
+				}
+				Values.Reserve(Indices.Num());
+				for (const FValue& Index : Indices)
+				{
+					const int32 DictionaryIndex = FCString::Atoi(*Index.Text);
+					Values.Add(!Index.bNull && Dictionary.IsValidIndex(DictionaryIndex) ? Dictionary[DictionaryIndex] : FValue());
+				}
+			}
+			return false;
+		}
+
+		TSharedRef<TJsonReader<>> Reader;
+		FSessionChunk& Chunk;
+		FFields Header;
+		/** Default attributes in effect, from the header or the last defaultsChanged record */
+		FFields Defaults;
+		/** Attributes of the record being read, kept around to reuse the allocation */
+		FFields Fields;
+	};
+
+	/** A column of the dataset and where its values are in the chunks */
+	struct FDatasetColumn
+	{
+		FString Name;
+		EColumnType Type = EColumnType::Null;
+		/** Index of the column in every chunk, INDEX_NONE for chunks without it */
+		TArray<int32> ChunkColumns;
+		FString ValuesFile;
+		FString DictionaryFile;
+		int32 DictionarySize = 0;
+		int64 Bytes = 0;
+		bool bWritten = false;
+	};
+
+	/** Interns the strings of a column into the dataset wide dictionary */
+	struct FStringDictionary
+	{
+		TMap<FString, uint32> Ids;
+		TArray<FString> Values;
+
+		uint32 Intern(const FString& Value)
+		{
+			uint32& Id = Ids.FindOrAdd(Value, (uint32)Values.Num());
+			if (Id == (uint32)Values.Num())
+			{
+				Values.Add(Value);
+			}
+			return Id;
+		}
+	};
+
+	void WriteNulls(FArchive& Writer, const void* Null, int32 Size, int32 Count)
+	{
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			Writer.Serialize(const_cast<void*>(Null), Size);
+		}
+	}
+
+	bool WriteColumn(const FString& OutputDir, FDatasetColumn& Column, const TArray<FSessionChunk>& Chunks)
+	{
+		ARCTICANALYTICS_TRACE_SCOPE(DatasetConverter::WriteColumn);
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*(OutputDir / Column.ValuesFile)));
+		if (!Writer)
+		{
+			return false;
+		}
+		FStringDictionary Dictionary;
+		TArray<uint32> StringIds;
+		TArray<double> Doubles;
+		for (int32 ChunkIndex = 0; ChunkIndex < Chunks.Num(); ++ChunkIndex)
+		{
+			const FSessionChunk& Chunk = Chunks[ChunkIndex];
+			const FChunkColumn* ChunkColumn = Column.ChunkColumns[ChunkIndex] != INDEX_NONE ? &Chunk.Columns[Column.ChunkColumns[ChunkIndex]] : nullptr;
+			const EColumnType ChunkType = ChunkColumn ? ChunkColumn->Type : EColumnType::Null;
+			if (Column.Type == EColumnType::Int)
+			{
+				if (ChunkType == EColumnType::Int)
+				{
+					Writer->Serialize(const_cast<int64*>(ChunkColumn->Ints.GetData()), ChunkColumn->Ints.Num() * sizeof(int64));
+				}
+				else
+				{
+					WriteNulls(*Writer, &NullInt, sizeof(int64), Chunk.NumRows);
+				}
+			}
+			else if (Column.Type == EColumnType::Double)
+			{
+				if (ChunkType == EColumnType::Double)
+				{
+					Writer->Serialize(const_cast<double*>(ChunkColumn->Doubles.GetData()), ChunkColumn->Doubles.Num() * sizeof(double));
+					continue;
+				}
+				Doubles.SetNumUninitialized(Chunk.NumRows);
+				for (int32 Row = 0; Row < Chunk.NumRows; ++Row)
+				{
+					Doubles[Row] = ChunkType == EColumnType::Int && ChunkColumn->Ints[Row] != NullInt ? (double)ChunkColumn->Ints[Row] : NullDouble;
+				}
+				Writer->Serialize(Doubles.GetData(), Doubles.Num() * sizeof(double));
+			}
+			else
+			{
+				// Numbers of files where the column also held text are written in their shortest form
+				StringIds.SetNumUninitialized(Chunk.NumRows);
+				TArray<uint32> LocalToDataset;
+				if (ChunkType == EColumnType::String)
+				{
+					for (const FString& Value : ChunkColumn->Dictionary)
+					{
+						LocalToDataset.Add(Dictionary.Intern(Value));
+					}
+				}
+				for (int32 Row = 0; Row < Chunk.NumRows; ++Row)
+				{
+					switch (ChunkType)
+					{
+					case EColumnType::String:
+						StringIds[Row] = ChunkColumn->Ids[Row] == INDEX_NONE ? NullStringId : LocalToDataset[ChunkColumn->Ids[Row]];
+						break;
+					case EColumnType::Int:
+						StringIds[Row] = ChunkColumn->Ints[Row] == NullInt ? NullStringId : Dictionary.Intern(LexToString(ChunkColumn->Ints[Row]));
+						break;
+					case EColumnType::Double:
+						StringIds[Row] = FMath::IsNaN(ChunkColumn->Doubles[Row]) ? NullStringId : Dictionary.Intern(FString::SanitizeFloat(ChunkColumn->Doubles[Row]));
+						break;
+					default:
+						StringIds[Row] = NullStringId;
+						break;
+					}
+				}
+				Writer->Serialize(StringIds.GetData(), StringIds.Num() * sizeof(uint32));
+			}
+		}
+		Column.Bytes = Writer->Tell();
+		if (!Writer->Close())
+		{
+			return false;
+		}
+		if (Column.Type != EColumnType::String)
+		{
+			return true;
+		}
+
+		// Count, count + 1 offsets, then the UTF-8 bytes of every value
+		Writer.Reset(IFileManager::Get().CreateFileWriter(*(OutputDir / Column.DictionaryFile)));
+		if (!Writer)
+		{
+			return false;
+		}
+		uint64 Count = (uint64)Dictionary.Values.Num();
+		*Writer << Count;
+		TArray<ANSICHAR> Bytes;
+		uint64 Offset = 0;
+		for (const FString& Value : Dictionary.Values)
+		{
+			*Writer << Offset;
+			FTCHARToUTF8 Converted(*Value, Value.Len());
+			Bytes.Append(Converted.Get(), Converted.Length());
+			Offset = Bytes.Num();
+		}
+		*Writer << Offset;
+		Writer->Serialize(Bytes.GetData(), Bytes.Num());
+		Column.DictionarySize = (int32)Count;
+		Column.Bytes += Writer->Tell();
+		return Writer->Close();
+	}
+
+	/** Makes a column name safe to be part of a file name */
+	FString GetColumnFileName(int32 ColumnIndex, const FString& Name)
+	{
+		FString SafeName = Name.Left(48);
+		for (TCHAR& Char : SafeName)
+		{
+			Char = FChar::IsAlnum(Char) || Char == TEXT('_') || Char == TEXT('.') ? Char : TEXT('_');
+		}
+		return FString::Printf(TEXT("%04d-%s"), ColumnIndex, *SafeName);
+	}
+}
+
+bool FArcticAnalyticsDatasetConverter::Convert(const FString& InputDir, const FString& OutputDir, int32 NumWorkers, FArcticAnalyticsConversionStats& OutStats)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(DatasetConverter::Convert);
+	OutStats = FArcticAnalyticsConversionStats();
+	TArray<FString> Files;
+	IFileManager::Get().FindFilesRecursive(Files, *InputDir, TEXT("*.analytics"), true, false);
+	Files.Sort();
+	if (Files.Num() == 0)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("No session files to convert in (%s)"), *InputDir);
+		return false;
+	}
+
+	// Workers take the next file until there are none left, so large and small files even out
+	double StartTime = FPlatformTime::Seconds();
+	TArray<FSessionChunk> Chunks;
+	Chunks.SetNum(Files.Num());
+	std::atomic<int32> NextFile{0};
+	OutStats.NumWorkers = FMath::Clamp(NumWorkers, 1, Files.Num());
+	TArray<TFuture<void>> Workers;
+	for (int32 Worker = 0; Worker < OutStats.NumWorkers; ++Worker)
+	{
+		Workers.Add(Async(EAsyncExecution::Thread, [&Files, &Chunks, &NextFile]()
+		{
+			for (int32 FileIndex = NextFile++; FileIndex < Files.Num(); FileIndex = NextFile++)
+			{
+				ARCTICANALYTICS_TRACE_SCOPE(DatasetConverter::Parse);
+				FSessionChunk& Chunk = Chunks[FileIndex];
+				Chunk.Path = Files[FileIndex];
+				TUniquePtr<FArchive> File(IFileManager::Get().CreateFileReader(*Chunk.Path));
+				if (File)
+				{
+					Chunk.Bytes = File->TotalSize();
+					FUtf8FileArchive Content(MoveTemp(File));
+					Chunk.bParsed = FSessionParser(Content, Chunk).Parse() && !Content.IsError();
+				}
+				if (Chunk.bParsed)
+				{
+					Chunk.Finish();
+				}
+				else
+				{
+					// Partial rows of a damaged file are not kept
+					Chunk.Columns.Empty();
+					Chunk.ColumnIds.Empty();
+					Chunk.NumRows = 0;
+				}
+			}
+		}));
+	}
+	for (TFuture<void>& Worker : Workers)
+	{
+		Worker.Wait();
+	}
+	OutStats.ParseSeconds = FPlatformTime::Seconds() - StartTime;
+
+	StartTime = FPlatformTime::Seconds();
+	TArray<FDatasetColumn> Columns;
+	TMap<FString, int32> ColumnIds;
+	for (int32 ChunkIndex = 0; ChunkIndex < Chunks.Num(); ++ChunkIndex)
+	{
+		const FSessionChunk& Chunk = Chunks[ChunkIndex];
+		OutStats.NumFiles += Chunk.bParsed ? 1 : 0;
+		OutStats.NumFailedFiles += Chunk.bParsed ? 0 : 1;
+		OutStats.InputBytes += Chunk.bParsed ? Chunk.Bytes : 0;
+		OutStats.NumRows += Chunk.NumRows;
+		for (int32 Index = 0; Index < Chunk.Columns.Num(); ++Index)
+		{
+			const FChunkColumn& ChunkColumn = Chunk.Columns[Index];
+			int32& ColumnId = ColumnIds.FindOrAdd(ChunkColumn.Name, Columns.Num());
+			if (ColumnId == Columns.Num())
+			{
+				FDatasetColumn& Column = Columns.AddDefaulted_GetRef();
+				Column.Name = ChunkColumn.Name;
+				Column.ChunkColumns.Init(INDEX_NONE, Chunks.Num());
+			}
+			FDatasetColumn& Column = Columns[ColumnId];
+			Column.ChunkColumns[ChunkIndex] = Index;
+			Column.Type = FMath::Max(Column.Type, ChunkColumn.Type);
+		}
+	}
+	for (FSessionChunk& Chunk : Chunks)
+	{
+		if (!Chunk.bParsed)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session (%s) could not be parsed and is left out of the dataset"), *Chunk.Path);
+		}
+	}
+
+	// Replace the files of an earlier dataset
+	IFileManager& FileManager = IFileManager::Get();
+	FileManager.MakeDirectory(*OutputDir, true);
+	for (const TCHAR* Pattern : {TEXT("*.values"), TEXT("*.dictionary"), TEXT("dataset.json")})
+	{
+		TArray<FString> OldFiles;
+		FileManager.FindFiles(OldFiles, *(OutputDir / Pattern), true, false);
+		for (const FString& OldFile : OldFiles)
+		{
+			FileManager.Delete(*(OutputDir / OldFile));
+		}
+	}
+
+	for (int32 ColumnIndex = 0; ColumnIndex < Columns.Num(); ++ColumnIndex)
+	{
+		FDatasetColumn& Column = Columns[ColumnIndex];
+		// Columns that never had a value are strings of missing values
+		Column.Type = Column.Type == EColumnType::Null ? EColumnType::String : Column.Type;
+		const FString FileName = GetColumnFileName(ColumnIndex, Column.Name);
+		Column.ValuesFile = FileName + TEXT(".values");
+		Column.DictionaryFile = Column.Type == EColumnType::String ? FileName + TEXT(".dictionary") : FString();
+	}
+	ParallelFor(Columns.Num(), [&Columns, &Chunks, &OutputDir](int32 ColumnIndex)
+	{
+		Columns[ColumnIndex].bWritten = WriteColumn(OutputDir, Columns[ColumnIndex], Chunks);
+	});
+
+	TSharedRef<FJsonObject> Manifest = MakeShared<FJsonObject>();
+	Manifest->SetStringField(TEXT("format"), TEXT("ArcticAnalyticsColumnar"));
+	Manifest->SetNumberField(TEXT("version"), 1);
+	Manifest->SetStringField(TEXT("created"), FDateTime::UtcNow().ToIso8601());
+	Manifest->SetStringField(TEXT("byteOrder"), TEXT("little"));
+	Manifest->SetStringField(TEXT("nullInt64"), LexToString(NullInt));
+	Manifest->SetStringField(TEXT("nullDouble"), TEXT("NaN"));
+	Manifest->SetNumberField(TEXT("nullStringId"), NullStringId);
+	Manifest->SetNumberField(TEXT("rows"), (double)OutStats.NumRows);
+	TArray<TSharedPtr<FJsonValue>> FileValues;
+	TArray<TSharedPtr<FJsonValue>> FailedFileValues;
+	int64 FirstRow = 0;
+	for (const FSessionChunk& Chunk : Chunks)
+	{
+		if (!Chunk.bParsed)
+		{
+			FailedFileValues.Add(MakeShared<FJsonValueString>(Chunk.Path));
+			continue;
+		}
+		TSharedRef<FJsonObject> File = MakeShared<FJsonObject>();
+		File->SetStringField(TEXT("path"), Chunk.Path);
+		File->SetNumberField(TEXT("firstRow"), (double)FirstRow);
+		File->SetNumberField(TEXT("rows"), Chunk.NumRows);
+		FileValues.Add(MakeShared<FJsonValueObject>(File));
+		FirstRow += Chunk.NumRows;
+	}
+	Manifest->SetArrayField(TEXT("files"), FileValues);
+	Manifest->SetArrayField(TEXT("failedFiles"), FailedFileValues);
+	bool bWritten = true;
+	TArray<TSharedPtr<FJsonValue>> ColumnValues;
+	for (const FDatasetColumn& Column : Columns)
+	{
+		bWritten = bWritten && Column.bWritten;
+		OutStats.OutputBytes += Column.Bytes;
+		TSharedRef<FJsonObject> ColumnObject = MakeShared<FJsonObject>();
+		ColumnObject->SetStringField(TEXT("name"), Column.Name);
+		ColumnObject->SetStringField(TEXT("type"), ColumnTypeNames[(int32)Column.Type]);
+		ColumnObject->SetStringField(TEXT("values"), Column.ValuesFile);
+		if (Column.Type == EColumnType::String)
+		{
+			ColumnObject->SetStringField(TEXT("dictionary"), Column.DictionaryFile);
+			ColumnObject->SetNumberField(TEXT("dictionarySize"), Column.DictionarySize);
+		}
+		ColumnValues.Add(MakeShared<FJsonValueObject>(ColumnObject));
+	}
+	Manifest->SetArrayField(TEXT("columns"), ColumnValues);
+	OutStats.NumColumns = Columns.Num();
+	OutStats.WriteSeconds = FPlatformTime::Seconds() - StartTime;
+
+	TSharedRef<FJsonObject> Stats = MakeShared<FJsonObject>();
+	Stats->SetNumberField(TEXT("workers"), OutStats.NumWorkers);
+	Stats->SetNumberField(TEXT("inputBytes"), (double)OutStats.InputBytes);
+	Stats->SetNumberField(TEXT("outputBytes"), (double)OutStats.OutputBytes);
+	Stats->SetNumberField(TEXT("parseSeconds"), OutStats.ParseSeconds);
+	Stats->SetNumberField(TEXT("writeSeconds"), OutStats.WriteSeconds);
+	Stats->SetNumberField(TEXT("filesPerSecond"), OutStats.GetFilesPerSecond());
+	Stats->SetNumberField(TEXT("megabytesPerSecond"), OutStats.GetMegabytesPerSecond());
+	Manifest->SetObjectField(TEXT("conversion"), Stats);
+
+	FString Json;
+	FJsonSerializer::Serialize(Manifest, TJsonWriterFactory<>::Create(&Json));
+	bWritten = bWritten && FFileHelper::SaveStringToFile(Json, *(OutputDir / TEXT("dataset.json")));
+	if (!bWritten)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Dataset (%s) could not be written"), *OutputDir);
+	}
+	return bWritten;
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/** Converts session files to a dataset, optionally with 1, 2, 4... workers to show how it scales */
+	void ConvertSessions(const TArray<FString>& Args)
+	{
+		const FString Line = FString::Join(Args, TEXT(" "));
+		FString InputDir = FPaths::ProjectSavedDir() / TEXT("Analytics");
+		FString OutputDir = InputDir / TEXT("Dataset");
+		int32 Threads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+		bool bScaling = false;
+		FParse::Value(*Line, TEXT("Input="), InputDir);
+		FParse::Value(*Line, TEXT("Output="), OutputDir);
+		FParse::Value(*Line, TEXT("Threads="), Threads);
+		FParse::Bool(*Line, TEXT("Scaling="), bScaling);
+		Threads = FMath::Clamp(Threads, 1, 256);
+
+		TArray<TSharedPtr<FJsonValue>> Runs;
+		for (int32 NumWorkers = bScaling ? 1 : Threads; NumWorkers <= Threads; NumWorkers = NumWorkers < Threads ? FMath::Min(NumWorkers * 2, Threads) : Threads + 1)
+		{
+			FArcticAnalyticsConversionStats Stats;
+			if (!FArcticAnalyticsDatasetConverter::Convert(InputDir, OutputDir, NumWorkers, Stats))
+			{
+				return;
+			}
+			UE_LOG(LogArcticAnalyticsAnalytics, Display,
+				   TEXT("Converted %d session files (%d failed, %.1fMB) to %lld rows in %d columns (%.1fMB) with %d workers: parse %.2fs (%.1f files/s, %.1fMB/s), ")
+				   TEXT("write %.2fs, overall %.1f files/s, %.1fMB/s"),
+				   Stats.NumFiles, Stats.NumFailedFiles, Stats.InputBytes / (1024.0 * 1024.0), Stats.NumRows, Stats.NumColumns, Stats.OutputBytes / (1024.0 * 1024.0),
+				   Stats.NumWorkers, Stats.ParseSeconds, Stats.NumFiles / FMath::Max(Stats.ParseSeconds, 1e-9),
+				   Stats.InputBytes / (1024.0 * 1024.0) / FMath::Max(Stats.ParseSeconds, 1e-9), Stats.WriteSeconds, Stats.GetFilesPerSecond(), Stats.GetMegabytesPerSecond());
+
+			TSharedRef<FJsonObject> Run = MakeShared<FJsonObject>();
+			Run->SetNumberField(TEXT("workers"), Stats.NumWorkers);
+			Run->SetNumberField(TEXT("files"), Stats.NumFiles);
+			Run->SetNumberField(TEXT("inputBytes"), (double)Stats.InputBytes);
+			Run->SetNumberField(TEXT("rows"), (double)Stats.NumRows);
+			Run->SetNumberField(TEXT("parseSeconds"), Stats.ParseSeconds);
+			Run->SetNumberField(TEXT("writeSeconds"), Stats.WriteSeconds);
+			Run->SetNumberField(TEXT("filesPerSecond"), Stats.GetFilesPerSecond());
+			Run->SetNumberField(TEXT("megabytesPerSecond"), Stats.GetMegabytesPerSecond());
+			Runs.Add(MakeShared<FJsonValueObject>(Run));
+		}
+
+		TSharedRef<FJsonObject> Results = MakeShared<FJsonObject>();
+		Results->SetStringField(TEXT("timestamp"), FDateTime::UtcNow().ToIso8601());
+		Results->SetStringField(TEXT("platform"), FPlatformProperties::IniPlatformName());
+		Results->SetStringField(TEXT("input"), InputDir);
+		Results->SetArrayField(TEXT("runs"), Runs);
+		const FString ResultsPath = FPaths::ProjectSavedDir() / TEXT("Analytics") / TEXT("BenchmarkResults") /
+									FString::Printf(TEXT("ArcticAnalyticsConvert-%s.json"), *FDateTime::Now().ToString());
+		FString Json;
+		FJsonSerializer::Serialize(Results, TJsonWriterFactory<>::Create(&Json));
+		FFileHelper::SaveStringToFile(Json, *ResultsPath);
+		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Dataset written to (%s), conversion results to (%s)"), *OutputDir, *ResultsPath);
+	}
+
+	FAutoConsoleCommand ConvertSessionsCommand(TEXT("ArcticAnalytics.ConvertSessions"),
+		TEXT("Converts a directory of session files into a columnar, memory mappable dataset and reports files/s and MB/s. ")
+		TEXT("Args: [Input=Saved/Analytics] [Output=Saved/Analytics/Dataset] [Threads=cores] [Scaling=false]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&ConvertSessions));
+}
+
+#endif
@@ -0,0 +1,60 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Throughput of converting session files to a dataset */
+struct FArcticAnalyticsConversionStats
+{
+	int32 NumWorkers = 0;
+	int32 NumFiles = 0;
+	/** Files that could not be read or parsed and are left out of the dataset */
+	int32 NumFailedFiles = 0;
+	/** Bytes of the parsed files, like NumFiles */
+	int64 InputBytes = 0;
+	int64 NumRows = 0;
+	int32 NumColumns = 0;
+	int64 OutputBytes = 0;
+	/** Wall time of reading and parsing the files */
+	double ParseSeconds = 0.0;
+	/** Wall time of merging the files and writing the columns */
+	double WriteSeconds = 0.0;
+
+	double GetFilesPerSecond() const
+	{
+		return NumFiles / FMath::Max(ParseSeconds + WriteSeconds, 1e-9);
+	}
+
+	double GetMegabytesPerSecond() const
+	{
+		return InputBytes / (1024.0 * 1024.0) / FMath::Max(ParseSeconds + WriteSeconds, 1e-9);
+	}
+};
+
+/**
+ * Converts a directory of session files into a columnar dataset for offline tooling.
+ *
+ * Files are read by a pool of workers, one file per worker at a time. A worker reads its file in 64 KB blocks and
+ * decodes them from UTF-8 as its streaming pull parser, which follows perf-data.schema.json, asks for more, so a
+ * file is never held in memory as a whole. Every event becomes a row, the events of a columnar batch one row each.
+ * Every attribute name becomes a column, as do the session header fields, the default attributes in effect,
+ * EventName, TimestampMs and RecordId.
+ *
+ * A column holds int64 if all its values are integers, double if they are all numbers, and otherwise strings that
+ * are dictionary encoded. Each column is written to its own file as a flat little endian array, so it can be memory
+ * mapped as is. String columns hold uint32 dictionary ids, and their dictionary file holds the count, count + 1
+ * uint64 offsets and the UTF-8 bytes of the values. Missing values are MIN_int64, NaN or MAX_uint32. dataset.json
+ * describes the columns and the rows of every file.
+ */
+class FArcticAnalyticsDatasetConverter
+{
+public:
+	/**
+	 * Converts every *.analytics file under InputDir into a dataset in OutputDir, replacing a dataset already there.
+	 *
+	 * @param NumWorkers files parsed at the same time
+	 * @return false if no dataset could be written
+	 */
+	static bool Convert(const FString& InputDir, const FString& OutputDir, int32 NumWorkers, FArcticAnalyticsConversionStats& OutStats);
+};
@@ -0,0 +1,79 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsErrorCoalescer.h"
+
+#include "HAL/PlatformTime.h"
+#include "Hash/CityHash.h"
+
+FArcticAnalyticsErrorCoalescer::FArcticAnalyticsErrorCoalescer(int32 InNumSlots, float InWindowSeconds)
+	: MaxEntries((int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(InNumSlots, 4)) * 3 / 4), WindowSeconds(InWindowSeconds), WindowStart(0.0)
+{
+	Slots.SetNum((int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(InNumSlots, 4)));
+	Order.Reserve(MaxEntries);
+}
+
+uint64 FArcticAnalyticsErrorCoalescer::HashError(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	uint64 Hash = CityHash64((const char*)*Error, Error.Len() * sizeof(TCHAR));
+	for (const FAnalyticsEventAttribute& Attribute : Attributes)
+	{
+		const FString& Name = Attribute.GetName();
+		const FString& Value = Attribute.GetValue();
+		Hash = CityHash64WithSeed((const char*)*Name, Name.Len() * sizeof(TCHAR), Hash);
+		Hash = CityHash64WithSeed((const char*)*Value, Value.Len() * sizeof(TCHAR), Hash);
+	}
+	// 0 marks free slots
+	return Hash != 0 ? Hash : 1;
+}
+
+void FArcticAnalyticsErrorCoalescer::Add(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes, double TimestampUTC)
+{
+	check(Order.Num() < MaxEntries);
+
+	const uint64 Hash = HashError(Error, Attributes);
+	const int32 Mask = Slots.Num() - 1;
+	// Linear probing, the table is never more than 3/4 full so a free slot is always found
+	for (int32 Index = (int32)(Hash & Mask);; Index = (Index + 1) & Mask)
+	{
+		FEntry& Entry = Slots[Index];
+		if (Entry.Hash == Hash && Entry.Error.Equals(Error, ESearchCase::CaseSensitive))
+		{
+			++Entry.Count;
+			Entry.LastTimestampUTC = TimestampUTC;
+			return;
+		}
+		if (Entry.Hash == 0)
+		{
+			if (Order.Num() == 0)
+			{
+				WindowStart = FPlatformTime::Seconds();
+			}
+			Entry.Hash = Hash;
+			Entry.Error = Error;
+			Entry.Attributes = Attributes;
+			Entry.Count = 1;
+			Entry.FirstTimestampUTC = TimestampUTC;
+			Entry.LastTimestampUTC = TimestampUTC;
+			Order.Add(Index);
+			return;
+		}
+	}
+}
+
+void FArcticAnalyticsErrorCoalescer::Drain(TFunctionRef<void(const FEntry&)> Visitor)
+{
+	for (int32 Index : Order)
+	{
+		Visitor(Slots[Index]);
+	}
+	for (int32 Index : Order)
+	{
+		// Strings are reset rather than emptied so the next storm of the same errors reuses the allocations
+		FEntry& Entry = Slots[Index];
+		Entry.Hash = 0;
+		Entry.Error.Reset();
+		Entry.Attributes.Reset();
+		Entry.Count = 0;
+	}
+	Order.Reset();
+}
@@ -0,0 +1,62 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+
+/**
+ * Collapses repeats of the same error and attributes within a time window into a single entry with a
+ * count and the first and last timestamps, so an error storm costs O(distinct errors) to write.
+ *
+ * Entries live in a small fixed size open addressing table keyed by a hash of the error and attributes.
+ */
+class FArcticAnalyticsErrorCoalescer
+{
+public:
+	struct FEntry
+	{
+		/** Hash of the error and attributes, 0 marks a free slot */
+		uint64 Hash = 0;
+		FString Error;
+		TArray<FAnalyticsEventAttribute> Attributes;
+		uint32 Count = 0;
+		double FirstTimestampUTC = 0.0;
+		double LastTimestampUTC = 0.0;
+	};
+
+	/**
+	 * @param InNumSlots size of the table, rounded up to a power of two
+	 * @param InWindowSeconds how long repeats are collapsed for, counted from the first error of the window
+	 */
+	FArcticAnalyticsErrorCoalescer(int32 InNumSlots, float InWindowSeconds);
+
+	bool IsEmpty() const
+	{
+		return Order.Num() == 0;
+	}
+
+	/** Whether the window is over or the table is too full to take another distinct error */
+	bool NeedsDrain(double Now) const
+	{
+		return Order.Num() > 0 && (Now - WindowStart >= WindowSeconds || Order.Num() >= MaxEntries);
+	}
+
+	/** Counts an error. NeedsDrain must have been checked first, so there is room for a new entry */
+	void Add(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes, double TimestampUTC);
+
+	/** Visits the entries in the order they were first seen and empties the table */
+	void Drain(TFunctionRef<void(const FEntry&)> Visitor);
+
+private:
+	static uint64 HashError(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes);
+
+	TArray<FEntry> Slots;
+	/** Used slot indices in the order they were first seen */
+	TArray<int32> Order;
+	/** Number of entries after which the window is closed early, keeps probe sequences short */
+	const int32 MaxEntries;
+	const double WindowSeconds;
+	/** Time the first error of the current window was added */
+	double WindowStart;
+};
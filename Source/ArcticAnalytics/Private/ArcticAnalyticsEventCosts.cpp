@@ -0,0 +1,96 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsEventCosts.h"
+
+#include "Hash/CityHash.h"
+
+FArcticAnalyticsEventCosts::FArcticAnalyticsEventCosts(int32 InNumSlots)
+	: MaxNames((int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(InNumSlots, 8)) / 2), OverflowIndex(INDEX_NONE)
+{
+	Slots.SetNum((int32)FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(InNumSlots, 8)));
+	Order.Reserve(MaxNames + 1);
+}
+
+uint64 FArcticAnalyticsEventCosts::HashName(const FString& EventName)
+{
+	const uint64 Hash = CityHash64((const char*)*EventName, EventName.Len() * sizeof(TCHAR));
+	// 0 marks free slots
+	return Hash != 0 ? Hash : 1;
+}
+
+int32 FArcticAnalyticsEventCosts::Intern(const FString& EventName)
+{
+	const uint64 Hash = HashName(EventName);
+	const int32 Mask = Slots.Num() - 1;
+	// Linear probing, the table is never more than half full so a free slot is always found
+	for (int32 Index = (int32)(Hash & Mask);; Index = (Index + 1) & Mask)
+	{
+		FSlot& Slot = Slots[Index];
+		if (Slot.Hash == Hash && Slot.Cost.EventName.Equals(EventName, ESearchCase::CaseSensitive))
+		{
+			return Index;
+		}
+		if (Slot.Hash == 0)
+		{
+			if (Order.Num() >= MaxNames)
+			{
+				if (OverflowIndex == INDEX_NONE)
+				{
+					// The one slot beyond MaxNames, claimed the first time the table runs out of room
+					OverflowIndex = Index;
+					Slot.Hash = 1;
+					Slot.Cost.EventName = TEXT("(other)");
+					Order.Add(Index);
+				}
+				return OverflowIndex;
+			}
+			Slot.Hash = Hash;
+			Slot.Cost.EventName = EventName;
+			Order.Add(Index);
+			return Index;
+		}
+	}
+}
+
+TArray<FArcticAnalyticsEventCost> FArcticAnalyticsEventCosts::Consume()
+{
+	TArray<FArcticAnalyticsEventCost> Costs;
+	Costs.Reserve(Order.Num());
+	for (int32 Index : Order)
+	{
+		Costs.Add(Slots[Index].Cost);
+	}
+	Reset();
+
+	Costs.Sort([](const FArcticAnalyticsEventCost& A, const FArcticAnalyticsEventCost& B)
+	{
+		return A.EncodedBytes != B.EncodedBytes ? A.EncodedBytes > B.EncodedBytes : A.EncodeCycles > B.EncodeCycles;
+	});
+	return Costs;
+}
+
+void FArcticAnalyticsEventCosts::Reset()
+{
+	for (int32 Index : Order)
+	{
+		Slots[Index] = FSlot();
+	}
+	Order.Reset();
+	OverflowIndex = INDEX_NONE;
+}
+
+TArray<FAnalyticsEventAttribute> FArcticAnalyticsEventCosts::ToAttributes(const TArray<FArcticAnalyticsEventCost>& Costs, int32 MaxEntries)
+{
+	TArray<FAnalyticsEventAttribute> Attributes;
+	const int32 NumEntries = FMath::Min(Costs.Num(), MaxEntries);
+	Attributes.Reserve(NumEntries * 4);
+	for (int32 Index = 0; Index < NumEntries; ++Index)
+	{
+		const FArcticAnalyticsEventCost& Cost = Costs[Index];
+		Attributes.Emplace(Cost.EventName + TEXT(".count"), Cost.Count);
+		Attributes.Emplace(Cost.EventName + TEXT(".bytes"), Cost.EncodedBytes);
+		Attributes.Emplace(Cost.EventName + TEXT(".attributesPerEvent"), Cost.GetAttributesPerEvent());
+		Attributes.Emplace(Cost.EventName + TEXT(".encodeMs"), Cost.GetEncodeSeconds() * 1000.0);
+	}
+	return Attributes;
+}
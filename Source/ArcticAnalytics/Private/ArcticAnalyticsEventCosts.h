@@ -0,0 +1,95 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+#include "HAL/PlatformTime.h"
+
+/** What the events of one name cost over a session */
+struct FArcticAnalyticsEventCost
+{
+	FString EventName;
+	int64 Count = 0;
+	int64 EncodedBytes = 0;
+	int64 Attributes = 0;
+	uint64 EncodeCycles = 0;
+
+	double GetAttributesPerEvent() const
+	{
+		return Count > 0 ? (double)Attributes / Count : 0.0;
+	}
+
+	double GetEncodeSeconds() const
+	{
+		return EncodeCycles * FPlatformTime::GetSecondsPerCycle64();
+	}
+};
+
+/**
+ * Per event name accounting of a session, so the call sites that produce most of a session's bytes can be found.
+ *
+ * Names are interned into a small fixed size open addressing table keyed by a hash of the name, so counting an
+ * event costs one hash and a probe. Once the table holds its maximum number of names, further names are counted
+ * under "(other)". Not thread safe, it is updated with the session writes.
+ */
+class FArcticAnalyticsEventCosts
+{
+public:
+	/** @param InNumSlots size of the table, rounded up to a power of two. Half of it is used at most */
+	explicit FArcticAnalyticsEventCosts(int32 InNumSlots);
+
+	/** Returns the index of the name in the table, adding it if needed */
+	int32 Intern(const FString& EventName);
+
+	/** Counts one event with its encoded size and the cycles spent encoding and writing it */
+	void Add(int32 Index, int32 NumAttributes, int64 EncodedBytes, uint64 EncodeCycles)
+	{
+		FArcticAnalyticsEventCost& Cost = Slots[Index].Cost;
+		++Cost.Count;
+		Cost.Attributes += NumAttributes;
+		Cost.EncodedBytes += EncodedBytes;
+		Cost.EncodeCycles += EncodeCycles;
+	}
+
+	/** Counts one event whose encoding is charged separately, such as one appended to a columnar batch */
+	void AddEvent(int32 Index, int32 NumAttributes, uint64 Cycles)
+	{
+		Add(Index, NumAttributes, 0, Cycles);
+	}
+
+	/** Charges encoded bytes and cycles to events counted before */
+	void AddEncoded(int32 Index, int64 EncodedBytes, uint64 EncodeCycles)
+	{
+		FArcticAnalyticsEventCost& Cost = Slots[Index].Cost;
+		Cost.EncodedBytes += EncodedBytes;
+		Cost.EncodeCycles += EncodeCycles;
+	}
+
+	/** Returns the costs sorted by encoded bytes, then encode time, and empties the table */
+	TArray<FArcticAnalyticsEventCost> Consume();
+
+	/** Empties the table */
+	void Reset();
+
+	/** Converts the first MaxEntries costs to event attributes, four per event name */
+	static TArray<FAnalyticsEventAttribute> ToAttributes(const TArray<FArcticAnalyticsEventCost>& Costs, int32 MaxEntries);
+
+private:
+	struct FSlot
+	{
+		/** Hash of the name, 0 marks a free slot */
+		uint64 Hash = 0;
+		FArcticAnalyticsEventCost Cost;
+	};
+
+	static uint64 HashName(const FString& EventName);
+
+	TArray<FSlot> Slots;
+	/** Used slot indices in the order they were first seen */
+	TArray<int32> Order;
+	/** Number of names after which new names go to the overflow slot, keeps probe sequences short */
+	const int32 MaxNames;
+	/** Slot of "(other)", or INDEX_NONE while the table has room */
+	int32 OverflowIndex;
+};
@@ -0,0 +1,94 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+#include "Misc/StringBuilder.h"
+
+/**
+ * Encoding of single event records, shared by every writer so all session files have the same layout
+ */
+namespace ArcticAnalyticsEventJson
+{
+	/** Writes a line of a session as UTF-8, so every session file has the same encoding whichever writer produced it */
+	inline void WriteLine(FArchive& Ar, FStringView Line)
+	{
+		const FTCHARToUTF8 Converted(Line.GetData(), Line.Len());
+		Ar.Serialize(const_cast<ANSICHAR*>(Converted.Get()), Converted.Length());
+		Ar.Serialize(const_cast<ANSICHAR*>(LINE_TERMINATOR_ANSI), sizeof(LINE_TERMINATOR_ANSI) - 1);
+	}
+
+	/** Formats and writes a line of a session as UTF-8. Use instead of FArchive::Logf, which narrows to ANSI */
+	template <typename FmtType, typename... Types>
+	void WriteLinef(FArchive& Ar, const FmtType& Fmt, Types... Args)
+	{
+		TStringBuilder<512> Builder;
+		Builder.Appendf(Fmt, Args...);
+		WriteLine(Ar, Builder.ToView());
+	}
+
+	/** Appends the attributes as a JSON object of name value pairs */
+	inline void AppendAttributesObject(FStringBuilderBase& Builder, const TArray<FAnalyticsEventAttribute>& Attributes)
+	{
+		Builder.AppendChar(TEXT('{'));
+		for (int32 Index = 0; Index < Attributes.Num(); ++Index)
+		{
+			const FAnalyticsEventAttribute& Attribute = Attributes[Index];
+			Builder.Appendf(Index == 0 ? TEXT(" \"%s\": ") : TEXT(", \"%s\": "), *Attribute.GetName());
+			if (Attribute.IsJsonFragment())
+			{
+				Builder.Append(Attribute.GetValue());
+			}
+			else
+			{
+				Builder.Appendf(TEXT("\"%s\""), *Attribute.GetValue());
+			}
+		}
+		Builder.Append(Attributes.Num() > 0 ? TEXT(" }") : TEXT("}"));
+	}
+
+	/** Appends the start of a RecordEvent record, up to where AppendEventRecordId goes */
+	inline void AppendEventStart(FStringBuilderBase& Builder, const FString& EventName, double TimestampUTC)
+	{
+		Builder.Appendf(TEXT("\t\t{\n"));
+		Builder.Appendf(TEXT("\t\t\t\"EventName\": \"%s\""), *EventName);
+
+		// Add the event timestamp field
+		Builder.Appendf(TEXT(",\n\t\t\t\"TimestampUTC\": \"%.3f\""), TimestampUTC);
+	}
+
+	/** Appends the record id field of a RecordEvent record */
+	inline void AppendEventRecordId(FStringBuilderBase& Builder, uint32 RecordId)
+	{
+		Builder.Appendf(TEXT(",\n\t\t\t\"RecordId\": \"%u\""), RecordId);
+	}
+
+	/** Appends the attributes of a RecordEvent record as its fields, and closes the record */
+	inline void AppendEventAttributes(FStringBuilderBase& Builder, const TArray<FAnalyticsEventAttribute>& Attributes)
+	{
+		for (const FAnalyticsEventAttribute& Attribute : Attributes)
+		{
+			// This should be almost nearly true, but we should check and JSON'ify as needed
+			if (Attribute.IsJsonFragment())
+			{
+				Builder.Appendf(TEXT(",\n\t\t\t\"%s\":%s"), *Attribute.GetName(), *Attribute.GetValue());
+			}
+			else
+			{
+				Builder.Appendf(TEXT(",\n\t\t\t\"%s\":\"%s\""), *Attribute.GetName(), *Attribute.GetValue());
+			}
+		}
+
+		Builder.Appendf(TEXT("\n\t\t}"));
+	}
+
+	/** Appends a RecordEvent record, the attributes are written as fields of the event */
+	inline void AppendEvent(FStringBuilderBase& Builder, const FString& EventName, double TimestampUTC, uint32 RecordId,
+							const TArray<FAnalyticsEventAttribute>& Attributes)
+	{
+		AppendEventStart(Builder, EventName, TimestampUTC);
+		AppendEventRecordId(Builder, RecordId);
+		AppendEventAttributes(Builder, Attributes);
+	}
+}
@@ -0,0 +1,154 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsEventPolicy.h"
+
+#include "HAL/PlatformTime.h"
+#include "Misc/Parse.h"
+
+#include "ArcticAnalyticsSettings.h"
+
+namespace
+{
+	/** Position in the random sequence of non-deterministic sampling, shared by every thread */
+	std::atomic<uint64> RandomSequence{0};
+
+	/** SplitMix64 finalizer, turns consecutive counter values into uncorrelated random numbers */
+	uint64 MixBits(uint64 Value)
+	{
+		Value ^= Value >> 30;
+		Value *= 0xbf58476d1ce4e5b9ull;
+		Value ^= Value >> 27;
+		Value *= 0x94d049bb133111ebull;
+		Value ^= Value >> 31;
+		return Value;
+	}
+}
+
+void FArcticAnalyticsEventPolicies::LoadFromConfig()
+{
+	Reset();
+
+	// Entries look like +EventPolicies=(EventName="FrameStats",SampleRate=0.1,bDeterministic=True,RateLimit=30,Burst=60)
+	TArray<FString> Entries;
+	ArcticAnalyticsSettings::GetArray(TEXT("EventPolicies"), Entries);
+	for (const FString& Entry : Entries)
+	{
+		FString EventName;
+		if (!FParse::Value(*Entry, TEXT("EventName="), EventName) || EventName.IsEmpty())
+		{
+			continue;
+		}
+		FArcticAnalyticsEventPolicy Policy;
+		FParse::Value(*Entry, TEXT("SampleRate="), Policy.SampleRate);
+		FParse::Bool(*Entry, TEXT("bDeterministic="), Policy.bDeterministicSampling);
+		FParse::Value(*Entry, TEXT("RateLimit="), Policy.RateLimit);
+		FParse::Value(*Entry, TEXT("Burst="), Policy.Burst);
+		SetPolicy(EventName, Policy);
+	}
+}
+
+void FArcticAnalyticsEventPolicies::SetPolicy(const FString& EventName, const FArcticAnalyticsEventPolicy& Policy)
+{
+	TUniquePtr<FPolicyState> State = MakeUnique<FPolicyState>();
+	State->Policy = Policy;
+	State->SampleThreshold = (uint64)((double)FMath::Clamp(Policy.SampleRate, 0.0f, 1.0f) * 4294967296.0);
+	if (Policy.RateLimit > 0.0f)
+	{
+		const double CyclesPerSecond = 1.0 / FPlatformTime::GetSecondsPerCycle64();
+		State->EmissionInterval = FMath::Max<int64>(1, (int64)(CyclesPerSecond / Policy.RateLimit));
+		State->BurstTolerance = (int64)(FMath::Max(Policy.Burst, 1.0f) * (double)State->EmissionInterval);
+	}
+	Policies.Add(EventName, MoveTemp(State));
+}
+
+void FArcticAnalyticsEventPolicies::Reset()
+{
+	Policies.Reset();
+	PendingDropped.store(0, std::memory_order_relaxed);
+}
+
+bool FArcticAnalyticsEventPolicies::ShouldRecord(const FString& EventName, uint32 RecordId)
+{
+	if (Policies.Num() == 0)
+	{
+		return true;
+	}
+	TUniquePtr<FPolicyState>* Found = Policies.Find(EventName);
+	if (Found == nullptr)
+	{
+		return true;
+	}
+	FPolicyState& State = **Found;
+	// Sampling goes first so sampled out events don't use up rate limit tokens
+	if (PassesSampling(State, RecordId) && PassesRateLimit(State))
+	{
+		return true;
+	}
+	State.Dropped.fetch_add(1, std::memory_order_relaxed);
+	PendingDropped.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+bool FArcticAnalyticsEventPolicies::PassesSampling(const FPolicyState& State, uint32 RecordId) const
+{
+	if (State.SampleThreshold > MAX_uint32)
+	{
+		return true;
+	}
+	uint32 Hash;
+	if (State.Policy.bDeterministicSampling)
+	{
+		// Murmur3 finalizer, so consecutive ids are spread over the whole range
+		Hash = RecordId;
+		Hash ^= Hash >> 16;
+		Hash *= 0x85ebca6b;
+		Hash ^= Hash >> 13;
+		Hash *= 0xc2b2ae35;
+		Hash ^= Hash >> 16;
+	}
+	else
+	{
+		// FMath::Rand isn't thread safe, a counter run through a mixer is and costs one atomic add
+		static const uint64 Seed = FPlatformTime::Cycles64();
+		Hash = (uint32)(MixBits(Seed + RandomSequence.fetch_add(0x9e3779b97f4a7c15ull, std::memory_order_relaxed)) >> 32);
+	}
+	return Hash < State.SampleThreshold;
+}
+
+bool FArcticAnalyticsEventPolicies::PassesRateLimit(FPolicyState& State) const
+{
+	if (State.EmissionInterval == 0)
+	{
+		return true;
+	}
+	const int64 Now = (int64)FPlatformTime::Cycles64();
+	int64 Arrival = State.TheoreticalArrival.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		const int64 NewArrival = FMath::Max(Arrival, Now) + State.EmissionInterval;
+		if (NewArrival - Now > State.BurstTolerance)
+		{
+			// Bucket is empty
+			return false;
+		}
+		if (State.TheoreticalArrival.compare_exchange_weak(Arrival, NewArrival, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+}
+
+TArray<FAnalyticsEventAttribute> FArcticAnalyticsEventPolicies::ConsumeDroppedCounts()
+{
+	TArray<FAnalyticsEventAttribute> Counts;
+	PendingDropped.store(0, std::memory_order_relaxed);
+	for (const TPair<FString, TUniquePtr<FPolicyState>>& Pair : Policies)
+	{
+		const uint64 Dropped = Pair.Value->Dropped.exchange(0, std::memory_order_relaxed);
+		if (Dropped > 0)
+		{
+			Counts.Emplace(Pair.Key, (int64)Dropped);
+		}
+	}
+	return Counts;
+}
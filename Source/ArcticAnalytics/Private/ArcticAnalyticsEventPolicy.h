@@ -0,0 +1,81 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+
+#include <atomic>
+
+/** Sampling and rate limiting settings for a single event name */
+struct FArcticAnalyticsEventPolicy
+{
+	/** Fraction of events that are kept, in the range [0, 1] */
+	float SampleRate = 1.0f;
+	/** Whether sampling is derived from the RecordId (reproducible between runs) or random */
+	bool bDeterministicSampling = true;
+	/** Sustained number of events per second that are let through, 0 for no limit */
+	float RateLimit = 0.0f;
+	/** Number of events that may be let through at once before the rate limit kicks in */
+	float Burst = 1.0f;
+};
+
+/**
+ * Per event name sampling and token bucket rate limiting.
+ *
+ * Policies may only be changed while no session is in progress, so the lookup done for every
+ * recorded event is a plain read of an immutable map plus a few atomics and never takes a lock.
+ */
+class FArcticAnalyticsEventPolicies
+{
+public:
+	/** Reads the EventPolicies array from the settings, replacing any existing policies */
+	void LoadFromConfig();
+
+	/** Adds or replaces the policy for an event name. Not safe while events are being recorded */
+	void SetPolicy(const FString& EventName, const FArcticAnalyticsEventPolicy& Policy);
+
+	/** Removes all policies */
+	void Reset();
+
+	/**
+	 * Decides whether an event should be written. Safe to call from any thread.
+	 *
+	 * @param EventName the name the policy is keyed on
+	 * @param RecordId the id of the record, used for deterministic sampling
+	 *
+	 * @return true if the event should be written, false if it was dropped
+	 */
+	bool ShouldRecord(const FString& EventName, uint32 RecordId);
+
+	/** Whether any event has been dropped since the last call to ConsumeDroppedCounts */
+	bool HasDroppedEvents() const
+	{
+		return PendingDropped.load(std::memory_order_relaxed) > 0;
+	}
+
+	/** Returns one attribute per event name with the number of events dropped since the last call, and resets the counters */
+	TArray<FAnalyticsEventAttribute> ConsumeDroppedCounts();
+
+private:
+	struct FPolicyState
+	{
+		FArcticAnalyticsEventPolicy Policy;
+		/** Hashed RecordIds at or above this value are sampled out */
+		uint64 SampleThreshold = 0;
+		/** Cycles between two events at the sustained rate, 0 for no limit */
+		int64 EmissionInterval = 0;
+		/** Maximum amount of cycles the theoretical arrival time may run ahead of now */
+		int64 BurstTolerance = 0;
+		/** Theoretical arrival time of the next event, in cycles (GCRA form of the token bucket) */
+		std::atomic<int64> TheoreticalArrival{0};
+		/** Events dropped since the counters were last consumed */
+		std::atomic<uint64> Dropped{0};
+	};
+
+	bool PassesSampling(const FPolicyState& State, uint32 RecordId) const;
+	bool PassesRateLimit(FPolicyState& State) const;
+
+	TMap<FString, TUniquePtr<FPolicyState>> Policies;
+	std::atomic<uint64> PendingDropped{0};
+};
@@ -0,0 +1,351 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsFrameBudget.h"
+
+#include "Containers/Ticker.h"
+#include "CoreGlobals.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsProvider.h"
+
+FArcticAnalyticsFrameBudget::FScope::FScope(FArcticAnalyticsFrameBudget* InBudget, const TCHAR* InEventName)
+	: Budget(InBudget), EventName(InEventName), StartCycles(0), Decision(EDecision::Record)
+{
+	if (Budget && (Budget->Depth > 0 || Budget->SuspendCount > 0 || !IsInGameThread()))
+	{
+		Budget = nullptr;
+	}
+	if (Budget)
+	{
+		Budget->UpdateFrame();
+		++Budget->Depth;
+		Decision = Budget->Decide();
+		StartCycles = FPlatformTime::Cycles64();
+	}
+}
+
+FArcticAnalyticsFrameBudget::FScope::~FScope()
+{
+	if (Budget)
+	{
+		--Budget->Depth;
+		Budget->EndCall(EventName, FPlatformTime::Cycles64() - StartCycles, Decision);
+	}
+}
+
+FArcticAnalyticsFrameBudget::FSuspendScope::FSuspendScope(FArcticAnalyticsFrameBudget* InBudget) : Budget(InBudget)
+{
+	if (Budget)
+	{
+		++Budget->SuspendCount;
+	}
+}
+
+FArcticAnalyticsFrameBudget::FSuspendScope::~FSuspendScope()
+{
+	if (Budget)
+	{
+		--Budget->SuspendCount;
+	}
+}
+
+FArcticAnalyticsFrameBudget::FArcticAnalyticsFrameBudget(double InBudgetSeconds, EArcticAnalyticsOverrunMode InMode, float InSampleRate, int32 InMaxDeferred,
+														 float InReportInterval)
+	: BudgetCycles((uint64)FMath::Max(1.0, InBudgetSeconds / FPlatformTime::GetSecondsPerCycle64())), Mode(InMode),
+	  SampleInterval(FMath::Max(1, FMath::RoundToInt(1.0f / FMath::Clamp(InSampleRate, 0.001f, 1.0f)))), MaxDeferred(FMath::Max(0, InMaxDeferred)),
+	  ReportInterval(InReportInterval), bFrameOverrun(false), Depth(0), SuspendCount(0), bReplaying(false), SampleCounter(0), DeferredHead(0),
+	  OverrunFrames(0), WorstFrameCycles(0), ReportDeferred(0), ReportDropped(0), LastReportTime(FPlatformTime::Seconds()), LastWarningTime(-DBL_MAX)
+{
+	Frame.Frame = GFrameCounter;
+}
+
+void FArcticAnalyticsFrameBudget::UpdateFrame()
+{
+	if (Frame.Frame == GFrameCounter)
+	{
+		return;
+	}
+	if (bFrameOverrun)
+	{
+		++OverrunFrames;
+		WorstFrameCycles = FMath::Max(WorstFrameCycles, Frame.SpentCycles + Frame.OverheadCycles);
+		for (const TPair<FString, uint64>& Name : FrameNames)
+		{
+			ReportNames.FindOrAdd(Name.Key) += Name.Value;
+		}
+	}
+	if (Frame.NumRecorded + Frame.NumDeferred + Frame.NumDropped > 0)
+	{
+		LastFrame = Frame;
+	}
+	Frame = FArcticAnalyticsFrameBudgetStats();
+	Frame.Frame = GFrameCounter;
+	bFrameOverrun = false;
+	FrameNames.Reset();
+	SampleCounter = 0;
+}
+
+FArcticAnalyticsFrameBudget::EDecision FArcticAnalyticsFrameBudget::Decide()
+{
+	if (Mode == EArcticAnalyticsOverrunMode::Defer)
+	{
+		// Calls queue behind deferred ones to keep their order, unless they are the ones being replayed
+		if (bReplaying || (!bFrameOverrun && GetNumDeferred() == 0))
+		{
+			return EDecision::Record;
+		}
+		return GetNumDeferred() < MaxDeferred ? EDecision::Defer : EDecision::Drop;
+	}
+	if (!bFrameOverrun)
+	{
+		return EDecision::Record;
+	}
+	return SampleCounter++ % SampleInterval == 0 ? EDecision::Record : EDecision::Drop;
+}
+
+void FArcticAnalyticsFrameBudget::EndCall(const TCHAR* EventName, uint64 Cycles, EDecision Decision)
+{
+	switch (Decision)
+	{
+	case EDecision::Record:
+		++Frame.NumRecorded;
+		Frame.SpentCycles += Cycles;
+		Frame.MaxCallCycles = FMath::Max(Frame.MaxCallCycles, Cycles);
+		break;
+	case EDecision::Defer:
+		++Frame.NumDeferred;
+		++ReportDeferred;
+		Frame.OverheadCycles += Cycles;
+		break;
+	case EDecision::Drop:
+		++Frame.NumDropped;
+		++ReportDropped;
+		Frame.OverheadCycles += Cycles;
+		break;
+	}
+
+	// Attribute the time to the event name, the names that don't fit share the last entry
+	TPair<FString, uint64>* Entry = FrameNames.FindByPredicate([EventName](const TPair<FString, uint64>& Name) { return Name.Key == EventName; });
+	if (!Entry)
+	{
+		Entry = FrameNames.Num() < MaxFrameNames ? &FrameNames.Emplace_GetRef(EventName, 0)
+			  : FrameNames.Num() == MaxFrameNames ? &FrameNames.Emplace_GetRef(TEXT("(other)"), 0)
+			  : &FrameNames.Last();
+	}
+	Entry->Value += Cycles;
+
+	if (!bFrameOverrun && Frame.SpentCycles + Frame.OverheadCycles >= BudgetCycles)
+	{
+		bFrameOverrun = true;
+		const double Now = FPlatformTime::Seconds();
+		if (Now - LastWarningTime >= ReportInterval)
+		{
+			LastWarningTime = Now;
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Analytics used its game thread budget of %.0fus in frame (%llu) after (%d) calls, last (%s). %s until the next frame"),
+				   GetBudgetSeconds() * 1000000.0, Frame.Frame, Frame.NumRecorded, EventName,
+				   Mode == EArcticAnalyticsOverrunMode::Defer ? TEXT("Deferring calls") : TEXT("Sampling calls"));
+		}
+	}
+}
+
+void FArcticAnalyticsFrameBudget::Defer(TFunction<void()>&& Call)
+{
+	if (DeferredHead > 0 && DeferredHead == Deferred.Num())
+	{
+		Deferred.Reset();
+		DeferredHead = 0;
+	}
+	Deferred.Add(MoveTemp(Call));
+}
+
+void FArcticAnalyticsFrameBudget::ReplayDeferred()
+{
+	UpdateFrame();
+	TGuardValue<bool> Replaying(bReplaying, true);
+	while (GetNumDeferred() > 0 && !bFrameOverrun)
+	{
+		TFunction<void()> Call = MoveTemp(Deferred[DeferredHead++]);
+		Call();
+	}
+	if (GetNumDeferred() == 0)
+	{
+		Deferred.Reset();
+		DeferredHead = 0;
+	}
+}
+
+void FArcticAnalyticsFrameBudget::FlushDeferred()
+{
+	FSuspendScope Suspend(this);
+	while (GetNumDeferred() > 0)
+	{
+		TFunction<void()> Call = MoveTemp(Deferred[DeferredHead++]);
+		Call();
+	}
+	Deferred.Reset();
+	DeferredHead = 0;
+}
+
+bool FArcticAnalyticsFrameBudget::ConsumeReport(double Now, bool bForce, TArray<FAnalyticsEventAttribute>& OutAttributes)
+{
+	if (OverrunFrames == 0 || (!bForce && Now - LastReportTime < ReportInterval))
+	{
+		return false;
+	}
+	const double SecondsPerCycle = FPlatformTime::GetSecondsPerCycle64();
+	OutAttributes.Emplace(TEXT("budgetUs"), GetBudgetSeconds() * 1000000.0);
+	OutAttributes.Emplace(TEXT("overrunFrames"), OverrunFrames);
+	OutAttributes.Emplace(TEXT("worstFrameUs"), WorstFrameCycles * SecondsPerCycle * 1000000.0);
+	OutAttributes.Emplace(TEXT("deferred"), ReportDeferred);
+	OutAttributes.Emplace(TEXT("dropped"), ReportDropped);
+	// The names that used the most time in the frames that overran
+	ReportNames.ValueSort([](uint64 A, uint64 B) { return A > B; });
+	int32 NumNames = 0;
+	for (const TPair<FString, uint64>& Name : ReportNames)
+	{
+		if (NumNames++ == 5)
+		{
+			break;
+		}
+		OutAttributes.Emplace(Name.Key + TEXT(".us"), Name.Value * SecondsPerCycle * 1000000.0);
+	}
+
+	LastReportTime = Now;
+	OverrunFrames = 0;
+	WorstFrameCycles = 0;
+	ReportDeferred = 0;
+	ReportDropped = 0;
+	ReportNames.Reset();
+	return true;
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/**
+	 * Replays a burst workload against a provider with a frame budget, one burst per frame, and checks every frame.
+	 * The calls that recorded plus the overhead of the deferred and dropped ones, and the wall time of the whole burst,
+	 * have to stay within the budget, the one call that crossed it, and MaxOverheadUs for every call that did not record
+	 * (for the burst, every call, as each one is also measured and dispatched).
+	 */
+	struct FFrameBudgetTest : public TSharedFromThis<FFrameBudgetTest>
+	{
+		TSharedPtr<FAnalyticsProviderArcticAnalytics> Provider;
+		int32 CallsPerFrame = 0;
+		int32 FramesLeft = 0;
+		int32 NumFrames = 0;
+		double BudgetSeconds = 0.0;
+		double MaxOverheadSeconds = 0.0;
+		int32 FramesOverBudget = 0;
+		int32 BurstsOverBudget = 0;
+		double WorstFrameSeconds = 0.0;
+		double WorstBurstSeconds = 0.0;
+		int64 Recorded = 0;
+		int64 Deferred = 0;
+		int64 Dropped = 0;
+		uint64 LastCountedFrame = 0;
+		/** Wall time of the bursts by frame, checked once the stats of their frame are complete */
+		TMap<uint64, double> BurstSeconds;
+
+		void CountLastFrame()
+		{
+			const FArcticAnalyticsFrameBudgetStats& Stats = Provider->GetFrameBudget()->GetLastFrameStats();
+			if (Stats.Frame == LastCountedFrame)
+			{
+				return;
+			}
+			LastCountedFrame = Stats.Frame;
+			const double SecondsPerCycle = FPlatformTime::GetSecondsPerCycle64();
+			const double FrameSeconds = (Stats.SpentCycles + Stats.OverheadCycles) * SecondsPerCycle;
+			const double AllowedSeconds = BudgetSeconds + Stats.MaxCallCycles * SecondsPerCycle;
+			WorstFrameSeconds = FMath::Max(WorstFrameSeconds, FrameSeconds);
+			// The call that crosses the budget completes, anything beyond it and the cost of turning calls away breaks the guarantee
+			if (FrameSeconds > AllowedSeconds + (Stats.NumDeferred + Stats.NumDropped) * MaxOverheadSeconds)
+			{
+				++FramesOverBudget;
+			}
+			double Burst = 0.0;
+			if (BurstSeconds.RemoveAndCopyValue(Stats.Frame, Burst))
+			{
+				WorstBurstSeconds = FMath::Max(WorstBurstSeconds, Burst);
+				if (Burst > AllowedSeconds + CallsPerFrame * MaxOverheadSeconds)
+				{
+					++BurstsOverBudget;
+				}
+			}
+			Recorded += Stats.NumRecorded;
+			Deferred += Stats.NumDeferred;
+			Dropped += Stats.NumDropped;
+		}
+
+		bool Tick(float DeltaTime)
+		{
+			CountLastFrame();
+			if (FramesLeft-- > 0)
+			{
+				static const FString EventNames[] = {TEXT("BurstMovement"), TEXT("BurstCombat"), TEXT("BurstInventory")};
+				// Built up front, so the burst only times the Record* calls
+				TArray<TArray<FAnalyticsEventAttribute>> Attributes;
+				Attributes.Reserve(CallsPerFrame);
+				for (int32 Index = 0; Index < CallsPerFrame; ++Index)
+				{
+					Attributes.Add({FAnalyticsEventAttribute(TEXT("Index"), Index), FAnalyticsEventAttribute(TEXT("Frame"), (int64)GFrameCounter),
+									FAnalyticsEventAttribute(TEXT("Payload"), TEXT("0123456789abcdef0123456789abcdef"))});
+				}
+				const double StartTime = FPlatformTime::Seconds();
+				for (int32 Index = 0; Index < CallsPerFrame; ++Index)
+				{
+					Provider->RecordEvent(EventNames[Index % UE_ARRAY_COUNT(EventNames)], Attributes[Index]);
+				}
+				BurstSeconds.Add(GFrameCounter, FPlatformTime::Seconds() - StartTime);
+				return true;
+			}
+			// Let the deferred calls drain before ending the session
+			if (Provider->GetFrameBudget()->GetNumDeferred() > 0)
+			{
+				return true;
+			}
+			Provider->EndSession();
+			UE_LOG(LogArcticAnalyticsAnalytics, Display,
+				   TEXT("Frame budget test: %d frames of %d calls, budget %.0fus, worst frame %.0fus, worst burst %.0fus, recorded %lld, deferred %lld, dropped %lld"),
+				   NumFrames, CallsPerFrame, BudgetSeconds * 1000000.0, WorstFrameSeconds * 1000000.0, WorstBurstSeconds * 1000000.0, Recorded, Deferred, Dropped);
+			if (FramesOverBudget > 0 || BurstsOverBudget > 0)
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Frame budget test failed: %d frames and %d bursts over the budget"), FramesOverBudget, BurstsOverBudget);
+			}
+			else
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Frame budget test passed"));
+			}
+			return false;
+		}
+	};
+
+	void FrameBudgetTest(const TArray<FString>& Args)
+	{
+		TSharedRef<FFrameBudgetTest> Test = MakeShared<FFrameBudgetTest>();
+		Test->CallsPerFrame = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 2000;
+		Test->NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 60;
+		Test->FramesLeft = Test->NumFrames;
+		const float BudgetMicroseconds = Args.Num() > 2 ? FCString::Atof(*Args[2]) : 200.0f;
+		const EArcticAnalyticsOverrunMode Mode = Args.Num() > 3 && Args[3] == TEXT("Sample") ? EArcticAnalyticsOverrunMode::Sample : EArcticAnalyticsOverrunMode::Defer;
+		Test->BudgetSeconds = BudgetMicroseconds / 1000000.0;
+		Test->MaxOverheadSeconds = (Args.Num() > 4 ? FCString::Atof(*Args[4]) : 1.0f) / 1000000.0;
+
+		Test->Provider = MakeShared<FAnalyticsProviderArcticAnalytics>();
+		Test->Provider->SetFrameBudget(BudgetMicroseconds, Mode);
+		Test->Provider->StartSession(TArray<FAnalyticsEventAttribute>());
+		// The ticker holds the only reference to the test until it finishes
+		FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([Test](float DeltaTime) { return Test->Tick(DeltaTime); }));
+	}
+
+	FAutoConsoleCommand FrameBudgetTestCommand(TEXT("ArcticAnalytics.FrameBudgetTest"),
+		TEXT("Replays a burst of RecordEvent calls every frame against a provider with a game thread budget. ")
+		TEXT("Args: [CallsPerFrame=2000] [Frames=60] [BudgetUs=200] [Defer|Sample] [MaxOverheadUs=1]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&FrameBudgetTest));
+}
+
+#endif
@@ -0,0 +1,158 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+
+/** What happens to Record* calls once the frame budget is spent */
+enum class EArcticAnalyticsOverrunMode : uint8
+{
+	/** Calls are queued and replayed in order on the following frames, within their budget */
+	Defer,
+	/** One in every 1 / FrameBudgetSampleRate calls is recorded, the others are dropped */
+	Sample
+};
+
+/** Game thread time spent in Record* calls during one frame */
+struct FArcticAnalyticsFrameBudgetStats
+{
+	uint64 Frame = 0;
+	/** Cycles of the calls that recorded */
+	uint64 SpentCycles = 0;
+	/** Cycles of the calls that were deferred or dropped */
+	uint64 OverheadCycles = 0;
+	/** Most expensive single call that recorded */
+	uint64 MaxCallCycles = 0;
+	int32 NumRecorded = 0;
+	int32 NumDeferred = 0;
+	int32 NumDropped = 0;
+};
+
+/**
+ * Caps the game thread time the provider spends in Record* calls per frame.
+ *
+ * Every top level Record* call on the game thread is measured with the cycle counter. Once the calls of a frame
+ * used up the budget, a warning is logged and the remaining calls of the frame are deferred or sampled, depending on
+ * the overrun mode. The call that crosses the budget still completes, so a frame can go over by at most one call.
+ * Deferred calls are replayed in order from the next frame on, and while any are queued new calls queue behind them.
+ *
+ * Frames that overran are summed up, with the event names that used the most time, into a periodic attribution
+ * report. Calls from other threads and nested calls are not measured. Game thread only.
+ */
+class FArcticAnalyticsFrameBudget
+{
+public:
+	enum class EDecision : uint8
+	{
+		Record,
+		Defer,
+		Drop
+	};
+
+	/** Measures one Record* call and decides whether it runs now */
+	class FScope
+	{
+	public:
+		/** @param InBudget budget to charge, or null when budgets are off */
+		FScope(FArcticAnalyticsFrameBudget* InBudget, const TCHAR* InEventName);
+		~FScope();
+
+		EDecision GetDecision() const
+		{
+			return Decision;
+		}
+
+	private:
+		/** Null when the call is not measured */
+		FArcticAnalyticsFrameBudget* Budget;
+		const TCHAR* EventName;
+		uint64 StartCycles;
+		EDecision Decision;
+	};
+
+	/** Lets calls through unmeasured, for the records the provider writes itself when a session ends or flushes */
+	class FSuspendScope
+	{
+	public:
+		explicit FSuspendScope(FArcticAnalyticsFrameBudget* InBudget);
+		~FSuspendScope();
+
+	private:
+		FArcticAnalyticsFrameBudget* Budget;
+	};
+
+	FArcticAnalyticsFrameBudget(double InBudgetSeconds, EArcticAnalyticsOverrunMode InMode, float InSampleRate, int32 InMaxDeferred, float InReportInterval);
+
+	/** Queues a call that FScope decided to defer */
+	void Defer(TFunction<void()>&& Call);
+
+	/** Replays deferred calls until the budget of the current frame is spent */
+	void ReplayDeferred();
+
+	/** Replays all deferred calls regardless of the budget */
+	void FlushDeferred();
+
+	int32 GetNumDeferred() const
+	{
+		return Deferred.Num() - DeferredHead;
+	}
+
+	/**
+	 * Returns the attribution of the frames that overran since the last report, once ReportInterval passed.
+	 *
+	 * @param bForce report without waiting for ReportInterval, when the session ends
+	 * @return false if there is nothing to report yet
+	 */
+	bool ConsumeReport(double Now, bool bForce, TArray<FAnalyticsEventAttribute>& OutAttributes);
+
+	/** Stats of the last complete frame in which Record* calls were measured */
+	const FArcticAnalyticsFrameBudgetStats& GetLastFrameStats() const
+	{
+		return LastFrame;
+	}
+
+	double GetBudgetSeconds() const
+	{
+		return BudgetCycles * FPlatformTime::GetSecondsPerCycle64();
+	}
+
+private:
+	/** Closes the current frame if the engine moved on to the next one */
+	void UpdateFrame();
+	EDecision Decide();
+	void EndCall(const TCHAR* EventName, uint64 Cycles, EDecision Decision);
+
+	const uint64 BudgetCycles;
+	const EArcticAnalyticsOverrunMode Mode;
+	/** Every how many calls one is recorded when sampling */
+	const int32 SampleInterval;
+	const int32 MaxDeferred;
+	const double ReportInterval;
+
+	/** Current frame */
+	FArcticAnalyticsFrameBudgetStats Frame;
+	bool bFrameOverrun;
+	/** Game thread time per event name in the current frame, the last entry collects the names that don't fit */
+	static constexpr int32 MaxFrameNames = 8;
+	TArray<TPair<FString, uint64>, TInlineAllocator<MaxFrameNames + 1>> FrameNames;
+	FArcticAnalyticsFrameBudgetStats LastFrame;
+
+	/** Nesting of measured calls */
+	int32 Depth;
+	int32 SuspendCount;
+	bool bReplaying;
+	uint32 SampleCounter;
+	TArray<TFunction<void()>> Deferred;
+	/** Index of the oldest deferred call that was not replayed yet */
+	int32 DeferredHead;
+
+	/** Attribution since the last report */
+	int32 OverrunFrames;
+	uint64 WorstFrameCycles;
+	int64 ReportDeferred;
+	int64 ReportDropped;
+	TMap<FString, uint64> ReportNames;
+	double LastReportTime;
+	double LastWarningTime;
+};
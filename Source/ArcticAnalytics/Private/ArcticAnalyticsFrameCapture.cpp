@@ -0,0 +1,127 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsFrameCapture.h"
+
+#include "HAL/PlatformMemory.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/App.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/StringBuilder.h"
+#include "RenderCore.h"
+#include "RHI.h"
+
+namespace
+{
+	template <typename T>
+	FJsonFragment ColumnToJson(const TArray<T>& Column, int32 Head, int32 Count, const TCHAR* Format)
+	{
+		TStringBuilder<4096> Builder;
+		Builder.AppendChar(TEXT('['));
+		for (int32 Offset = 0; Offset < Count; ++Offset)
+		{
+			if (Offset > 0)
+			{
+				Builder.AppendChar(TEXT(','));
+			}
+			Builder.Appendf(Format, Column[(Head + Offset) % Column.Num()]);
+		}
+		Builder.AppendChar(TEXT(']'));
+		return FJsonFragment(FString(Builder.ToString()));
+	}
+}
+
+FArcticAnalyticsFrameCapture::FArcticAnalyticsFrameCapture(int32 InCapacity, float InMemorySampleSeconds)
+	: Capacity(FMath::Max(1, InCapacity)), Head(0), Count(0), MemorySampleSeconds(FMath::Max(0.0f, InMemorySampleSeconds)), LastMemorySampleTime(0.0),
+	  LastUsedPhysicalMB(0.0f), LastUsedVirtualMB(0.0f)
+{
+	FrameNumber.SetNumZeroed(Capacity);
+	TimestampUTC.SetNumZeroed(Capacity);
+	FrameMs.SetNumZeroed(Capacity);
+	GameThreadMs.SetNumZeroed(Capacity);
+	RenderThreadMs.SetNumZeroed(Capacity);
+	RHIThreadMs.SetNumZeroed(Capacity);
+	GPUMs.SetNumZeroed(Capacity);
+	UsedPhysicalMB.SetNumZeroed(Capacity);
+	UsedVirtualMB.SetNumZeroed(Capacity);
+}
+
+FArcticAnalyticsFrameCapture::~FArcticAnalyticsFrameCapture()
+{
+	Stop();
+}
+
+void FArcticAnalyticsFrameCapture::Start()
+{
+	if (!EndFrameHandle.IsValid())
+	{
+		EndFrameHandle = FCoreDelegates::OnEndFrame.AddRaw(this, &FArcticAnalyticsFrameCapture::CaptureFrame);
+	}
+}
+
+void FArcticAnalyticsFrameCapture::Stop()
+{
+	if (EndFrameHandle.IsValid())
+	{
+		FCoreDelegates::OnEndFrame.Remove(EndFrameHandle);
+		EndFrameHandle.Reset();
+	}
+}
+
+void FArcticAnalyticsFrameCapture::CaptureFrame()
+{
+	// When nobody flushes the buffer the oldest frame is overwritten
+	const int32 Index = (Head + Count) % Capacity;
+	if (Count < Capacity)
+	{
+		++Count;
+	}
+	else
+	{
+		Head = (Head + 1) % Capacity;
+	}
+
+	const double Now = FPlatformTime::Seconds();
+	if (LastMemorySampleTime == 0.0 || Now - LastMemorySampleTime >= MemorySampleSeconds)
+	{
+		const FPlatformMemoryStats MemoryStats = FPlatformMemory::GetStats();
+		LastMemorySampleTime = Now;
+		LastUsedPhysicalMB = (float)((double)MemoryStats.UsedPhysical / (1024.0 * 1024.0));
+		LastUsedVirtualMB = (float)((double)MemoryStats.UsedVirtual / (1024.0 * 1024.0));
+	}
+	FrameNumber[Index] = GFrameCounter;
+	TimestampUTC[Index] = FDateTime::UtcNow().ToUnixTimestampDecimal();
+	FrameMs[Index] = (float)(FApp::GetDeltaTime() * 1000.0);
+	GameThreadMs[Index] = FPlatformTime::ToMilliseconds(GGameThreadTime);
+	RenderThreadMs[Index] = FPlatformTime::ToMilliseconds(GRenderThreadTime);
+	RHIThreadMs[Index] = FPlatformTime::ToMilliseconds(GRHIThreadTime);
+	GPUMs[Index] = FPlatformTime::ToMilliseconds(RHIGetGPUFrameCycles());
+	UsedPhysicalMB[Index] = LastUsedPhysicalMB;
+	UsedVirtualMB[Index] = LastUsedVirtualMB;
+
+	if (Count == Capacity)
+	{
+		OnBufferFull.ExecuteIfBound();
+	}
+}
+
+TArray<FAnalyticsEventAttribute> FArcticAnalyticsFrameCapture::Flush()
+{
+	TArray<FAnalyticsEventAttribute> Attributes;
+	if (Count > 0)
+	{
+		Attributes.Reserve(10);
+		Attributes.Emplace(TEXT("frameCount"), Count);
+		Attributes.Emplace(TEXT("frameNumber"), ColumnToJson(FrameNumber, Head, Count, TEXT("%llu")));
+		Attributes.Emplace(TEXT("timestampUTC"), ColumnToJson(TimestampUTC, Head, Count, TEXT("%.3f")));
+		Attributes.Emplace(TEXT("frameMs"), ColumnToJson(FrameMs, Head, Count, TEXT("%.3f")));
+		Attributes.Emplace(TEXT("gameThreadMs"), ColumnToJson(GameThreadMs, Head, Count, TEXT("%.3f")));
+		Attributes.Emplace(TEXT("renderThreadMs"), ColumnToJson(RenderThreadMs, Head, Count, TEXT("%.3f")));
+		Attributes.Emplace(TEXT("rhiThreadMs"), ColumnToJson(RHIThreadMs, Head, Count, TEXT("%.3f")));
+		Attributes.Emplace(TEXT("gpuMs"), ColumnToJson(GPUMs, Head, Count, TEXT("%.3f")));
+		Attributes.Emplace(TEXT("usedPhysicalMB"), ColumnToJson(UsedPhysicalMB, Head, Count, TEXT("%.1f")));
+		Attributes.Emplace(TEXT("usedVirtualMB"), ColumnToJson(UsedVirtualMB, Head, Count, TEXT("%.1f")));
+	}
+	Head = 0;
+	Count = 0;
+	return Attributes;
+}
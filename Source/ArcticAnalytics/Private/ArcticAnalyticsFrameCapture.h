@@ -0,0 +1,72 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+
+/**
+ * Samples frame, thread and GPU times at the end of every frame into a fixed size structure of arrays ring
+ * buffer. Memory stats are expensive to query on some platforms (/proc on Linux), so they are sampled every
+ * MemorySampleSeconds and frames in between repeat the last sample. Capturing a frame does no allocations, the
+ * buffer is only converted to a columnar FrameCapture event when it is full or flushed.
+ */
+class FArcticAnalyticsFrameCapture
+{
+public:
+	/** Called on the game thread when the buffer is full and should be flushed */
+	DECLARE_DELEGATE(FOnBufferFull);
+
+	/** @param InMemorySampleSeconds seconds between two memory samples */
+	FArcticAnalyticsFrameCapture(int32 InCapacity, float InMemorySampleSeconds);
+	~FArcticAnalyticsFrameCapture();
+
+	/** Starts sampling at the end of every frame */
+	void Start();
+	/** Stops sampling, the buffered frames are kept until flushed */
+	void Stop();
+
+	bool IsCapturing() const
+	{
+		return EndFrameHandle.IsValid();
+	}
+
+	/** Number of frames currently buffered */
+	int32 Num() const
+	{
+		return Count;
+	}
+
+	/** Converts the buffered frames to the attributes of a FrameCapture event, one array per column, and empties the buffer */
+	TArray<FAnalyticsEventAttribute> Flush();
+
+	FOnBufferFull OnBufferFull;
+
+private:
+	void CaptureFrame();
+
+	/** Maximum number of buffered frames */
+	const int32 Capacity;
+	/** Index of the oldest buffered frame */
+	int32 Head;
+	/** Number of buffered frames */
+	int32 Count;
+	const double MemorySampleSeconds;
+	/** Time of the last memory sample, and its values */
+	double LastMemorySampleTime;
+	float LastUsedPhysicalMB;
+	float LastUsedVirtualMB;
+
+	// One column per sampled value, all of Capacity length
+	TArray<uint64> FrameNumber;
+	TArray<double> TimestampUTC;
+	TArray<float> FrameMs;
+	TArray<float> GameThreadMs;
+	TArray<float> RenderThreadMs;
+	TArray<float> RHIThreadMs;
+	TArray<float> GPUMs;
+	TArray<float> UsedPhysicalMB;
+	TArray<float> UsedVirtualMB;
+
+	FDelegateHandle EndFrameHandle;
+};
@@ -0,0 +1,169 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsHousekeeping.h"
+
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsTrace.h"
+
+FArcticAnalyticsHousekeeping::FArcticAnalyticsHousekeeping(double InBudgetSeconds, float InSpikeFactor, int32 InSpikeFrames, float InMaxDeferSeconds)
+	: BudgetCycles((uint64)FMath::Max(1.0, InBudgetSeconds / FPlatformTime::GetSecondsPerCycle64())), SpikeFactor(FMath::Max(1.0f, InSpikeFactor)),
+	  SpikeFrames(FMath::Max(0, InSpikeFrames)), MaxDeferSeconds(InMaxDeferSeconds), LastTaskIndex(INDEX_NONE), SpikeFramesLeft(0),
+	  LastServedTime(FPlatformTime::Seconds())
+{
+	Stats.BudgetSeconds = InBudgetSeconds;
+}
+
+void FArcticAnalyticsHousekeeping::AddTask(const FString& Name, TFunction<bool()>&& HasWork, TFunction<void()>&& Step)
+{
+	Tasks.Add(FTask{MoveTemp(HasWork), MoveTemp(Step)});
+	Stats.Tasks.AddDefaulted_GetRef().Name = Name;
+}
+
+void FArcticAnalyticsHousekeeping::Tick(float DeltaTime)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Housekeeping);
+	++Stats.NumTicks;
+	// Frames are compared with the ones before them, spikes only move the average as far as the spike threshold
+	if (Stats.AverageFrameSeconds <= 0.0)
+	{
+		Stats.AverageFrameSeconds = DeltaTime;
+	}
+	const double SpikeThreshold = Stats.AverageFrameSeconds * SpikeFactor;
+	if (DeltaTime > SpikeThreshold)
+	{
+		SpikeFramesLeft = SpikeFrames + 1;
+	}
+	const bool bSpike = SpikeFramesLeft > 0;
+	SpikeFramesLeft -= bSpike ? 1 : 0;
+	const bool bIdle = !bSpike && DeltaTime <= Stats.AverageFrameSeconds * 1.05;
+	Stats.AverageFrameSeconds += (FMath::Min<double>(DeltaTime, SpikeThreshold) - Stats.AverageFrameSeconds) * 0.05;
+
+	const double Now = FPlatformTime::Seconds();
+	int32 TaskIndex = FindNextTask();
+	if (TaskIndex == INDEX_NONE)
+	{
+		LastServedTime = Now;
+		return;
+	}
+	const bool bForced = Now - LastServedTime > MaxDeferSeconds;
+	if (bSpike && !bForced)
+	{
+		++Stats.NumDeferredTicks;
+		return;
+	}
+	Stats.NumIdleTicks += bIdle ? 1 : 0;
+	Stats.NumBusyTicks += !bIdle && !bSpike ? 1 : 0;
+	Stats.NumForcedTicks += bSpike ? 1 : 0;
+
+	// Slow frames and forced ticks run one step, idle frames run steps until the budget is spent
+	const uint64 StartCycles = FPlatformTime::Cycles64();
+	do
+	{
+		RunStep(TaskIndex);
+		TaskIndex = bIdle && FPlatformTime::Cycles64() - StartCycles < BudgetCycles ? FindNextTask() : INDEX_NONE;
+	} while (TaskIndex != INDEX_NONE);
+
+	const uint64 TickCycles = FPlatformTime::Cycles64() - StartCycles;
+	Stats.LastTickSeconds = TickCycles * FPlatformTime::GetSecondsPerCycle64();
+	Stats.MaxTickSeconds = FMath::Max(Stats.MaxTickSeconds, Stats.LastTickSeconds);
+	Stats.NumOverBudgetTicks += TickCycles > BudgetCycles ? 1 : 0;
+	LastServedTime = Now;
+	TRACE_COUNTER_SET(ArcticAnalytics_HousekeepingMicroseconds, (int64)(Stats.LastTickSeconds * 1000000.0));
+}
+
+void FArcticAnalyticsHousekeeping::Flush()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Housekeeping::Flush);
+	for (int32 TaskIndex = FindNextTask(); TaskIndex != INDEX_NONE; TaskIndex = FindNextTask())
+	{
+		RunStep(TaskIndex);
+	}
+	LastServedTime = FPlatformTime::Seconds();
+}
+
+int32 FArcticAnalyticsHousekeeping::FindNextTask() const
+{
+	for (int32 Offset = 1; Offset <= Tasks.Num(); ++Offset)
+	{
+		const int32 TaskIndex = (LastTaskIndex + Offset) % Tasks.Num();
+		if (Tasks[TaskIndex].HasWork())
+		{
+			return TaskIndex;
+		}
+	}
+	return INDEX_NONE;
+}
+
+void FArcticAnalyticsHousekeeping::RunStep(int32 TaskIndex)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	Tasks[TaskIndex].Step();
+	const double StepSeconds = FPlatformTime::Seconds() - StartTime;
+	FArcticAnalyticsHousekeepingTaskStats& TaskStats = Stats.Tasks[TaskIndex];
+	++TaskStats.NumSteps;
+	TaskStats.TotalSeconds += StepSeconds;
+	TaskStats.MaxStepSeconds = FMath::Max(TaskStats.MaxStepSeconds, StepSeconds);
+	LastTaskIndex = TaskIndex;
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/** Feeds a frame time trace with a spike to a housekeeper with busy work and checks that it kept to the budget */
+	void HousekeepingTest(const TArray<FString>& Args)
+	{
+		const int32 NumSteps = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 2000;
+		const float StepUs = Args.Num() > 1 ? FCString::Atof(*Args[1]) : 20.0f;
+		const float BudgetUs = Args.Num() > 2 ? FCString::Atof(*Args[2]) : 200.0f;
+
+		FArcticAnalyticsHousekeeping Housekeeping(BudgetUs / 1000000.0, 1.5f, 10, 3600.0f);
+		int32 StepsLeft = NumSteps;
+		int32 StepsThisTick = 0;
+		Housekeeping.AddTask(TEXT("Spin"), [&StepsLeft]() { return StepsLeft > 0; }, [&StepsLeft, &StepsThisTick, StepUs]()
+		{
+			const double EndTime = FPlatformTime::Seconds() + StepUs / 1000000.0;
+			while (FPlatformTime::Seconds() < EndTime)
+			{
+			}
+			--StepsLeft;
+			++StepsThisTick;
+		});
+
+		// 60 Hz with some jitter, a loading hitch every 200 frames
+		FRandomStream Random(42);
+		const float MaxTickUs = BudgetUs + StepUs * 1.5f;
+		int32 NumFrames = 0;
+		int32 NumSlowTicks = 0;
+		int32 NumSpikeSteps = 0;
+		int32 SpikeFramesLeft = 0;
+		while (StepsLeft > 0 && NumFrames < 100000)
+		{
+			const bool bHitch = NumFrames % 200 == 199;
+			SpikeFramesLeft = bHitch ? 11 : FMath::Max(0, SpikeFramesLeft - 1);
+			const float DeltaTime = bHitch ? 0.5f : 1.0f / 60.0f + Random.FRandRange(-0.001f, 0.001f);
+			StepsThisTick = 0;
+			Housekeeping.Tick(DeltaTime);
+			NumSlowTicks += Housekeeping.GetStats().LastTickSeconds * 1000000.0 > MaxTickUs && StepsThisTick > 0 ? 1 : 0;
+			NumSpikeSteps += SpikeFramesLeft > 0 ? StepsThisTick : 0;
+			++NumFrames;
+		}
+
+		const FArcticAnalyticsHousekeepingStats& Stats = Housekeeping.GetStats();
+		const bool bPassed = StepsLeft == 0 && NumSlowTicks == 0 && NumSpikeSteps == 0;
+		UE_LOG(LogArcticAnalyticsAnalytics, Display,
+			   TEXT("Housekeeping test %s: %d steps of %.0fus in %d frames, budget %.0fus, worst tick %.0fus, %d ticks over %.0fus, %d steps during spikes, ")
+			   TEXT("%lld idle, %lld busy, %lld deferred ticks"),
+			   bPassed ? TEXT("passed") : TEXT("FAILED"), NumSteps - StepsLeft, StepUs, NumFrames, BudgetUs, Stats.MaxTickSeconds * 1000000.0, NumSlowTicks,
+			   MaxTickUs, NumSpikeSteps, Stats.NumIdleTicks, Stats.NumBusyTicks, Stats.NumDeferredTicks);
+	}
+
+	FAutoConsoleCommand HousekeepingTestCommand(TEXT("ArcticAnalytics.HousekeepingTest"),
+		TEXT("Runs busy work through the housekeeping ticker on a frame time trace with hitches. Args: [Steps=2000] [StepUs=20] [BudgetUs=200]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&HousekeepingTest));
+}
+
+#endif
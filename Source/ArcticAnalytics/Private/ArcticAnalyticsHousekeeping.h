@@ -0,0 +1,98 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Time spent by one housekeeping task */
+struct FArcticAnalyticsHousekeepingTaskStats
+{
+	FString Name;
+	int64 NumSteps = 0;
+	double TotalSeconds = 0.0;
+	double MaxStepSeconds = 0.0;
+};
+
+/** Budget and observed durations of the housekeeping ticker */
+struct FArcticAnalyticsHousekeepingStats
+{
+	double BudgetSeconds = 0.0;
+	/** Smoothed frame time that idle frames and spikes are measured against */
+	double AverageFrameSeconds = 0.0;
+	double LastTickSeconds = 0.0;
+	double MaxTickSeconds = 0.0;
+	int64 NumTicks = 0;
+	/** Ticks with pending work that ran the full budget, one step, or nothing */
+	int64 NumIdleTicks = 0;
+	int64 NumBusyTicks = 0;
+	int64 NumDeferredTicks = 0;
+	/** Ticks that ran a step because work waited longer than MaxDeferSeconds */
+	int64 NumForcedTicks = 0;
+	/** Ticks whose steps went over the budget */
+	int64 NumOverBudgetTicks = 0;
+	TArray<FArcticAnalyticsHousekeepingTaskStats> Tasks;
+};
+
+/**
+ * Spreads background work of the provider across frames, such as starting uploads, draining upload retries and
+ * recovering sessions of earlier runs.
+ *
+ * Work is split into small steps. Every frame, steps of the tasks with pending work run in turn until the per tick
+ * budget is spent, a step is never interrupted so a tick goes over by at most one step. Only idle frames, whose
+ * frame time is at or below the smoothed average, get the full budget. Slower frames run a single step, and while a
+ * frame time spike is in progress no work runs at all, unless work waited longer than MaxDeferSeconds. Game thread only.
+ */
+class FArcticAnalyticsHousekeeping
+{
+public:
+	/**
+	 * @param InBudgetSeconds game thread time per tick
+	 * @param InSpikeFactor frames this much slower than the average start a spike
+	 * @param InSpikeFrames frames after a spike during which it is still in progress
+	 * @param InMaxDeferSeconds longest pending work is held back by slow frames
+	 */
+	FArcticAnalyticsHousekeeping(double InBudgetSeconds, float InSpikeFactor, int32 InSpikeFrames, float InMaxDeferSeconds);
+
+	/**
+	 * Adds a task. Tasks with pending work take turns, one step each.
+	 *
+	 * @param HasWork returns whether a step would do anything
+	 * @param Step does one small unit of the work
+	 */
+	void AddTask(const FString& Name, TFunction<bool()>&& HasWork, TFunction<void()>&& Step);
+
+	/** Runs the steps this frame allows, DeltaTime is the duration of the last frame */
+	void Tick(float DeltaTime);
+
+	/** Runs steps until no task has work left, regardless of the budget */
+	void Flush();
+
+	const FArcticAnalyticsHousekeepingStats& GetStats() const
+	{
+		return Stats;
+	}
+
+private:
+	struct FTask
+	{
+		TFunction<bool()> HasWork;
+		TFunction<void()> Step;
+	};
+
+	/** Index of the next task with work, starting after the last one that ran, or INDEX_NONE */
+	int32 FindNextTask() const;
+	void RunStep(int32 TaskIndex);
+
+	const uint64 BudgetCycles;
+	const float SpikeFactor;
+	const int32 SpikeFrames;
+	const double MaxDeferSeconds;
+
+	TArray<FTask> Tasks;
+	int32 LastTaskIndex;
+	/** Frames the current spike still lasts */
+	int32 SpikeFramesLeft;
+	/** Last time work ran or nothing was pending */
+	double LastServedTime;
+	FArcticAnalyticsHousekeepingStats Stats;
+};
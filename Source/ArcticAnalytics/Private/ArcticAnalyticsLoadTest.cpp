@@ -0,0 +1,789 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "CoreMinimal.h"
+
+#if !UE_BUILD_SHIPPING
+
+#include "Async/Async.h"
+#include "Containers/Ticker.h"
+#include "Dom/JsonObject.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Parse.h"
+#include "Misc/Paths.h"
+#include "Policies/CondensedJsonPrintPolicy.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+#include "ArcticAnalyticsBenchmarkResults.h"
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsMultiSession.h"
+#include "ArcticAnalyticsProvider.h"
+#include "ArcticAnalyticsTestServer.h"
+
+namespace
+{
+	/** Record* variant a load test call goes to */
+	enum class ELoadCall : uint8
+	{
+		Event,
+		ItemPurchase,
+		CurrencyPurchase,
+		CurrencyGiven,
+		ItemPurchaseAttributes,
+		CurrencyPurchaseAttributes,
+		CurrencyGivenAttributes,
+		Error,
+		Progress,
+		Num
+	};
+
+	const TCHAR* LoadCallNames[] = {TEXT("Event"), TEXT("ItemPurchase"), TEXT("CurrencyPurchase"), TEXT("CurrencyGiven"), TEXT("ItemPurchaseAttributes"),
+									TEXT("CurrencyPurchaseAttributes"), TEXT("CurrencyGivenAttributes"), TEXT("Error"), TEXT("Progress")};
+	static_assert(UE_ARRAY_COUNT(LoadCallNames) == (int32)ELoadCall::Num, "Every call needs a name");
+
+	/** One Record* call with its arguments */
+	struct FLoadCall
+	{
+		ELoadCall Call = ELoadCall::Event;
+		/** Seconds after the start of the captured session, at 1x */
+		double Offset = 0.0;
+		/** Event name, item id, game currency type, error or progress type */
+		FString Name;
+		/** Currency, real currency type or progress name */
+		FString Detail;
+		FString PaymentProvider;
+		int32 Amount = 0;
+		float Cost = 0.0f;
+		TArray<FAnalyticsEventAttribute> Attributes;
+		/** Arguments as attributes, for sessions of the multi session provider, which only record events, errors and progress */
+		TArray<FAnalyticsEventAttribute> SessionAttributes;
+
+		void Record(FAnalyticsProviderArcticAnalytics& Provider) const
+		{
+			switch (Call)
+			{
+			case ELoadCall::Event:
+				Provider.RecordEvent(Name, Attributes);
+				break;
+			case ELoadCall::ItemPurchase:
+				Provider.RecordItemPurchase(Name, Detail, (int)Cost, Amount);
+				break;
+			case ELoadCall::CurrencyPurchase:
+				Provider.RecordCurrencyPurchase(Name, Amount, Detail, Cost, PaymentProvider);
+				break;
+			case ELoadCall::CurrencyGiven:
+				Provider.RecordCurrencyGiven(Name, Amount);
+				break;
+			case ELoadCall::ItemPurchaseAttributes:
+				Provider.RecordItemPurchase(Name, Amount, Attributes);
+				break;
+			case ELoadCall::CurrencyPurchaseAttributes:
+				Provider.RecordCurrencyPurchase(Name, Amount, Attributes);
+				break;
+			case ELoadCall::CurrencyGivenAttributes:
+				Provider.RecordCurrencyGiven(Name, Amount, Attributes);
+				break;
+			case ELoadCall::Error:
+				Provider.RecordError(Name, Attributes);
+				break;
+			case ELoadCall::Progress:
+				Provider.RecordProgress(Name, Detail, Attributes);
+				break;
+			default:
+				break;
+			}
+		}
+
+		void Record(FArcticAnalyticsSession& Session) const
+		{
+			switch (Call)
+			{
+			case ELoadCall::Event:
+				Session.RecordEvent(Name, Attributes);
+				break;
+			case ELoadCall::Error:
+				Session.RecordError(Name, Attributes);
+				break;
+			case ELoadCall::Progress:
+				Session.RecordProgress(Name, Detail, Attributes);
+				break;
+			default:
+				Session.RecordEvent(LoadCallNames[(int32)Call], SessionAttributes);
+				break;
+			}
+		}
+
+		/** Builds SessionAttributes from the arguments */
+		void PrepareForSessions()
+		{
+			SessionAttributes.Reset();
+			if (Call == ELoadCall::Event || Call == ELoadCall::Error || Call == ELoadCall::Progress)
+			{
+				return;
+			}
+			SessionAttributes.Emplace(TEXT("name"), Name);
+			SessionAttributes.Emplace(TEXT("amount"), Amount);
+			if (Call == ELoadCall::ItemPurchase || Call == ELoadCall::CurrencyPurchase)
+			{
+				SessionAttributes.Emplace(TEXT("detail"), Detail);
+				SessionAttributes.Emplace(TEXT("cost"), Cost);
+			}
+			SessionAttributes.Append(Attributes);
+		}
+	};
+
+	/** Calls to make, either a weighted mix of synthetic calls or the calls of a captured session */
+	struct FLoadPlan
+	{
+		bool bReplay = false;
+		/** Synthetic calls and their cumulative weights */
+		TArray<FLoadCall> Calls;
+		TArray<uint32> CumulativeWeights;
+		/** Calls per second of every stream, 0 for as fast as possible */
+		double StreamRate = 0.0;
+		/** Length of a synthetic run */
+		double Seconds = 10.0;
+		/** Replay speed */
+		double Speed = 1.0;
+
+		/**
+		 * Returns the Index-th call of a stream and when it is due, relative to the start of the run.
+		 * Synthetic calls are picked from a hash of the index and the stream, so every run makes the same calls.
+		 *
+		 * @return null once the stream is done
+		 */
+		const FLoadCall* GetCall(int32 Index, uint32 StreamSeed, double& OutOffset) const
+		{
+			if (bReplay)
+			{
+				if (Index >= Calls.Num())
+				{
+					return nullptr;
+				}
+				OutOffset = Calls[Index].Offset / Speed;
+				return &Calls[Index];
+			}
+			OutOffset = StreamRate > 0.0 ? Index / StreamRate : 0.0;
+			if (StreamRate > 0.0 && OutOffset >= Seconds)
+			{
+				return nullptr;
+			}
+			const uint32 Roll = HashCombine((uint32)Index * 2654435761u, StreamSeed) % CumulativeWeights.Last();
+			int32 CallIndex = 0;
+			while (CumulativeWeights[CallIndex] <= Roll)
+			{
+				++CallIndex;
+			}
+			return &Calls[CallIndex];
+		}
+	};
+
+	/** Builds one synthetic call of every variant that has a weight in Mix, such as "Event:60,Error:5" */
+	bool BuildSyntheticPlan(const FString& Mix, int32 NumAttributes, int32 ValueBytes, FLoadPlan& OutPlan)
+	{
+		uint32 Weights[(int32)ELoadCall::Num] = {60, 5, 5, 5, 5, 5, 5, 5, 5};
+		if (!Mix.IsEmpty())
+		{
+			FMemory::Memzero(Weights);
+			TArray<FString> Entries;
+			Mix.ParseIntoArray(Entries, TEXT(","));
+			for (const FString& Entry : Entries)
+			{
+				FString CallName, Weight;
+				int32 Found = INDEX_NONE;
+				for (int32 Index = 0; Entry.Split(TEXT(":"), &CallName, &Weight) && Index < (int32)ELoadCall::Num; ++Index)
+				{
+					Found = CallName.TrimStartAndEnd().Equals(LoadCallNames[Index], ESearchCase::IgnoreCase) ? Index : Found;
+				}
+				if (Found == INDEX_NONE)
+				{
+					UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Load test mix entry (%s) is not <Call>:<Weight>, calls are Event, ItemPurchase, CurrencyPurchase, ")
+						   TEXT("CurrencyGiven, ItemPurchaseAttributes, CurrencyPurchaseAttributes, CurrencyGivenAttributes, Error and Progress"), *Entry);
+					return false;
+				}
+				Weights[Found] = (uint32)FMath::Max(0, FCString::Atoi(*Weight));
+			}
+		}
+
+		const FString Value = FString::ChrN(ValueBytes, TEXT('v'));
+		TArray<FAnalyticsEventAttribute> Attributes;
+		for (int32 Index = 0; Index < NumAttributes; ++Index)
+		{
+			Attributes.Emplace(FString::Printf(TEXT("attribute%d"), Index), Value);
+		}
+		uint32 TotalWeight = 0;
+		for (int32 Index = 0; Index < (int32)ELoadCall::Num; ++Index)
+		{
+			if (Weights[Index] == 0)
+			{
+				continue;
+			}
+			FLoadCall& Call = OutPlan.Calls.AddDefaulted_GetRef();
+			Call.Call = (ELoadCall)Index;
+			Call.Name = Call.Call == ELoadCall::Event ? TEXT("LoadTestEvent") : Value;
+			Call.Detail = Value;
+			Call.PaymentProvider = Value;
+			Call.Amount = 100;
+			Call.Cost = 0.99f;
+			Call.Attributes = Attributes;
+			Call.PrepareForSessions();
+			TotalWeight += Weights[Index];
+			OutPlan.CumulativeWeights.Add(TotalWeight);
+		}
+		if (TotalWeight == 0)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Load test mix (%s) has no call with a weight"), *Mix);
+			return false;
+		}
+		return true;
+	}
+
+	FAnalyticsEventAttribute ToAttribute(const FString& Name, const TSharedPtr<FJsonValue>& Value)
+	{
+		switch (Value->Type)
+		{
+		case EJson::String:
+			return FAnalyticsEventAttribute(Name, Value->AsString());
+		case EJson::Number:
+			return FAnalyticsEventAttribute(Name, Value->AsNumber());
+		case EJson::Boolean:
+			return FAnalyticsEventAttribute(Name, Value->AsBool());
+		default:
+		{
+			FString Json;
+			const TSharedRef<TJsonWriter<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>> Writer = TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&Json);
+			FJsonSerializer::Serialize(Value, FString(), Writer);
+			return FAnalyticsEventAttribute(Name, FJsonFragment(MoveTemp(Json)));
+		}
+		}
+	}
+
+	/** Attributes written as a list of name value objects */
+	TArray<FAnalyticsEventAttribute> ReadAttributeList(const FJsonObject& Record)
+	{
+		TArray<FAnalyticsEventAttribute> Attributes;
+		const TArray<TSharedPtr<FJsonValue>>* List;
+		if (Record.TryGetArrayField(TEXT("attributes"), List))
+		{
+			for (const TSharedPtr<FJsonValue>& Entry : *List)
+			{
+				const TSharedPtr<FJsonObject>* Attribute;
+				if (Entry->TryGetObject(Attribute))
+				{
+					Attributes.Emplace((*Attribute)->GetStringField(TEXT("name")), (*Attribute)->GetStringField(TEXT("value")));
+				}
+			}
+		}
+		return Attributes;
+	}
+
+	/** Returns the value of a name value attribute */
+	FString FindAttribute(const TArray<FAnalyticsEventAttribute>& Attributes, const TCHAR* Name)
+	{
+		const FAnalyticsEventAttribute* Attribute = Attributes.FindByPredicate([Name](const FAnalyticsEventAttribute& Candidate) { return Candidate.GetName() == Name; });
+		return Attribute ? Attribute->GetValue() : FString();
+	}
+
+	/** Expands a columnar batch record into one RecordEvent call per event */
+	void ReadBatch(const FJsonObject& Record, TArray<FLoadCall>& OutCalls)
+	{
+		const FString EventName = Record.GetStringField(TEXT("EventName"));
+		const int32 Count = (int32)Record.GetNumberField(TEXT("count"));
+		const TSharedPtr<FJsonObject> Timestamps = Record.GetObjectField(TEXT("TimestampUTC"));
+		const TArray<TSharedPtr<FJsonValue>>& Deltas = Timestamps->GetArrayField(TEXT("deltaMs"));
+		const TSharedPtr<FJsonObject> Columns = Record.GetObjectField(TEXT("columns"));
+		const TArray<TSharedPtr<FJsonValue>>& Keys = Record.GetArrayField(TEXT("keys"));
+
+		double TimestampMs = Timestamps->GetNumberField(TEXT("baseMs"));
+		const int32 FirstCall = OutCalls.Num();
+		for (int32 Index = 0; Index < Count; ++Index)
+		{
+			TimestampMs += Deltas.IsValidIndex(Index) ? Deltas[Index]->AsNumber() : 0.0;
+			FLoadCall& Call = OutCalls.AddDefaulted_GetRef();
+			Call.Name = EventName;
+			Call.Offset = TimestampMs / 1000.0;
+		}
+		for (const TSharedPtr<FJsonValue>& Key : Keys)
+		{
+			const FString Name = Key->AsString();
+			const TSharedPtr<FJsonValue> Column = Columns->TryGetField(Name);
+			if (!Column.IsValid())
+			{
+				continue;
+			}
+			const TSharedPtr<FJsonObject>* Dictionary;
+			if (Column->TryGetObject(Dictionary))
+			{
+				// Dictionary encoded strings
+				const TArray<TSharedPtr<FJsonValue>>& Values = (*Dictionary)->GetArrayField(TEXT("dictionary"));
+				const TArray<TSharedPtr<FJsonValue>>& Indices = (*Dictionary)->GetArrayField(TEXT("indices"));
+				for (int32 Index = 0; Index < Count && Index < Indices.Num(); ++Index)
+				{
+					const int32 ValueIndex = (int32)Indices[Index]->AsNumber();
+					OutCalls[FirstCall + Index].Attributes.Emplace(Name, Values.IsValidIndex(ValueIndex) ? Values[ValueIndex]->AsString() : FString());
+				}
+			}
+			else
+			{
+				const TArray<TSharedPtr<FJsonValue>>& Values = Column->AsArray();
+				for (int32 Index = 0; Index < Count && Index < Values.Num(); ++Index)
+				{
+					OutCalls[FirstCall + Index].Attributes.Add(ToAttribute(Name, Values[Index]));
+				}
+			}
+		}
+	}
+
+	/**
+	 * Reads the records of a session file back into the Record* calls that wrote them. Records without a timestamp
+	 * are due with the record before them.
+	 */
+	bool BuildReplayPlan(const FString& FilePath, FLoadPlan& OutPlan)
+	{
+		FString Session;
+		if (!FFileHelper::LoadFileToString(Session, *FilePath))
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Load test could not read session (%s)"), *FilePath);
+			return false;
+		}
+		TSharedPtr<FJsonObject> Root;
+		const TArray<TSharedPtr<FJsonValue>>* Records;
+		if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Session), Root) || !Root.IsValid() || !Root->TryGetArrayField(TEXT("events"), Records))
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Load test could not parse session (%s), unfinished sessions can't be replayed"), *FilePath);
+			return false;
+		}
+
+		TArray<FLoadCall>& Calls = OutPlan.Calls;
+		double Timestamp = -1.0;
+		for (const TSharedPtr<FJsonValue>& Value : *Records)
+		{
+			const TSharedPtr<FJsonObject>* RecordPtr;
+			if (!Value->TryGetObject(RecordPtr))
+			{
+				continue;
+			}
+			const FJsonObject& Record = **RecordPtr;
+			FString String;
+			if (Record.TryGetStringField(TEXT("eventKind"), String) && String == TEXT("batch"))
+			{
+				ReadBatch(Record, Calls);
+				continue;
+			}
+			FLoadCall Call;
+			if (Record.TryGetStringField(TEXT("EventName"), Call.Name))
+			{
+				Call.Call = ELoadCall::Event;
+				for (const TPair<FString, TSharedPtr<FJsonValue>>& Field : Record.Values)
+				{
+					if (Field.Key == TEXT("TimestampUTC"))
+					{
+						Timestamp = FCString::Atod(*Field.Value->AsString());
+					}
+					else if (Field.Key != TEXT("EventName") && Field.Key != TEXT("RecordId"))
+					{
+						Call.Attributes.Add(ToAttribute(Field.Key, Field.Value));
+					}
+				}
+			}
+			else if (Record.TryGetStringField(TEXT("eventName"), String))
+			{
+				// Record* calls without extra attributes write their arguments as name value attributes
+				const TArray<FAnalyticsEventAttribute> Arguments = ReadAttributeList(Record);
+				Call.Name = FindAttribute(Arguments, String == TEXT("recordItemPurchase") ? TEXT("itemId") : TEXT("gameCurrencyType"));
+				if (String == TEXT("recordItemPurchase"))
+				{
+					Call.Call = ELoadCall::ItemPurchase;
+					Call.Detail = FindAttribute(Arguments, TEXT("currency"));
+					Call.Cost = (float)FCString::Atoi(*FindAttribute(Arguments, TEXT("perItemCost")));
+					Call.Amount = FCString::Atoi(*FindAttribute(Arguments, TEXT("itemQuantity")));
+				}
+				else if (String == TEXT("recordCurrencyPurchase"))
+				{
+					Call.Call = ELoadCall::CurrencyPurchase;
+					Call.Amount = FCString::Atoi(*FindAttribute(Arguments, TEXT("gameCurrencyAmount")));
+					Call.Detail = FindAttribute(Arguments, TEXT("realCurrencyType"));
+					Call.Cost = FCString::Atof(*FindAttribute(Arguments, TEXT("realMoneyCost")));
+					Call.PaymentProvider = FindAttribute(Arguments, TEXT("paymentProvider"));
+				}
+				else
+				{
+					Call.Call = ELoadCall::CurrencyGiven;
+					Call.Amount = FCString::Atoi(*FindAttribute(Arguments, TEXT("gameCurrencyAmount")));
+				}
+			}
+			else if (Record.TryGetStringField(TEXT("error"), Call.Name))
+			{
+				Call.Call = ELoadCall::Error;
+				Call.Attributes = ReadAttributeList(Record);
+			}
+			else if (Record.TryGetStringField(TEXT("eventType"), String))
+			{
+				Call.Attributes = ReadAttributeList(Record);
+				if (String == TEXT("Progress"))
+				{
+					Call.Call = ELoadCall::Progress;
+					Call.Name = Record.GetStringField(TEXT("progressType"));
+					Call.Detail = Record.GetStringField(TEXT("progressName"));
+				}
+				else
+				{
+					Call.Call = String == TEXT("ItemPurchase") ? ELoadCall::ItemPurchaseAttributes
+							  : String == TEXT("CurrencyPurchase") ? ELoadCall::CurrencyPurchaseAttributes
+																   : ELoadCall::CurrencyGivenAttributes;
+					Call.Name = Record.GetStringField(Call.Call == ELoadCall::ItemPurchaseAttributes ? TEXT("itemId") : TEXT("gameCurrencyType"));
+					Call.Amount = (int32)Record.GetNumberField(Call.Call == ELoadCall::ItemPurchaseAttributes ? TEXT("itemQuantity") : TEXT("gameCurrencyAmount"));
+				}
+			}
+			else
+			{
+				continue;
+			}
+			Call.Offset = Timestamp;
+			Calls.Add(MoveTemp(Call));
+		}
+		if (Calls.Num() == 0)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Load test found no records in session (%s)"), *FilePath);
+			return false;
+		}
+
+		// Offsets from the earliest timestamp. Batches are written after records that came later than their first event
+		double FirstTimestamp = DBL_MAX;
+		for (const FLoadCall& Call : Calls)
+		{
+			FirstTimestamp = Call.Offset >= 0.0 ? FMath::Min(FirstTimestamp, Call.Offset) : FirstTimestamp;
+		}
+		for (FLoadCall& Call : Calls)
+		{
+			Call.Offset = Call.Offset >= 0.0 ? Call.Offset - FirstTimestamp : 0.0;
+			Call.PrepareForSessions();
+		}
+		Calls.StableSort([](const FLoadCall& A, const FLoadCall& B) { return A.Offset < B.Offset; });
+		OutPlan.bReplay = true;
+		return true;
+	}
+
+	/** Calls made by one stream, on the game thread or on its own thread */
+	struct FLoadStream
+	{
+		uint32 Seed = 0;
+		int32 NextIndex = 0;
+		TArray<uint64> Cycles;
+		TSharedPtr<FArcticAnalyticsSession, ESPMode::ThreadSafe> Session;
+	};
+
+	/**
+	 * One load test run. Calls to the single session provider are made from the game thread in slices of every tick,
+	 * as that provider is not thread safe. Several streams record into sessions of a multi session provider, one
+	 * session and thread per stream.
+	 */
+	class FLoadTestRun : public TSharedFromThis<FLoadTestRun>
+	{
+	public:
+		FLoadTestRun(FLoadPlan&& InPlan, int32 NumStreams, bool bInMultiSession, const FString& InDescription, uint32 Port)
+			: Plan(MoveTemp(InPlan)), bMultiSession(bInMultiSession), Description(InDescription), StartTime(0.0), PeakUsedPhysical(0)
+		{
+			if (!bMultiSession)
+			{
+				// The provider uploads the session it ends, to the stand-in rather than the configured server
+				Server = MakeUnique<FArcticAnalyticsTestServer>(Port);
+			}
+			Streams.SetNum(NumStreams);
+			for (int32 Index = 0; Index < NumStreams; ++Index)
+			{
+				Streams[Index].Seed = (uint32)Index * 7919u + 1;
+			}
+		}
+
+		void Start()
+		{
+			FArcticAnalyticsMemoryBudget::Get().ResetCounters();
+			SampleMemory();
+			if (bMultiSession)
+			{
+				SessionPath = FPaths::ProjectSavedDir() / TEXT("Analytics") / TEXT("LoadTest");
+				IFileManager::Get().DeleteDirectory(*SessionPath, false, true);
+				MultiSessionProvider = MakeUnique<FArcticAnalyticsMultiSessionProvider>(SessionPath, false);
+				for (int32 Index = 0; Index < Streams.Num(); ++Index)
+				{
+					Streams[Index].Session = MultiSessionProvider->StartSession(FString::Printf(TEXT("LoadTestUser%d"), Index));
+				}
+			}
+			else
+			{
+				if (!Server->Start())
+				{
+					return;
+				}
+				Provider = MakeShared<FAnalyticsProviderArcticAnalytics>();
+				Provider->StartSession(TArray<FAnalyticsEventAttribute>());
+			}
+
+			StartTime = FPlatformTime::Seconds();
+			if (bMultiSession)
+			{
+				for (FLoadStream& Stream : Streams)
+				{
+					Futures.Add(Async(EAsyncExecution::Thread, [this, &Stream]() { RunThread(Stream); }));
+				}
+			}
+			FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([This = AsShared()](float DeltaTime) { return This->Tick(DeltaTime); }));
+		}
+
+	private:
+		bool Tick(float DeltaTime)
+		{
+			SampleMemory();
+			bool bDone = true;
+			if (bMultiSession)
+			{
+				for (const TFuture<void>& Future : Futures)
+				{
+					bDone &= Future.IsReady();
+				}
+			}
+			else
+			{
+				// Slices leave the frame loop running, so the provider's tickers run as they would in a game
+				double NextOffset;
+				bDone = !RunStream(Streams[0], FPlatformTime::Seconds() + 0.05, NextOffset);
+			}
+			if (bDone)
+			{
+				Finish();
+			}
+			return !bDone;
+		}
+
+		/**
+		 * Makes the calls of a stream that are due, until Deadline.
+		 *
+		 * @param OutNextOffset when the next call is due
+		 * @return false once the stream is done
+		 */
+		bool RunStream(FLoadStream& Stream, double Deadline, double& OutNextOffset)
+		{
+			for (;;)
+			{
+				const double Now = FPlatformTime::Seconds();
+				const FLoadCall* Call = Plan.GetCall(Stream.NextIndex, Stream.Seed, OutNextOffset);
+				if (!Call || (!Plan.bReplay && Now - StartTime >= Plan.Seconds))
+				{
+					return false;
+				}
+				if (OutNextOffset > Now - StartTime || Now >= Deadline)
+				{
+					return true;
+				}
+				const uint64 StartCycles = FPlatformTime::Cycles64();
+				if (Stream.Session.IsValid())
+				{
+					Call->Record(*Stream.Session);
+				}
+				else
+				{
+					Call->Record(*Provider);
+				}
+				Stream.Cycles.Add(FPlatformTime::Cycles64() - StartCycles);
+				++Stream.NextIndex;
+			}
+		}
+
+		void RunThread(FLoadStream& Stream)
+		{
+			double NextOffset;
+			while (RunStream(Stream, DBL_MAX, NextOffset))
+			{
+				// Sleeps are coarse, the last millisecond is yielded away
+				const double Wait = NextOffset - (FPlatformTime::Seconds() - StartTime);
+				FPlatformProcess::SleepNoStats(Wait > 0.002 ? (float)(Wait - 0.001) : 0.0f);
+			}
+		}
+
+		void SampleMemory()
+		{
+			PeakUsedPhysical = FMath::Max<uint64>(PeakUsedPhysical, FPlatformMemory::GetStats().UsedPhysical);
+		}
+
+		void Finish()
+		{
+			const double RecordSeconds = FPlatformTime::Seconds() - StartTime;
+			SampleMemory();
+
+			// Ending the sessions writes them out, the files are measured once they are complete
+			const double EndStartTime = FPlatformTime::Seconds();
+			TArray<FString> SessionFiles;
+			int64 Deliveries = 0;
+			if (bMultiSession)
+			{
+				MultiSessionProvider->EndAllSessions();
+				MultiSessionProvider->WaitForWrites();
+				IFileManager::Get().FindFiles(SessionFiles, *(SessionPath / TEXT("*.analytics")), true, false);
+				for (FString& File : SessionFiles)
+				{
+					File = SessionPath / File;
+				}
+			}
+			else
+			{
+				SessionFiles.Add(FPaths::ProjectSavedDir() / TEXT("Analytics") / (Provider->GetSessionID() + TEXT(".analytics")));
+				Deliveries = Provider->GetDeliveryLatency(EArcticAnalyticsLane::Bulk).Deliveries;
+				Provider->EndSession();
+			}
+			const double EndSeconds = FPlatformTime::Seconds() - EndStartTime;
+			SampleMemory();
+			int64 FileBytes = 0;
+			for (const FString& File : SessionFiles)
+			{
+				FileBytes += FMath::Max<int64>(0, IFileManager::Get().FileSize(*File));
+			}
+
+			TArray<uint64> Cycles;
+			for (FLoadStream& Stream : Streams)
+			{
+				Cycles.Append(MoveTemp(Stream.Cycles));
+			}
+			const double TargetRate = Plan.bReplay ? 0.0 : Plan.StreamRate * Streams.Num();
+			const FArcticAnalyticsBudgetCounters Budget = FArcticAnalyticsMemoryBudget::Get().GetCounters();
+
+			TSharedRef<FJsonObject> Results = MakeShared<FJsonObject>();
+			ArcticAnalyticsBenchmarkResults::AddHeader(*Results);
+			Results->SetStringField(TEXT("run"), Description);
+			Results->SetNumberField(TEXT("streams"), Streams.Num());
+			Results->SetNumberField(TEXT("calls"), Cycles.Num());
+			Results->SetNumberField(TEXT("seconds"), RecordSeconds);
+			Results->SetNumberField(TEXT("targetCallsPerSecond"), TargetRate);
+			Results->SetNumberField(TEXT("callsPerSecond"), Cycles.Num() / FMath::Max(RecordSeconds, 1e-9));
+			ArcticAnalyticsBenchmarkResults::AddPercentiles(*Results, Cycles);
+			Results->SetNumberField(TEXT("endSessionMs"), EndSeconds * 1000.0);
+			Results->SetNumberField(TEXT("bufferedHighWaterBytes"), (double)Budget.HighWaterBytes);
+			Results->SetNumberField(TEXT("peakUsedPhysicalMB"), PeakUsedPhysical / (1024.0 * 1024.0));
+			Results->SetNumberField(TEXT("fileBytes"), (double)FileBytes);
+
+			UE_LOG(LogArcticAnalyticsAnalytics, Display,
+				   TEXT("Load test %s: %d calls in %.2fs, %.0f calls/s (target %.0f), p50=%.2fus p90=%.2fus p99=%.2fus p99.9=%.2fus max=%.2fus, ")
+				   TEXT("end %.1fms, buffered high water %.1fKB, peak used physical %.1fMB, %d files %.1fKB"),
+				   *Description, Cycles.Num(), RecordSeconds, Results->GetNumberField(TEXT("callsPerSecond")), TargetRate,
+				   Results->GetNumberField(TEXT("p50Us")), Results->GetNumberField(TEXT("p90Us")), Results->GetNumberField(TEXT("p99Us")),
+				   Results->GetNumberField(TEXT("p999Us")), Results->GetNumberField(TEXT("maxUs")), EndSeconds * 1000.0, Budget.HighWaterBytes / 1024.0,
+				   PeakUsedPhysical / (1024.0 * 1024.0), SessionFiles.Num(), FileBytes / 1024.0);
+
+			ArcticAnalyticsBenchmarkResults::Save(Results, TEXT("ArcticAnalyticsLoadTest"));
+
+			for (FLoadStream& Stream : Streams)
+			{
+				Stream.Session.Reset();
+			}
+			MultiSessionProvider.Reset();
+			if (Provider.IsValid())
+			{
+				WaitForDelivery(Deliveries, SessionFiles[0]);
+			}
+		}
+
+		/** Keeps the stand-in running until the provider delivered the ended session, or for 30 seconds, then deletes its file */
+		void WaitForDelivery(int64 Deliveries, const FString& SessionFile)
+		{
+			const double Deadline = FPlatformTime::Seconds() + 30.0;
+			FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([This = AsShared(), Deliveries, Deadline, SessionFile](float DeltaTime)
+			{
+				const bool bTimedOut = FPlatformTime::Seconds() > Deadline;
+				if (!bTimedOut && This->Provider->GetDeliveryLatency(EArcticAnalyticsLane::Bulk).Deliveries <= Deliveries)
+				{
+					return true;
+				}
+				if (bTimedOut)
+				{
+					UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Load test: the session was not delivered to the stand-in server within 30s"));
+				}
+				This->Provider.Reset();
+				IFileManager::Get().Delete(*SessionFile);
+				This->Server->Stop();
+				return false;
+			}));
+		}
+
+		FLoadPlan Plan;
+		const bool bMultiSession;
+		const FString Description;
+		TArray<FLoadStream> Streams;
+		TArray<TFuture<void>> Futures;
+		TSharedPtr<FAnalyticsProviderArcticAnalytics> Provider;
+		TUniquePtr<FArcticAnalyticsMultiSessionProvider> MultiSessionProvider;
+		TUniquePtr<FArcticAnalyticsTestServer> Server;
+		FString SessionPath;
+		double StartTime;
+		uint64 PeakUsedPhysical;
+	};
+
+	void LoadTest(const TArray<FString>& Args)
+	{
+		const FString Line = FString::Join(Args, TEXT(" "));
+		FString Mode = TEXT("Synth");
+		FString Target = TEXT("Provider");
+		FString File, Mix;
+		int32 Threads = 1;
+		int32 NumAttributes = 4;
+		int32 ValueBytes = 16;
+		float Rate = 10000.0f;
+		float Seconds = 10.0f;
+		float Speed = 1.0f;
+		uint32 Port = 8089;
+		FParse::Value(*Line, TEXT("Mode="), Mode);
+		FParse::Value(*Line, TEXT("Target="), Target);
+		FParse::Value(*Line, TEXT("File="), File);
+		FParse::Value(*Line, TEXT("Mix="), Mix);
+		FParse::Value(*Line, TEXT("Threads="), Threads);
+		FParse::Value(*Line, TEXT("Attributes="), NumAttributes);
+		FParse::Value(*Line, TEXT("ValueBytes="), ValueBytes);
+		FParse::Value(*Line, TEXT("Rate="), Rate);
+		FParse::Value(*Line, TEXT("Seconds="), Seconds);
+		FParse::Value(*Line, TEXT("Speed="), Speed);
+		FParse::Value(*Line, TEXT("Port="), Port);
+
+		const bool bMultiSession = Target.Equals(TEXT("MultiSession"), ESearchCase::IgnoreCase);
+		if (!bMultiSession && Threads > 1)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Load test: the provider is game thread only, use Target=MultiSession for several threads. Running one stream."));
+		}
+		Threads = bMultiSession ? FMath::Clamp(Threads, 1, 256) : 1;
+
+		FLoadPlan Plan;
+		FString Description;
+		if (Mode.Equals(TEXT("Replay"), ESearchCase::IgnoreCase))
+		{
+			Plan.Speed = FMath::Clamp(Speed, 1.0f, 100.0f);
+			if (!BuildReplayPlan(File, Plan))
+			{
+				return;
+			}
+			Description = FString::Printf(TEXT("replay of %s at %.0fx, %d calls, %s x%d"), *FPaths::GetCleanFilename(File), Plan.Speed, Plan.Calls.Num(), *Target, Threads);
+		}
+		else
+		{
+			if (!BuildSyntheticPlan(Mix, FMath::Max(0, NumAttributes), FMath::Max(0, ValueBytes), Plan))
+			{
+				return;
+			}
+			Plan.StreamRate = FMath::Max(0.0f, Rate) / Threads;
+			Plan.Seconds = FMath::Max(0.1f, Seconds);
+			Description = FString::Printf(TEXT("synthetic %.0f calls/s for %.0fs, %d attributes of %d bytes, %s x%d"), Rate, Plan.Seconds, NumAttributes, ValueBytes,
+										  *Target, Threads);
+		}
+		MakeShared<FLoadTestRun>(MoveTemp(Plan), Threads, bMultiSession, Description, Port)->Start();
+	}
+
+	FAutoConsoleCommand LoadTestCommand(TEXT("ArcticAnalytics.LoadTest"),
+		TEXT("Drives a provider with synthetic calls or a replayed session and reports throughput, call latency, memory and file size. ")
+		TEXT("Args: [Mode=Synth|Replay] [Target=Provider|MultiSession] [Threads=1] [Rate=10000] [Seconds=10] [Attributes=4] [ValueBytes=16] ")
+		TEXT("[Mix=Event:60,ItemPurchase:5,...] [File=<session>.analytics] [Speed=1..100] [Port=8089]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&LoadTest));
+}
+
+#endif
@@ -0,0 +1,192 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsMemoryArchive.h"
+
+#include "HAL/FileManager.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+
+FArcticAnalyticsChunkBuffer::~FArcticAnalyticsChunkBuffer()
+{
+	Empty();
+}
+
+void FArcticAnalyticsChunkBuffer::Empty()
+{
+	Chunks.Empty();
+	NumBytes = 0;
+	FArcticAnalyticsMemoryBudget::Get().Release(ChargedBytes);
+	ChargedBytes = 0;
+}
+
+FArcticAnalyticsMemoryArchive::FArcticAnalyticsMemoryArchive(int32 InChunkBytes, int64 InMaxBytes, const FString& InSpillFilePath)
+	: ChunkBytes(FMath::Max(1024, InChunkBytes)), MaxBytes(InMaxBytes), SpillFilePath(InSpillFilePath),
+	  Buffer(MakeShared<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>()), bHasSpilled(false)
+{
+	SetIsSaving(true);
+	SetIsPersistent(true);
+}
+
+FArcticAnalyticsMemoryArchive::~FArcticAnalyticsMemoryArchive()
+{
+	Close();
+}
+
+void FArcticAnalyticsMemoryArchive::Serialize(void* Data, int64 Num)
+{
+	if (!bHasSpilled && Buffer->NumBytes + Num > MaxBytes)
+	{
+		Spill();
+	}
+	if (bHasSpilled)
+	{
+		if (SpillWriter)
+		{
+			SpillWriter->Serialize(Data, Num);
+		}
+		return;
+	}
+
+	const uint8* Bytes = (const uint8*)Data;
+	Buffer->NumBytes += Num;
+	while (Num > 0)
+	{
+		if (Buffer->Chunks.Num() == 0 || Buffer->Chunks.Last().Num() == ChunkBytes)
+		{
+			Buffer->Chunks.AddDefaulted_GetRef().Reserve(ChunkBytes);
+			Buffer->ChargedBytes += ChunkBytes;
+			FArcticAnalyticsMemoryBudget::Get().Charge(ChunkBytes);
+		}
+		TArray<uint8>& Chunk = Buffer->Chunks.Last();
+		const int32 Copied = (int32)FMath::Min<int64>(Num, ChunkBytes - Chunk.Num());
+		Chunk.Append(Bytes, Copied);
+		Bytes += Copied;
+		Num -= Copied;
+	}
+}
+
+void FArcticAnalyticsMemoryArchive::Flush()
+{
+	if (SpillWriter)
+	{
+		SpillWriter->Flush();
+	}
+}
+
+bool FArcticAnalyticsMemoryArchive::Close()
+{
+	if (SpillWriter)
+	{
+		SpillWriter->Close();
+		SpillWriter = nullptr;
+	}
+	return !IsError();
+}
+
+int64 FArcticAnalyticsMemoryArchive::Tell()
+{
+	return SpillWriter ? SpillWriter->Tell() : Buffer->NumBytes;
+}
+
+int64 FArcticAnalyticsMemoryArchive::TotalSize()
+{
+	return Tell();
+}
+
+FString FArcticAnalyticsMemoryArchive::GetArchiveName() const
+{
+	return TEXT("FArcticAnalyticsMemoryArchive");
+}
+
+TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> FArcticAnalyticsMemoryArchive::ReleaseBuffer()
+{
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Released = Buffer;
+	Buffer = MakeShared<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>();
+	return Released;
+}
+
+void FArcticAnalyticsMemoryArchive::Spill()
+{
+	if (bHasSpilled)
+	{
+		return;
+	}
+	UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Spilling in memory session of (%lld) bytes to (%s)"), Buffer->NumBytes, *SpillFilePath);
+	bHasSpilled = true;
+	FArcticAnalyticsMemoryBudget::Get().AddSpilledBytes(Buffer->NumBytes);
+	SpillWriter = TUniquePtr<FArchive>(IFileManager::Get().CreateFileWriter(*SpillFilePath, FILEWRITE_EvenIfReadOnly));
+	if (!SpillWriter)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FArcticAnalyticsMemoryArchive failed to create (%s), dropping the session"), *SpillFilePath);
+		SetError();
+	}
+	else
+	{
+		for (TArray<uint8>& Chunk : Buffer->Chunks)
+		{
+			SpillWriter->Serialize(Chunk.GetData(), Chunk.Num());
+		}
+	}
+	Buffer->Empty();
+}
+
+FArcticAnalyticsChunkReader::FArcticAnalyticsChunkReader(const TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>& InBuffer)
+	: Buffer(InBuffer), Pos(0), ChunkIndex(0), ChunkStart(0)
+{
+	SetIsLoading(true);
+	SetIsPersistent(true);
+}
+
+void FArcticAnalyticsChunkReader::Serialize(void* Data, int64 Num)
+{
+	if (Pos + Num > Buffer->NumBytes)
+	{
+		SetError();
+		return;
+	}
+	uint8* Bytes = (uint8*)Data;
+	while (Num > 0)
+	{
+		const TArray<uint8>& Chunk = Buffer->Chunks[ChunkIndex];
+		const int64 Offset = Pos - ChunkStart;
+		const int32 Copied = (int32)FMath::Min<int64>(Num, Chunk.Num() - Offset);
+		FMemory::Memcpy(Bytes, Chunk.GetData() + Offset, Copied);
+		Bytes += Copied;
+		Num -= Copied;
+		Pos += Copied;
+		if (Pos - ChunkStart == Chunk.Num() && ChunkIndex + 1 < Buffer->Chunks.Num())
+		{
+			ChunkStart += Chunk.Num();
+			++ChunkIndex;
+		}
+	}
+}
+
+void FArcticAnalyticsChunkReader::Seek(int64 InPos)
+{
+	check(InPos >= 0 && InPos <= Buffer->NumBytes);
+	Pos = InPos;
+	ChunkIndex = 0;
+	ChunkStart = 0;
+	while (ChunkIndex + 1 < Buffer->Chunks.Num() && ChunkStart + Buffer->Chunks[ChunkIndex].Num() <= Pos)
+	{
+		ChunkStart += Buffer->Chunks[ChunkIndex].Num();
+		++ChunkIndex;
+	}
+}
+
+int64 FArcticAnalyticsChunkReader::Tell()
+{
+	return Pos;
+}
+
+int64 FArcticAnalyticsChunkReader::TotalSize()
+{
+	return Buffer->NumBytes;
+}
+
+FString FArcticAnalyticsChunkReader::GetArchiveName() const
+{
+	return TEXT("FArcticAnalyticsChunkReader");
+}
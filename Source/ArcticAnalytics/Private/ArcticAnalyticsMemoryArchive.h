@@ -0,0 +1,84 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Serialization/Archive.h"
+
+/**
+ * Data of a session kept in memory, split into fixed size chunks so it never has to be reallocated as a whole.
+ * Allocated chunks are charged to the memory budget until the buffer is freed, e.g. once its upload completed.
+ */
+struct FArcticAnalyticsChunkBuffer
+{
+	~FArcticAnalyticsChunkBuffer();
+
+	/** Frees the chunks and gives their memory back to the budget */
+	void Empty();
+
+	TArray<TArray<uint8>> Chunks;
+	int64 NumBytes = 0;
+	int64 ChargedBytes = 0;
+};
+
+/**
+ * Archive that keeps a session in memory instead of writing it to disk.
+ *
+ * Data goes into chunks of ChunkBytes. Once more than MaxBytes were written, everything so far is spilled to
+ * SpillFilePath and the rest of the session is written there.
+ */
+class FArcticAnalyticsMemoryArchive : public FArchive
+{
+public:
+	FArcticAnalyticsMemoryArchive(int32 InChunkBytes, int64 InMaxBytes, const FString& InSpillFilePath);
+	virtual ~FArcticAnalyticsMemoryArchive();
+
+	// FArchive interface
+	virtual void Serialize(void* Data, int64 Num) override;
+	virtual void Flush() override;
+	virtual bool Close() override;
+	virtual int64 Tell() override;
+	virtual int64 TotalSize() override;
+	virtual FString GetArchiveName() const override;
+
+	/** Whether the session outgrew the cap and is on disk at the spill path */
+	bool HasSpilled() const
+	{
+		return bHasSpilled;
+	}
+
+	/** Hands over the buffered session, leaving the archive empty */
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> ReleaseBuffer();
+
+	/** Moves the session to the spill path, the rest of it is written there */
+	void Spill();
+
+private:
+	const int32 ChunkBytes;
+	const int64 MaxBytes;
+	const FString SpillFilePath;
+	TSharedRef<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Buffer;
+	TUniquePtr<FArchive> SpillWriter;
+	bool bHasSpilled;
+};
+
+/** Reads a chunk buffer back as one contiguous stream, e.g. as the content of an HTTP request */
+class FArcticAnalyticsChunkReader : public FArchive
+{
+public:
+	explicit FArcticAnalyticsChunkReader(const TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>& InBuffer);
+
+	// FArchive interface
+	virtual void Serialize(void* Data, int64 Num) override;
+	virtual void Seek(int64 InPos) override;
+	virtual int64 Tell() override;
+	virtual int64 TotalSize() override;
+	virtual FString GetArchiveName() const override;
+
+private:
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Buffer;
+	int64 Pos;
+	/** Chunk containing Pos and the offset of its first byte */
+	int32 ChunkIndex;
+	int64 ChunkStart;
+};
@@ -0,0 +1,278 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsMemoryBudget.h"
+
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/Paths.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMultiSession.h"
+#include "ArcticAnalyticsSettings.h"
+
+FArcticAnalyticsMemoryBudget& FArcticAnalyticsMemoryBudget::Get()
+{
+	static FArcticAnalyticsMemoryBudget Budget;
+	return Budget;
+}
+
+FArcticAnalyticsMemoryBudget::FArcticAnalyticsMemoryBudget()
+	: BudgetBytes(0), SoftLimitBytes(0), Policy(EArcticAnalyticsBudgetPolicy::Block), BlockMs(5), SampleEvery(10), UsedBytes(0), HighWaterBytes(0),
+	  DroppedEvents(0), DroppedBytes(0), SpilledEvents(0), SpilledBytes(0), BlockedEvents(0), SampleCounter(0), bBlockTimedOut(false)
+{
+	LoadFromConfig();
+}
+
+void FArcticAnalyticsMemoryBudget::LoadFromConfig()
+{
+	int32 MemoryBudgetMB = 0;
+	ArcticAnalyticsSettings::GetInt(TEXT("MemoryBudgetMB"), MemoryBudgetMB);
+	FString PolicyName;
+	ArcticAnalyticsSettings::GetString(TEXT("MemoryBudgetPolicy"), PolicyName);
+	float SoftFraction = 0.8f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("MemoryBudgetSoftFraction"), SoftFraction);
+	int32 ConfigBlockMs = 5;
+	ArcticAnalyticsSettings::GetInt(TEXT("MemoryBudgetBlockMs"), ConfigBlockMs);
+	int32 ConfigSampleEvery = 10;
+	ArcticAnalyticsSettings::GetInt(TEXT("MemoryBudgetSampleEvery"), ConfigSampleEvery);
+
+	EArcticAnalyticsBudgetPolicy ConfigPolicy = EArcticAnalyticsBudgetPolicy::Block;
+	if (PolicyName == TEXT("DropLowPriority"))
+	{
+		ConfigPolicy = EArcticAnalyticsBudgetPolicy::DropLowPriority;
+	}
+	else if (PolicyName == TEXT("Sample"))
+	{
+		ConfigPolicy = EArcticAnalyticsBudgetPolicy::Sample;
+	}
+	else if (PolicyName == TEXT("Spill"))
+	{
+		ConfigPolicy = EArcticAnalyticsBudgetPolicy::Spill;
+	}
+	else if (PolicyName.Len() > 0 && PolicyName != TEXT("Block"))
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Unknown MemoryBudgetPolicy (%s), using Block"), *PolicyName);
+	}
+	Configure((int64)MemoryBudgetMB * 1024 * 1024, ConfigPolicy, SoftFraction, ConfigBlockMs, ConfigSampleEvery);
+}
+
+void FArcticAnalyticsMemoryBudget::Configure(int64 InBudgetBytes, EArcticAnalyticsBudgetPolicy InPolicy, float InSoftFraction, int32 InBlockMs, int32 InSampleEvery)
+{
+	BudgetBytes = FMath::Max<int64>(0, InBudgetBytes);
+	SoftLimitBytes = (int64)(BudgetBytes * FMath::Clamp(InSoftFraction, 0.0f, 1.0f));
+	Policy = InPolicy;
+	BlockMs = FMath::Max(0, InBlockMs);
+	SampleEvery = FMath::Max(1, InSampleEvery);
+	bBlockTimedOut.store(false, std::memory_order_relaxed);
+}
+
+EArcticAnalyticsBudgetDecision FArcticAnalyticsMemoryBudget::Admit(int64 Bytes, bool bHighPriority)
+{
+	if (BudgetBytes <= 0)
+	{
+		return EArcticAnalyticsBudgetDecision::Accept;
+	}
+	int64 Used = UsedBytes.load(std::memory_order_relaxed);
+	if (Used + Bytes <= SoftLimitBytes)
+	{
+		if (bBlockTimedOut.load(std::memory_order_relaxed))
+		{
+			bBlockTimedOut.store(false, std::memory_order_relaxed);
+		}
+		return EArcticAnalyticsBudgetDecision::Accept;
+	}
+
+	switch (Policy)
+	{
+	case EArcticAnalyticsBudgetPolicy::Block:
+	{
+		// Some buffers only drain when their session ends, so after one wait ran out the overflow spills instead
+		// of every caller waiting again, until usage is back under the soft limit
+		if (!bBlockTimedOut.load(std::memory_order_relaxed))
+		{
+			BlockedEvents.fetch_add(1, std::memory_order_relaxed);
+			const double Deadline = FPlatformTime::Seconds() + BlockMs / 1000.0;
+			while (Used + Bytes > SoftLimitBytes && FPlatformTime::Seconds() < Deadline)
+			{
+				FPlatformProcess::SleepNoStats(0.0005f);
+				Used = UsedBytes.load(std::memory_order_relaxed);
+			}
+			if (Used + Bytes <= SoftLimitBytes)
+			{
+				break;
+			}
+			bBlockTimedOut.store(true, std::memory_order_relaxed);
+		}
+		if (Used + Bytes > BudgetBytes)
+		{
+			return Drop(Bytes);
+		}
+		SpilledEvents.fetch_add(1, std::memory_order_relaxed);
+		return EArcticAnalyticsBudgetDecision::Spill;
+	}
+	case EArcticAnalyticsBudgetPolicy::DropLowPriority:
+		if (!bHighPriority)
+		{
+			return Drop(Bytes);
+		}
+		break;
+	case EArcticAnalyticsBudgetPolicy::Sample:
+		if (!bHighPriority && SampleCounter.fetch_add(1, std::memory_order_relaxed) % SampleEvery != 0)
+		{
+			return Drop(Bytes);
+		}
+		break;
+	case EArcticAnalyticsBudgetPolicy::Spill:
+		// Spilling frees what is buffered, so it's fine past the hard limit too
+		SpilledEvents.fetch_add(1, std::memory_order_relaxed);
+		return EArcticAnalyticsBudgetDecision::Spill;
+	}
+
+	if (Used + Bytes > BudgetBytes)
+	{
+		return Drop(Bytes);
+	}
+	return EArcticAnalyticsBudgetDecision::Accept;
+}
+
+EArcticAnalyticsBudgetDecision FArcticAnalyticsMemoryBudget::Drop(int64 Bytes)
+{
+	DroppedEvents.fetch_add(1, std::memory_order_relaxed);
+	DroppedBytes.fetch_add(Bytes, std::memory_order_relaxed);
+	return EArcticAnalyticsBudgetDecision::Drop;
+}
+
+void FArcticAnalyticsMemoryBudget::Charge(int64 Bytes)
+{
+	const int64 Used = UsedBytes.fetch_add(Bytes, std::memory_order_relaxed) + Bytes;
+	int64 HighWater = HighWaterBytes.load(std::memory_order_relaxed);
+	while (Used > HighWater && !HighWaterBytes.compare_exchange_weak(HighWater, Used, std::memory_order_relaxed))
+	{
+	}
+}
+
+void FArcticAnalyticsMemoryBudget::Release(int64 Bytes)
+{
+	UsedBytes.fetch_sub(Bytes, std::memory_order_relaxed);
+}
+
+void FArcticAnalyticsMemoryBudget::AddSpilledBytes(int64 Bytes)
+{
+	SpilledBytes.fetch_add(Bytes, std::memory_order_relaxed);
+}
+
+FArcticAnalyticsBudgetCounters FArcticAnalyticsMemoryBudget::GetCounters() const
+{
+	FArcticAnalyticsBudgetCounters Counters;
+	Counters.UsedBytes = UsedBytes.load(std::memory_order_relaxed);
+	Counters.HighWaterBytes = HighWaterBytes.load(std::memory_order_relaxed);
+	Counters.DroppedEvents = DroppedEvents.load(std::memory_order_relaxed);
+	Counters.DroppedBytes = DroppedBytes.load(std::memory_order_relaxed);
+	Counters.SpilledEvents = SpilledEvents.load(std::memory_order_relaxed);
+	Counters.SpilledBytes = SpilledBytes.load(std::memory_order_relaxed);
+	Counters.BlockedEvents = BlockedEvents.load(std::memory_order_relaxed);
+	return Counters;
+}
+
+void FArcticAnalyticsMemoryBudget::ResetCounters()
+{
+	HighWaterBytes.store(UsedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	DroppedEvents.store(0, std::memory_order_relaxed);
+	DroppedBytes.store(0, std::memory_order_relaxed);
+	SpilledEvents.store(0, std::memory_order_relaxed);
+	SpilledBytes.store(0, std::memory_order_relaxed);
+	BlockedEvents.store(0, std::memory_order_relaxed);
+}
+
+namespace
+{
+	void LogBudgetCounters(const TCHAR* Label, const FArcticAnalyticsBudgetCounters& Counters)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("%s: used=%lld highWater=%lld dropped=%lld events (%lld bytes) spilled=%lld events (%lld bytes) blocked=%lld events"),
+			   Label, Counters.UsedBytes, Counters.HighWaterBytes, Counters.DroppedEvents, Counters.DroppedBytes, Counters.SpilledEvents,
+			   Counters.SpilledBytes, Counters.BlockedEvents);
+	}
+
+	FAutoConsoleCommand MemoryBudgetCommand(TEXT("ArcticAnalytics.MemoryBudget"), TEXT("Logs the analytics memory budget counters"),
+		FConsoleCommandDelegate::CreateLambda([]()
+		{
+			LogBudgetCounters(TEXT("Memory budget"), FArcticAnalyticsMemoryBudget::Get().GetCounters());
+		}));
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/**
+	 * Floods a small budget from several threads, then checks that the memory held never went past the budget by
+	 * more than what the threads can have in flight at once, and that every policy shed or spilled load
+	 */
+	void OverloadTest(const TArray<FString>& Args)
+	{
+		const int32 BudgetKB = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 256;
+		const int32 NumThreads = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 4;
+		const int32 EventsPerThread = Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 5000;
+		const FString TestPath = FPaths::ProjectSavedDir() / TEXT("Analytics") / TEXT("OverloadTest");
+		const TCHAR* PolicyNames[] = {TEXT("Block"), TEXT("DropLowPriority"), TEXT("Sample"), TEXT("Spill")};
+
+		TArray<FAnalyticsEventAttribute> Attributes;
+		Attributes.Emplace(TEXT("map"), TEXT("Overload"));
+		Attributes.Emplace(TEXT("payload"), FString::ChrN(200, TEXT('x')));
+
+		FArcticAnalyticsMemoryBudget& Budget = FArcticAnalyticsMemoryBudget::Get();
+		bool bPassed = true;
+		for (int32 PolicyIndex = 0; PolicyIndex < UE_ARRAY_COUNT(PolicyNames); ++PolicyIndex)
+		{
+			const EArcticAnalyticsBudgetPolicy Policy = (EArcticAnalyticsBudgetPolicy)PolicyIndex;
+			Budget.Configure((int64)BudgetKB * 1024, Policy);
+			Budget.ResetCounters();
+			const double StartTime = FPlatformTime::Seconds();
+			{
+				FArcticAnalyticsMultiSessionProvider Provider(TestPath, false);
+				ParallelFor(NumThreads, [&Provider, &Attributes, EventsPerThread](int32 ThreadIndex)
+				{
+					TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe> Session = Provider.StartSession(FString::Printf(TEXT("OverloadUser%d"), ThreadIndex));
+					for (int32 EventIndex = 0; EventIndex < EventsPerThread; ++EventIndex)
+					{
+						if (EventIndex % 100 == 0)
+						{
+							Session->RecordError(TEXT("OverloadError"), Attributes);
+						}
+						else
+						{
+							Session->RecordEvent(TEXT("OverloadEvent"), Attributes);
+						}
+					}
+				});
+				Provider.EndAllSessions();
+				Provider.WaitForWrites();
+			}
+			const double Seconds = FPlatformTime::Seconds() - StartTime;
+			const FArcticAnalyticsBudgetCounters Counters = Budget.GetCounters();
+			LogBudgetCounters(*FString::Printf(TEXT("Overload test %s (%.3fs)"), PolicyNames[PolicyIndex], Seconds), Counters);
+
+			// Every thread can be between the budget check and charging its record, plus a record separator
+			const int64 Slack = (int64)NumThreads * 1024;
+			const bool bWithinBudget = Policy == EArcticAnalyticsBudgetPolicy::Spill || Counters.HighWaterBytes <= Budget.GetBudgetBytes() + Slack;
+			const bool bShedLoad = Counters.DroppedEvents > 0 || Counters.SpilledEvents > 0 || Counters.BlockedEvents > 0;
+			if (!bWithinBudget || !bShedLoad)
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Overload test %s failed: within budget (%d), shed load (%d)"), PolicyNames[PolicyIndex], bWithinBudget, bShedLoad);
+				bPassed = false;
+			}
+		}
+		Budget.LoadFromConfig();
+		IFileManager::Get().DeleteDirectory(*TestPath, false, true);
+		UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Overload test %s"), bPassed ? TEXT("passed") : TEXT("FAILED"));
+	}
+
+	FAutoConsoleCommand OverloadTestCommand(TEXT("ArcticAnalytics.OverloadTest"),
+		TEXT("Floods a small memory budget with every policy and checks it holds. Args: [BudgetKB=256] [Threads=4] [EventsPerThread=5000]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&OverloadTest));
+}
+
+#endif
@@ -0,0 +1,115 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <atomic>
+
+/** What happens to events once buffered analytics data goes over the soft limit of the budget */
+enum class EArcticAnalyticsBudgetPolicy : uint8
+{
+	/** Wait up to MemoryBudgetBlockMs for buffers to drain, spill once a wait ran out until usage is under the soft limit again */
+	Block,
+	/** Drop everything but high priority events */
+	DropLowPriority,
+	/** Keep one in MemoryBudgetSampleEvery low priority events */
+	Sample,
+	/** Move buffered data to disk */
+	Spill
+};
+
+enum class EArcticAnalyticsBudgetDecision : uint8
+{
+	Accept,
+	Drop,
+	/** Accept, but move what is buffered to disk first */
+	Spill
+};
+
+struct FArcticAnalyticsBudgetCounters
+{
+	int64 UsedBytes = 0;
+	int64 HighWaterBytes = 0;
+	int64 DroppedEvents = 0;
+	int64 DroppedBytes = 0;
+	int64 SpilledEvents = 0;
+	int64 SpilledBytes = 0;
+	int64 BlockedEvents = 0;
+};
+
+/**
+ * Process wide byte budget for analytics data held in memory: session buffers, queued writes and pending uploads.
+ *
+ * Buffers charge what they allocate and release it once written or uploaded. Recording paths ask Admit before
+ * buffering an event. Under the soft limit (MemoryBudgetSoftFraction of MemoryBudgetMB) everything is accepted,
+ * above it the configured policy applies, and past the budget itself only a spill is accepted.
+ */
+class FArcticAnalyticsMemoryBudget
+{
+public:
+	static FArcticAnalyticsMemoryBudget& Get();
+
+	/** Reads the MemoryBudget settings. Not thread safe, only call while nothing is recording */
+	void LoadFromConfig();
+
+	/** Replaces the configured budget, a budget of 0 disables it. Not thread safe, only call while nothing is recording */
+	void Configure(int64 InBudgetBytes, EArcticAnalyticsBudgetPolicy InPolicy, float InSoftFraction = 0.8f, int32 InBlockMs = 5, int32 InSampleEvery = 10);
+
+	bool IsEnabled() const
+	{
+		return BudgetBytes > 0;
+	}
+
+	int64 GetBudgetBytes() const
+	{
+		return BudgetBytes;
+	}
+
+	/** Whether buffers should be written out as soon as possible */
+	bool IsOverSoftLimit() const
+	{
+		return BudgetBytes > 0 && UsedBytes.load(std::memory_order_relaxed) > SoftLimitBytes;
+	}
+
+	/**
+	 * Decides whether an event about to be buffered is kept. Safe to call from any thread.
+	 *
+	 * @param Bytes estimated size of the event once buffered
+	 * @param bHighPriority whether the event is kept by DropLowPriority and Sample
+	 */
+	EArcticAnalyticsBudgetDecision Admit(int64 Bytes, bool bHighPriority);
+
+	/** Accounts for memory allocated for analytics data */
+	void Charge(int64 Bytes);
+	/** Accounts for memory given back */
+	void Release(int64 Bytes);
+	/** Accounts for buffered data that was moved to disk because of a spill */
+	void AddSpilledBytes(int64 Bytes);
+
+	FArcticAnalyticsBudgetCounters GetCounters() const;
+	/** Resets every counter but the used bytes */
+	void ResetCounters();
+
+private:
+	FArcticAnalyticsMemoryBudget();
+
+	EArcticAnalyticsBudgetDecision Drop(int64 Bytes);
+
+	int64 BudgetBytes;
+	int64 SoftLimitBytes;
+	EArcticAnalyticsBudgetPolicy Policy;
+	int32 BlockMs;
+	int32 SampleEvery;
+
+	std::atomic<int64> UsedBytes;
+	std::atomic<int64> HighWaterBytes;
+	std::atomic<int64> DroppedEvents;
+	std::atomic<int64> DroppedBytes;
+	std::atomic<int64> SpilledEvents;
+	std::atomic<int64> SpilledBytes;
+	std::atomic<int64> BlockedEvents;
+	std::atomic<uint32> SampleCounter;
+	/** Set once a Block wait ran out, cleared when usage is back under the soft limit */
+	std::atomic<bool> bBlockTimedOut;
+};
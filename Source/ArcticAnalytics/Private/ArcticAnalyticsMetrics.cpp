@@ -0,0 +1,224 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsMetrics.h"
+
+#include "HAL/PlatformTLS.h"
+#include "Misc/ScopeLock.h"
+
+#include <cmath>
+
+namespace
+{
+	std::atomic<uint32> NextMetricsInstanceId(1);
+
+	/** Single entry cache of the accumulators the current thread last recorded into */
+	struct FThreadMetricsCache
+	{
+		uint32 InstanceId = 0;
+		void* Metrics = nullptr;
+	};
+	thread_local FThreadMetricsCache ThreadMetricsCache;
+
+	/** Bucket counts of all threads for one metric */
+	struct FMergedHistogram
+	{
+		uint64 Buckets[ArcticAnalyticsHistogram::NumBuckets] = {};
+		uint64 Count = 0;
+		double Sum = 0.0;
+		double Min = TNumericLimits<double>::Max();
+		double Max = TNumericLimits<double>::Lowest();
+
+		double GetPercentile(double Percentile) const
+		{
+			const uint64 Rank = FMath::Max<uint64>(1, (uint64)FMath::CeilToDouble(Percentile * (double)Count));
+			uint64 Seen = 0;
+			for (int32 Index = 0; Index < ArcticAnalyticsHistogram::NumBuckets; ++Index)
+			{
+				Seen += Buckets[Index];
+				if (Seen >= Rank)
+				{
+					// Bucket midpoints can fall outside the observed range at the edges
+					return FMath::Clamp(ArcticAnalyticsHistogram::GetBucketValue(Index), Min, Max);
+				}
+			}
+			return Max;
+		}
+	};
+}
+
+int32 ArcticAnalyticsHistogram::GetBucketIndex(double Value)
+{
+	const double Magnitude = FMath::Abs(Value);
+	if (!(Magnitude > 0.0))
+	{
+		return ZeroBucket;
+	}
+	int Exponent;
+	const double Mantissa = std::frexp(Magnitude, &Exponent);
+	if (Exponent < MinExponent)
+	{
+		return ZeroBucket;
+	}
+	int32 MagnitudeIndex = NumMagnitudeBuckets - 1;
+	if (Exponent < MinExponent + NumExponents)
+	{
+		// Mantissa is in [0.5, 1)
+		const int32 SubBucket = FMath::Min(SubBuckets - 1, (int32)((Mantissa - 0.5) * 2.0 * SubBuckets));
+		MagnitudeIndex = (Exponent - MinExponent) * SubBuckets + SubBucket;
+	}
+	return Value > 0.0 ? ZeroBucket + 1 + MagnitudeIndex : ZeroBucket - 1 - MagnitudeIndex;
+}
+
+double ArcticAnalyticsHistogram::GetBucketValue(int32 BucketIndex)
+{
+	if (BucketIndex == ZeroBucket)
+	{
+		return 0.0;
+	}
+	const int32 MagnitudeIndex = BucketIndex > ZeroBucket ? BucketIndex - ZeroBucket - 1 : ZeroBucket - 1 - BucketIndex;
+	const int32 Exponent = MagnitudeIndex / SubBuckets + MinExponent;
+	const int32 SubBucket = MagnitudeIndex % SubBuckets;
+	const double Magnitude = std::ldexp(0.5 + ((double)SubBucket + 0.5) / (2.0 * SubBuckets), Exponent);
+	return BucketIndex > ZeroBucket ? Magnitude : -Magnitude;
+}
+
+TArray<FAnalyticsEventAttribute> FArcticAnalyticsMetricSummary::ToAttributes() const
+{
+	TArray<FAnalyticsEventAttribute> Attributes;
+	Attributes.Reserve(9);
+	Attributes.Emplace(TEXT("metric"), MetricName.ToString());
+	Attributes.Emplace(TEXT("count"), (int64)Count);
+	Attributes.Emplace(TEXT("min"), Min);
+	Attributes.Emplace(TEXT("max"), Max);
+	Attributes.Emplace(TEXT("mean"), Mean);
+	Attributes.Emplace(TEXT("p50"), P50);
+	Attributes.Emplace(TEXT("p90"), P90);
+	Attributes.Emplace(TEXT("p99"), P99);
+	Attributes.Emplace(TEXT("p99.9"), P999);
+	return Attributes;
+}
+
+FArcticAnalyticsMetrics::FThreadHistogram::FThreadHistogram()
+	: Sum(0.0), Min(TNumericLimits<double>::Max()), Max(TNumericLimits<double>::Lowest())
+{
+	for (std::atomic<uint32>& Bucket : Buckets)
+	{
+		Bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+void FArcticAnalyticsMetrics::FThreadHistogram::Add(double Value)
+{
+	// Only the owning thread writes here, the atomics are uncontended and only make the drain in CloseWindow safe.
+	// A sample racing with the drain may be split between two windows, which the summaries tolerate.
+	Buckets[ArcticAnalyticsHistogram::GetBucketIndex(Value)].fetch_add(1, std::memory_order_relaxed);
+
+	double Current = Sum.load(std::memory_order_relaxed);
+	while (!Sum.compare_exchange_weak(Current, Current + Value, std::memory_order_relaxed))
+	{
+	}
+	Current = Min.load(std::memory_order_relaxed);
+	while (Value < Current && !Min.compare_exchange_weak(Current, Value, std::memory_order_relaxed))
+	{
+	}
+	Current = Max.load(std::memory_order_relaxed);
+	while (Value > Current && !Max.compare_exchange_weak(Current, Value, std::memory_order_relaxed))
+	{
+	}
+}
+
+FArcticAnalyticsMetrics::FArcticAnalyticsMetrics() : InstanceId(NextMetricsInstanceId.fetch_add(1))
+{
+}
+
+FArcticAnalyticsMetrics::~FArcticAnalyticsMetrics()
+{
+}
+
+FArcticAnalyticsMetrics::FThreadMetrics& FArcticAnalyticsMetrics::GetThreadMetrics()
+{
+	FThreadMetricsCache& Cache = ThreadMetricsCache;
+	if (Cache.InstanceId != InstanceId)
+	{
+		// Instance ids are never reused, so a stale cache entry can't point into a destroyed instance
+		FScopeLock Lock(&ThreadsCS);
+		TUniquePtr<FThreadMetrics>& Metrics = Threads.FindOrAdd(FPlatformTLS::GetCurrentThreadId());
+		if (!Metrics.IsValid())
+		{
+			Metrics = MakeUnique<FThreadMetrics>();
+		}
+		Cache.InstanceId = InstanceId;
+		Cache.Metrics = Metrics.Get();
+	}
+	return *static_cast<FThreadMetrics*>(Cache.Metrics);
+}
+
+void FArcticAnalyticsMetrics::Record(FName MetricName, double Value)
+{
+	FThreadMetrics& Metrics = GetThreadMetrics();
+	// Only this thread adds to the map, so finding without the lock is safe
+	TUniquePtr<FThreadHistogram>* Histogram = Metrics.Histograms.Find(MetricName);
+	if (Histogram == nullptr)
+	{
+		FScopeLock Lock(&Metrics.MetricsCS);
+		Histogram = &Metrics.Histograms.Add(MetricName, MakeUnique<FThreadHistogram>());
+	}
+	(*Histogram)->Add(Value);
+}
+
+TArray<FArcticAnalyticsMetricSummary> FArcticAnalyticsMetrics::CloseWindow()
+{
+	TMap<FName, FMergedHistogram> Merged;
+	{
+		FScopeLock ThreadsLock(&ThreadsCS);
+		for (TPair<uint32, TUniquePtr<FThreadMetrics>>& Thread : Threads)
+		{
+			FScopeLock MetricsLock(&Thread.Value->MetricsCS);
+			for (TPair<FName, TUniquePtr<FThreadHistogram>>& Pair : Thread.Value->Histograms)
+			{
+				FThreadHistogram& Source = *Pair.Value;
+				FMergedHistogram* Target = nullptr;
+				for (int32 Index = 0; Index < ArcticAnalyticsHistogram::NumBuckets; ++Index)
+				{
+					const uint32 BucketCount = Source.Buckets[Index].exchange(0, std::memory_order_relaxed);
+					if (BucketCount > 0)
+					{
+						if (Target == nullptr)
+						{
+							Target = &Merged.FindOrAdd(Pair.Key);
+						}
+						Target->Buckets[Index] += BucketCount;
+						Target->Count += BucketCount;
+					}
+				}
+				const double Sum = Source.Sum.exchange(0.0, std::memory_order_relaxed);
+				const double Min = Source.Min.exchange(TNumericLimits<double>::Max(), std::memory_order_relaxed);
+				const double Max = Source.Max.exchange(TNumericLimits<double>::Lowest(), std::memory_order_relaxed);
+				if (Target != nullptr)
+				{
+					Target->Sum += Sum;
+					Target->Min = FMath::Min(Target->Min, Min);
+					Target->Max = FMath::Max(Target->Max, Max);
+				}
+			}
+		}
+	}
+
+	TArray<FArcticAnalyticsMetricSummary> Summaries;
+	Summaries.Reserve(Merged.Num());
+	for (const TPair<FName, FMergedHistogram>& Pair : Merged)
+	{
+		const FMergedHistogram& Histogram = Pair.Value;
+		FArcticAnalyticsMetricSummary& Summary = Summaries.AddDefaulted_GetRef();
+		Summary.MetricName = Pair.Key;
+		Summary.Count = Histogram.Count;
+		Summary.Min = Histogram.Min;
+		Summary.Max = Histogram.Max;
+		Summary.Mean = Histogram.Sum / (double)Histogram.Count;
+		Summary.P50 = Histogram.GetPercentile(0.5);
+		Summary.P90 = Histogram.GetPercentile(0.9);
+		Summary.P99 = Histogram.GetPercentile(0.99);
+		Summary.P999 = Histogram.GetPercentile(0.999);
+	}
+	return Summaries;
+}
@@ -0,0 +1,94 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+#include "HAL/CriticalSection.h"
+
+#include <atomic>
+
+/** Log-linear histogram layout shared by the per thread accumulators and the merged result */
+namespace ArcticAnalyticsHistogram
+{
+	/** Sub buckets per power of two, bounds the relative error of percentiles to about 3% */
+	static constexpr int32 SubBuckets = 16;
+	/** Smallest power of two that gets its own buckets, smaller magnitudes land in the zero bucket */
+	static constexpr int32 MinExponent = -16;
+	/** Number of powers of two covered, larger magnitudes land in the outermost bucket of their sign */
+	static constexpr int32 NumExponents = 64;
+	/** Buckets per sign */
+	static constexpr int32 NumMagnitudeBuckets = SubBuckets * NumExponents;
+	/** Negative values mirror the positive ones below the zero bucket, so buckets are in ascending order of value */
+	static constexpr int32 ZeroBucket = NumMagnitudeBuckets;
+	static constexpr int32 NumBuckets = 2 * NumMagnitudeBuckets + 1;
+
+	int32 GetBucketIndex(double Value);
+	double GetBucketValue(int32 BucketIndex);
+}
+
+/** Summary of a metric over one aggregation window */
+struct FArcticAnalyticsMetricSummary
+{
+	FName MetricName;
+	uint64 Count = 0;
+	double Min = 0.0;
+	double Max = 0.0;
+	double Mean = 0.0;
+	double P50 = 0.0;
+	double P90 = 0.0;
+	double P99 = 0.0;
+	double P999 = 0.0;
+
+	/** Converts the summary to event attributes */
+	TArray<FAnalyticsEventAttribute> ToAttributes() const;
+};
+
+/**
+ * Pre-aggregates metric samples into histograms so a single summary event is written per window
+ * instead of one event per sample.
+ *
+ * Every thread records into its own accumulators, so recording never contends with other threads.
+ * The accumulators are drained and merged when the window is closed.
+ */
+class FArcticAnalyticsMetrics
+{
+public:
+	FArcticAnalyticsMetrics();
+	~FArcticAnalyticsMetrics();
+
+	/** Adds a sample to the calling thread's accumulator for the metric. Safe to call from any thread */
+	void Record(FName MetricName, double Value);
+
+	/** Drains all thread accumulators and returns one summary per metric that received samples */
+	TArray<FArcticAnalyticsMetricSummary> CloseWindow();
+
+private:
+	/** Accumulator for a metric that is only written by the thread that owns it */
+	struct FThreadHistogram
+	{
+		std::atomic<uint32> Buckets[ArcticAnalyticsHistogram::NumBuckets];
+		std::atomic<double> Sum;
+		std::atomic<double> Min;
+		std::atomic<double> Max;
+
+		FThreadHistogram();
+		void Add(double Value);
+	};
+
+	/** All accumulators of a single thread */
+	struct FThreadMetrics
+	{
+		/** Taken by the owning thread when adding a metric and by CloseWindow while iterating */
+		FCriticalSection MetricsCS;
+		TMap<FName, TUniquePtr<FThreadHistogram>> Histograms;
+	};
+
+	FThreadMetrics& GetThreadMetrics();
+
+	/** Unique id of this instance, used to validate the thread local cache */
+	const uint32 InstanceId;
+	/** Guards the Threads map */
+	FCriticalSection ThreadsCS;
+	TMap<uint32, TUniquePtr<FThreadMetrics>> Threads;
+};
@@ -0,0 +1,420 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsMultiSession.h"
+
+#include "Async/Async.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/Guid.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+#include "ArcticAnalyticsEventJson.h"
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "ArcticAnalyticsSettings.h"
+#include "ArcticAnalyticsTrace.h"
+#include "ArcticAnalyticsUploader.h"
+
+namespace
+{
+	int32 GetMaxConcurrentUploads()
+	{
+		int32 MaxConcurrentUploads = 4;
+		ArcticAnalyticsSettings::GetInt(TEXT("MaxConcurrentUploads"), MaxConcurrentUploads);
+		return MaxConcurrentUploads;
+	}
+
+	void AppendAttributesArray(FStringBuilderBase& Builder, const TArray<FAnalyticsEventAttribute>& Attributes)
+	{
+		Builder.Appendf(TEXT("\t\t\t\"attributes\" :\n\t\t\t["));
+		for (int32 Index = 0; Index < Attributes.Num(); ++Index)
+		{
+			Builder.Appendf(Index == 0 ? TEXT("\n") : TEXT("\n\t\t\t,\n"));
+			Builder.Appendf(TEXT("\t\t\t{\n\t\t\t\t\"name\" : \"%s\",\n\t\t\t\t\"value\" : \"%s\"\n\t\t\t}"), *Attributes[Index].GetName(),
+							*Attributes[Index].GetValue());
+		}
+		Builder.Appendf(TEXT("\n\t\t\t]\n"));
+	}
+}
+
+// Session
+
+FArcticAnalyticsSession::FArcticAnalyticsSession(FArcticAnalyticsMultiSessionProvider& InOwner, const FString& InUserId, const FString& InFilePath)
+	: Owner(InOwner), UserId(InUserId), SessionId(InUserId + TEXT("-") + FGuid::NewGuid().ToString()), FilePath(InFilePath / (SessionId + TEXT(".analytics"))),
+	  bIsActive(true), bHasWrittenFirstEvent(false), NextRecordId(0), DefaultEventAttributes(MakeShared<const TArray<FAnalyticsEventAttribute>, ESPMode::ThreadSafe>())
+{
+}
+
+bool FArcticAnalyticsSession::IsActive() const
+{
+	FScopeLock Lock(&SessionCS);
+	return bIsActive;
+}
+
+void FArcticAnalyticsSession::SetDefaultEventAttributes(TArray<FAnalyticsEventAttribute>&& Attributes)
+{
+	TSharedRef<const TArray<FAnalyticsEventAttribute>, ESPMode::ThreadSafe> Snapshot = MakeShared<const TArray<FAnalyticsEventAttribute>, ESPMode::ThreadSafe>(MoveTemp(Attributes));
+	FScopeLock Lock(&SessionCS);
+	DefaultEventAttributes = MoveTemp(Snapshot);
+}
+
+void FArcticAnalyticsSession::RecordEvent(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Session::RecordEvent);
+	TSharedPtr<const TArray<FAnalyticsEventAttribute>, ESPMode::ThreadSafe> Defaults;
+	{
+		FScopeLock Lock(&SessionCS);
+		if (!bIsActive)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FArcticAnalyticsSession::RecordEvent called after the session ended. Ignoring."));
+			return;
+		}
+		Defaults = DefaultEventAttributes;
+	}
+
+	TArray<FAnalyticsEventAttribute> EventAttributes;
+	EventAttributes.Reserve(Defaults->Num() + Attributes.Num());
+	EventAttributes.Append(*Defaults);
+	EventAttributes.Append(Attributes);
+
+	// The record id is only added once the record is appended, so ids follow the order of the records in the file
+	TStringBuilder<1024> Builder;
+	int32 RecordIdOffset;
+	{
+		ARCTICANALYTICS_TRACE_SCOPE(Encode);
+		ArcticAnalyticsEventJson::AppendEventStart(Builder, EventName, FDateTime::UtcNow().ToUnixTimestampDecimal());
+		RecordIdOffset = Builder.Len();
+		ArcticAnalyticsEventJson::AppendEventAttributes(Builder, EventAttributes);
+	}
+	AdmitRecord(Builder, EArcticAnalyticsRecordType::Event, false, TEXT("RecordEvent"), RecordIdOffset);
+}
+
+void FArcticAnalyticsSession::RecordError(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Session::RecordError);
+	TStringBuilder<1024> Builder;
+	Builder.Appendf(TEXT("\t\t{\n"));
+	Builder.Appendf(TEXT("\t\t\t\"error\" : \"%s\",\n"), *Error);
+	AppendAttributesArray(Builder, Attributes);
+	Builder.Appendf(TEXT("\t\t}"));
+	AdmitRecord(Builder, EArcticAnalyticsRecordType::Error, true, TEXT("RecordError"));
+}
+
+void FArcticAnalyticsSession::RecordProgress(const FString& ProgressType, const FString& ProgressName, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Session::RecordProgress);
+	TStringBuilder<1024> Builder;
+	Builder.Appendf(TEXT("\t\t{\n"));
+	Builder.Appendf(TEXT("\t\t\t\"eventType\" : \"Progress\",\n"));
+	Builder.Appendf(TEXT("\t\t\t\"progressType\" : \"%s\",\n"), *ProgressType);
+	Builder.Appendf(TEXT("\t\t\t\"progressName\" : \"%s\",\n"), *ProgressName);
+	AppendAttributesArray(Builder, Attributes);
+	Builder.Appendf(TEXT("\t\t}"));
+	AdmitRecord(Builder, EArcticAnalyticsRecordType::Progress, true, TEXT("RecordProgress"));
+}
+
+void FArcticAnalyticsSession::AdmitRecord(const FStringBuilderBase& Record, EArcticAnalyticsRecordType Type, bool bHighPriority, const TCHAR* Caller,
+										  int32 RecordIdOffset)
+{
+	// Admit may wait for the writer under the Block policy, so other threads must still be able to use the session meanwhile
+	const EArcticAnalyticsBudgetDecision Decision = FArcticAnalyticsMemoryBudget::Get().Admit(Record.Len(), bHighPriority);
+	if (Decision == EArcticAnalyticsBudgetDecision::Drop)
+	{
+		FArcticAnalyticsSelfMetrics::Get().AddDropped(Type);
+		return;
+	}
+	const bool bSpill = Decision == EArcticAnalyticsBudgetDecision::Spill;
+	bool bShouldSubmit;
+	{
+		FScopeLock Lock(&SessionCS);
+		if (!bIsActive)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FArcticAnalyticsSession::%s called after the session ended. Ignoring."), Caller);
+			return;
+		}
+		FArcticAnalyticsSelfMetrics::Get().AddRecorded(Type);
+		FArcticAnalyticsSelfMetrics::Get().AddBytesEncoded(Record.Len());
+		if (RecordIdOffset != INDEX_NONE)
+		{
+			TStringBuilder<64> RecordId;
+			ArcticAnalyticsEventJson::AppendEventRecordId(RecordId, NextRecordId++);
+			AppendRecord(Record.ToView().Left(RecordIdOffset), RecordId.ToView(), Record.ToView().RightChop(RecordIdOffset));
+		}
+		else
+		{
+			AppendRecord(Record.ToView());
+		}
+		bShouldSubmit = bSpill || PendingData.Num() >= Owner.SessionFlushBytes;
+	}
+	if (bShouldSubmit)
+	{
+		SubmitBuffer(false, bSpill);
+	}
+}
+
+void FArcticAnalyticsSession::AppendRecord(FStringView Record, FStringView RecordId, FStringView RecordTail)
+{
+	if (bHasWrittenFirstEvent)
+	{
+		AppendLine(TEXT("\t\t,"));
+	}
+	bHasWrittenFirstEvent = true;
+	AppendText(Record);
+	AppendText(RecordId);
+	AppendLine(RecordTail);
+}
+
+void FArcticAnalyticsSession::AppendLine(FStringView Line)
+{
+	AppendText(Line);
+	PendingData.Append((const uint8*)LINE_TERMINATOR_ANSI, sizeof(LINE_TERMINATOR_ANSI) - 1);
+	// Given back by the writer once the data is on disk
+	FArcticAnalyticsMemoryBudget::Get().Charge(sizeof(LINE_TERMINATOR_ANSI) - 1);
+}
+
+void FArcticAnalyticsSession::AppendText(FStringView Text)
+{
+	if (Text.Len() == 0)
+	{
+		return;
+	}
+	const FTCHARToUTF8 Converted(Text.GetData(), Text.Len());
+	PendingData.Append((const uint8*)Converted.Get(), Converted.Length());
+	FArcticAnalyticsMemoryBudget::Get().Charge(Converted.Length());
+}
+
+void FArcticAnalyticsSession::SubmitBuffer(bool bIsFinal, bool bSpill)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Session::SubmitBuffer);
+	TArray<uint8> Data;
+	{
+		FScopeLock Lock(&SessionCS);
+		if (!bIsActive)
+		{
+			return;
+		}
+		if (bIsFinal)
+		{
+			AppendLine(TEXT("\t]"));
+			AppendLine(TEXT("}"));
+			bIsActive = false;
+		}
+		if (PendingData.Num() == 0)
+		{
+			return;
+		}
+		// Copied out rather than moved, so PendingData keeps its capacity for the next batch of events
+		Data.Reserve(PendingData.Num());
+		Data.Append(PendingData);
+		PendingData.Reset();
+	}
+
+	TFunction<void(bool)> OnWritten;
+	if (bIsFinal)
+	{
+		FArcticAnalyticsMultiSessionProvider* Provider = &Owner;
+		const FString WrittenFilePath = FilePath;
+		OnWritten = [Provider, WrittenFilePath](bool bSucceeded)
+		{
+			Provider->OnSessionWritten(WrittenFilePath, bSucceeded);
+		};
+	}
+	if (bSpill)
+	{
+		FArcticAnalyticsMemoryBudget::Get().AddSpilledBytes(Data.Num());
+	}
+	Owner.Writer.Enqueue(FilePath, MoveTemp(Data), MoveTemp(OnWritten), bSpill);
+}
+
+// Provider
+
+FArcticAnalyticsMultiSessionProvider::FArcticAnalyticsMultiSessionProvider(const FString& InAnalyticsFilePath, bool bInUploadSessions)
+	: AnalyticsFilePath(InAnalyticsFilePath), bUploadSessions(bInUploadSessions), SessionFlushBytes(64 * 1024),
+	  Uploader(MakeShared<FArcticAnalyticsUploader, ESPMode::ThreadSafe>(GetMaxConcurrentUploads()))
+{
+	ArcticAnalyticsSettings::GetInt(TEXT("SessionFlushBytes"), SessionFlushBytes);
+	float WriteIntervalSeconds = 1.0f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("WriteIntervalSeconds"), WriteIntervalSeconds);
+	TickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FArcticAnalyticsMultiSessionProvider::Tick), WriteIntervalSeconds);
+
+	IFileManager::Get().MakeDirectory(*AnalyticsFilePath, true);
+}
+
+FArcticAnalyticsMultiSessionProvider::~FArcticAnalyticsMultiSessionProvider()
+{
+	FTSTicker::GetCoreTicker().RemoveTicker(TickHandle);
+	EndAllSessions();
+	WaitForWrites();
+}
+
+TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe> FArcticAnalyticsMultiSessionProvider::StartSession(const FString& UserId, const FString& BuildInfo)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(MultiSession::StartSession);
+	TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe> Session = MakeShareable(new FArcticAnalyticsSession(*this, UserId, AnalyticsFilePath));
+	{
+		FScopeLock Lock(&Session->SessionCS);
+		TStringBuilder<256> Builder;
+		Session->AppendLine(TEXT("{"));
+		Builder.Appendf(TEXT("\t\"sessionId\" : \"%s\","), *Session->SessionId);
+		Session->AppendLine(Builder.ToView());
+		Builder.Reset();
+		Builder.Appendf(TEXT("\t\"userId\" : \"%s\","), *UserId);
+		Session->AppendLine(Builder.ToView());
+		if (BuildInfo.Len() > 0)
+		{
+			Builder.Reset();
+			Builder.Appendf(TEXT("\t\"buildInfo\" : \"%s\","), *BuildInfo);
+			Session->AppendLine(Builder.ToView());
+		}
+		Session->AppendLine(TEXT("\t\"events\" : ["));
+	}
+	{
+		FScopeLock Lock(&SessionsCS);
+		Sessions.Add(Session);
+	}
+	UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Session (%s) started for user (%s)"), *Session->SessionId, *UserId);
+	return Session;
+}
+
+void FArcticAnalyticsMultiSessionProvider::EndSession(const TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>& Session)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(MultiSession::EndSession);
+	Session->SubmitBuffer(true);
+	{
+		FScopeLock Lock(&SessionsCS);
+		Sessions.RemoveSingleSwap(Session, false);
+	}
+	UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Session ended for user (%s) and session id (%s)"), *Session->UserId, *Session->SessionId);
+}
+
+void FArcticAnalyticsMultiSessionProvider::EndAllSessions()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(MultiSession::EndAllSessions);
+	TArray<TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>> Ended;
+	{
+		FScopeLock Lock(&SessionsCS);
+		Ended = MoveTemp(Sessions);
+		Sessions.Reset();
+	}
+	for (const TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>& Session : Ended)
+	{
+		Session->SubmitBuffer(true);
+	}
+}
+
+void FArcticAnalyticsMultiSessionProvider::FlushEvents()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(MultiSession::FlushEvents);
+	TArray<TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>> Active;
+	{
+		FScopeLock Lock(&SessionsCS);
+		Active = Sessions;
+	}
+	for (const TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>& Session : Active)
+	{
+		Session->SubmitBuffer(false);
+	}
+}
+
+void FArcticAnalyticsMultiSessionProvider::WaitForWrites()
+{
+	Writer.WaitForWrites();
+}
+
+int32 FArcticAnalyticsMultiSessionProvider::GetNumSessions() const
+{
+	FScopeLock Lock(&SessionsCS);
+	return Sessions.Num();
+}
+
+bool FArcticAnalyticsMultiSessionProvider::Tick(float DeltaTime)
+{
+	FlushEvents();
+	return true;
+}
+
+void FArcticAnalyticsMultiSessionProvider::OnSessionWritten(const FString& FilePath, bool bSucceeded)
+{
+	if (!bSucceeded)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session (%s) is incomplete after a failed write and won't be uploaded"), *FilePath);
+		return;
+	}
+	if (bUploadSessions)
+	{
+		// Uploads are started from the game thread, the provider may be gone by then but the uploader is kept alive
+		TWeakPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> WeakUploader = Uploader;
+		AsyncTask(ENamedThreads::GameThread, [WeakUploader, FilePath]()
+		{
+			if (TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> PinnedUploader = WeakUploader.Pin())
+			{
+				PinnedUploader->EnqueueFile(FilePath);
+			}
+		});
+	}
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/** Measures recording and writing cost as the number of concurrent sessions grows */
+	void BenchmarkMultiSession(const TArray<FString>& Args)
+	{
+		const int32 MaxSessions = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 64;
+		const int32 EventsPerSession = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 1000;
+		const FString BenchmarkPath = FPaths::ProjectSavedDir() / TEXT("Analytics") / TEXT("Benchmark");
+
+		TArray<FAnalyticsEventAttribute> Attributes;
+		Attributes.Emplace(TEXT("map"), TEXT("Benchmark"));
+		Attributes.Emplace(TEXT("health"), 100);
+		Attributes.Emplace(TEXT("x"), 1234.5f);
+		Attributes.Emplace(TEXT("y"), -678.25f);
+
+		TArray<int32> SessionCounts;
+		for (int32 NumSessions = 1; NumSessions < MaxSessions; NumSessions *= 4)
+		{
+			SessionCounts.Add(NumSessions);
+		}
+		SessionCounts.Add(MaxSessions);
+
+		for (int32 NumSessions : SessionCounts)
+		{
+			double RecordSeconds;
+			const double StartTime = FPlatformTime::Seconds();
+			{
+				FArcticAnalyticsMultiSessionProvider Provider(BenchmarkPath, false);
+				TArray<TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>> Sessions;
+				for (int32 Index = 0; Index < NumSessions; ++Index)
+				{
+					Sessions.Add(Provider.StartSession(FString::Printf(TEXT("BenchmarkUser%d"), Index)));
+				}
+				// Interleave sessions like players on a server would
+				for (int32 EventIndex = 0; EventIndex < EventsPerSession; ++EventIndex)
+				{
+					for (const TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>& Session : Sessions)
+					{
+						Session->RecordEvent(TEXT("BenchmarkEvent"), Attributes);
+					}
+				}
+				RecordSeconds = FPlatformTime::Seconds() - StartTime;
+				Provider.EndAllSessions();
+				Provider.WaitForWrites();
+			}
+			const double TotalSeconds = FPlatformTime::Seconds() - StartTime;
+			const double NumEvents = (double)NumSessions * EventsPerSession;
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("MultiSession benchmark: sessions=%d events=%.0f record=%.3fs (%.0f events/s) total=%.3fs (%.0f events/s)"),
+				   NumSessions, NumEvents, RecordSeconds, NumEvents / RecordSeconds, TotalSeconds, NumEvents / TotalSeconds);
+		}
+		IFileManager::Get().DeleteDirectory(*BenchmarkPath, false, true);
+	}
+
+	FAutoConsoleCommand BenchmarkMultiSessionCommand(TEXT("ArcticAnalytics.BenchmarkMultiSession"),
+		TEXT("Records events into a growing number of concurrent sessions and reports throughput. Args: [MaxSessions=64] [EventsPerSession=1000]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&BenchmarkMultiSession));
+}
+
+#endif
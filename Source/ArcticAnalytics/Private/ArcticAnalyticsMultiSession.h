@@ -0,0 +1,135 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+#include "Containers/Ticker.h"
+#include "HAL/CriticalSection.h"
+#include "Misc/StringBuilder.h"
+
+#include "ArcticAnalyticsSessionWriter.h"
+
+class FArcticAnalyticsMultiSessionProvider;
+class FArcticAnalyticsUploader;
+enum class EArcticAnalyticsRecordType : uint8;
+
+/**
+ * Lightweight handle to one session of a FArcticAnalyticsMultiSessionProvider, e.g. one player on a
+ * dedicated server. Events are encoded into a per session buffer that is handed to the shared writer
+ * when it grows large or on the provider's write interval. Safe to use from any thread.
+ */
+class FArcticAnalyticsSession
+{
+public:
+	const FString& GetUserId() const
+	{
+		return UserId;
+	}
+
+	const FString& GetSessionId() const
+	{
+		return SessionId;
+	}
+
+	/** Whether the session can still record events */
+	bool IsActive() const;
+
+	void SetDefaultEventAttributes(TArray<FAnalyticsEventAttribute>&& Attributes);
+
+	void RecordEvent(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes);
+	void RecordError(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes);
+	void RecordProgress(const FString& ProgressType, const FString& ProgressName, const TArray<FAnalyticsEventAttribute>& Attributes);
+
+private:
+	friend class FArcticAnalyticsMultiSessionProvider;
+
+	FArcticAnalyticsSession(FArcticAnalyticsMultiSessionProvider& InOwner, const FString& InUserId, const FString& InFilePath);
+
+	/**
+	 * Asks the memory budget to keep an encoded record, then appends it unless the session ended meanwhile. Takes SessionCS.
+	 * With a RecordIdOffset, the next record id is assigned and inserted there under the same lock
+	 */
+	void AdmitRecord(const FStringBuilderBase& Record, EArcticAnalyticsRecordType Type, bool bHighPriority, const TCHAR* Caller,
+					 int32 RecordIdOffset = INDEX_NONE);
+	/** Appends a complete record, given in pieces, separated from the previous one. Expects SessionCS to be held */
+	void AppendRecord(FStringView Record, FStringView RecordId = FStringView(), FStringView RecordTail = FStringView());
+	/** Appends a line to the buffer as UTF-8. Expects SessionCS to be held */
+	void AppendLine(FStringView Line);
+	/** Appends text to the buffer as UTF-8, without a line terminator. Expects SessionCS to be held */
+	void AppendText(FStringView Text);
+	/**
+	 * Hands the buffer to the shared writer, closing the document when it's the last one.
+	 * A spill wakes the writer right away to get the data out of memory.
+	 */
+	void SubmitBuffer(bool bIsFinal, bool bSpill = false);
+
+	FArcticAnalyticsMultiSessionProvider& Owner;
+	const FString UserId;
+	const FString SessionId;
+	const FString FilePath;
+
+	/** Guards everything below */
+	mutable FCriticalSection SessionCS;
+	bool bIsActive;
+	bool bHasWrittenFirstEvent;
+	uint32 NextRecordId;
+	/** Replaced as a whole, so records can be encoded from a snapshot without holding the lock */
+	TSharedRef<const TArray<FAnalyticsEventAttribute>, ESPMode::ThreadSafe> DefaultEventAttributes;
+	/** Encoded records that have not been handed to the writer yet */
+	TArray<uint8> PendingData;
+};
+
+/**
+ * Analytics for processes hosting many concurrent sessions, such as dedicated servers with one session per player.
+ *
+ * All sessions share one background writer and one uploader, instead of one file writer per session that
+ * writes synchronously. Session files have the same layout as the ones from FAnalyticsProviderArcticAnalytics.
+ */
+class FArcticAnalyticsMultiSessionProvider
+{
+public:
+	/**
+	 * @param InAnalyticsFilePath directory the session files are written to
+	 * @param bInUploadSessions whether finished session files are uploaded to the configured server
+	 */
+	FArcticAnalyticsMultiSessionProvider(const FString& InAnalyticsFilePath, bool bInUploadSessions);
+	~FArcticAnalyticsMultiSessionProvider();
+
+	/** Starts a new session for a user and writes its header */
+	TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe> StartSession(const FString& UserId, const FString& BuildInfo = FString());
+
+	/** Ends a session, its file is uploaded once it's written. The handle ignores any further events */
+	void EndSession(const TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>& Session);
+
+	/** Ends every active session */
+	void EndAllSessions();
+
+	/** Hands the buffered events of every session to the writer */
+	void FlushEvents();
+
+	/** Blocks until everything handed to the writer is on disk */
+	void WaitForWrites();
+
+	int32 GetNumSessions() const;
+
+private:
+	friend class FArcticAnalyticsSession;
+
+	bool Tick(float DeltaTime);
+	/** Called on the writer thread once the last buffer of a session was written, uploads it unless a write failed */
+	void OnSessionWritten(const FString& FilePath, bool bSucceeded);
+
+	const FString AnalyticsFilePath;
+	const bool bUploadSessions;
+	/** Buffers larger than this are handed to the writer without waiting for the next tick */
+	int32 SessionFlushBytes;
+
+	FArcticAnalyticsSessionWriter Writer;
+	TSharedRef<FArcticAnalyticsUploader, ESPMode::ThreadSafe> Uploader;
+
+	mutable FCriticalSection SessionsCS;
+	TArray<TSharedRef<FArcticAnalyticsSession, ESPMode::ThreadSafe>> Sessions;
+
+	FTSTicker::FDelegateHandle TickHandle;
+};
@@ -0,0 +1,67 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsPriorityLane.h"
+
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsEventJson.h"
+
+FArcticAnalyticsPriorityLane::FArcticAnalyticsPriorityLane(float InFlushSeconds)
+	: FlushSeconds(InFlushSeconds), bHasWrittenFirstEvent(false), OldestRecordTime(0.0), Sequence(0)
+{
+}
+
+void FArcticAnalyticsPriorityLane::Start(const FString& InSessionId, const FString& InUserId, const FString& InBuildInfo)
+{
+	SessionId = InSessionId;
+	UserId = InUserId;
+	BuildInfo = InBuildInfo;
+	Writer = nullptr;
+	bHasWrittenFirstEvent = false;
+	Sequence = 0;
+}
+
+FArchive& FArcticAnalyticsPriorityLane::BeginRecord()
+{
+	if (!Writer)
+	{
+		// Documents are small and short lived, so they never spill
+		Writer = MakeUnique<FArcticAnalyticsMemoryArchive>(4 * 1024, MAX_int64, FString());
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("{"));
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\"sessionId\" : \"%s\","), *SessionId);
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\"userId\" : \"%s\","), *UserId);
+		if (BuildInfo.Len() > 0)
+		{
+			ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\"buildInfo\" : \"%s\","), *BuildInfo);
+		}
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\"lane\" : \"priority\","));
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\"sequence\" : %u,"), Sequence);
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\"events\" : ["));
+		bHasWrittenFirstEvent = false;
+		OldestRecordTime = FPlatformTime::Seconds();
+	}
+	if (bHasWrittenFirstEvent)
+	{
+		ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t\t,"));
+	}
+	bHasWrittenFirstEvent = true;
+	return *Writer;
+}
+
+TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> FArcticAnalyticsPriorityLane::Flush(double& OutOldestRecordTime)
+{
+	check(Writer);
+	ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("\t]"));
+	ArcticAnalyticsEventJson::WriteLinef(*Writer, TEXT("}"));
+	Writer->Close();
+	OutOldestRecordTime = OldestRecordTime;
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Buffer = Writer->ReleaseBuffer();
+	Writer = nullptr;
+	++Sequence;
+	return Buffer;
+}
+
+FString FArcticAnalyticsPriorityLane::GetDocumentName() const
+{
+	return FString::Printf(TEXT("%s-priority-%u"), *SessionId, Sequence);
+}
@@ -0,0 +1,89 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "ArcticAnalyticsMemoryArchive.h"
+
+/** Delivery paths of a session */
+enum class EArcticAnalyticsLane : uint8
+{
+	/** Batched into the session file and uploaded when the session ends */
+	Bulk,
+	/** Uploaded as small documents within seconds of being recorded */
+	Priority,
+	Num
+};
+
+/** End to end delivery latency of a lane, measured from recording the oldest event of a delivery to the server's response */
+struct FArcticAnalyticsLaneLatency
+{
+	int64 Deliveries = 0;
+	double LastSeconds = 0.0;
+	double MaxSeconds = 0.0;
+	double TotalSeconds = 0.0;
+
+	void Add(double Seconds)
+	{
+		++Deliveries;
+		LastSeconds = Seconds;
+		MaxSeconds = FMath::Max(MaxSeconds, Seconds);
+		TotalSeconds += Seconds;
+	}
+
+	double GetMeanSeconds() const
+	{
+		return Deliveries > 0 ? TotalSeconds / Deliveries : 0.0;
+	}
+};
+
+/**
+ * Collects high priority records of a session, such as errors and progress, into small documents that are
+ * uploaded on their own shortly after being recorded instead of waiting for the session to end.
+ *
+ * Each document has the session header fields, "lane" : "priority", a sequence number and its events.
+ */
+class FArcticAnalyticsPriorityLane
+{
+public:
+	explicit FArcticAnalyticsPriorityLane(float InFlushSeconds);
+
+	/** Starts collecting for a new session */
+	void Start(const FString& InSessionId, const FString& InUserId, const FString& InBuildInfo);
+
+	/** Returns the archive to write the next record to, after its separator */
+	FArchive& BeginRecord();
+
+	bool IsEmpty() const
+	{
+		return !Writer.IsValid();
+	}
+
+	/** Whether the oldest pending record waited long enough, or the document reached the upload batch size */
+	bool IsDue(double Now, int64 BatchBytes) const
+	{
+		return Writer.IsValid() && (Now - OldestRecordTime >= FlushSeconds || Writer->TotalSize() >= BatchBytes);
+	}
+
+	/**
+	 * Closes the pending records into a document.
+	 *
+	 * @param OutOldestRecordTime FPlatformTime::Seconds of the oldest record in the document
+	 */
+	TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Flush(double& OutOldestRecordTime);
+
+	/** Name the next document is uploaded under */
+	FString GetDocumentName() const;
+
+private:
+	const float FlushSeconds;
+	FString SessionId;
+	FString UserId;
+	FString BuildInfo;
+	/** Document being collected, null while no record is pending */
+	TUniquePtr<FArcticAnalyticsMemoryArchive> Writer;
+	bool bHasWrittenFirstEvent;
+	double OldestRecordTime;
+	uint32 Sequence;
+};
@@ -6,8 +6,25 @@
 
 #include "ArcticAnalytics.h"
 #include "AnalyticsEventAttribute.h"
+#include "Async/Future.h"
+#include "Containers/Ticker.h"
 #include "Interfaces/IAnalyticsProvider.h"
 
+#include "ArcticAnalyticsBatchEncoder.h"
+#include "ArcticAnalyticsErrorCoalescer.h"
+#include "ArcticAnalyticsEventCosts.h"
+#include "ArcticAnalyticsEventPolicy.h"
+#include "ArcticAnalyticsFrameBudget.h"
+#include "ArcticAnalyticsFrameCapture.h"
+#include "ArcticAnalyticsHousekeeping.h"
+#include "ArcticAnalyticsMetrics.h"
+#include "ArcticAnalyticsPriorityLane.h"
+#include "ArcticAnalyticsRecentEvents.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "ArcticAnalyticsSessionIndex.h"
+#include "ArcticAnalyticsSessionRecovery.h"
+#include "ArcticAnalyticsUploader.h"
+
 class Error;
 
 class FAnalyticsProviderArcticAnalytics : public IAnalyticsProvider
@@ -38,6 +55,45 @@ public:
 	virtual int32 GetDefaultEventAttributeCount() const override;
 	virtual FAnalyticsEventAttribute GetDefaultEventAttribute(int AttributeIndex) const override;
 
+	/**
+	 * Holds on to the default attributes that are current when it is created, without copying or locking. The
+	 * snapshot is immutable and can't be freed while the scope exists, even if the defaults are replaced meanwhile.
+	 * Safe to use from any thread, but keep it short lived: replaced snapshots are only freed when no scope is open.
+	 */
+	class FDefaultAttributesScope
+	{
+	public:
+		explicit FDefaultAttributesScope(const FAnalyticsProviderArcticAnalytics& InProvider)
+			: Provider(InProvider)
+		{
+			// Registered before the load, so a writer that saw no readers has already published a newer snapshot
+			Provider.NumDefaultAttributeReaders.fetch_add(1);
+			Snapshot = Provider.DefaultEventAttributes.load();
+		}
+
+		~FDefaultAttributesScope()
+		{
+			Provider.NumDefaultAttributeReaders.fetch_sub(1);
+		}
+
+		FDefaultAttributesScope(const FDefaultAttributesScope&) = delete;
+		FDefaultAttributesScope& operator=(const FDefaultAttributesScope&) = delete;
+
+		const TArray<FAnalyticsEventAttribute>& operator*() const
+		{
+			return *Snapshot;
+		}
+
+		const TArray<FAnalyticsEventAttribute>* operator->() const
+		{
+			return Snapshot;
+		}
+
+	private:
+		const FAnalyticsProviderArcticAnalytics& Provider;
+		const TArray<FAnalyticsEventAttribute>* Snapshot;
+	};
+
 	virtual void RecordEvent(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes) override;
 
 	virtual void RecordItemPurchase(const FString& ItemId, const FString& Currency, int PerItemCost, int ItemQuantity) override;
@@ -57,9 +113,142 @@ public:
 	virtual void RecordError(const FString& Error, const TArray<FAnalyticsEventAttribute>& EventAttrs) override;
 	virtual void RecordProgress(const FString& ProgressType, const FString& ProgressHierarchy, const TArray<FAnalyticsEventAttribute>& EventAttrs) override;
 
+	/**
+	 * Adds a sample to a metric. Samples are aggregated and written as one MetricSummary event per metric
+	 * every MetricWindowSeconds instead of one event per sample. Percentiles are within about 3%, for zero and
+	 * negative values too. Safe to call from any thread.
+	 */
+	void RecordMetric(const FString& MetricName, double Value);
+	void RecordMetric(FName MetricName, double Value);
+
 	void SendDataToServer();
 
+	/**
+	 * Sets the sampling and rate limiting policy for an event name, overriding the EventPolicies setting.
+	 * Ignored while a session is in progress.
+	 */
+	void SetEventPolicy(const FString& EventName, const FArcticAnalyticsEventPolicy& Policy);
+
+	/**
+	 * Caps the game thread time of Record* calls per frame, overriding the FrameBudget settings. 0 turns the budget off.
+	 * Ignored while a session is in progress.
+	 */
+	void SetFrameBudget(float BudgetMicroseconds, EArcticAnalyticsOverrunMode Mode);
+
+	/** The game thread budget of Record* calls, null when it is off */
+	const FArcticAnalyticsFrameBudget* GetFrameBudget() const
+	{
+		return FrameBudget.Get();
+	}
+
+	/** Budget and observed durations of the background work ticker, null when HousekeepingBudgetMicroseconds is not set */
+	const FArcticAnalyticsHousekeepingStats* GetHousekeepingStats() const
+	{
+		return Housekeeping ? &Housekeeping->GetStats() : nullptr;
+	}
+
+	/** The most recently recorded events, for queries from any thread. Null when bRecentEvents is not set */
+	const FArcticAnalyticsRecentEvents* GetRecentEvents() const
+	{
+		return RecentEvents.Get();
+	}
+
+	/** Whether events with this name go through the priority lane and are kept by the memory budget's DropLowPriority policy */
+	bool IsPriorityEvent(const FString& EventName) const
+	{
+		return PriorityEventNames.Contains(EventName);
+	}
+
+	/** Delivery latency of every session and priority document uploaded so far */
+	const FArcticAnalyticsLaneLatency& GetDeliveryLatency(EArcticAnalyticsLane Lane) const
+	{
+		return DeliveryLatency[(int32)Lane];
+	}
+
+	/** What the plugin itself recorded, dropped, wrote, hashed and uploaded so far, over every provider in the process */
+	FArcticAnalyticsSelfMetricsSnapshot GetSelfMetrics() const
+	{
+		return FArcticAnalyticsSelfMetrics::Get().GetSnapshot();
+	}
+
 private:
+	/** Runs the event policy for the event, counts it if it's dropped and periodically writes out the dropped event counts */
+	bool ShouldRecordEvent(const FString& EventName, uint32 RecordId, EArcticAnalyticsRecordType Type);
+	/** Asks the memory budget to keep an encoded record of NumEvents events and counts them as recorded or dropped */
+	bool AdmitRecord(const FString& EventName, int64 EncodedBytes, EArcticAnalyticsRecordType Type, int32 NumEvents = 1);
+	/** Adds what was written to the session since the last call to the self metrics */
+	void ReportWrittenBytes();
+	/** Writes an event with the number of dropped events per event name */
+	void WriteDroppedEventsReport();
+	/** Closes the current metric window and writes a summary event per metric */
+	void WriteMetricSummaries();
+	/**
+	 * Returns where the next record goes, the priority lane or the session file, after separating it from the previous one.
+	 *
+	 * @param EventName name the record is indexed under
+	 * @param OldestTimestampUTC timestamp of the oldest event in the record, 0 for now
+	 */
+	FArchive& BeginRecord(bool bPriority, const TCHAR* EventName, double OldestTimestampUTC = 0.0);
+	/** Writes a complete event record, separating it from the previous one */
+	void WriteEventRecord(const TCHAR* Record, const TCHAR* EventName, double OldestTimestampUTC, bool bPriority = false);
+	/** The index of the session being written, null unless it goes to a file and bSessionIndex is set */
+	FArcticAnalyticsSessionIndex* GetSessionFileIndex() const
+	{
+		return SessionSink == ESessionSink::File ? SessionIndex.Get() : nullptr;
+	}
+	/** Uploads the records collected by the priority lane */
+	void FlushPriorityLane();
+	bool TickPriorityLane(float DeltaTime);
+	/** Adds the delivery latency of an upload once the server accepted it */
+	void OnDelivered(EArcticAnalyticsLane Lane, double OldestRecordTime, bool bSucceeded);
+	/** Writes the pending columnar batch, must be called before writing any record that isn't part of it */
+	void FlushPendingBatch();
+	/** Writes an error record, with the repeat count and timestamps if it was coalesced. False if the memory budget dropped it */
+	bool WriteErrorRecord(const FString& Error, const TArray<FAnalyticsEventAttribute>& Attributes, const FArcticAnalyticsErrorCoalescer::FEntry* Coalesced);
+	/** Writes one error record per distinct error collected by the coalescer */
+	void WriteCoalescedErrors();
+	/** Frees the replaced default attribute snapshots if no reader can still hold one */
+	void ReclaimDefaultEventAttributes();
+	/** Writes the buffered frames of the frame capture as a FrameCapture event */
+	void WriteFrameCapture();
+	/** Writes an event of the provider's own, such as a report, directly rather than through RecordEvent */
+	void WriteInternalEvent(const TCHAR* EventName, const TArray<FAnalyticsEventAttribute>& Attributes);
+	/**
+	 * Runs the frame budget decision of a Record* call and returns whether the call runs now. MakeDeferredCall is only
+	 * invoked when the call is deferred, so calls that run now copy nothing.
+	 */
+	template <typename MakeCallType>
+	bool AdmitCall(const FArcticAnalyticsFrameBudget::FScope& BudgetScope, EArcticAnalyticsRecordType Type, MakeCallType&& MakeDeferredCall)
+	{
+		switch (BudgetScope.GetDecision())
+		{
+		case FArcticAnalyticsFrameBudget::EDecision::Defer:
+			FrameBudget->Defer(MakeDeferredCall());
+			return false;
+		case FArcticAnalyticsFrameBudget::EDecision::Drop:
+			FArcticAnalyticsSelfMetrics::Get().AddDropped(Type);
+			return false;
+		default:
+			return true;
+		}
+	}
+	/** Writes the metric summaries once the window ended */
+	bool TickMetricWindow(float DeltaTime);
+	/** Replays deferred Record* calls and writes the frame budget attribution report when it is due */
+	bool TickFrameBudget(float DeltaTime);
+	bool TickHousekeeping(float DeltaTime);
+	/** Whether StepSessionRecovery has work that doesn't wait for the worker */
+	bool HasSessionRecoveryWork() const;
+	/**
+	 * Lists the session files of earlier runs on the first call, then hands one at a time to a worker that closes it,
+	 * and queues it for upload once the worker is done
+	 */
+	void StepSessionRecovery();
+	/** Charges a record encoded and written since StartCycles to its event name */
+	void AddEventCost(const FString& EventName, int32 NumAttributes, int64 EncodedBytes, uint64 StartCycles);
+	/** Logs the event costs of the session sorted by bytes and writes them as an ArcticAnalyticsEventCosts event */
+	void WriteEventCostReport();
+
 	/** Id representing the user the analytics are recording for */
 	FString UserId;
 	/** Unique Id representing the session the analytics are recording for */
@@ -74,5 +263,88 @@ private:
 	FString BuildInfo;
 	/** The file archive used to write the data */
 	TUniquePtr<FArchive> FileWriter;
-	TArray<FAnalyticsEventAttribute> DefaultEventAttributes;
+	/** Socket of a local collector sessions are streamed to instead of being written and uploaded, empty to always use files */
+	FString CollectorSocketPath;
+	/** Whether sessions are kept in memory and only written to disk when they outgrow MemorySessionMaxBytes */
+	bool bInMemorySessions;
+	/** Where the current session goes */
+	enum class ESessionSink : uint8
+	{
+		File,
+		Collector,
+		Memory
+	};
+	ESessionSink SessionSink;
+	/** Current immutable snapshot of the default attributes, replaced as a whole by SetDefaultEventAttributes */
+	std::atomic<const TArray<FAnalyticsEventAttribute>*> DefaultEventAttributes;
+	/** Owns the current snapshot */
+	TUniquePtr<const TArray<FAnalyticsEventAttribute>> CurrentDefaultEventAttributes;
+	/** Replaced snapshots a reader may still hold, freed once no FDefaultAttributesScope is open */
+	TArray<TUniquePtr<const TArray<FAnalyticsEventAttribute>>> RetiredDefaultEventAttributes;
+	/** Number of open FDefaultAttributesScopes */
+	mutable std::atomic<int32> NumDefaultAttributeReaders;
+	/** Serializes writers of the default attributes, readers never take it */
+	FCriticalSection DefaultEventAttributesCS;
+	/** Id of the next record, also used for deterministic sampling */
+	uint32 NextRecordId;
+	/** Sampling and rate limiting per event name */
+	FArcticAnalyticsEventPolicies EventPolicies;
+	/** Seconds between two dropped event reports */
+	float DroppedReportInterval;
+	/** Time the last dropped event report was written */
+	double LastDroppedReportTime;
+	/** Per thread metric accumulators */
+	FArcticAnalyticsMetrics Metrics;
+	/** Length of a metric aggregation window in seconds */
+	float MetricWindowSeconds;
+	/** Time the current metric window closes */
+	double MetricWindowEnd;
+	FTSTicker::FDelegateHandle MetricWindowTickHandle;
+	/** Per frame performance capture, only created when bCaptureFramePerformance is set */
+	TUniquePtr<FArcticAnalyticsFrameCapture> FrameCapture;
+	/** Columnar batch of RecordEvent events, only created when bColumnarBatches is set */
+	TUniquePtr<FArcticAnalyticsBatchEncoder> BatchEncoder;
+	/** Collapses repeated errors, only created when ErrorCoalesceWindowSeconds is above 0 */
+	TUniquePtr<FArcticAnalyticsErrorCoalescer> ErrorCoalescer;
+	/** Whether default attributes are written once to the session header instead of into every event */
+	bool bHoistDefaultAttributes;
+	/** Uploads finished session files */
+	TSharedRef<FArcticAnalyticsUploader, ESPMode::ThreadSafe> Uploader;
+	/** Names of the events that are high priority */
+	TSet<FString> PriorityEventNames;
+	/** Uploads high priority records within seconds, only created when bPriorityLane is set */
+	TUniquePtr<FArcticAnalyticsPriorityLane> PriorityLane;
+	FTSTicker::FDelegateHandle PriorityLaneTickHandle;
+	/** Time the first record of the session file was written */
+	double BulkOldestRecordTime;
+	FArcticAnalyticsLaneLatency DeliveryLatency[(int32)EArcticAnalyticsLane::Num];
+	/** Size of the session when its written bytes were last reported */
+	int64 ReportedWrittenBytes;
+	/** Per event name cost of the session, only created when bEventCostReport is set */
+	TUniquePtr<FArcticAnalyticsEventCosts> EventCosts;
+	/** Number of event names in the event cost report */
+	int32 EventCostReportSize;
+	/** Event cost slot of the events in the pending columnar batch */
+	int32 PendingBatchCostIndex;
+	/** Decoded copies of the latest records, only created when bRecentEvents is set */
+	TUniquePtr<FArcticAnalyticsRecentEvents> RecentEvents;
+	/** Offsets of the records of the session file, only created when bSessionIndex is set */
+	TUniquePtr<FArcticAnalyticsSessionIndex> SessionIndex;
+	/** Game thread budget of Record* calls, only created when FrameBudgetMicroseconds is above 0 */
+	TUniquePtr<FArcticAnalyticsFrameBudget> FrameBudget;
+	FTSTicker::FDelegateHandle FrameBudgetTickHandle;
+	/** Starts uploads, sends upload retries and recovers sessions across frames, only created when HousekeepingBudgetMicroseconds is above 0 */
+	TUniquePtr<FArcticAnalyticsHousekeeping> Housekeeping;
+	FTSTicker::FDelegateHandle HousekeepingTickHandle;
+	/** Whether the session files of earlier runs still have to be listed for recovery */
+	bool bRecoveryScanPending;
+	/** Session files of earlier runs that were not checked yet */
+	TArray<FString> RecoveryCandidates;
+	/** Session file the worker is closing and its result, see ArcticAnalyticsSessionRecovery */
+	FString RecoveringFilePath;
+	TFuture<TPair<EArcticAnalyticsRecoveryResult, int64>> RecoveryResult;
+	/** Files last written before this are from earlier runs */
+	FDateTime ProviderStartTime;
+	/** Files written to more recently than this may belong to a live instance and are not recovered */
+	float RecoveryMinAgeSeconds;
 };
@@ -0,0 +1,187 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsRecentEvents.h"
+
+#include "Async/Async.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/ScopeLock.h"
+
+#include "ArcticAnalyticsLog.h"
+
+FArcticAnalyticsRecentEvents::FArcticAnalyticsRecentEvents(int32 InCapacity)
+	: Mask(FMath::RoundUpToPowerOfTwo((uint32)FMath::Max(16, InCapacity)) - 1), NextIndex(0)
+{
+	Slots = MakeUnique<FSlot[]>(Mask + 1);
+}
+
+void FArcticAnalyticsRecentEvents::Add(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes)
+{
+	// Decoded before taking the lock, attributes that are not numbers are left out
+	FArcticAnalyticsRecentEvent Event;
+	Event.Time = FPlatformTime::Seconds();
+	Event.EventName = FName(*EventName);
+	for (const FAnalyticsEventAttribute& Attribute : Attributes)
+	{
+		const FString& Value = Attribute.GetValue();
+		if (Event.NumValues < FArcticAnalyticsRecentEvent::MaxValues && Value.Len() > 0 && FCString::IsNumeric(*Value))
+		{
+			Event.Keys[Event.NumValues] = FName(*Attribute.GetName());
+			Event.Values[Event.NumValues] = FCString::Atod(*Value);
+			++Event.NumValues;
+		}
+	}
+
+	FScopeLock Lock(&WriteCS);
+	const uint64 Index = NextIndex.load(std::memory_order_relaxed);
+	FSlot& Slot = Slots[Index & Mask];
+	Slot.Stamp.store(Index * 2 + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Slot.Event = Event;
+	Slot.Stamp.store(Index * 2 + 2, std::memory_order_release);
+	NextIndex.store(Index + 1, std::memory_order_release);
+}
+
+template <typename VisitorType>
+void FArcticAnalyticsRecentEvents::ForEachRecent(double WindowSeconds, VisitorType&& Visitor) const
+{
+	const double Since = FPlatformTime::Seconds() - WindowSeconds;
+	const uint64 End = NextIndex.load(std::memory_order_acquire);
+	FArcticAnalyticsRecentEvent Event;
+	for (uint64 Index = End; Index > 0 && End - Index <= Mask;)
+	{
+		--Index;
+		const FSlot& Slot = Slots[Index & Mask];
+		const uint64 Stamp = Index * 2 + 2;
+		if (Slot.Stamp.load(std::memory_order_acquire) != Stamp)
+		{
+			// Overwritten by a newer event, and so are all older slots
+			return;
+		}
+		Event = Slot.Event;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (Slot.Stamp.load(std::memory_order_relaxed) != Stamp || Event.Time < Since || !Visitor(Event))
+		{
+			return;
+		}
+	}
+}
+
+void FArcticAnalyticsRecentEvents::Query(FName EventName, double WindowSeconds, TArray<FArcticAnalyticsRecentEvent>& OutEvents, int32 MaxEvents) const
+{
+	OutEvents.Reset();
+	ForEachRecent(WindowSeconds, [EventName, MaxEvents, &OutEvents](const FArcticAnalyticsRecentEvent& Event)
+	{
+		if (EventName.IsNone() || Event.EventName == EventName)
+		{
+			OutEvents.Add(Event);
+		}
+		return OutEvents.Num() < MaxEvents;
+	});
+}
+
+FArcticAnalyticsRecentAggregate FArcticAnalyticsRecentEvents::Aggregate(FName EventName, FName Attribute, double WindowSeconds) const
+{
+	FArcticAnalyticsRecentAggregate Result;
+	ForEachRecent(WindowSeconds, [EventName, Attribute, &Result](const FArcticAnalyticsRecentEvent& Event)
+	{
+		double Value;
+		if (EventName.IsNone() || Event.EventName == EventName)
+		{
+			++Result.NumEvents;
+			if (Event.FindValue(Attribute, Value))
+			{
+				// Newest first
+				Result.Latest = Result.NumValues == 0 ? Value : Result.Latest;
+				Result.Min = Result.NumValues == 0 ? Value : FMath::Min(Result.Min, Value);
+				Result.Max = Result.NumValues == 0 ? Value : FMath::Max(Result.Max, Value);
+				Result.Sum += Value;
+				++Result.NumValues;
+			}
+		}
+		return true;
+	});
+	return Result;
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/**
+	 * Writes events from one thread while other threads query them, and checks that no reader ever saw a torn
+	 * event. Every event carries two values that must agree.
+	 */
+	void RecentEventsTest(const TArray<FString>& Args)
+	{
+		const int32 NumReaders = FMath::Clamp(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 4, 1, 64);
+		const float Seconds = Args.Num() > 1 ? FCString::Atof(*Args[1]) : 2.0f;
+		const int32 Capacity = Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 1024;
+
+		FArcticAnalyticsRecentEvents RecentEvents(Capacity);
+		std::atomic<bool> bStop{false};
+		std::atomic<int64> NumQueries{0};
+		std::atomic<int64> NumTorn{0};
+		const FName EventName(TEXT("RecentEventsTest"));
+		const FName ValueName(TEXT("value"));
+		const FName DoubleName(TEXT("double"));
+
+		TArray<TFuture<void>> Readers;
+		for (int32 Index = 0; Index < NumReaders; ++Index)
+		{
+			Readers.Add(Async(EAsyncExecution::Thread, [&]()
+			{
+				TArray<FArcticAnalyticsRecentEvent> Events;
+				while (!bStop.load(std::memory_order_relaxed))
+				{
+					RecentEvents.Query(EventName, 1.0, Events);
+					for (const FArcticAnalyticsRecentEvent& Event : Events)
+					{
+						double Value = 0.0, Double = 0.0;
+						if (!Event.FindValue(ValueName, Value) || !Event.FindValue(DoubleName, Double) || Double != Value * 2.0)
+						{
+							NumTorn.fetch_add(1, std::memory_order_relaxed);
+						}
+					}
+					RecentEvents.Aggregate(EventName, ValueName, 1.0);
+					NumQueries.fetch_add(2, std::memory_order_relaxed);
+				}
+			}));
+		}
+
+		TArray<uint64> Cycles;
+		const double EndTime = FPlatformTime::Seconds() + Seconds;
+		TArray<FAnalyticsEventAttribute> Attributes;
+		for (int64 Index = 0; FPlatformTime::Seconds() < EndTime; ++Index)
+		{
+			Attributes.Reset();
+			Attributes.Emplace(TEXT("value"), Index);
+			Attributes.Emplace(TEXT("double"), Index * 2);
+			Attributes.Emplace(TEXT("map"), TEXT("Test"));
+			const uint64 StartCycles = FPlatformTime::Cycles64();
+			RecentEvents.Add(TEXT("RecentEventsTest"), Attributes);
+			Cycles.Add(FPlatformTime::Cycles64() - StartCycles);
+		}
+		bStop = true;
+		for (TFuture<void>& Reader : Readers)
+		{
+			Reader.Wait();
+		}
+
+		Cycles.Sort();
+		const FArcticAnalyticsRecentAggregate Aggregate = RecentEvents.Aggregate(EventName, ValueName, 60.0);
+		const bool bPassed = NumTorn.load() == 0 && Aggregate.NumValues == FMath::Min(Cycles.Num(), RecentEvents.GetCapacity())
+							 && Aggregate.Latest == Cycles.Num() - 1;
+		UE_LOG(LogArcticAnalyticsAnalytics, Display,
+			   TEXT("Recent events test %s: %d events written, %lld queries by %d readers, %lld torn, add p50=%.2fus p99=%.2fus max=%.2fus, last %d values max %.0f"),
+			   bPassed ? TEXT("passed") : TEXT("FAILED"), Cycles.Num(), NumQueries.load(), NumReaders, NumTorn.load(),
+			   FPlatformTime::ToSeconds64(Cycles[Cycles.Num() / 2]) * 1000000.0, FPlatformTime::ToSeconds64(Cycles[(int32)(Cycles.Num() * 0.99)]) * 1000000.0,
+			   FPlatformTime::ToSeconds64(Cycles.Last()) * 1000000.0, Aggregate.NumValues, Aggregate.Max);
+	}
+
+	FAutoConsoleCommand RecentEventsTestCommand(TEXT("ArcticAnalytics.RecentEventsTest"),
+		TEXT("Writes recent events while other threads query them and checks that no query saw a torn event. Args: [Readers=4] [Seconds=2] [Capacity=1024]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RecentEventsTest));
+}
+
+#endif
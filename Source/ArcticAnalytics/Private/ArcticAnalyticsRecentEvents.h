@@ -0,0 +1,108 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AnalyticsEventAttribute.h"
+#include "HAL/CriticalSection.h"
+
+#include <atomic>
+
+/** Decoded form of a recorded event, with its numeric attributes */
+struct FArcticAnalyticsRecentEvent
+{
+	static constexpr int32 MaxValues = 8;
+
+	/** FPlatformTime::Seconds when the event was recorded */
+	double Time = 0.0;
+	FName EventName;
+	int32 NumValues = 0;
+	FName Keys[MaxValues];
+	double Values[MaxValues];
+
+	/** @return false if the event has no numeric attribute with this name */
+	bool FindValue(FName Key, double& OutValue) const
+	{
+		for (int32 Index = 0; Index < NumValues; ++Index)
+		{
+			if (Keys[Index] == Key)
+			{
+				OutValue = Values[Index];
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+/** A numeric attribute aggregated over the recent events that matched a query */
+struct FArcticAnalyticsRecentAggregate
+{
+	/** Events that matched, with or without the attribute */
+	int32 NumEvents = 0;
+	/** Events that had the attribute */
+	int32 NumValues = 0;
+	double Sum = 0.0;
+	double Min = 0.0;
+	double Max = 0.0;
+	/** Value of the newest event that had the attribute */
+	double Latest = 0.0;
+
+	double GetAverage() const
+	{
+		return NumValues > 0 ? Sum / NumValues : 0.0;
+	}
+};
+
+/**
+ * Ring of the most recently recorded events, so a perf HUD or a test can look at the last seconds of analytics
+ * without parsing the session file.
+ *
+ * Events are kept decoded: the event name and up to MaxValues numeric attributes as names and doubles, other
+ * attributes are left out. Every slot carries a sequence stamp, written odd before and even after the event,
+ * so readers on any thread copy events without taking a lock, and skip the ones overwritten while they were read.
+ * Writers are serialized among themselves and are never held up by readers.
+ */
+class FArcticAnalyticsRecentEvents
+{
+public:
+	/** @param InCapacity number of events kept, rounded up to a power of two */
+	explicit FArcticAnalyticsRecentEvents(int32 InCapacity);
+
+	/** Adds an event with the numeric attributes among Attributes */
+	void Add(const FString& EventName, const TArray<FAnalyticsEventAttribute>& Attributes);
+
+	/**
+	 * Copies the events of the last WindowSeconds, newest first.
+	 *
+	 * @param EventName events with this name, or every event for NAME_None
+	 * @param MaxEvents stop after this many events
+	 */
+	void Query(FName EventName, double WindowSeconds, TArray<FArcticAnalyticsRecentEvent>& OutEvents, int32 MaxEvents = MAX_int32) const;
+
+	/** Aggregates a numeric attribute over the events of the last WindowSeconds, NAME_None matches every event */
+	FArcticAnalyticsRecentAggregate Aggregate(FName EventName, FName Attribute, double WindowSeconds) const;
+
+	int32 GetCapacity() const
+	{
+		return (int32)(Mask + 1);
+	}
+
+private:
+	struct FSlot
+	{
+		/** 2 * index + 1 while the event with that index is written, 2 * index + 2 once it's complete, 0 if empty */
+		std::atomic<uint64> Stamp{0};
+		FArcticAnalyticsRecentEvent Event;
+	};
+
+	/** Calls Visitor with a copy of every complete event of the window, newest first, until it returns false */
+	template <typename VisitorType>
+	void ForEachRecent(double WindowSeconds, VisitorType&& Visitor) const;
+
+	TUniquePtr<FSlot[]> Slots;
+	const uint64 Mask;
+	/** Index of the next event, events before it are complete */
+	std::atomic<uint64> NextIndex;
+	FCriticalSection WriteCS;
+};
@@ -0,0 +1,162 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsSelfMetrics.h"
+
+#include "HAL/IConsoleManager.h"
+#include "Stats/Stats.h"
+
+#include "ArcticAnalyticsLog.h"
+
+DECLARE_STATS_GROUP(TEXT("ArcticAnalytics"), STATGROUP_ArcticAnalytics, STATCAT_Advanced);
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Events Recorded"), STAT_ArcticAnalytics_EventsRecorded, STATGROUP_ArcticAnalytics);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Events Dropped"), STAT_ArcticAnalytics_EventsDropped, STATGROUP_ArcticAnalytics);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Encoded (MB)"), STAT_ArcticAnalytics_EncodedMB, STATGROUP_ArcticAnalytics);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Written (MB)"), STAT_ArcticAnalytics_WrittenMB, STATGROUP_ArcticAnalytics);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Flushes"), STAT_ArcticAnalytics_Flushes, STATGROUP_ArcticAnalytics);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Flush Max (ms)"), STAT_ArcticAnalytics_FlushMaxMs, STATGROUP_ArcticAnalytics);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Upload Queue Depth"), STAT_ArcticAnalytics_UploadQueueDepth, STATGROUP_ArcticAnalytics);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Write Queue Depth"), STAT_ArcticAnalytics_WriteQueueDepth, STATGROUP_ArcticAnalytics);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Hash Time (ms)"), STAT_ArcticAnalytics_HashMs, STATGROUP_ArcticAnalytics);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Upload Attempts"), STAT_ArcticAnalytics_UploadAttempts, STATGROUP_ArcticAnalytics);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Upload Failures"), STAT_ArcticAnalytics_UploadFailures, STATGROUP_ArcticAnalytics);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Uploaded (MB)"), STAT_ArcticAnalytics_UploadedMB, STATGROUP_ArcticAnalytics);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Upload Max (ms)"), STAT_ArcticAnalytics_UploadMaxMs, STATGROUP_ArcticAnalytics);
+
+int64 FArcticAnalyticsSelfMetricsSnapshot::GetTotalRecorded() const
+{
+	int64 Total = 0;
+	for (const int64 Count : EventsRecorded)
+	{
+		Total += Count;
+	}
+	return Total;
+}
+
+int64 FArcticAnalyticsSelfMetricsSnapshot::GetTotalDropped() const
+{
+	int64 Total = 0;
+	for (const int64 Count : EventsDropped)
+	{
+		Total += Count;
+	}
+	return Total;
+}
+
+FArcticAnalyticsSelfMetrics& FArcticAnalyticsSelfMetrics::Get()
+{
+	static FArcticAnalyticsSelfMetrics Metrics;
+	return Metrics;
+}
+
+FArcticAnalyticsSelfMetrics::FArcticAnalyticsSelfMetrics()
+	: BytesEncoded(0), BytesWritten(0), Flushes(0), FlushTotalMicroseconds(0), FlushMaxMicroseconds(0), UploadQueueDepth(0), WriteQueueDepth(0),
+	  HashedBytes(0), HashMicroseconds(0), UploadAttempts(0), UploadBytes(0), UploadFailures(0), UploadTotalMicroseconds(0), UploadMaxMicroseconds(0)
+{
+	for (int32 Index = 0; Index < (int32)EArcticAnalyticsRecordType::Num; ++Index)
+	{
+		EventsRecorded[Index].store(0, std::memory_order_relaxed);
+		EventsDropped[Index].store(0, std::memory_order_relaxed);
+	}
+}
+
+void FArcticAnalyticsSelfMetrics::UpdateMax(std::atomic<int64>& Max, int64 Value)
+{
+	int64 Current = Max.load(std::memory_order_relaxed);
+	while (Value > Current && !Max.compare_exchange_weak(Current, Value, std::memory_order_relaxed))
+	{
+	}
+}
+
+void FArcticAnalyticsSelfMetrics::AddFlush(double Seconds)
+{
+	const int64 Microseconds = ToMicroseconds(Seconds);
+	Flushes.fetch_add(1, std::memory_order_relaxed);
+	FlushTotalMicroseconds.fetch_add(Microseconds, std::memory_order_relaxed);
+	UpdateMax(FlushMaxMicroseconds, Microseconds);
+}
+
+void FArcticAnalyticsSelfMetrics::AddHash(int64 Bytes, double Seconds)
+{
+	HashedBytes.fetch_add(Bytes, std::memory_order_relaxed);
+	HashMicroseconds.fetch_add(ToMicroseconds(Seconds), std::memory_order_relaxed);
+}
+
+void FArcticAnalyticsSelfMetrics::AddUploadResult(bool bSucceeded, double Seconds)
+{
+	const int64 Microseconds = ToMicroseconds(Seconds);
+	if (!bSucceeded)
+	{
+		UploadFailures.fetch_add(1, std::memory_order_relaxed);
+	}
+	UploadTotalMicroseconds.fetch_add(Microseconds, std::memory_order_relaxed);
+	UpdateMax(UploadMaxMicroseconds, Microseconds);
+}
+
+FArcticAnalyticsSelfMetricsSnapshot FArcticAnalyticsSelfMetrics::GetSnapshot() const
+{
+	FArcticAnalyticsSelfMetricsSnapshot Snapshot;
+	for (int32 Index = 0; Index < (int32)EArcticAnalyticsRecordType::Num; ++Index)
+	{
+		Snapshot.EventsRecorded[Index] = EventsRecorded[Index].load(std::memory_order_relaxed);
+		Snapshot.EventsDropped[Index] = EventsDropped[Index].load(std::memory_order_relaxed);
+	}
+	Snapshot.BytesEncoded = BytesEncoded.load(std::memory_order_relaxed);
+	Snapshot.BytesWritten = BytesWritten.load(std::memory_order_relaxed);
+	Snapshot.Flushes = Flushes.load(std::memory_order_relaxed);
+	Snapshot.FlushTotalSeconds = FlushTotalMicroseconds.load(std::memory_order_relaxed) / 1000000.0;
+	Snapshot.FlushMaxSeconds = FlushMaxMicroseconds.load(std::memory_order_relaxed) / 1000000.0;
+	Snapshot.UploadQueueDepth = UploadQueueDepth.load(std::memory_order_relaxed);
+	Snapshot.WriteQueueDepth = WriteQueueDepth.load(std::memory_order_relaxed);
+	Snapshot.HashedBytes = HashedBytes.load(std::memory_order_relaxed);
+	Snapshot.HashSeconds = HashMicroseconds.load(std::memory_order_relaxed) / 1000000.0;
+	Snapshot.UploadAttempts = UploadAttempts.load(std::memory_order_relaxed);
+	Snapshot.UploadBytes = UploadBytes.load(std::memory_order_relaxed);
+	Snapshot.UploadFailures = UploadFailures.load(std::memory_order_relaxed);
+	Snapshot.UploadTotalSeconds = UploadTotalMicroseconds.load(std::memory_order_relaxed) / 1000000.0;
+	Snapshot.UploadMaxSeconds = UploadMaxMicroseconds.load(std::memory_order_relaxed) / 1000000.0;
+	return Snapshot;
+}
+
+void FArcticAnalyticsSelfMetrics::PublishStats() const
+{
+#if STATS
+	const FArcticAnalyticsSelfMetricsSnapshot Snapshot = GetSnapshot();
+	SET_DWORD_STAT(STAT_ArcticAnalytics_EventsRecorded, Snapshot.GetTotalRecorded());
+	SET_DWORD_STAT(STAT_ArcticAnalytics_EventsDropped, Snapshot.GetTotalDropped());
+	SET_FLOAT_STAT(STAT_ArcticAnalytics_EncodedMB, Snapshot.BytesEncoded / (1024.0 * 1024.0));
+	SET_FLOAT_STAT(STAT_ArcticAnalytics_WrittenMB, Snapshot.BytesWritten / (1024.0 * 1024.0));
+	SET_DWORD_STAT(STAT_ArcticAnalytics_Flushes, Snapshot.Flushes);
+	SET_FLOAT_STAT(STAT_ArcticAnalytics_FlushMaxMs, Snapshot.FlushMaxSeconds * 1000.0);
+	SET_DWORD_STAT(STAT_ArcticAnalytics_UploadQueueDepth, Snapshot.UploadQueueDepth);
+	SET_DWORD_STAT(STAT_ArcticAnalytics_WriteQueueDepth, Snapshot.WriteQueueDepth);
+	SET_FLOAT_STAT(STAT_ArcticAnalytics_HashMs, Snapshot.HashSeconds * 1000.0);
+	SET_DWORD_STAT(STAT_ArcticAnalytics_UploadAttempts, Snapshot.UploadAttempts);
+	SET_DWORD_STAT(STAT_ArcticAnalytics_UploadFailures, Snapshot.UploadFailures);
+	SET_FLOAT_STAT(STAT_ArcticAnalytics_UploadedMB, Snapshot.UploadBytes / (1024.0 * 1024.0));
+	SET_FLOAT_STAT(STAT_ArcticAnalytics_UploadMaxMs, Snapshot.UploadMaxSeconds * 1000.0);
+#endif
+}
+
+namespace
+{
+	FAutoConsoleCommand SelfMetricsCommand(TEXT("ArcticAnalytics.SelfMetrics"), TEXT("Logs the analytics self metrics"),
+		FConsoleCommandDelegate::CreateLambda([]()
+		{
+			static const TCHAR* TypeNames[] = {TEXT("Event"), TEXT("ItemPurchase"), TEXT("CurrencyPurchase"), TEXT("CurrencyGiven"), TEXT("Error"), TEXT("Progress")};
+			static_assert(UE_ARRAY_COUNT(TypeNames) == (int32)EArcticAnalyticsRecordType::Num, "Every record type needs a name");
+
+			const FArcticAnalyticsSelfMetricsSnapshot Snapshot = FArcticAnalyticsSelfMetrics::Get().GetSnapshot();
+			for (int32 Index = 0; Index < (int32)EArcticAnalyticsRecordType::Num; ++Index)
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Self metrics: %s recorded=%lld dropped=%lld"), TypeNames[Index], Snapshot.EventsRecorded[Index],
+					   Snapshot.EventsDropped[Index]);
+			}
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Self metrics: encoded=%lld written=%lld flushes=%lld (total %.2fms, max %.2fms) queues upload=%d write=%d"),
+				   Snapshot.BytesEncoded, Snapshot.BytesWritten, Snapshot.Flushes, Snapshot.FlushTotalSeconds * 1000.0, Snapshot.FlushMaxSeconds * 1000.0,
+				   Snapshot.UploadQueueDepth, Snapshot.WriteQueueDepth);
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Self metrics: hashed=%lld in %.2fms, uploads=%lld (%lld bytes) failed=%lld (total %.2fs, max %.2fs)"),
+				   Snapshot.HashedBytes, Snapshot.HashSeconds * 1000.0, Snapshot.UploadAttempts, Snapshot.UploadBytes, Snapshot.UploadFailures,
+				   Snapshot.UploadTotalSeconds, Snapshot.UploadMaxSeconds);
+		}));
+}
@@ -0,0 +1,139 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "ArcticAnalyticsTrace.h"
+
+#include <atomic>
+
+/** Record paths counted separately by the self metrics */
+enum class EArcticAnalyticsRecordType : uint8
+{
+	Event,
+	ItemPurchase,
+	CurrencyPurchase,
+	CurrencyGiven,
+	Error,
+	Progress,
+	Num
+};
+
+/** Values of the self metrics at one point in time */
+struct FArcticAnalyticsSelfMetricsSnapshot
+{
+	int64 EventsRecorded[(int32)EArcticAnalyticsRecordType::Num] = {};
+	int64 EventsDropped[(int32)EArcticAnalyticsRecordType::Num] = {};
+	/** Text produced by the event encoders */
+	int64 BytesEncoded = 0;
+	/** Data that reached a session file, buffer or collector */
+	int64 BytesWritten = 0;
+	int64 Flushes = 0;
+	double FlushTotalSeconds = 0.0;
+	double FlushMaxSeconds = 0.0;
+	/** Uploads waiting or in flight */
+	int32 UploadQueueDepth = 0;
+	/** Writes queued for the session writer thread */
+	int32 WriteQueueDepth = 0;
+	int64 HashedBytes = 0;
+	double HashSeconds = 0.0;
+	int64 UploadAttempts = 0;
+	int64 UploadBytes = 0;
+	int64 UploadFailures = 0;
+	double UploadTotalSeconds = 0.0;
+	double UploadMaxSeconds = 0.0;
+
+	int64 GetTotalRecorded() const;
+	int64 GetTotalDropped() const;
+};
+
+/**
+ * Process wide counters of what the plugin itself does, shared by every provider and session.
+ *
+ * Counters are relaxed atomics, cheap enough to stay on in shipping builds. They are read as a snapshot through
+ * the query API and, when stats are enabled, published every frame to the ArcticAnalytics stat group.
+ */
+class FArcticAnalyticsSelfMetrics
+{
+public:
+	static FArcticAnalyticsSelfMetrics& Get();
+
+	void AddRecorded(EArcticAnalyticsRecordType Type, int64 Count = 1)
+	{
+		EventsRecorded[(int32)Type].fetch_add(Count, std::memory_order_relaxed);
+	}
+
+	void AddDropped(EArcticAnalyticsRecordType Type, int64 Count = 1)
+	{
+		EventsDropped[(int32)Type].fetch_add(Count, std::memory_order_relaxed);
+	}
+
+	void AddBytesEncoded(int64 Bytes)
+	{
+		BytesEncoded.fetch_add(Bytes, std::memory_order_relaxed);
+	}
+
+	void AddBytesWritten(int64 Bytes)
+	{
+		BytesWritten.fetch_add(Bytes, std::memory_order_relaxed);
+	}
+
+	void AddFlush(double Seconds);
+
+	/** Queue depths are summed over every uploader and writer, so they are changed by deltas */
+	void AddUploadQueueDepth(int32 Delta)
+	{
+		const int32 Depth = UploadQueueDepth.fetch_add(Delta, std::memory_order_relaxed) + Delta;
+		TRACE_COUNTER_SET(ArcticAnalytics_UploadQueueDepth, Depth);
+	}
+
+	void AddWriteQueueDepth(int32 Delta)
+	{
+		const int32 Depth = WriteQueueDepth.fetch_add(Delta, std::memory_order_relaxed) + Delta;
+		TRACE_COUNTER_SET(ArcticAnalytics_WriteQueueDepth, Depth);
+	}
+
+	void AddHash(int64 Bytes, double Seconds);
+
+	void AddUploadAttempt(int64 Bytes)
+	{
+		UploadAttempts.fetch_add(1, std::memory_order_relaxed);
+		UploadBytes.fetch_add(Bytes, std::memory_order_relaxed);
+	}
+
+	void AddUploadResult(bool bSucceeded, double Seconds);
+
+	FArcticAnalyticsSelfMetricsSnapshot GetSnapshot() const;
+
+	/** Sets the ArcticAnalytics stats to the current values. Game thread only */
+	void PublishStats() const;
+
+private:
+	FArcticAnalyticsSelfMetrics();
+
+	/** Microseconds, so times can be summed in integer atomics */
+	static int64 ToMicroseconds(double Seconds)
+	{
+		return (int64)(Seconds * 1000000.0);
+	}
+
+	static void UpdateMax(std::atomic<int64>& Max, int64 Value);
+
+	std::atomic<int64> EventsRecorded[(int32)EArcticAnalyticsRecordType::Num];
+	std::atomic<int64> EventsDropped[(int32)EArcticAnalyticsRecordType::Num];
+	std::atomic<int64> BytesEncoded;
+	std::atomic<int64> BytesWritten;
+	std::atomic<int64> Flushes;
+	std::atomic<int64> FlushTotalMicroseconds;
+	std::atomic<int64> FlushMaxMicroseconds;
+	std::atomic<int32> UploadQueueDepth;
+	std::atomic<int32> WriteQueueDepth;
+	std::atomic<int64> HashedBytes;
+	std::atomic<int64> HashMicroseconds;
+	std::atomic<int64> UploadAttempts;
+	std::atomic<int64> UploadBytes;
+	std::atomic<int64> UploadFailures;
+	std::atomic<int64> UploadTotalMicroseconds;
+	std::atomic<int64> UploadMaxMicroseconds;
+};
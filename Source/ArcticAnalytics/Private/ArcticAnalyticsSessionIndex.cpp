@@ -0,0 +1,470 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsSessionIndex.h"
+
+#include "Algo/BinarySearch.h"
+#include "Dom/JsonObject.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsTrace.h"
+
+namespace
+{
+	const uint32 IndexMagic = 0x58494141; // "AAIX"
+	const uint32 IndexVersion = 1;
+
+	/** Serializes a variable length integer, 7 bits per byte */
+	void SerializePacked(FArchive& Ar, uint64& Value)
+	{
+		if (Ar.IsLoading())
+		{
+			Value = 0;
+			for (int32 Shift = 0; Shift < 64 && !Ar.IsError(); Shift += 7)
+			{
+				uint8 Byte = 0;
+				Ar << Byte;
+				Value |= (uint64)(Byte & 0x7f) << Shift;
+				if ((Byte & 0x80) == 0)
+				{
+					break;
+				}
+			}
+			return;
+		}
+		uint64 Rest = Value;
+		do
+		{
+			uint8 Byte = (uint8)(Rest & 0x7f);
+			Rest >>= 7;
+			Byte |= Rest != 0 ? 0x80 : 0;
+			Ar << Byte;
+		} while (Rest != 0);
+	}
+
+	/** Reads a count and checks that the rest of the archive can hold that many entries of at least MinBytes */
+	bool SerializeCount(FArchive& Ar, int32& Count, int32 MinBytes)
+	{
+		uint64 Value = (uint64)Count;
+		SerializePacked(Ar, Value);
+		if (Ar.IsLoading())
+		{
+			if (Ar.IsError() || Value > (uint64)FMath::Max<int64>(0, (Ar.TotalSize() - Ar.Tell()) / MinBytes))
+			{
+				Ar.SetError();
+				return false;
+			}
+			Count = (int32)Value;
+		}
+		return true;
+	}
+}
+
+FArcticAnalyticsSessionIndex::FArcticAnalyticsSessionIndex(int32 InCheckpointBytes)
+	: CheckpointBytes(FMath::Max(1, InCheckpointBytes)), OpenRecordNameId(INDEX_NONE), SessionFileBytes(0)
+{
+}
+
+TUniquePtr<FArcticAnalyticsSessionIndex> FArcticAnalyticsSessionIndex::Load(const FString& SessionFilePath)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(SessionIndex::Load);
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*GetIndexPath(SessionFilePath)));
+	if (!Reader)
+	{
+		return nullptr;
+	}
+	TUniquePtr<FArcticAnalyticsSessionIndex> Index = MakeUnique<FArcticAnalyticsSessionIndex>(1);
+	Index->Serialize(*Reader);
+	if (!Reader->Close())
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Index of session (%s) is damaged"), *SessionFilePath);
+		return nullptr;
+	}
+	if (Index->SessionFileBytes != IFileManager::Get().FileSize(*SessionFilePath))
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Index of session (%s) is stale, the session was changed after it was indexed"), *SessionFilePath);
+		return nullptr;
+	}
+	return Index;
+}
+
+void FArcticAnalyticsSessionIndex::Reset()
+{
+	EventNames.Reset();
+	EventNameIds.Reset();
+	Records.Reset();
+	Checkpoints.Reset();
+	OpenRecordNameId = INDEX_NONE;
+	SessionFileBytes = 0;
+}
+
+void FArcticAnalyticsSessionIndex::BeginRecord(const FString& EventName, double OldestTimestampUTC, double NewestTimestampUTC, int64 Offset)
+{
+	int32& NameId = EventNameIds.FindOrAdd(EventName, EventNames.Num());
+	if (NameId == EventNames.Num())
+	{
+		EventNames.Add(EventName);
+		Records.AddDefaulted();
+	}
+	Records[NameId].Add(FArcticAnalyticsRecordSpan{Offset, 0});
+	OpenRecordNameId = NameId;
+
+	if (Checkpoints.Num() == 0 || Offset - Checkpoints.Last().Offset >= CheckpointBytes)
+	{
+		Checkpoints.Add(FArcticAnalyticsIndexCheckpoint{Offset, OldestTimestampUTC, NewestTimestampUTC});
+	}
+	else
+	{
+		FArcticAnalyticsIndexCheckpoint& Checkpoint = Checkpoints.Last();
+		Checkpoint.MinTimestampUTC = FMath::Min(Checkpoint.MinTimestampUTC, OldestTimestampUTC);
+		Checkpoint.MaxTimestampUTC = FMath::Max(Checkpoint.MaxTimestampUTC, NewestTimestampUTC);
+	}
+}
+
+void FArcticAnalyticsSessionIndex::EndRecord(int64 EndOffset)
+{
+	if (OpenRecordNameId != INDEX_NONE)
+	{
+		FArcticAnalyticsRecordSpan& Record = Records[OpenRecordNameId].Last();
+		Record.Length = (int32)(EndOffset - Record.Offset);
+		OpenRecordNameId = INDEX_NONE;
+	}
+}
+
+bool FArcticAnalyticsSessionIndex::Save(const FString& SessionFilePath, int64 InSessionFileBytes)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(SessionIndex::Save);
+	SessionFileBytes = InSessionFileBytes;
+	const FString IndexPath = GetIndexPath(SessionFilePath);
+	TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*IndexPath, FILEWRITE_EvenIfReadOnly));
+	if (!Writer)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Index of session (%s) could not be written"), *SessionFilePath);
+		return false;
+	}
+	Serialize(*Writer);
+	if (!Writer->Close())
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Index of session (%s) could not be written"), *SessionFilePath);
+		Writer = nullptr;
+		IFileManager::Get().Delete(*IndexPath);
+		return false;
+	}
+	return true;
+}
+
+void FArcticAnalyticsSessionIndex::Serialize(FArchive& Ar)
+{
+	uint32 Magic = IndexMagic;
+	uint32 Version = IndexVersion;
+	Ar << Magic;
+	Ar << Version;
+	if (Magic != IndexMagic || Version != IndexVersion)
+	{
+		Ar.SetError();
+		return;
+	}
+	Ar << SessionFileBytes;
+
+	int32 NumNames = EventNames.Num();
+	if (!SerializeCount(Ar, NumNames, 2))
+	{
+		return;
+	}
+	EventNames.SetNum(NumNames);
+	Records.SetNum(NumNames);
+	for (int32 NameId = 0; NameId < NumNames && !Ar.IsError(); ++NameId)
+	{
+		Ar << EventNames[NameId];
+		TArray<FArcticAnalyticsRecordSpan>& NameRecords = Records[NameId];
+		int32 NumRecords = NameRecords.Num();
+		if (!SerializeCount(Ar, NumRecords, 2))
+		{
+			return;
+		}
+		NameRecords.SetNum(NumRecords);
+		int64 PreviousOffset = 0;
+		for (FArcticAnalyticsRecordSpan& Record : NameRecords)
+		{
+			uint64 Delta = (uint64)(Record.Offset - PreviousOffset);
+			uint64 Length = (uint64)Record.Length;
+			SerializePacked(Ar, Delta);
+			SerializePacked(Ar, Length);
+			Record.Offset = PreviousOffset + (int64)Delta;
+			Record.Length = (int32)Length;
+			PreviousOffset = Record.Offset;
+		}
+	}
+
+	int32 NumCheckpoints = Checkpoints.Num();
+	if (!SerializeCount(Ar, NumCheckpoints, 17))
+	{
+		return;
+	}
+	Checkpoints.SetNum(NumCheckpoints);
+	int64 PreviousOffset = 0;
+	for (FArcticAnalyticsIndexCheckpoint& Checkpoint : Checkpoints)
+	{
+		uint64 Delta = (uint64)(Checkpoint.Offset - PreviousOffset);
+		SerializePacked(Ar, Delta);
+		Ar << Checkpoint.MinTimestampUTC;
+		Ar << Checkpoint.MaxTimestampUTC;
+		Checkpoint.Offset = PreviousOffset + (int64)Delta;
+		PreviousOffset = Checkpoint.Offset;
+	}
+
+	if (Ar.IsLoading())
+	{
+		EventNameIds.Reset();
+		for (int32 NameId = 0; NameId < EventNames.Num(); ++NameId)
+		{
+			EventNameIds.Add(EventNames[NameId], NameId);
+		}
+	}
+}
+
+const TArray<FArcticAnalyticsRecordSpan>* FArcticAnalyticsSessionIndex::FindRecords(const FString& EventName) const
+{
+	const int32* NameId = EventNameIds.Find(EventName);
+	return NameId ? &Records[*NameId] : nullptr;
+}
+
+void FArcticAnalyticsSessionIndex::FindRecordsInRange(double FromUTC, double ToUTC, TArray<FArcticAnalyticsRecordSpan>& OutRecords, const FString& EventName) const
+{
+	OutRecords.Reset();
+	// Byte ranges of the checkpoints that overlap the time range, adjacent ones merged
+	TArray<TPair<int64, int64>, TInlineAllocator<16>> Ranges;
+	for (int32 Index = 0; Index < Checkpoints.Num(); ++Index)
+	{
+		const FArcticAnalyticsIndexCheckpoint& Checkpoint = Checkpoints[Index];
+		if (Checkpoint.MaxTimestampUTC < FromUTC || Checkpoint.MinTimestampUTC > ToUTC)
+		{
+			continue;
+		}
+		const int64 End = Index + 1 < Checkpoints.Num() ? Checkpoints[Index + 1].Offset : MAX_int64;
+		if (Ranges.Num() > 0 && Ranges.Last().Value == Checkpoint.Offset)
+		{
+			Ranges.Last().Value = End;
+		}
+		else
+		{
+			Ranges.Emplace(Checkpoint.Offset, End);
+		}
+	}
+
+	const int32* OnlyNameId = EventName.IsEmpty() ? nullptr : EventNameIds.Find(EventName);
+	if (Ranges.Num() == 0 || (!EventName.IsEmpty() && !OnlyNameId))
+	{
+		return;
+	}
+	for (int32 NameId = OnlyNameId ? *OnlyNameId : 0; NameId < (OnlyNameId ? *OnlyNameId + 1 : Records.Num()); ++NameId)
+	{
+		const TArray<FArcticAnalyticsRecordSpan>& NameRecords = Records[NameId];
+		for (const TPair<int64, int64>& Range : Ranges)
+		{
+			for (int32 Index = Algo::LowerBoundBy(NameRecords, Range.Key, &FArcticAnalyticsRecordSpan::Offset);
+				 Index < NameRecords.Num() && NameRecords[Index].Offset < Range.Value; ++Index)
+			{
+				OutRecords.Add(NameRecords[Index]);
+			}
+		}
+	}
+	if (!OnlyNameId)
+	{
+		OutRecords.Sort([](const FArcticAnalyticsRecordSpan& A, const FArcticAnalyticsRecordSpan& B) { return A.Offset < B.Offset; });
+	}
+}
+
+bool FArcticAnalyticsSessionIndex::ReadRecords(const FString& SessionFilePath, const TArray<FArcticAnalyticsRecordSpan>& Records, TArray<FString>& OutRecords)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(SessionIndex::ReadRecords);
+	OutRecords.Reset(Records.Num());
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*SessionFilePath));
+	if (!Reader)
+	{
+		return false;
+	}
+	TArray<ANSICHAR> Buffer;
+	for (const FArcticAnalyticsRecordSpan& Record : Records)
+	{
+		Buffer.SetNumUninitialized(Record.Length, false);
+		Reader->Seek(Record.Offset);
+		Reader->Serialize(Buffer.GetData(), Record.Length);
+		if (Reader->IsError())
+		{
+			return false;
+		}
+		// Session files are written as UTF-8
+		const FUTF8ToTCHAR Converter(Buffer.GetData(), Buffer.Num());
+		OutRecords.Emplace(Converter.Length(), Converter.Get());
+	}
+	return Reader->Close();
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	/** Name a record is indexed under, see the Record* functions of the provider */
+	FString GetRecordName(const FJsonObject& Record)
+	{
+		FString Name;
+		if (Record.TryGetStringField(TEXT("EventName"), Name) || Record.TryGetStringField(TEXT("eventName"), Name) || Record.TryGetStringField(TEXT("eventType"), Name))
+		{
+			return Name;
+		}
+		if (Record.HasField(TEXT("error")))
+		{
+			return TEXT("Error");
+		}
+		Record.TryGetStringField(TEXT("eventKind"), Name);
+		return Name;
+	}
+
+	/** Timestamp of a single event record, false for records without one or with several */
+	bool GetRecordTimestamp(const FJsonObject& Record, double& OutTimestampUTC)
+	{
+		FString Timestamp;
+		if (Record.TryGetStringField(TEXT("TimestampUTC"), Timestamp))
+		{
+			OutTimestampUTC = FCString::Atod(*Timestamp);
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	 * Extracts the rarest event name and the events of a middle checkpoint from an indexed session, once by a full
+	 * parse and once through the index, and checks that both found the same records.
+	 */
+	void SessionIndexTest(const TArray<FString>& Args)
+	{
+		FString SessionFilePath = Args.Num() > 0 ? Args[0] : FString();
+		if (SessionFilePath.IsEmpty())
+		{
+			// Newest indexed session
+			const FString AnalyticsDir = FPaths::ProjectSavedDir() / TEXT("Analytics");
+			TArray<FString> FileNames;
+			IFileManager::Get().FindFiles(FileNames, *(AnalyticsDir / TEXT("*.analytics")), true, false);
+			FDateTime NewestTime = FDateTime::MinValue();
+			for (const FString& FileName : FileNames)
+			{
+				const FString FilePath = AnalyticsDir / FileName;
+				const FDateTime Time = IFileManager::Get().GetTimeStamp(*FilePath);
+				if (Time > NewestTime && IFileManager::Get().FileExists(*FArcticAnalyticsSessionIndex::GetIndexPath(FilePath)))
+				{
+					NewestTime = Time;
+					SessionFilePath = FilePath;
+				}
+			}
+		}
+
+		double StartTime = FPlatformTime::Seconds();
+		const TUniquePtr<FArcticAnalyticsSessionIndex> Index = FArcticAnalyticsSessionIndex::Load(SessionFilePath);
+		const double LoadSeconds = FPlatformTime::Seconds() - StartTime;
+		if (!Index || Index->GetEventNames().Num() == 0)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session index test needs a session written with bSessionIndex, (%s) has no usable index"), *SessionFilePath);
+			return;
+		}
+		FString EventName = Args.Num() > 1 ? Args[1] : FString();
+		for (const FString& Name : Index->GetEventNames())
+		{
+			if (EventName.IsEmpty() || (Args.Num() <= 1 && Index->FindRecords(Name)->Num() < Index->FindRecords(EventName)->Num()))
+			{
+				EventName = Name;
+			}
+		}
+		if (!Index->FindRecords(EventName))
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session (%s) has no (%s) records"), *SessionFilePath, *EventName);
+			return;
+		}
+		const TArray<FArcticAnalyticsIndexCheckpoint>& Checkpoints = Index->GetCheckpoints();
+		const FArcticAnalyticsIndexCheckpoint& MiddleCheckpoint = Checkpoints[Checkpoints.Num() / 2];
+		const double FromUTC = MiddleCheckpoint.MinTimestampUTC;
+		const double ToUTC = MiddleCheckpoint.MaxTimestampUTC;
+
+		// Full parse
+		StartTime = FPlatformTime::Seconds();
+		FString Session;
+		TSharedPtr<FJsonObject> Root;
+		const TArray<TSharedPtr<FJsonValue>>* Events = nullptr;
+		if (!FFileHelper::LoadFileToString(Session, *SessionFilePath) || !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Session), Root) || !Root.IsValid()
+			|| !Root->TryGetArrayField(TEXT("events"), Events))
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session (%s) could not be parsed"), *SessionFilePath);
+			return;
+		}
+		int32 NumScanned = 0;
+		int32 NumScannedInRange = 0;
+		for (const TSharedPtr<FJsonValue>& Event : *Events)
+		{
+			const TSharedPtr<FJsonObject>* Record = nullptr;
+			double Timestamp = 0.0;
+			if (Event->TryGetObject(Record))
+			{
+				NumScanned += GetRecordName(**Record) == EventName ? 1 : 0;
+				NumScannedInRange += GetRecordTimestamp(**Record, Timestamp) && Timestamp >= FromUTC && Timestamp <= ToUTC ? 1 : 0;
+			}
+		}
+		const double ScanSeconds = FPlatformTime::Seconds() - StartTime;
+
+		// Through the index
+		StartTime = FPlatformTime::Seconds();
+		TArray<FString> Records;
+		int64 ReadBytes = 0;
+		int32 NumIndexed = 0;
+		int32 NumMismatched = 0;
+		if (!FArcticAnalyticsSessionIndex::ReadRecords(SessionFilePath, *Index->FindRecords(EventName), Records))
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Session (%s) could not be read"), *SessionFilePath);
+			return;
+		}
+		for (const FString& Text : Records)
+		{
+			TSharedPtr<FJsonObject> Record;
+			ReadBytes += Text.Len();
+			NumMismatched += FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Text), Record) && Record.IsValid() && GetRecordName(*Record) == EventName ? 0 : 1;
+			++NumIndexed;
+		}
+		const double NameSeconds = FPlatformTime::Seconds() - StartTime;
+
+		StartTime = FPlatformTime::Seconds();
+		TArray<FArcticAnalyticsRecordSpan> RangeSpans;
+		Index->FindRecordsInRange(FromUTC, ToUTC, RangeSpans);
+		int32 NumIndexedInRange = 0;
+		FArcticAnalyticsSessionIndex::ReadRecords(SessionFilePath, RangeSpans, Records);
+		for (const FString& Text : Records)
+		{
+			TSharedPtr<FJsonObject> Record;
+			double Timestamp = 0.0;
+			ReadBytes += Text.Len();
+			if (FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Text), Record) && Record.IsValid())
+			{
+				NumIndexedInRange += GetRecordTimestamp(*Record, Timestamp) && Timestamp >= FromUTC && Timestamp <= ToUTC ? 1 : 0;
+			}
+		}
+		const double RangeSeconds = FPlatformTime::Seconds() - StartTime;
+
+		const bool bPassed = NumIndexed == NumScanned && NumMismatched == 0 && NumIndexedInRange == NumScannedInRange;
+		UE_LOG(LogArcticAnalyticsAnalytics, Display,
+			   TEXT("Session index test %s on (%s), %d records in %d checkpoints: full parse %.2fms, index load %.2fms, ")
+			   TEXT("(%s) %d/%d records in %.2fms, %d/%d single events in checkpoint %d in %.2fms, read %lld of %lld characters"),
+			   bPassed ? TEXT("passed") : TEXT("FAILED"), *SessionFilePath, Events->Num(), Checkpoints.Num(), ScanSeconds * 1000.0, LoadSeconds * 1000.0,
+			   *EventName, NumIndexed, NumScanned, NameSeconds * 1000.0, NumIndexedInRange, NumScannedInRange, Checkpoints.Num() / 2, RangeSeconds * 1000.0,
+			   ReadBytes, (int64)Session.Len());
+	}
+
+	FAutoConsoleCommand SessionIndexTestCommand(TEXT("ArcticAnalytics.SessionIndexTest"),
+		TEXT("Extracts an event name and a time range from an indexed session, by a full parse and through its index, and compares them. Args: [SessionFile=newest] [EventName=rarest]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&SessionIndexTest));
+}
+
+#endif
@@ -0,0 +1,101 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/** Where one record of a session file is, in bytes */
+struct FArcticAnalyticsRecordSpan
+{
+	int64 Offset = 0;
+	int32 Length = 0;
+};
+
+/** Timestamps of the records that start between this checkpoint and the next one */
+struct FArcticAnalyticsIndexCheckpoint
+{
+	int64 Offset = 0;
+	double MinTimestampUTC = 0.0;
+	double MaxTimestampUTC = 0.0;
+};
+
+/**
+ * Sidecar index of a session file, so tools can pull one event name or one time range out of a session without
+ * parsing all of it.
+ *
+ * The index lists where every record of the session file is, grouped by event name, and adds a checkpoint every
+ * CheckpointBytes with the range of timestamps of the records written since the previous one. It is built while
+ * the session is written and saved next to it as <session>.analytics.index once the session file is complete.
+ * Offsets are delta encoded as variable length integers. An index whose session file no longer has the size it
+ * was saved for is stale and isn't loaded. Not thread safe.
+ */
+class FArcticAnalyticsSessionIndex
+{
+public:
+	/** @param InCheckpointBytes session bytes between two timestamp checkpoints */
+	explicit FArcticAnalyticsSessionIndex(int32 InCheckpointBytes);
+
+	/** Path of the index of a session file */
+	static FString GetIndexPath(const FString& SessionFilePath)
+	{
+		return SessionFilePath + TEXT(".index");
+	}
+
+	/** Loads the index of a session file, null if there is none or it's stale */
+	static TUniquePtr<FArcticAnalyticsSessionIndex> Load(const FString& SessionFilePath);
+
+	/** Empties the index for a new session */
+	void Reset();
+
+	/**
+	 * Adds a record that starts at Offset, it ends where EndRecord is next called.
+	 *
+	 * @param OldestTimestampUTC timestamp of the oldest event in the record
+	 * @param NewestTimestampUTC timestamp of the newest event in the record
+	 */
+	void BeginRecord(const FString& EventName, double OldestTimestampUTC, double NewestTimestampUTC, int64 Offset);
+
+	/** Ends the record added last, EndOffset is past its last byte */
+	void EndRecord(int64 EndOffset);
+
+	/** Saves the index of the complete session file, which is SessionFileBytes long */
+	bool Save(const FString& SessionFilePath, int64 SessionFileBytes);
+
+	const TArray<FString>& GetEventNames() const
+	{
+		return EventNames;
+	}
+
+	const TArray<FArcticAnalyticsIndexCheckpoint>& GetCheckpoints() const
+	{
+		return Checkpoints;
+	}
+
+	/** Records of an event name in file order, null if the session has none */
+	const TArray<FArcticAnalyticsRecordSpan>* FindRecords(const FString& EventName) const;
+
+	/**
+	 * Records that may hold events between FromUTC and ToUTC, in file order. Whole checkpoints are returned, so
+	 * some records only hold events outside the range and callers still filter on the event timestamps.
+	 *
+	 * @param EventName only records of this name, or of every name if empty
+	 */
+	void FindRecordsInRange(double FromUTC, double ToUTC, TArray<FArcticAnalyticsRecordSpan>& OutRecords, const FString& EventName = FString()) const;
+
+	/** Reads records of a session file, as the JSON objects they are. Returns false if the file can't be read */
+	static bool ReadRecords(const FString& SessionFilePath, const TArray<FArcticAnalyticsRecordSpan>& Records, TArray<FString>& OutRecords);
+
+private:
+	void Serialize(FArchive& Ar);
+
+	const int32 CheckpointBytes;
+	TArray<FString> EventNames;
+	TMap<FString, int32> EventNameIds;
+	/** Records of every event name, indexed by event name id */
+	TArray<TArray<FArcticAnalyticsRecordSpan>> Records;
+	TArray<FArcticAnalyticsIndexCheckpoint> Checkpoints;
+	/** Id of the event name of the record that EndRecord ends, or INDEX_NONE */
+	int32 OpenRecordNameId;
+	/** Size of the session file the index was saved for */
+	int64 SessionFileBytes;
+};
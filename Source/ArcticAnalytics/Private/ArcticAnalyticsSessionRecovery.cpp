@@ -0,0 +1,221 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsSessionRecovery.h"
+
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "HAL/PlatformFileManager.h"
+
+#include "ArcticAnalyticsTrace.h"
+
+namespace
+{
+	/** Bytes read at a time */
+	constexpr int64 PieceBytes = 64 * 1024;
+
+	/** Searches a session file in its own encoding, a code unit is one byte in UTF-8 and two in UTF-16 */
+	class FSessionFile
+	{
+	public:
+		explicit FSessionFile(IFileHandle& InHandle) : Handle(InHandle), Size(InHandle.Size()), UnitBytes(1), DataStart(0)
+		{
+			uint8 ByteOrderMark[2];
+			if (Size >= 2 && Read(0, 2, ByteOrderMark) && ByteOrderMark[0] == 0xFF && ByteOrderMark[1] == 0xFE)
+			{
+				UnitBytes = 2;
+				DataStart = 2;
+			}
+			// A unit cut in half at the end is not searched
+			DataEnd = DataStart + (FMath::Max<int64>(0, Size - DataStart) / UnitBytes) * UnitBytes;
+		}
+
+		TArray<uint8> Encode(const ANSICHAR* Text) const
+		{
+			TArray<uint8> Bytes;
+			for (; *Text; ++Text)
+			{
+				Bytes.Add((uint8)*Text);
+				if (UnitBytes == 2)
+				{
+					Bytes.Add(0);
+				}
+			}
+			return Bytes;
+		}
+
+		/** Whether the session was finished, i.e. ends with the end of the events list and the document */
+		bool IsFinished()
+		{
+			const int64 End = TrimWhitespace(DataEnd);
+			for (const ANSICHAR* Ending : {"\n\t]\n}", "\n\t]\r\n}"})
+			{
+				const TArray<uint8> Pattern = Encode(Ending);
+				TArray<uint8> Tail;
+				Tail.SetNumUninitialized(Pattern.Num());
+				if (End - Pattern.Num() >= DataStart && Read(End - Pattern.Num(), Pattern.Num(), Tail.GetData()) && Tail == Pattern)
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/** Offset of the last record separator that ends its line, everything before it is complete records, or INDEX_NONE */
+		int64 FindLastRecordSeparator()
+		{
+			const TArray<uint8> Pattern = Encode("\n\t\t,");
+			TArray<uint8> Buffer;
+			for (int64 End = DataEnd; End > DataStart;)
+			{
+				// Also read past the piece, a separator starting in it may end in the next one
+				const int64 Start = FMath::Max(DataStart, End - PieceBytes);
+				const int64 ReadEnd = FMath::Min(DataEnd, End + Pattern.Num() + UnitBytes);
+				Buffer.SetNumUninitialized(ReadEnd - Start);
+				if (!Read(Start, Buffer.Num(), Buffer.GetData()))
+				{
+					return INDEX_NONE;
+				}
+				for (int64 Offset = End - UnitBytes; Offset >= Start; Offset -= UnitBytes)
+				{
+					const int64 Next = Offset + Pattern.Num();
+					if (Next <= ReadEnd && FMemory::Memcmp(Buffer.GetData() + (Offset - Start), Pattern.GetData(), Pattern.Num()) == 0 &&
+						(Next == DataEnd || IsUnit(Buffer.GetData() + (Next - Start), '\r') || IsUnit(Buffer.GetData() + (Next - Start), '\n')))
+					{
+						return Offset;
+					}
+				}
+				End = Start;
+			}
+			return INDEX_NONE;
+		}
+
+		/** Offset of the first Text at or after From, or INDEX_NONE */
+		int64 FindForward(const ANSICHAR* Text, int64 From)
+		{
+			const TArray<uint8> Pattern = Encode(Text);
+			TArray<uint8> Buffer;
+			for (int64 Start = From; Start + Pattern.Num() <= DataEnd; Start += PieceBytes)
+			{
+				const int64 ReadEnd = FMath::Min(DataEnd, Start + PieceBytes + Pattern.Num());
+				Buffer.SetNumUninitialized(ReadEnd - Start);
+				if (!Read(Start, Buffer.Num(), Buffer.GetData()))
+				{
+					return INDEX_NONE;
+				}
+				for (int64 Offset = Start; Offset < Start + PieceBytes && Offset + Pattern.Num() <= ReadEnd; Offset += UnitBytes)
+				{
+					if (FMemory::Memcmp(Buffer.GetData() + (Offset - Start), Pattern.GetData(), Pattern.Num()) == 0)
+					{
+						return Offset;
+					}
+				}
+			}
+			return INDEX_NONE;
+		}
+
+		/** Moves End back over whitespace */
+		int64 TrimWhitespace(int64 End)
+		{
+			uint8 Unit[2];
+			while (End > DataStart && Read(End - UnitBytes, UnitBytes, Unit) &&
+				   (IsUnit(Unit, ' ') || IsUnit(Unit, '\t') || IsUnit(Unit, '\r') || IsUnit(Unit, '\n')))
+			{
+				End -= UnitBytes;
+			}
+			return End;
+		}
+
+		bool IsUnitAt(int64 Offset, ANSICHAR Char)
+		{
+			uint8 Unit[2];
+			return Offset >= DataStart && Offset + UnitBytes <= DataEnd && Read(Offset, UnitBytes, Unit) && IsUnit(Unit, Char);
+		}
+
+		int64 GetSize() const
+		{
+			return Size;
+		}
+
+		int64 GetDataStart() const
+		{
+			return DataStart;
+		}
+
+		int64 GetDataEnd() const
+		{
+			return DataEnd;
+		}
+
+		int32 GetUnitBytes() const
+		{
+			return UnitBytes;
+		}
+
+	private:
+		bool Read(int64 Offset, int64 Num, uint8* Data)
+		{
+			return Handle.Seek(Offset) && Handle.Read(Data, Num);
+		}
+
+		bool IsUnit(const uint8* Unit, ANSICHAR Char) const
+		{
+			return Unit[0] == (uint8)Char && (UnitBytes == 1 || Unit[1] == 0);
+		}
+
+		IFileHandle& Handle;
+		const int64 Size;
+		int32 UnitBytes;
+		int64 DataStart;
+		int64 DataEnd;
+	};
+}
+
+EArcticAnalyticsRecoveryResult ArcticAnalyticsSessionRecovery::Recover(const FString& FilePath, double MinAgeSeconds, int64& OutDroppedBytes)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(RecoverSession);
+	OutDroppedBytes = 0;
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	const FDateTime TimeStamp = PlatformFile.GetTimeStamp(*FilePath);
+	if (TimeStamp == FDateTime::MinValue())
+	{
+		return EArcticAnalyticsRecoveryResult::Failed;
+	}
+	if ((FDateTime::UtcNow() - TimeStamp).GetTotalSeconds() < MinAgeSeconds)
+	{
+		return EArcticAnalyticsRecoveryResult::InUse;
+	}
+	// Fails while another process has the file open for writing, on platforms that lock files
+	TUniquePtr<IFileHandle> Handle(PlatformFile.OpenWrite(*FilePath, true, true));
+	if (!Handle.IsValid())
+	{
+		return EArcticAnalyticsRecoveryResult::InUse;
+	}
+
+	FSessionFile File(*Handle);
+	if (File.IsFinished())
+	{
+		return EArcticAnalyticsRecoveryResult::Finished;
+	}
+	// Everything before the last record separator is complete, the record after it may have been cut off
+	int64 EndOffset = File.FindLastRecordSeparator();
+	if (EndOffset == INDEX_NONE)
+	{
+		// No complete record, keep the header
+		EndOffset = File.FindForward("\t\"events\" : [", File.GetDataStart());
+		if (EndOffset == INDEX_NONE)
+		{
+			return EArcticAnalyticsRecoveryResult::Failed;
+		}
+		EndOffset = File.FindForward("\n", EndOffset);
+		EndOffset = EndOffset == INDEX_NONE ? File.GetDataEnd() : EndOffset;
+	}
+	// Closed with the line terminator the file was written with
+	const bool bCarriageReturn = File.IsUnitAt(EndOffset - File.GetUnitBytes(), '\r');
+	const int64 NewSize = File.TrimWhitespace(EndOffset);
+	const TArray<uint8> Ending = File.Encode(bCarriageReturn ? "\r\n\t]\r\n}\r\n" : "\n\t]\n}\n");
+	if (!Handle->Truncate(NewSize) || !Handle->Seek(NewSize) || !Handle->Write(Ending.GetData(), Ending.Num()))
+	{
+		return EArcticAnalyticsRecoveryResult::Failed;
+	}
+	OutDroppedBytes = File.GetSize() - NewSize;
+	return EArcticAnalyticsRecoveryResult::Recovered;
+}
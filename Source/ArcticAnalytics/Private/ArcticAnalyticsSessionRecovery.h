@@ -0,0 +1,34 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class EArcticAnalyticsRecoveryResult : uint8
+{
+	/** Closed and ready to be uploaded */
+	Recovered,
+	/** Already finished by its session */
+	Finished,
+	/** Open in another process or written to recently, left for a later run */
+	InUse,
+	/** Has no events list, or could not be read or written */
+	Failed
+};
+
+/**
+ * Closes session files an earlier run left unfinished.
+ *
+ * The file is read in pieces backwards from its end to find the last complete record, and is then truncated after it
+ * and closed in place. The complete records keep their bytes and their encoding, UTF-8, or UTF-16 with a byte order
+ * mark as older builds wrote. Files that another process has open for writing, or that were written to recently,
+ * may belong to a live instance and are left alone. Any thread.
+ */
+namespace ArcticAnalyticsSessionRecovery
+{
+	/**
+	 * @param MinAgeSeconds files written to more recently than this are in use
+	 * @param OutDroppedBytes bytes of the last, possibly cut off, record that were dropped
+	 */
+	EArcticAnalyticsRecoveryResult Recover(const FString& FilePath, double MinAgeSeconds, int64& OutDroppedBytes);
+}
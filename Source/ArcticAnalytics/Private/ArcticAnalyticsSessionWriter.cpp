@@ -0,0 +1,159 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsSessionWriter.h"
+
+#include "HAL/Event.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/ScopeLock.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "ArcticAnalyticsTrace.h"
+
+FArcticAnalyticsSessionWriter::FArcticAnalyticsSessionWriter() : NumPending(0), bStopping(false), WakeEvent(nullptr), Thread(nullptr)
+{
+	if (FPlatformProcess::SupportsMultithreading())
+	{
+		WakeEvent = FPlatformProcess::GetSynchEventFromPool();
+		Thread = FRunnableThread::Create(this, TEXT("ArcticAnalyticsWriter"), 0, TPri_BelowNormal);
+	}
+}
+
+FArcticAnalyticsSessionWriter::~FArcticAnalyticsSessionWriter()
+{
+	if (Thread)
+	{
+		Thread->Kill(true);
+		delete Thread;
+		Thread = nullptr;
+	}
+	if (WakeEvent)
+	{
+		FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+		WakeEvent = nullptr;
+	}
+	// Anything queued after the thread stopped still goes to disk
+	DrainQueue();
+}
+
+void FArcticAnalyticsSessionWriter::Enqueue(const FString& FilePath, TArray<uint8>&& Data, TFunction<void(bool)>&& OnWritten, bool bWriteNow)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(SessionWriter::Enqueue);
+	const bool bIsFinal = (bool)OnWritten;
+	NumPending.fetch_add(1, std::memory_order_relaxed);
+	FArcticAnalyticsSelfMetrics::Get().AddWriteQueueDepth(1);
+	Queue.Enqueue(FWriteRequest{FilePath, MoveTemp(Data), MoveTemp(OnWritten)});
+	if (Thread == nullptr)
+	{
+		DrainQueue();
+	}
+	// The thread wakes up on its own every so often, so only wake it early for a final buffer or
+	// when the memory budget runs low, to keep many small sessions batched together
+	else if (bIsFinal || bWriteNow || FArcticAnalyticsMemoryBudget::Get().IsOverSoftLimit())
+	{
+		WakeEvent->Trigger();
+	}
+}
+
+void FArcticAnalyticsSessionWriter::WaitForWrites()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(SessionWriter::WaitForWrites);
+	while (NumPending.load(std::memory_order_relaxed) > 0)
+	{
+		if (WakeEvent)
+		{
+			WakeEvent->Trigger();
+		}
+		else
+		{
+			DrainQueue();
+		}
+		FPlatformProcess::Sleep(0.001f);
+	}
+}
+
+uint32 FArcticAnalyticsSessionWriter::Run()
+{
+	while (!bStopping.load(std::memory_order_relaxed))
+	{
+		WakeEvent->Wait(FTimespan::FromMilliseconds(250));
+		DrainQueue();
+	}
+	return 0;
+}
+
+void FArcticAnalyticsSessionWriter::Stop()
+{
+	bStopping.store(true, std::memory_order_relaxed);
+	if (WakeEvent)
+	{
+		WakeEvent->Trigger();
+	}
+}
+
+int32 FArcticAnalyticsSessionWriter::DrainQueue()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(SessionWriter::Write);
+	FScopeLock Lock(&DrainCS);
+
+	TArray<FWriteRequest> Requests;
+	FWriteRequest Request;
+	while (Queue.Dequeue(Request))
+	{
+		Requests.Add(MoveTemp(Request));
+	}
+	if (Requests.Num() == 0)
+	{
+		return 0;
+	}
+	const double StartTime = FPlatformTime::Seconds();
+
+	// Group per file, keeping the order within each file, so each file is opened once per drain
+	TMap<FString, TArray<int32>> RequestsPerFile;
+	for (int32 Index = 0; Index < Requests.Num(); ++Index)
+	{
+		RequestsPerFile.FindOrAdd(Requests[Index].FilePath).Add(Index);
+	}
+	for (const TPair<FString, TArray<int32>>& File : RequestsPerFile)
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*File.Key, FILEWRITE_Append | FILEWRITE_AllowRead));
+		if (!Writer)
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FArcticAnalyticsSessionWriter failed to open (%s), dropping (%d) buffers"), *File.Key, File.Value.Num());
+			FailedFiles.Add(File.Key);
+			continue;
+		}
+		for (int32 Index : File.Value)
+		{
+			Writer->Serialize(Requests[Index].Data.GetData(), Requests[Index].Data.Num());
+		}
+		if (!Writer->Close() || Writer->IsError())
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("FArcticAnalyticsSessionWriter failed to write (%d) buffers to (%s)"), File.Value.Num(), *File.Key);
+			FailedFiles.Add(File.Key);
+		}
+	}
+
+	int64 WrittenBytes = 0;
+	for (FWriteRequest& Written : Requests)
+	{
+		WrittenBytes += Written.Data.Num();
+		if (Written.OnWritten)
+		{
+			// A file that missed any write is incomplete, whether or not its last buffer made it
+			Written.OnWritten(FailedFiles.Remove(Written.FilePath) == 0);
+		}
+	}
+	FArcticAnalyticsMemoryBudget::Get().Release(WrittenBytes);
+	FArcticAnalyticsSelfMetrics& SelfMetrics = FArcticAnalyticsSelfMetrics::Get();
+	SelfMetrics.AddBytesWritten(WrittenBytes);
+	TRACE_COUNTER_SET(ArcticAnalytics_WriteBatchBytes, WrittenBytes);
+	SelfMetrics.AddFlush(FPlatformTime::Seconds() - StartTime);
+	SelfMetrics.AddWriteQueueDepth(-Requests.Num());
+	NumPending.fetch_sub(Requests.Num(), std::memory_order_relaxed);
+	return Requests.Num();
+}
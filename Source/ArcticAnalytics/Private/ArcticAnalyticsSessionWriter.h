@@ -0,0 +1,69 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "HAL/Runnable.h"
+
+#include <atomic>
+
+class FEvent;
+class FRunnableThread;
+
+/**
+ * Background writer shared by many sessions. Encoded buffers are queued from any thread and appended to
+ * their session files on a single thread. Each wake-up writes everything that was queued, grouped per file,
+ * and files are only open while they are being appended to, so the number of sessions doesn't bound the
+ * number of open handles. Queued data stays charged to the memory budget until it is written.
+ */
+class FArcticAnalyticsSessionWriter : public FRunnable
+{
+public:
+	FArcticAnalyticsSessionWriter();
+	virtual ~FArcticAnalyticsSessionWriter();
+
+	/**
+	 * Queues data to be appended to a file. Safe to call from any thread.
+	 *
+	 * @param FilePath the file to append to, created on first write
+	 * @param Data the encoded data, moved into the queue
+	 * @param OnWritten optional callback run on the writer thread once the data was written, with whether every write to the file succeeded
+	 * @param bWriteNow whether to wake the writer right away, which it always does for data with a callback
+	 */
+	void Enqueue(const FString& FilePath, TArray<uint8>&& Data, TFunction<void(bool)>&& OnWritten = nullptr, bool bWriteNow = false);
+
+	/** Blocks until everything queued so far has been written */
+	void WaitForWrites();
+
+	/** Number of queued requests that have not been written yet */
+	int32 GetNumPending() const
+	{
+		return NumPending.load(std::memory_order_relaxed);
+	}
+
+	// FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+
+private:
+	struct FWriteRequest
+	{
+		FString FilePath;
+		TArray<uint8> Data;
+		TFunction<void(bool)> OnWritten;
+	};
+
+	/** Writes all queued requests, returns the number written */
+	int32 DrainQueue();
+
+	TQueue<FWriteRequest, EQueueMode::Mpsc> Queue;
+	std::atomic<int32> NumPending;
+	std::atomic<bool> bStopping;
+	FEvent* WakeEvent;
+	FRunnableThread* Thread;
+	/** Serializes DrainQueue when the platform has no threads and writes happen on the caller */
+	FCriticalSection DrainCS;
+	/** Files a write failed for since their last callback, guarded by DrainCS. Their data is incomplete */
+	TSet<FString> FailedFiles;
+};
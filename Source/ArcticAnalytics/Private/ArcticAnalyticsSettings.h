@@ -0,0 +1,45 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ConfigCacheIni.h"
+#include "Misc/Paths.h"
+
+/**
+ * Helpers for reading the [/Script/ArcticAnalytics.Settings] section of DefaultEngine.ini
+ */
+namespace ArcticAnalyticsSettings
+{
+	static const TCHAR* const Section = TEXT("/Script/ArcticAnalytics.Settings");
+
+	inline FString GetConfigFilename()
+	{
+		return FString::Printf(TEXT("%sDefaultEngine.ini"), *FPaths::SourceConfigDir());
+	}
+
+	inline bool GetString(const TCHAR* Key, FString& OutValue)
+	{
+		return GConfig->GetString(Section, Key, OutValue, GetConfigFilename());
+	}
+
+	inline bool GetBool(const TCHAR* Key, bool& OutValue)
+	{
+		return GConfig->GetBool(Section, Key, OutValue, GetConfigFilename());
+	}
+
+	inline bool GetInt(const TCHAR* Key, int32& OutValue)
+	{
+		return GConfig->GetInt(Section, Key, OutValue, GetConfigFilename());
+	}
+
+	inline bool GetFloat(const TCHAR* Key, float& OutValue)
+	{
+		return GConfig->GetFloat(Section, Key, OutValue, GetConfigFilename());
+	}
+
+	inline int32 GetArray(const TCHAR* Key, TArray<FString>& OutValues)
+	{
+		return GConfig->GetArray(Section, Key, OutValues, GetConfigFilename());
+	}
+}
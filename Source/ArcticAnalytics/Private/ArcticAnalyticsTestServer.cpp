@@ -0,0 +1,236 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsTestServer.h"
+
+#if !UE_BUILD_SHIPPING
+
+#include "HAL/PlatformTime.h"
+#include "HttpPath.h"
+#include "HttpServerModule.h"
+#include "HttpServerRequest.h"
+#include "HttpServerResponse.h"
+#include "IHttpRouter.h"
+
+#include "ArcticAnalyticsChunkedUpload.h"
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryArchive.h"
+#include "ArcticAnalyticsSettings.h"
+#include "Data_SHA256.h"
+
+namespace
+{
+	const FString* FindHeader(const FHttpServerRequest& Request, const TCHAR* Name)
+	{
+		const TArray<FString>* Values = Request.Headers.Find(Name);
+		return Values && Values->Num() > 0 ? &(*Values)[0] : nullptr;
+	}
+}
+
+FArcticAnalyticsTestServer::FArcticAnalyticsTestServer(uint32 InPort)
+	: Port(InPort), LatencySeconds(0.0), BytesPerSecond(0.0), FailureRate(0.0f), Random(1234), bKeepUploads(false), NumRequests(0), NumFailed(0),
+	  NumRejected(0), ReceivedBytes(0)
+{
+}
+
+FArcticAnalyticsTestServer::~FArcticAnalyticsTestServer()
+{
+	Stop();
+}
+
+bool FArcticAnalyticsTestServer::Start(const FString& InSecret)
+{
+	check(IsInGameThread());
+	Router = FHttpServerModule::Get().GetHttpRouter(Port);
+	if (!Router.IsValid())
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Stand-in server could not listen on port (%u)"), Port);
+		return false;
+	}
+	RouteHandle = Router->BindRoute(FHttpPath(TEXT("/analytics")), EHttpServerRequestVerbs::VERB_POST,
+		[this](const FHttpServerRequest& Request, const FHttpResultCallback& OnComplete) { return HandleRequest(Request, OnComplete); });
+	FHttpServerModule::Get().StartAllListeners();
+	TickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FArcticAnalyticsTestServer::Tick));
+
+	OverrideSetting(TEXT("Server"), FString::Printf(TEXT("http://127.0.0.1:%u/analytics"), Port));
+	if (!InSecret.IsEmpty())
+	{
+		OverrideSetting(TEXT("Secret"), InSecret);
+	}
+	else if (!ArcticAnalyticsSettings::GetString(TEXT("Secret"), Secret))
+	{
+		OverrideSetting(TEXT("Secret"), TEXT("StandIn"));
+	}
+	ArcticAnalyticsSettings::GetString(TEXT("Secret"), Secret);
+	return true;
+}
+
+void FArcticAnalyticsTestServer::Stop()
+{
+	if (!Router.IsValid())
+	{
+		return;
+	}
+	FTSTicker::GetCoreTicker().RemoveTicker(TickHandle);
+	for (FHeldResponse& Held : HeldResponses)
+	{
+		Held.OnComplete(MoveTemp(Held.Response));
+	}
+	HeldResponses.Reset();
+	Router->UnbindRoute(RouteHandle);
+	Router.Reset();
+	for (const TPair<FString, TOptional<FString>>& Setting : SavedSettings)
+	{
+		if (Setting.Value.IsSet())
+		{
+			GConfig->SetString(ArcticAnalyticsSettings::Section, *Setting.Key, *Setting.Value.GetValue(), ArcticAnalyticsSettings::GetConfigFilename());
+		}
+		else
+		{
+			GConfig->RemoveKey(ArcticAnalyticsSettings::Section, *Setting.Key, ArcticAnalyticsSettings::GetConfigFilename());
+		}
+	}
+	SavedSettings.Reset();
+}
+
+void FArcticAnalyticsTestServer::OverrideSetting(const TCHAR* Key, const FString& Value)
+{
+	// Only the value from before the first override is restored
+	if (!SavedSettings.Contains(Key))
+	{
+		FString Previous;
+		SavedSettings.Add(Key, ArcticAnalyticsSettings::GetString(Key, Previous) ? TOptional<FString>(Previous) : TOptional<FString>());
+	}
+	GConfig->SetString(ArcticAnalyticsSettings::Section, Key, *Value, ArcticAnalyticsSettings::GetConfigFilename());
+}
+
+void FArcticAnalyticsTestServer::SetLatency(double InLatencySeconds, double InBytesPerSecond)
+{
+	LatencySeconds = FMath::Max(0.0, InLatencySeconds);
+	BytesPerSecond = FMath::Max(0.0, InBytesPerSecond);
+}
+
+void FArcticAnalyticsTestServer::SetFailureRate(float InFailureRate)
+{
+	FailureRate = FMath::Clamp(InFailureRate, 0.0f, 1.0f);
+}
+
+bool FArcticAnalyticsTestServer::HandleRequest(const FHttpServerRequest& Request, const FHttpResultCallback& OnComplete)
+{
+	++NumRequests;
+	ReceivedBytes += Request.Body.Num();
+
+	TUniquePtr<FHttpServerResponse> Response;
+	const float Roll = Random.FRand();
+	if (Roll < FailureRate * 0.5f)
+	{
+		// Connection dropped before the request was stored
+		++NumFailed;
+		Response = FHttpServerResponse::Error(EHttpServerResponseCodes::ServiceUnavail);
+	}
+	else
+	{
+		const int64 Acked = Store(Request);
+		if (Acked < 0)
+		{
+			++NumRejected;
+			Response = FHttpServerResponse::Error(EHttpServerResponseCodes::Denied);
+		}
+		else if (Roll < FailureRate)
+		{
+			// Stored, but the response was lost
+			++NumFailed;
+			Response = FHttpServerResponse::Error(EHttpServerResponseCodes::ServiceUnavail);
+		}
+		else
+		{
+			Response = FHttpServerResponse::Ok();
+			if (FindHeader(Request, TEXT("X-Upload-Id")))
+			{
+				Response->Headers.Add(TEXT("X-Upload-Acked"), {LexToString(Acked)});
+			}
+		}
+	}
+
+	// The body is shared with every other request in flight
+	double DueTime = FPlatformTime::Seconds() + LatencySeconds;
+	if (BytesPerSecond > 0.0)
+	{
+		DueTime += Request.Body.Num() * (HeldResponses.Num() + 1) / BytesPerSecond;
+	}
+	int32 Index = HeldResponses.Num();
+	while (Index > 0 && HeldResponses[Index - 1].DueTime > DueTime)
+	{
+		--Index;
+	}
+	HeldResponses.Insert(FHeldResponse{DueTime, MoveTemp(Response), OnComplete}, Index);
+	return true;
+}
+
+int64 FArcticAnalyticsTestServer::Store(const FHttpServerRequest& Request)
+{
+	const FString* Signature = FindHeader(Request, TEXT("Authorization"));
+	const FString* UploadId = FindHeader(Request, TEXT("X-Upload-Id"));
+	if (UploadId == nullptr)
+	{
+		// Whole session, signed over its body
+		HMAC_SHA256 Hmac(Secret);
+		Hmac.Update(Request.Body.GetData(), Request.Body.Num());
+		return Signature && *Signature == Hmac.Final().ToHexString() ? Request.Body.Num() : -1;
+	}
+
+	const FString* Offset = FindHeader(Request, TEXT("X-Upload-Offset"));
+	const FString* Length = FindHeader(Request, TEXT("X-Upload-Length"));
+	const FString* Total = FindHeader(Request, TEXT("X-Upload-Total"));
+	if (!Signature || !Offset || !Length || !Total || FCString::Atoi64(**Length) != Request.Body.Num())
+	{
+		return -1;
+	}
+	FArcticAnalyticsChunkBuffer Data;
+	Data.Chunks.Add(Request.Body);
+	Data.NumBytes = Request.Body.Num();
+	const int64 ChunkOffset = FCString::Atoi64(**Offset);
+	if (FArcticAnalyticsChunkedUpload::Sign(Secret, *UploadId, ChunkOffset, FCString::Atoi64(**Total), Data) != *Signature)
+	{
+		return -1;
+	}
+
+	// Keeps only what continues the contiguous bytes, like the real server
+	int64& Acked = AckedBytes.FindOrAdd(*UploadId);
+	if (ChunkOffset <= Acked && ChunkOffset + Request.Body.Num() > Acked)
+	{
+		const int32 Skip = (int32)(Acked - ChunkOffset);
+		if (bKeepUploads)
+		{
+			Uploads.FindOrAdd(*UploadId).Append(Request.Body.GetData() + Skip, Request.Body.Num() - Skip);
+		}
+		Acked = ChunkOffset + Request.Body.Num();
+	}
+	return Acked;
+}
+
+bool FArcticAnalyticsTestServer::Tick(float DeltaTime)
+{
+	const double Now = FPlatformTime::Seconds();
+	int32 NumDue = 0;
+	while (NumDue < HeldResponses.Num() && HeldResponses[NumDue].DueTime <= Now)
+	{
+		++NumDue;
+	}
+	if (NumDue > 0)
+	{
+		// Removed first, a response may complete a request that sends the next one right away
+		TArray<FHeldResponse> Due;
+		for (int32 Index = 0; Index < NumDue; ++Index)
+		{
+			Due.Add(MoveTemp(HeldResponses[Index]));
+		}
+		HeldResponses.RemoveAt(0, NumDue, false);
+		for (FHeldResponse& Held : Due)
+		{
+			Held.OnComplete(MoveTemp(Held.Response));
+		}
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,131 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if !UE_BUILD_SHIPPING
+
+#include "Containers/Ticker.h"
+#include "HttpResultCallback.h"
+#include "HttpRouteHandle.h"
+#include "Math/RandomStream.h"
+
+class IHttpRouter;
+struct FHttpServerRequest;
+struct FHttpServerResponse;
+
+/**
+ * Local stand-in for the analytics server, for the non-shipping benchmarks and tests.
+ *
+ * While running it points the Server setting at itself. It checks the signature of whole sessions and chunks, and
+ * keeps chunks the way the real server does: it stores a chunk whose offset is at or before its acknowledged count
+ * and answers with X-Upload-Acked. Responses can be held back by an injected latency and bandwidth, and a share of
+ * requests can fail before or after they were stored. Game thread only.
+ */
+class FArcticAnalyticsTestServer
+{
+public:
+	explicit FArcticAnalyticsTestServer(uint32 InPort);
+	~FArcticAnalyticsTestServer();
+
+	/** Starts listening and overrides the Server setting, and the Secret setting with InSecret, or a fixed one if it is unset */
+	bool Start(const FString& InSecret = FString());
+
+	/** Answers held back responses, stops listening and restores the overridden settings */
+	void Stop();
+
+	/** Overrides a setting until Stop */
+	void OverrideSetting(const TCHAR* Key, const FString& Value);
+
+	/**
+	 * Holds back every response by LatencySeconds, plus the time its body takes at BytesPerSecond when that is
+	 * set, shared by every request in flight
+	 */
+	void SetLatency(double InLatencySeconds, double InBytesPerSecond = 0.0);
+
+	/** Fails this share of requests with 503, half of them after the chunk was stored, as if the response was lost */
+	void SetFailureRate(float InFailureRate);
+
+	/** Keeps the bytes of every upload, see GetUpload */
+	void SetKeepUploads(bool bInKeepUploads)
+	{
+		bKeepUploads = bInKeepUploads;
+	}
+
+	/** Bytes stored contiguously for a chunked upload id */
+	const TArray<uint8>* GetUpload(const FString& UploadId) const
+	{
+		return Uploads.Find(UploadId);
+	}
+
+	const FString& GetSecret() const
+	{
+		return Secret;
+	}
+
+	int32 GetNumRequests() const
+	{
+		return NumRequests;
+	}
+
+	int32 GetNumFailed() const
+	{
+		return NumFailed;
+	}
+
+	/** Requests with a missing or wrong signature */
+	int32 GetNumRejected() const
+	{
+		return NumRejected;
+	}
+
+	int64 GetReceivedBytes() const
+	{
+		return ReceivedBytes;
+	}
+
+	/** Requests received and not answered yet */
+	int32 GetNumInFlight() const
+	{
+		return HeldResponses.Num();
+	}
+
+private:
+	struct FHeldResponse
+	{
+		double DueTime;
+		TUniquePtr<FHttpServerResponse> Response;
+		FHttpResultCallback OnComplete;
+	};
+
+	bool HandleRequest(const FHttpServerRequest& Request, const FHttpResultCallback& OnComplete);
+	/** Stores a chunk or session, returns the acknowledged byte count, or -1 if the signature did not match */
+	int64 Store(const FHttpServerRequest& Request);
+	bool Tick(float DeltaTime);
+
+	const uint32 Port;
+	FString Secret;
+	TSharedPtr<IHttpRouter> Router;
+	FHttpRouteHandle RouteHandle;
+	FTSTicker::FDelegateHandle TickHandle;
+	TMap<FString, TOptional<FString>> SavedSettings;
+
+	double LatencySeconds;
+	double BytesPerSecond;
+	float FailureRate;
+	FRandomStream Random;
+	bool bKeepUploads;
+
+	/** Contiguous bytes stored per upload id, kept empty unless bKeepUploads */
+	TMap<FString, TArray<uint8>> Uploads;
+	TMap<FString, int64> AckedBytes;
+	/** Sorted by due time */
+	TArray<FHeldResponse> HeldResponses;
+	int32 NumRequests;
+	int32 NumFailed;
+	int32 NumRejected;
+	int64 ReceivedBytes;
+};
+
+#endif
@@ -0,0 +1,15 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsTrace.h"
+
+#if CPUPROFILERTRACE_ENABLED
+UE_TRACE_CHANNEL_DEFINE(ArcticAnalyticsChannel);
+#endif
+
+TRACE_DECLARE_INT_COUNTER(ArcticAnalytics_UploadQueueDepth, TEXT("ArcticAnalytics/UploadQueueDepth"));
+TRACE_DECLARE_INT_COUNTER(ArcticAnalytics_WriteQueueDepth, TEXT("ArcticAnalytics/WriteQueueDepth"));
+TRACE_DECLARE_MEMORY_COUNTER(ArcticAnalytics_UploadBatchBytes, TEXT("ArcticAnalytics/UploadBatchBytes"));
+TRACE_DECLARE_MEMORY_COUNTER(ArcticAnalytics_UploadBytes, TEXT("ArcticAnalytics/UploadBytes"));
+TRACE_DECLARE_MEMORY_COUNTER(ArcticAnalytics_WriteBatchBytes, TEXT("ArcticAnalytics/WriteBatchBytes"));
+TRACE_DECLARE_INT_COUNTER(ArcticAnalytics_EncodedBatchEvents, TEXT("ArcticAnalytics/EncodedBatchEvents"));
+TRACE_DECLARE_INT_COUNTER(ArcticAnalytics_HousekeepingMicroseconds, TEXT("ArcticAnalytics/HousekeepingMicroseconds"));
@@ -0,0 +1,35 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProfilingDebugging/CountersTrace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Trace/Trace.h"
+
+/**
+ * Unreal Insights instrumentation of the analytics hot paths.
+ *
+ * CPU scopes go to the ArcticAnalytics trace channel, enabled with -trace=cpu,ArcticAnalytics, so analytics can be
+ * told apart from the rest of a hitch. A disabled channel costs one branch per scope, and builds without CPU
+ * profiler tracing compile the scopes out. Queue depths and batch sizes are sent as counters on the counters channel.
+ */
+#if CPUPROFILERTRACE_ENABLED
+
+UE_TRACE_CHANNEL_EXTERN(ArcticAnalyticsChannel);
+
+#define ARCTICANALYTICS_TRACE_SCOPE(Name) TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL_STR("ArcticAnalytics::" #Name, ArcticAnalyticsChannel)
+
+#else
+
+#define ARCTICANALYTICS_TRACE_SCOPE(Name)
+
+#endif
+
+TRACE_DECLARE_INT_COUNTER_EXTERN(ArcticAnalytics_UploadQueueDepth);
+TRACE_DECLARE_INT_COUNTER_EXTERN(ArcticAnalytics_WriteQueueDepth);
+TRACE_DECLARE_MEMORY_COUNTER_EXTERN(ArcticAnalytics_UploadBatchBytes);
+TRACE_DECLARE_MEMORY_COUNTER_EXTERN(ArcticAnalytics_UploadBytes);
+TRACE_DECLARE_MEMORY_COUNTER_EXTERN(ArcticAnalytics_WriteBatchBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(ArcticAnalytics_EncodedBatchEvents);
+TRACE_DECLARE_INT_COUNTER_EXTERN(ArcticAnalytics_HousekeepingMicroseconds);
@@ -0,0 +1,245 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsUploadController.h"
+
+#include "HAL/IConsoleManager.h"
+
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsSettings.h"
+
+namespace
+{
+	double GetKBSetting(const TCHAR* Key, int32 DefaultKB)
+	{
+		int32 ValueKB = DefaultKB;
+		ArcticAnalyticsSettings::GetInt(Key, ValueKB);
+		return FMath::Max(1, ValueKB) * 1024.0;
+	}
+
+	/** Weight of a new sample in the smoothed round trip and throughput */
+	constexpr double SmoothingWeight = 0.125;
+}
+
+FArcticAnalyticsUploadController::FArcticAnalyticsUploadController(int32 InMaxInFlight)
+	: MinBatchBytes(GetKBSetting(TEXT("UploadMinBatchKB"), 16)), MaxBatchBytes(FMath::Max(MinBatchBytes, GetKBSetting(TEXT("UploadMaxBatchKB"), 4096))),
+	  BatchStepBytes(GetKBSetting(TEXT("UploadBatchStepKB"), 32)), MaxInFlight(FMath::Max(1, InMaxInFlight)), TargetLatencySeconds(2.0),
+	  BatchBytes(MinBatchBytes), InFlightWindow(1.0), SmoothedRoundTrip(0.0), SmoothedThroughput(0.0), LastDecreaseTime(-DBL_MAX)
+{
+	float UploadTargetLatencySeconds = 2.0f;
+	ArcticAnalyticsSettings::GetFloat(TEXT("UploadTargetLatencySeconds"), UploadTargetLatencySeconds);
+	TargetLatencySeconds = FMath::Max(0.01f, UploadTargetLatencySeconds);
+}
+
+void FArcticAnalyticsUploadController::OnRequestComplete(int64 Bytes, double RoundTripSeconds, bool bSucceeded, double Now)
+{
+	SmoothedRoundTrip = SmoothedRoundTrip > 0.0 ? SmoothedRoundTrip + SmoothingWeight * (RoundTripSeconds - SmoothedRoundTrip) : RoundTripSeconds;
+	if (!bSucceeded || RoundTripSeconds > TargetLatencySeconds)
+	{
+		Decrease(Now);
+		return;
+	}
+
+	if (RoundTripSeconds > 0.0)
+	{
+		const double Throughput = Bytes / RoundTripSeconds;
+		SmoothedThroughput = SmoothedThroughput > 0.0 ? SmoothedThroughput + SmoothingWeight * (Throughput - SmoothedThroughput) : Throughput;
+	}
+	// Only grow batches that the measured throughput can still deliver within the target latency
+	if (SmoothedThroughput <= 0.0 || (BatchBytes + BatchStepBytes) / SmoothedThroughput <= TargetLatencySeconds)
+	{
+		BatchBytes = FMath::Min(MaxBatchBytes, BatchBytes + BatchStepBytes);
+	}
+	InFlightWindow = FMath::Min(MaxInFlight, InFlightWindow + 1.0 / InFlightWindow);
+}
+
+void FArcticAnalyticsUploadController::Decrease(double Now)
+{
+	// Requests that were already in flight when the last decrease happened report the same congestion
+	if (Now - LastDecreaseTime < SmoothedRoundTrip)
+	{
+		return;
+	}
+	LastDecreaseTime = Now;
+	BatchBytes = FMath::Max(MinBatchBytes, BatchBytes * 0.5);
+	InFlightWindow = FMath::Max(1.0, InFlightWindow * 0.5);
+}
+
+#if !UE_BUILD_SHIPPING
+
+#include "Containers/Ticker.h"
+#include "HAL/PlatformTime.h"
+
+#include "ArcticAnalyticsMemoryArchive.h"
+#include "ArcticAnalyticsTestServer.h"
+#include "ArcticAnalyticsUploader.h"
+
+namespace
+{
+	/**
+	 * Sends sessions in chunks through the real uploader to the stand-in server, which holds back every response by a
+	 * fixed latency and a bandwidth shared by the requests in flight, and checks that batch size and concurrency settle.
+	 * Over the second half of the run both have to stay within two halvings of their lowest value, the smoothed
+	 * round trip within the target latency, and the delivered bytes at half the bandwidth or more.
+	 */
+	class FUploadControllerTest : public TSharedFromThis<FUploadControllerTest>
+	{
+	public:
+		FUploadControllerTest(double InLatencySeconds, double InBytesPerSecond, double InSeconds, uint32 InPort)
+			: LatencySeconds(InLatencySeconds), BytesPerSecond(InBytesPerSecond), Seconds(InSeconds), Server(InPort)
+		{
+		}
+
+		void Start()
+		{
+			if (!Server.Start())
+			{
+				return;
+			}
+			Server.SetLatency(LatencySeconds, BytesPerSecond);
+			// Read by the uploader when it is created
+			Server.OverrideSetting(TEXT("bChunkedUploads"), TEXT("True"));
+			Uploader = MakeShared<FArcticAnalyticsUploader, ESPMode::ThreadSafe>(8);
+
+			// Larger than the largest batch, so every session is sent in chunks sized by the controller
+			TSharedRef<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Buffer = MakeShared<FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>();
+			Buffer->Chunks.AddDefaulted_GetRef().Init('x', 8 * 1024 * 1024);
+			Buffer->NumBytes = Buffer->Chunks[0].Num();
+			Session = Buffer;
+			// More sessions than requests may be in flight, so the controller is the limit
+			for (int32 Index = 0; Index < 16; ++Index)
+			{
+				EnqueueSession();
+			}
+			StartTime = FPlatformTime::Seconds();
+			FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateSP(AsShared(), &FUploadControllerTest::Tick));
+		}
+
+	private:
+		void EnqueueSession()
+		{
+			const TWeakPtr<FUploadControllerTest> WeakThis = AsShared();
+			Uploader->EnqueueBuffer(FString::Printf(TEXT("UploadControllerTest-%d"), NumSessions++), Session.ToSharedRef(), false,
+				[WeakThis](bool bSucceeded)
+				{
+					if (TSharedPtr<FUploadControllerTest> This = WeakThis.Pin())
+					{
+						This->NumFailedSessions += bSucceeded ? 0 : 1;
+						if (This->Uploader.IsValid())
+						{
+							This->EnqueueSession();
+						}
+					}
+				});
+		}
+
+		bool Tick(float DeltaTime)
+		{
+			const double Elapsed = FPlatformTime::Seconds() - StartTime;
+			const FArcticAnalyticsUploadController& Controller = Uploader->GetController();
+			if (Elapsed >= Seconds * 0.5)
+			{
+				if (SettledReceivedBytes < 0)
+				{
+					SettledReceivedBytes = Server.GetReceivedBytes();
+					SettledTime = Elapsed;
+				}
+				MinBatchBytes = FMath::Min(MinBatchBytes, Controller.GetBatchBytes());
+				MaxBatchBytes = FMath::Max(MaxBatchBytes, Controller.GetBatchBytes());
+				MinInFlight = FMath::Min(MinInFlight, Controller.GetMaxInFlight());
+				MaxInFlight = FMath::Max(MaxInFlight, Controller.GetMaxInFlight());
+			}
+			if (Elapsed >= NextLogTime)
+			{
+				NextLogTime += Seconds / 20.0;
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Upload controller: %.1fs batch=%lldKB inFlight=%d/%d rtt=%.0fms throughput=%.0fKB/s"), Elapsed,
+					   Controller.GetBatchBytes() / 1024, Server.GetNumInFlight(), Controller.GetMaxInFlight(), Controller.GetSmoothedRoundTripSeconds() * 1000.0,
+					   Controller.GetThroughput() / 1024.0);
+			}
+			if (Elapsed < Seconds)
+			{
+				return true;
+			}
+			Finish(Elapsed);
+			return false;
+		}
+
+		void Finish(double Elapsed)
+		{
+			const FArcticAnalyticsUploadController& Controller = Uploader->GetController();
+			float TargetLatencySeconds = 2.0f;
+			ArcticAnalyticsSettings::GetFloat(TEXT("UploadTargetLatencySeconds"), TargetLatencySeconds);
+			const double Throughput = (Server.GetReceivedBytes() - SettledReceivedBytes) / FMath::Max(Elapsed - SettledTime, 1e-3);
+
+			TArray<FString> Failures;
+			if (MaxBatchBytes > MinBatchBytes * 4)
+			{
+				Failures.Add(FString::Printf(TEXT("batch size did not settle (%lldKB to %lldKB)"), MinBatchBytes / 1024, MaxBatchBytes / 1024));
+			}
+			if (MaxInFlight > MinInFlight * 4)
+			{
+				Failures.Add(FString::Printf(TEXT("concurrency did not settle (%d to %d)"), MinInFlight, MaxInFlight));
+			}
+			if (LatencySeconds < TargetLatencySeconds && Controller.GetSmoothedRoundTripSeconds() > TargetLatencySeconds * 1.5)
+			{
+				Failures.Add(FString::Printf(TEXT("round trip (%.0fms) over the target latency"), Controller.GetSmoothedRoundTripSeconds() * 1000.0));
+			}
+			if (BytesPerSecond > 0.0 && Throughput < BytesPerSecond * 0.5)
+			{
+				Failures.Add(FString::Printf(TEXT("delivered %.0fKB/s of %.0fKB/s"), Throughput / 1024.0, BytesPerSecond / 1024.0));
+			}
+			if (Server.GetNumRejected() > 0 || NumFailedSessions > 0)
+			{
+				Failures.Add(FString::Printf(TEXT("%d requests rejected, %d sessions failed"), Server.GetNumRejected(), NumFailedSessions));
+			}
+
+			UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Upload controller: %d requests, settled at batch=%lld-%lldKB inFlight=%d-%d, %.0fKB/s"),
+				   Server.GetNumRequests(), MinBatchBytes / 1024, MaxBatchBytes / 1024, MinInFlight, MaxInFlight, Throughput / 1024.0);
+			if (Failures.Num() > 0)
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Upload controller test failed: %s"), *FString::Join(Failures, TEXT(", ")));
+			}
+			else
+			{
+				UE_LOG(LogArcticAnalyticsAnalytics, Display, TEXT("Upload controller test passed"));
+			}
+
+			// Responses still held back find the uploader gone
+			Uploader.Reset();
+			Server.Stop();
+		}
+
+		const double LatencySeconds;
+		const double BytesPerSecond;
+		const double Seconds;
+		FArcticAnalyticsTestServer Server;
+		TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> Uploader;
+		TSharedPtr<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Session;
+		int32 NumSessions = 0;
+		int32 NumFailedSessions = 0;
+		double StartTime = 0.0;
+		double NextLogTime = 0.0;
+		/** Received bytes and time once the second half of the run started */
+		int64 SettledReceivedBytes = -1;
+		double SettledTime = 0.0;
+		int64 MinBatchBytes = MAX_int64;
+		int64 MaxBatchBytes = 0;
+		int32 MinInFlight = MAX_int32;
+		int32 MaxInFlight = 0;
+	};
+
+	void UploadControllerTest(const TArray<FString>& Args)
+	{
+		const double LatencySeconds = (Args.Num() > 0 ? FCString::Atof(*Args[0]) : 50.0) / 1000.0;
+		const double BytesPerSecond = (Args.Num() > 1 ? FCString::Atof(*Args[1]) : 1024.0) * 1024.0;
+		const double Seconds = FMath::Max(2.0f, Args.Num() > 2 ? FCString::Atof(*Args[2]) : 30.0f);
+		const uint32 Port = Args.Num() > 3 ? (uint32)FCString::Atoi(*Args[3]) : 8089;
+		MakeShared<FUploadControllerTest>(LatencySeconds, BytesPerSecond, Seconds, Port)->Start();
+	}
+
+	FAutoConsoleCommand UploadControllerTestCommand(TEXT("ArcticAnalytics.UploadControllerTest"),
+		TEXT("Uploads sessions through the adaptive upload controller to a stand-in server with injected latency and checks that batch size and concurrency settle. ")
+		TEXT("Args: [LatencyMs=50] [BandwidthKBps=1024] [Seconds=30] [Port=8089]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&UploadControllerTest));
+}
+
+#endif
@@ -0,0 +1,71 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * AIMD controller for the upload path, fed from HTTP completion callbacks.
+ *
+ * While requests come back within the target latency, the batch size grows by a fixed step per request and the
+ * number of requests in flight by one per window of requests. A request over the target latency, or a failed one,
+ * halves both, at most once per smoothed round trip, so a burst of slow completions counts as one congestion signal.
+ * Larger batches amortize per request overhead on fast links, smaller ones keep latency down on slow links.
+ */
+class FArcticAnalyticsUploadController
+{
+public:
+	/**
+	 * @param InMaxInFlight most requests the controller ever allows in flight
+	 */
+	explicit FArcticAnalyticsUploadController(int32 InMaxInFlight);
+
+	/** Number of requests that may be in flight right now */
+	int32 GetMaxInFlight() const
+	{
+		return FMath::Max(1, FMath::FloorToInt(InFlightWindow));
+	}
+
+	/** Size new batches should aim for */
+	int64 GetBatchBytes() const
+	{
+		return (int64)BatchBytes;
+	}
+
+	/**
+	 * Adds the outcome of a request.
+	 *
+	 * @param Bytes size of the request body
+	 * @param RoundTripSeconds time from sending the request to its response
+	 * @param bSucceeded whether the server accepted it
+	 * @param Now FPlatformTime::Seconds at completion
+	 */
+	void OnRequestComplete(int64 Bytes, double RoundTripSeconds, bool bSucceeded, double Now);
+
+	double GetSmoothedRoundTripSeconds() const
+	{
+		return SmoothedRoundTrip;
+	}
+
+	/** Smoothed bytes per second of the requests that succeeded */
+	double GetThroughput() const
+	{
+		return SmoothedThroughput;
+	}
+
+private:
+	void Decrease(double Now);
+
+	const double MinBatchBytes;
+	const double MaxBatchBytes;
+	const double BatchStepBytes;
+	const double MaxInFlight;
+	double TargetLatencySeconds;
+
+	double BatchBytes;
+	/** Fractional so in flight requests grow by one per window of successful requests */
+	double InFlightWindow;
+	double SmoothedRoundTrip;
+	double SmoothedThroughput;
+	double LastDecreaseTime;
+};
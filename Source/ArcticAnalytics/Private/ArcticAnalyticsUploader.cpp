@@ -0,0 +1,471 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#include "ArcticAnalyticsUploader.h"
+
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/Paths.h"
+#include "Runtime/Online/HTTP/Public/Http.h"
+
+#include "ArcticAnalyticsBandwidthLimiter.h"
+#include "ArcticAnalyticsLog.h"
+#include "ArcticAnalyticsMemoryArchive.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "ArcticAnalyticsSettings.h"
+#include "ArcticAnalyticsTrace.h"
+#include "Data_SHA256.h"
+
+namespace
+{
+	/** HMAC_SHA256 of the whole content as a hex string, empty if it could not be read. Leaves the content at its start */
+	FString SignContent(const FString& Secret, FArchive& Content, const FArcticAnalyticsChunkBuffer* Buffer)
+	{
+		ARCTICANALYTICS_TRACE_SCOPE(Hash);
+		HMAC_SHA256 Hmac(Secret);
+		if (Buffer)
+		{
+			for (const TArray<uint8>& Chunk : Buffer->Chunks)
+			{
+				Hmac.Update(Chunk.GetData(), Chunk.Num());
+			}
+			return Hmac.Final().ToHexString();
+		}
+		TArray<uint8> Piece;
+		Piece.SetNumUninitialized(64 * 1024);
+		for (int64 Remaining = Content.TotalSize(); Remaining > 0 && !Content.IsError();)
+		{
+			const int32 PieceBytes = (int32)FMath::Min<int64>(Remaining, Piece.Num());
+			Content.Serialize(Piece.GetData(), PieceBytes);
+			Hmac.Update(Piece.GetData(), PieceBytes);
+			Remaining -= PieceBytes;
+		}
+		if (Content.IsError())
+		{
+			return FString();
+		}
+		Content.Seek(0);
+		return Hmac.Final().ToHexString();
+	}
+}
+
+FArcticAnalyticsUploader::FArcticAnalyticsUploader(int32 InMaxConcurrentUploads) : Controller(InMaxConcurrentUploads), bChunkedUploads(false), NumInFlight(0), bScheduled(false)
+{
+	ArcticAnalyticsSettings::GetBool(TEXT("bChunkedUploads"), bChunkedUploads);
+}
+
+FArcticAnalyticsUploader::~FArcticAnalyticsUploader()
+{
+	if (NetworkGameTickHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(NetworkGameTickHandle);
+	}
+	if (PacingTickHandle.IsValid())
+	{
+		FTSTicker::GetCoreTicker().RemoveTicker(PacingTickHandle);
+	}
+}
+
+void FArcticAnalyticsUploader::EnqueueFile(const FString& FilePath, FOnUploadComplete&& OnComplete)
+{
+	Enqueue(FPendingUpload{FilePath, nullptr, false, MoveTemp(OnComplete)});
+}
+
+void FArcticAnalyticsUploader::EnqueueBuffer(const FString& SessionId, const TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>& Buffer, bool bPriority,
+											 FOnUploadComplete&& OnComplete)
+{
+	Enqueue(FPendingUpload{SessionId, Buffer, bPriority, MoveTemp(OnComplete)});
+}
+
+void FArcticAnalyticsUploader::Enqueue(FPendingUpload&& Upload)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::Enqueue);
+	check(IsInGameThread());
+	FArcticAnalyticsSelfMetrics::Get().AddUploadQueueDepth(1);
+	if (Upload.bPriority)
+	{
+		// Behind earlier priority uploads, ahead of everything else
+		int32 Index = 0;
+		while (Index < PendingUploads.Num() && PendingUploads[Index].bPriority)
+		{
+			++Index;
+		}
+		PendingUploads.Insert(MoveTemp(Upload), Index);
+	}
+	else
+	{
+		PendingUploads.Add(MoveTemp(Upload));
+	}
+	StartUploads();
+}
+
+void FArcticAnalyticsUploader::StartUploads()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::StartUploads);
+	if (bScheduled)
+	{
+		// Started by housekeeping
+		return;
+	}
+	while (CanStartUpload())
+	{
+		StartNextUpload();
+	}
+}
+
+void FArcticAnalyticsUploader::StartNextUpload()
+{
+	FArcticAnalyticsBandwidthLimiter& Limiter = FArcticAnalyticsBandwidthLimiter::Get();
+	if (Limiter.IsEnabled())
+	{
+		Limiter.UpdateNetworkGameActive();
+	}
+	const FPendingUpload Upload = MoveTemp(PendingUploads[0]);
+	PendingUploads.RemoveAt(0, 1, false);
+	if (StartUpload(Upload))
+	{
+		++NumInFlight;
+	}
+	else
+	{
+		FArcticAnalyticsSelfMetrics::Get().AddUploadQueueDepth(-1);
+		if (Upload.OnComplete)
+		{
+			Upload.OnComplete(false);
+		}
+	}
+	// A network game may start or end during a long upload
+	if (Limiter.IsEnabled() && NumInFlight > 0 && !NetworkGameTickHandle.IsValid())
+	{
+		NetworkGameTickHandle =
+			FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FArcticAnalyticsUploader::TickNetworkGameActive), 1.0f);
+	}
+}
+
+void FArcticAnalyticsUploader::SetScheduled(bool bInScheduled)
+{
+	check(IsInGameThread());
+	bScheduled = bInScheduled;
+	if (!bScheduled)
+	{
+		const double Now = FPlatformTime::Seconds();
+		for (FPendingRetry& Retry : PendingRetries)
+		{
+			ScheduleOnTicker((float)FMath::Max(0.0, Retry.DueTime - Now), MoveTemp(Retry.Retry));
+		}
+		PendingRetries.Reset();
+		StartUploads();
+	}
+}
+
+void FArcticAnalyticsUploader::AddRetry(float DelaySeconds, TFunction<void()>&& Retry)
+{
+	if (!bScheduled)
+	{
+		ScheduleOnTicker(DelaySeconds, MoveTemp(Retry));
+		return;
+	}
+	const double DueTime = FPlatformTime::Seconds() + DelaySeconds;
+	int32 Index = PendingRetries.Num();
+	while (Index > 0 && PendingRetries[Index - 1].DueTime > DueTime)
+	{
+		--Index;
+	}
+	PendingRetries.Insert(FPendingRetry{DueTime, MoveTemp(Retry)}, Index);
+}
+
+void FArcticAnalyticsUploader::DrainRetry()
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::DrainRetry);
+	const TFunction<void()> Retry = MoveTemp(PendingRetries[0].Retry);
+	PendingRetries.RemoveAt(0, 1, false);
+	Retry();
+}
+
+void FArcticAnalyticsUploader::ScheduleOnTicker(float DelaySeconds, TFunction<void()>&& Retry)
+{
+	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([Retry = MoveTemp(Retry)](float DeltaTime)
+	{
+		Retry();
+		return false;
+	}), DelaySeconds);
+}
+
+bool FArcticAnalyticsUploader::TickNetworkGameActive(float DeltaTime)
+{
+	if (NumInFlight == 0)
+	{
+		NetworkGameTickHandle.Reset();
+		return false;
+	}
+	FArcticAnalyticsBandwidthLimiter::Get().UpdateNetworkGameActive();
+	return true;
+}
+
+TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> FArcticAnalyticsUploader::CreateRequest(FString& OutSecret) const
+{
+	// Get configured server
+	FString ConfigServer;
+	if (!ArcticAnalyticsSettings::GetString(TEXT("Server"), ConfigServer))
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Server not configured! Can't send data to server."));
+		return nullptr;
+	}
+	// Get configured secret
+	if (!ArcticAnalyticsSettings::GetString(TEXT("Secret"), OutSecret))
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Secret not configured! Can't send data to server."));
+		return nullptr;
+	}
+	// Create the request
+	const TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request = FHttpModule::Get().CreateRequest();
+	// Set endpoint
+	Request->SetURL(ConfigServer);
+	// Set headers
+	Request->SetHeader(TEXT("User-Agent"), TEXT("X-UnrealEngine-Agent"));
+	Request->SetHeader(TEXT("Content-Type"), TEXT("application/json"));
+	Request->SetHeader(TEXT("Accept"), TEXT("application/json"));
+	// POST request
+	Request->SetVerb("POST");
+	return Request;
+}
+
+void FArcticAnalyticsUploader::ProcessRequest(const TSharedRef<IHttpRequest, ESPMode::ThreadSafe>& Request, int64 ContentBytes, TFunction<void(double StartTime)>&& BindComplete)
+{
+	// Paced here on the game thread, the HTTP thread reads the body at full speed
+	FPacedRequest Paced{Request, ContentBytes, MoveTemp(BindComplete)};
+	if (!FArcticAnalyticsBandwidthLimiter::Get().IsEnabled() || (PacedRequests.Num() == 0 && FArcticAnalyticsBandwidthLimiter::Get().TryAcquire(ContentBytes)))
+	{
+		SendRequest(Paced);
+		return;
+	}
+	PacedRequests.Add(MoveTemp(Paced));
+	if (!PacingTickHandle.IsValid())
+	{
+		PacingTickHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(this, &FArcticAnalyticsUploader::TickPacing));
+	}
+}
+
+void FArcticAnalyticsUploader::SendRequest(const FPacedRequest& Paced)
+{
+	// The round trip starts here, time spent waiting for bandwidth is not the server's
+	Paced.BindComplete(FPlatformTime::Seconds());
+	if (!Paced.Request->ProcessRequest())
+	{
+		// Completes like a request that failed in flight
+		Paced.Request->OnProcessRequestComplete().ExecuteIfBound(Paced.Request, nullptr, false);
+	}
+}
+
+bool FArcticAnalyticsUploader::TickPacing(float DeltaTime)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::TickPacing);
+	FArcticAnalyticsBandwidthLimiter& Limiter = FArcticAnalyticsBandwidthLimiter::Get();
+	while (PacedRequests.Num() > 0 && Limiter.TryAcquire(PacedRequests[0].ContentBytes))
+	{
+		const FPacedRequest Paced = MoveTemp(PacedRequests[0]);
+		PacedRequests.RemoveAt(0, 1, false);
+		SendRequest(Paced);
+	}
+	if (PacedRequests.Num() == 0)
+	{
+		PacingTickHandle.Reset();
+		return false;
+	}
+	return true;
+}
+
+bool FArcticAnalyticsUploader::StartUpload(const FPendingUpload& Upload)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::Upload);
+	FString ConfigSecret;
+	const TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> Request = CreateRequest(ConfigSecret);
+	if (!Request.IsValid())
+	{
+		return false;
+	}
+	// Both kinds of sessions are streamed as the content, so neither is copied
+	TSharedPtr<FArchive, ESPMode::ThreadSafe> Content;
+	if (Upload.Buffer.IsValid())
+	{
+		Content = MakeShared<FArcticAnalyticsChunkReader, ESPMode::ThreadSafe>(Upload.Buffer.ToSharedRef());
+	}
+	else
+	{
+		Content = MakeShareable(IFileManager::Get().CreateFileReader(*Upload.Name));
+		if (!Content.IsValid())
+		{
+			UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Session (%s) could not be loaded! Can't send data to server."), *Upload.Name);
+			return false;
+		}
+	}
+	// A paced request is never larger than the limiter's burst, larger sessions are chunked even without bChunkedUploads
+	const FArcticAnalyticsBandwidthLimiter& Limiter = FArcticAnalyticsBandwidthLimiter::Get();
+	if ((bChunkedUploads && Content->TotalSize() > Controller.GetBatchBytes()) || (Limiter.IsEnabled() && Content->TotalSize() > Limiter.GetBurstBytes()))
+	{
+		StartChunkedUpload(FPaths::GetBaseFilename(Upload.Name), Content.ToSharedRef(), ConfigSecret, Upload.OnComplete);
+		return true;
+	}
+
+	// HMAC for auth header, signed in a first pass over the content on a worker, so a large session doesn't hold up the game thread
+	const TWeakPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> WeakThis = AsShared();
+	Async(EAsyncExecution::ThreadPool, [WeakThis, Request = Request.ToSharedRef(), Content = Content.ToSharedRef(), Buffer = Upload.Buffer, Name = Upload.Name,
+										OnComplete = Upload.OnComplete, ConfigSecret]()
+	{
+		const double HashStartTime = FPlatformTime::Seconds();
+		FString Signature = SignContent(ConfigSecret, *Content, Buffer.Get());
+		const double HashSeconds = FPlatformTime::Seconds() - HashStartTime;
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Request, Content, Name, OnComplete, Signature = MoveTemp(Signature), HashSeconds]()
+		{
+			if (TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> This = WeakThis.Pin())
+			{
+				This->SendSignedUpload(Request, Content, Name, Signature, HashSeconds, OnComplete);
+			}
+		});
+	});
+	return true;
+}
+
+void FArcticAnalyticsUploader::SendSignedUpload(const TSharedRef<IHttpRequest, ESPMode::ThreadSafe>& Request, const TSharedRef<FArchive, ESPMode::ThreadSafe>& Content,
+												const FString& Name, const FString& Signature, double HashSeconds, const FOnUploadComplete& OnComplete)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::SendSignedUpload);
+	FInFlightUpload InFlight{Content->TotalSize(), OnComplete};
+	if (Signature.IsEmpty())
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Error, TEXT("Session (%s) could not be read! Can't send data to server."), *Name);
+		OnUploadComplete(Request, nullptr, false, FPlatformTime::Seconds(), MoveTemp(InFlight));
+		return;
+	}
+	Request->SetHeader(TEXT("Authorization"), Signature);
+	FArcticAnalyticsSelfMetrics::Get().AddHash(Content->TotalSize(), HashSeconds);
+	FArcticAnalyticsSelfMetrics::Get().AddUploadAttempt(Content->TotalSize());
+	TRACE_COUNTER_SET(ArcticAnalytics_UploadBytes, Content->TotalSize());
+	// Set analytics content
+	Request->SetContentFromStream(Content);
+	ProcessRequest(Request, Content->TotalSize(), [this, Request, InFlight = MoveTemp(InFlight)](double StartTime)
+	{
+		Request->OnProcessRequestComplete().BindThreadSafeSP(AsShared(), &FArcticAnalyticsUploader::OnUploadComplete, StartTime, InFlight);
+	});
+}
+
+void FArcticAnalyticsUploader::StartChunkedUpload(const FString& UploadId, const TSharedRef<FArchive, ESPMode::ThreadSafe>& Content, const FString& Secret,
+												  const FOnUploadComplete& OnComplete)
+{
+	// Chunks are sized by the controller and each one feeds it, the upload as a whole takes one slot
+	const TWeakPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> WeakThis = AsShared();
+	TSharedRef<FArcticAnalyticsChunkedUpload, ESPMode::ThreadSafe> ChunkedUpload = MakeShared<FArcticAnalyticsChunkedUpload, ESPMode::ThreadSafe>(
+		UploadId, Content, Secret,
+		[WeakThis](const FArcticAnalyticsUploadChunk& Chunk, FArcticAnalyticsChunkedUpload::FOnChunkAcked&& OnAcked)
+		{
+			if (TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> This = WeakThis.Pin())
+			{
+				This->SendChunk(Chunk, MoveTemp(OnAcked));
+			}
+		},
+		[WeakThis]()
+		{
+			TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> This = WeakThis.Pin();
+			if (!This.IsValid())
+			{
+				return (int64)0;
+			}
+			// Chunks are what the bandwidth limiter releases, so they are kept to its burst size
+			const FArcticAnalyticsBandwidthLimiter& Limiter = FArcticAnalyticsBandwidthLimiter::Get();
+			return Limiter.IsEnabled() ? FMath::Min(This->Controller.GetBatchBytes(), Limiter.GetBurstBytes()) : This->Controller.GetBatchBytes();
+		});
+	ChunkedUpload->SetRetryScheduler([WeakThis](float DelaySeconds, TFunction<void()>&& Retry)
+	{
+		if (TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> This = WeakThis.Pin())
+		{
+			This->AddRetry(DelaySeconds, MoveTemp(Retry));
+		}
+	});
+	// Started on the next tick, so a failure to read the first chunk never completes before the slot was taken
+	FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([ChunkedUpload, WeakThis, OnComplete](float DeltaTime)
+	{
+		ChunkedUpload->Start([WeakThis, OnComplete](bool bSucceeded)
+		{
+			if (TSharedPtr<FArcticAnalyticsUploader, ESPMode::ThreadSafe> This = WeakThis.Pin())
+			{
+				--This->NumInFlight;
+				FArcticAnalyticsSelfMetrics::Get().AddUploadQueueDepth(-1);
+				if (OnComplete)
+				{
+					OnComplete(bSucceeded);
+				}
+				This->StartUploads();
+			}
+		});
+		return false;
+	}));
+}
+
+void FArcticAnalyticsUploader::SendChunk(const FArcticAnalyticsUploadChunk& Chunk, FArcticAnalyticsChunkedUpload::FOnChunkAcked&& OnAcked)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::SendChunk);
+	FString ConfigSecret;
+	const TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> Request = CreateRequest(ConfigSecret);
+	if (!Request.IsValid())
+	{
+		OnAcked(false, 0);
+		return;
+	}
+	Request->SetHeader(TEXT("Authorization"), Chunk.Signature);
+	Request->SetHeader(TEXT("X-Upload-Id"), Chunk.UploadId);
+	Request->SetHeader(TEXT("X-Upload-Offset"), LexToString(Chunk.Offset));
+	Request->SetHeader(TEXT("X-Upload-Length"), LexToString(Chunk.Data->NumBytes));
+	Request->SetHeader(TEXT("X-Upload-Total"), LexToString(Chunk.TotalBytes));
+	Request->SetContentFromStream(MakeShared<FArcticAnalyticsChunkReader, ESPMode::ThreadSafe>(Chunk.Data));
+	FArcticAnalyticsSelfMetrics::Get().AddUploadAttempt(Chunk.Data->NumBytes);
+	TRACE_COUNTER_SET(ArcticAnalytics_UploadBytes, Chunk.Data->NumBytes);
+	ProcessRequest(Request.ToSharedRef(), Chunk.Data->NumBytes, [this, Request, ContentBytes = Chunk.Data->NumBytes, OnAcked = MoveTemp(OnAcked)](double StartTime)
+	{
+		Request->OnProcessRequestComplete().BindThreadSafeSP(AsShared(), &FArcticAnalyticsUploader::OnChunkComplete, StartTime, ContentBytes, OnAcked);
+	});
+}
+
+void FArcticAnalyticsUploader::OnChunkComplete(FHttpRequestPtr Request, FHttpResponsePtr Response, bool bSucceeded, double StartTime, int64 ContentBytes,
+											   FArcticAnalyticsChunkedUpload::FOnChunkAcked OnAcked)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::OnChunkComplete);
+	const bool bDelivered = bSucceeded && Response.IsValid() && EHttpResponseCodes::IsOk(Response->GetResponseCode());
+	const double Now = FPlatformTime::Seconds();
+	Controller.OnRequestComplete(ContentBytes, Now - StartTime, bDelivered, Now);
+	TRACE_COUNTER_SET(ArcticAnalytics_UploadBatchBytes, Controller.GetBatchBytes());
+	FArcticAnalyticsSelfMetrics::Get().AddUploadResult(bDelivered, Now - StartTime);
+	int64 AckedBytes = 0;
+	if (bDelivered)
+	{
+		LexFromString(AckedBytes, *Response->GetHeader(TEXT("X-Upload-Acked")));
+	}
+	else
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Verbose, TEXT("Chunk upload to (%s) failed with code (%d)"), *Request->GetURL(),
+			   Response.IsValid() ? Response->GetResponseCode() : 0);
+	}
+	OnAcked(bDelivered, AckedBytes);
+}
+
+void FArcticAnalyticsUploader::OnUploadComplete(FHttpRequestPtr Request, FHttpResponsePtr Response, bool bSucceeded, double StartTime, FInFlightUpload InFlight)
+{
+	ARCTICANALYTICS_TRACE_SCOPE(Uploader::OnUploadComplete);
+	--NumInFlight;
+	const bool bDelivered = bSucceeded && Response.IsValid() && EHttpResponseCodes::IsOk(Response->GetResponseCode());
+	const double Now = FPlatformTime::Seconds();
+	Controller.OnRequestComplete(InFlight.ContentBytes, Now - StartTime, bDelivered, Now);
+	TRACE_COUNTER_SET(ArcticAnalytics_UploadBatchBytes, Controller.GetBatchBytes());
+	FArcticAnalyticsSelfMetrics& SelfMetrics = FArcticAnalyticsSelfMetrics::Get();
+	SelfMetrics.AddUploadResult(bDelivered, Now - StartTime);
+	SelfMetrics.AddUploadQueueDepth(-1);
+	if (!bDelivered)
+	{
+		UE_LOG(LogArcticAnalyticsAnalytics, Warning, TEXT("Upload to (%s) failed with code (%d)"), *Request->GetURL(),
+			   Response.IsValid() ? Response->GetResponseCode() : 0);
+	}
+	if (InFlight.OnComplete)
+	{
+		InFlight.OnComplete(bDelivered);
+	}
+	StartUploads();
+}
@@ -0,0 +1,150 @@
+// Copyright 2017-2018 Project Borealis. All rights reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Ticker.h"
+#include "HAL/PlatformTime.h"
+#include "Interfaces/IHttpRequest.h"
+
+#include "ArcticAnalyticsChunkedUpload.h"
+#include "ArcticAnalyticsUploadController.h"
+
+struct FArcticAnalyticsChunkBuffer;
+
+/**
+ * Posts finished sessions to the configured server, signed with HMAC_SHA256 of the configured secret.
+ * Sessions are either files or in memory chunk buffers, which are signed and sent without being copied.
+ * Requests in flight are limited by an adaptive controller, up to MaxConcurrentUploads, the rest wait in a queue,
+ * so many sessions ending at once share a small pool of requests. Priority uploads skip the queue and get one
+ * extra request, so they are not held up by large sessions. Requests are released as the bandwidth limiter's tokens
+ * accrue, and the limiter is told whether a network game is running while uploads are in flight.
+ *
+ * With bChunkedUploads, sessions larger than the controller's batch size are sent as resumable chunks of that size,
+ * see FArcticAnalyticsChunkedUpload. While the bandwidth limiter is enabled, sessions larger than its burst are always
+ * chunked, and chunks are kept to the burst, so no single request exceeds it. The server acknowledges each chunk with an X-Upload-Acked response header.
+ *
+ * When scheduled, uploads are not started and chunk retries are not sent on their own, the owner's housekeeping
+ * does both one step at a time, see FArcticAnalyticsHousekeeping.
+ */
+class FArcticAnalyticsUploader : public TSharedFromThis<FArcticAnalyticsUploader, ESPMode::ThreadSafe>
+{
+public:
+	explicit FArcticAnalyticsUploader(int32 InMaxConcurrentUploads);
+	~FArcticAnalyticsUploader();
+
+	/** Called on the game thread once the server responded or the upload failed */
+	using FOnUploadComplete = TFunction<void(bool bSucceeded)>;
+
+	/** Queues a session file for upload. Game thread only */
+	void EnqueueFile(const FString& FilePath, FOnUploadComplete&& OnComplete = nullptr);
+
+	/** Queues an in memory session for upload. Game thread only */
+	void EnqueueBuffer(const FString& SessionId, const TSharedRef<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe>& Buffer, bool bPriority = false,
+					   FOnUploadComplete&& OnComplete = nullptr);
+
+	/** Number of files queued or being uploaded */
+	int32 GetNumPending() const
+	{
+		return PendingUploads.Num() + NumInFlight;
+	}
+
+	/**
+	 * Leaves starting uploads and sending chunk retries to StartNextUpload and DrainRetry instead of doing both as soon
+	 * as possible. Turning it off starts what is queued and hands pending retries back to the core ticker.
+	 */
+	void SetScheduled(bool bInScheduled);
+
+	/** Whether the next queued upload can start now */
+	bool CanStartUpload() const
+	{
+		return PendingUploads.Num() > 0 && NumInFlight < Controller.GetMaxInFlight() + (PendingUploads[0].bPriority ? 1 : 0);
+	}
+
+	/** Starts the next queued upload. Sessions that are not sent in chunks are signed on a worker and sent once it is done */
+	void StartNextUpload();
+
+	/** Whether a chunk retry is due */
+	bool HasDueRetry() const
+	{
+		return PendingRetries.Num() > 0 && PendingRetries[0].DueTime <= FPlatformTime::Seconds();
+	}
+
+	/** Sends the chunk retry that has been due the longest */
+	void DrainRetry();
+
+	/** Batch size and concurrency the upload path currently settles on */
+	const FArcticAnalyticsUploadController& GetController() const
+	{
+		return Controller;
+	}
+
+private:
+	struct FPendingUpload
+	{
+		/** File path, or the session id of an in memory session */
+		FString Name;
+		/** Set for in memory sessions */
+		TSharedPtr<const FArcticAnalyticsChunkBuffer, ESPMode::ThreadSafe> Buffer;
+		bool bPriority;
+		FOnUploadComplete OnComplete;
+	};
+
+	struct FPendingRetry
+	{
+		double DueTime;
+		TFunction<void()> Retry;
+	};
+
+	struct FPacedRequest
+	{
+		TSharedRef<IHttpRequest, ESPMode::ThreadSafe> Request;
+		int64 ContentBytes;
+		/** Binds the completion handler with the time the request was handed to the HTTP module */
+		TFunction<void(double StartTime)> BindComplete;
+	};
+
+	struct FInFlightUpload
+	{
+		/** Size of the request body */
+		int64 ContentBytes;
+		FOnUploadComplete OnComplete;
+	};
+
+	void Enqueue(FPendingUpload&& Upload);
+	void StartUploads();
+	/** Request to the configured server with the common headers, null if server or secret are not configured */
+	TSharedPtr<IHttpRequest, ESPMode::ThreadSafe> CreateRequest(FString& OutSecret) const;
+	/** Sends the request now, or once the bandwidth limiter has tokens for it. A request that fails to start completes as failed */
+	void ProcessRequest(const TSharedRef<IHttpRequest, ESPMode::ThreadSafe>& Request, int64 ContentBytes, TFunction<void(double StartTime)>&& BindComplete);
+	void SendRequest(const FPacedRequest& Paced);
+	bool TickPacing(float DeltaTime);
+	bool StartUpload(const FPendingUpload& Upload);
+	/** Sends a session once its signature is known, an empty signature fails the upload */
+	void SendSignedUpload(const TSharedRef<IHttpRequest, ESPMode::ThreadSafe>& Request, const TSharedRef<FArchive, ESPMode::ThreadSafe>& Content, const FString& Name,
+						  const FString& Signature, double HashSeconds, const FOnUploadComplete& OnComplete);
+	void OnUploadComplete(FHttpRequestPtr Request, FHttpResponsePtr Response, bool bSucceeded, double StartTime, FInFlightUpload InFlight);
+	void StartChunkedUpload(const FString& UploadId, const TSharedRef<FArchive, ESPMode::ThreadSafe>& Content, const FString& Secret,
+							const FOnUploadComplete& OnComplete);
+	void SendChunk(const FArcticAnalyticsUploadChunk& Chunk, FArcticAnalyticsChunkedUpload::FOnChunkAcked&& OnAcked);
+	void OnChunkComplete(FHttpRequestPtr Request, FHttpResponsePtr Response, bool bSucceeded, double StartTime, int64 ContentBytes,
+						 FArcticAnalyticsChunkedUpload::FOnChunkAcked OnAcked);
+	bool TickNetworkGameActive(float DeltaTime);
+	void AddRetry(float DelaySeconds, TFunction<void()>&& Retry);
+	static void ScheduleOnTicker(float DelaySeconds, TFunction<void()>&& Retry);
+
+	FArcticAnalyticsUploadController Controller;
+	bool bChunkedUploads;
+	int32 NumInFlight;
+	TArray<FPendingUpload> PendingUploads;
+	/** Whether housekeeping starts uploads and sends retries */
+	bool bScheduled;
+	/** Chunk retries waiting for housekeeping, sorted by due time */
+	TArray<FPendingRetry> PendingRetries;
+	/** Registered while uploads are in flight and the bandwidth limiter is enabled */
+	FTSTicker::FDelegateHandle NetworkGameTickHandle;
+	/** Requests waiting for bandwidth, in order */
+	TArray<FPacedRequest> PacedRequests;
+	/** Registered while requests wait for bandwidth */
+	FTSTicker::FDelegateHandle PacingTickHandle;
+};
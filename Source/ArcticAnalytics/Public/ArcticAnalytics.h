@@ -5,6 +5,10 @@
 #include "CoreMinimal.h"
 #include "Interfaces/IAnalyticsProviderModule.h"
 #include "ArcticAnalyticsProvider.h"
+#include "ArcticAnalyticsMemoryBudget.h"
+#include "ArcticAnalyticsMultiSession.h"
+#include "ArcticAnalyticsSelfMetrics.h"
+#include "Containers/Ticker.h"
 #include "Modules/ModuleManager.h"
 
 class IAnalyticsProvider;
@@ -17,6 +21,10 @@ class FAnalyticsArcticAnalytics :
 {
 	/** Singleton for analytics */
 	TSharedPtr<IAnalyticsProvider> ArcticAnalyticsProvider;
+	/** Provider for processes hosting many sessions, created on first use */
+	TUniquePtr<FArcticAnalyticsMultiSessionProvider> MultiSessionProvider;
+	/** Publishes the self metrics to the ArcticAnalytics stat group every frame */
+	FTSTicker::FDelegateHandle SelfMetricsTickHandle;
 
 	//--------------------------------------------------------------------------
 	// Module functionality
@@ -44,6 +52,18 @@ public:
 	 */
 	virtual TSharedPtr<IAnalyticsProvider> CreateAnalyticsProvider(const FAnalyticsProviderConfigurationDelegate& GetConfigValue) const override;
 
+	/**
+	 * Returns the provider for processes hosting many concurrent sessions, such as dedicated servers.
+	 * All its sessions share one writer and one uploader.
+	 */
+	FArcticAnalyticsMultiSessionProvider& GetMultiSessionProvider();
+
+	/** Returns how much analytics data is held in memory and how much was dropped or spilled to stay within the budget */
+	FArcticAnalyticsBudgetCounters GetMemoryBudgetCounters() const;
+
+	/** Returns what the plugin itself recorded, dropped, wrote, flushed, hashed and uploaded since startup, over all providers */
+	FArcticAnalyticsSelfMetricsSnapshot GetSelfMetrics() const;
+
 private:
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;